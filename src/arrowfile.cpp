@@ -0,0 +1,1085 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "arrowfile.h"
+
+#include <QFile>
+#include <QSaveFile>
+#include <QSharedPointer>
+#include <QSysInfo>
+#include <QtEndian>
+#include <QtNumeric>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "iofile.h"
+
+
+
+namespace
+{
+    constexpr char magic[] = "ARROW1";
+    constexpr qint64 magicSize = 6;
+    constexpr qint64 alignment = 8;
+    constexpr qint16 metadataVersion = 4;      //V5
+
+    enum MessageHeader : quint8 { HeaderNone = 0, HeaderSchema = 1, HeaderDictionaryBatch = 2, HeaderRecordBatch = 3 };
+    enum TypeId : quint8 { TypeNull = 1, TypeInt = 2, TypeFloatingPoint = 3, TypeBinary = 4, TypeUtf8 = 5, TypeBool = 6,
+                           TypeDate = 8, TypeTime = 9, TypeTimestamp = 10, TypeDuration = 18,
+                           TypeLargeBinary = 19, TypeLargeUtf8 = 20 };
+
+    inline qint64 paddedSize(const qint64 size) { return (size + alignment - 1) / alignment * alignment; }
+
+
+
+
+    /* flatbuffersのテーブルの読み込み．バッファの外を指すオフセットは，そのフィールドがないものとして扱う */
+    class FlatTable
+    {
+    public:
+        FlatTable() {}
+        FlatTable(const char *buffer, const qint64 size, const qint64 pos)
+        {
+            if(pos < 0 || pos + 4 > size) return;
+
+            const qint64 vtable = pos - qFromLittleEndian<qint32>(buffer + pos);
+            if(vtable < 0 || vtable + 4 > size) return;
+
+            const qint64 vtableSize = qFromLittleEndian<quint16>(buffer + vtable);
+            if(vtableSize < 4 || vtable + vtableSize > size) return;
+
+            this->buffer = buffer;
+            this->size = size;
+            this->pos = pos;
+            this->vtable = vtable;
+            this->vtableSize = vtableSize;
+        }
+
+        static FlatTable root(const char *buffer, const qint64 size)
+        {
+            if(size < 4) return FlatTable();
+            return FlatTable(buffer, size, qFromLittleEndian<quint32>(buffer));
+        }
+
+        bool isValid() const { return buffer != nullptr; }
+
+        template <typename T>
+        T scalar(const int field, const T defaultValue = T()) const
+        {
+            const qint64 p = fieldPos(field, sizeof(T));
+            return (p < 0) ? defaultValue : qFromLittleEndian<T>(buffer + p);
+        }
+
+        FlatTable table(const int field) const
+        {
+            const qint64 p = target(field);
+            return (p < 0) ? FlatTable() : FlatTable(buffer, size, p);
+        }
+
+        QByteArray string(const int field) const
+        {
+            const qint64 p = target(field);
+            if(p < 0 || p + 4 > size) return QByteArray();
+
+            const qint64 length = qFromLittleEndian<quint32>(buffer + p);
+            if(p + 4 + length > size) return QByteArray();
+
+            return QByteArray(buffer + p + 4, length);
+        }
+
+        /* ベクターの要素数．dataに先頭を入れる．なければ0，範囲外なら-1 */
+        qint64 vector(const int field, const qint64 elementSize, const char **data) const
+        {
+            *data = nullptr;
+
+            const qint64 p = target(field);
+            if(p < 0) return 0;
+            if(p + 4 > size) return -1;
+
+            const qint64 count = qFromLittleEndian<quint32>(buffer + p);
+            if(p + 4 + count * elementSize > size) return -1;
+
+            *data = buffer + p + 4;
+            return count;
+        }
+
+        /* テーブルのベクター(vector()で得たdata)のindex番目 */
+        FlatTable vectorTable(const char *data, const qint64 index) const
+        {
+            const qint64 slot = (data - buffer) + index * 4;
+            return FlatTable(buffer, size, slot + qFromLittleEndian<quint32>(data + index * 4));
+        }
+
+    private:
+        qint64 fieldPos(const int field, const qint64 valueSize) const
+        {
+            if(!buffer) return -1;
+
+            const qint64 entry = 4 + 2 * field;
+            if(entry + 2 > vtableSize) return -1;
+
+            const qint64 offset = qFromLittleEndian<quint16>(buffer + vtable + entry);
+            if(offset == 0 || pos + offset + valueSize > size) return -1;
+
+            return pos + offset;
+        }
+
+        qint64 target(const int field) const
+        {
+            const qint64 p = fieldPos(field, 4);
+            if(p < 0) return -1;
+
+            const qint64 t = p + qFromLittleEndian<quint32>(buffer + p);
+            return (t < size) ? t : -1;
+        }
+
+    private:
+        const char *buffer = nullptr;
+        qint64 size = 0;
+        qint64 pos = 0;
+        qint64 vtable = 0;
+        qint64 vtableSize = 0;
+    };
+
+
+
+
+    /* 列の型．日時と時間は整数のまま読む */
+    struct FieldType
+    {
+        enum class Kind { Null, Integer, Floating, Bool, Text };
+
+        Kind kind = Kind::Null;
+        int byteWidth = 0;          //Integer, Floating
+        bool isSigned = true;
+        bool largeOffsets = false;  //Text
+
+        int bufferCount() const { return (kind == Kind::Null) ? 0 : (kind == Kind::Text) ? 3 : 2; }
+    };
+
+    /* 1つのレコードバッチの中の1列分 */
+    struct Piece
+    {
+        qint64 length = 0;
+        qint64 nullCount = 0;
+        const char *validity = nullptr;
+        const char *offsets = nullptr;      //Text
+        const char *values = nullptr;
+        qint64 valuesSize = 0;
+
+        bool isValid(const qint64 i) const
+        {
+            return nullCount == 0 || !validity || ((quint8(validity[i >> 3]) >> (i & 7)) & 1);
+        }
+    };
+
+    struct Message
+    {
+        quint8 headerType = HeaderNone;     //HeaderNoneはストリームの終わり
+        FlatTable header;
+        const char *body = nullptr;
+        qint64 bodyLength = 0;
+    };
+
+    /* posから1つのメッセージを読み，posを次のメッセージへ進める．
+     * 0xFFFFFFFFの継続マーカーのない古い形式も読む */
+    bool readMessage(const char *data, const qint64 size, qint64& pos, Message& message)
+    {
+        message = Message();
+        if(pos == size) return true;    //終わりのマーカーのないストリーム
+        if(pos < 0 || pos + 4 > size) return false;
+
+        qint64 meta = pos + 4;
+        qint64 length = qFromLittleEndian<qint32>(data + pos);
+        if(length == -1)
+        {
+            if(pos + 8 > size) return false;
+            length = qFromLittleEndian<qint32>(data + pos + 4);
+            meta = pos + 8;
+        }
+
+        if(length == 0) { pos = meta; return true; }
+        if(length < 0 || meta + length > size) return false;
+
+        const FlatTable root = FlatTable::root(data + meta, length);
+        if(!root.isValid()) return false;
+
+        message.headerType = root.scalar<quint8>(1);
+        message.header = root.table(2);
+        message.bodyLength = root.scalar<qint64>(3);
+        message.body = data + meta + length;
+
+        if(!message.header.isValid() || message.bodyLength < 0 || meta + length + message.bodyLength > size) return false;
+
+        pos = meta + length + message.bodyLength;
+        return true;
+    }
+
+    bool readFieldType(const FlatTable& field, FieldType& type)
+    {
+        if(field.table(4).isValid()) return false;      //辞書エンコード
+
+        const char *children = nullptr;
+        if(field.vector(5, 4, &children) != 0) return false;   //List, Structなどの入れ子の型
+
+        const FlatTable detail = field.table(3);
+
+        switch(field.scalar<quint8>(2))
+        {
+        case TypeNull:
+            type.kind = FieldType::Kind::Null;
+            return true;
+        case TypeBool:
+            type.kind = FieldType::Kind::Bool;
+            return true;
+        case TypeUtf8:
+        case TypeBinary:
+            type.kind = FieldType::Kind::Text;
+            return true;
+        case TypeLargeUtf8:
+        case TypeLargeBinary:
+            type.kind = FieldType::Kind::Text;
+            type.largeOffsets = true;
+            return true;
+        case TypeInt:
+            type.kind = FieldType::Kind::Integer;
+            type.byteWidth = detail.scalar<qint32>(0) / 8;
+            type.isSigned = (detail.scalar<quint8>(1) != 0);
+            break;
+        case TypeFloatingPoint:
+        {
+            const qint16 precision = detail.scalar<qint16>(0);   //0: HALF, 1: SINGLE, 2: DOUBLE
+            type.kind = FieldType::Kind::Floating;
+            type.byteWidth = (precision == 0) ? 2 : (precision == 1) ? 4 : 8;
+            break;
+        }
+        case TypeDate:
+            type.kind = FieldType::Kind::Integer;
+            type.byteWidth = (detail.scalar<qint16>(0, 1) == 0) ? 4 : 8;     //DAY: int32, MILLISECOND: int64
+            break;
+        case TypeTime:
+            type.kind = FieldType::Kind::Integer;
+            type.byteWidth = detail.scalar<qint32>(1, 32) / 8;
+            break;
+        case TypeTimestamp:
+        case TypeDuration:
+            type.kind = FieldType::Kind::Integer;
+            type.byteWidth = 8;
+            break;
+        default:
+            return false;
+        }
+
+        return type.byteWidth == 2 || type.byteWidth == 4 || type.byteWidth == 8 ||
+               (type.byteWidth == 1 && type.kind == FieldType::Kind::Integer);
+    }
+
+    double halfToDouble(const quint16 half)
+    {
+        const int exponent = (half >> 10) & 0x1F;
+        const int mantissa = half & 0x3FF;
+
+        double value;
+        if(exponent == 0) value = std::ldexp(double(mantissa), -24);
+        else if(exponent == 31) value = (mantissa != 0) ? qQNaN() : qInf();
+        else value = std::ldexp(double(mantissa + 1024), exponent - 25);
+
+        return (half & 0x8000) ? -value : value;
+    }
+
+    double floatingAt(const Piece& piece, const qint64 i, const int byteWidth)
+    {
+        const char *p = piece.values + i * byteWidth;
+
+        switch(byteWidth)
+        {
+        case 2:
+            return halfToDouble(qFromLittleEndian<quint16>(p));
+        case 4:
+        {
+            float value;
+            std::memcpy(&value, p, sizeof(value));
+            return SheetColumn::fromFloat(value);
+        }
+        default:
+        {
+            double value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+        }
+    }
+
+    qint64 integerAt(const Piece& piece, const qint64 i, const FieldType& type)
+    {
+        if(type.kind == FieldType::Kind::Bool) return (quint8(piece.values[i >> 3]) >> (i & 7)) & 1;
+
+        const char *p = piece.values + i * type.byteWidth;
+
+        switch(type.byteWidth)
+        {
+        case 1: return (type.isSigned) ? qint64(qint8(*p)) : qint64(quint8(*p));
+        case 2: return (type.isSigned) ? qint64(qFromLittleEndian<qint16>(p)) : qint64(qFromLittleEndian<quint16>(p));
+        case 4: return (type.isSigned) ? qint64(qFromLittleEndian<qint32>(p)) : qint64(qFromLittleEndian<quint32>(p));
+        default: return qFromLittleEndian<qint64>(p);
+        }
+    }
+
+
+
+
+    class ArrowReader
+    {
+    public:
+        bool readSchema(const FlatTable& schema);
+        bool readRecordBatch(const Message& message);
+        SheetData sheet(const QSharedPointer<QFile>& mapping) const;
+
+    private:
+        SheetColumn column(const qsizetype col, const QSharedPointer<QFile>& mapping) const;
+
+        QStringList names;
+        QList<FieldType> types;
+        QList<QList<Piece> > pieces;
+    };
+
+    bool ArrowReader::readSchema(const FlatTable& schema)
+    {
+        if(!schema.isValid()) return false;
+        if(schema.scalar<qint16>(0) != 0) return false;     //ビッグエンディアン
+
+        const char *fields = nullptr;
+        const qint64 fieldCount = schema.vector(1, 4, &fields);
+        if(fieldCount < 0) return false;
+
+        for(qint64 i = 0; i < fieldCount; ++i)
+        {
+            const FlatTable field = schema.vectorTable(fields, i);
+
+            FieldType type;
+            if(!field.isValid() || !readFieldType(field, type)) return false;
+
+            names << QString::fromUtf8(field.string(0));
+            types << type;
+        }
+
+        pieces.resize(types.size());
+        return true;
+    }
+
+    bool ArrowReader::readRecordBatch(const Message& message)
+    {
+        const FlatTable& batch = message.header;
+        if(batch.table(3).isValid()) return false;      //圧縮されたボディ
+
+        const char *nodes = nullptr;
+        const char *buffers = nullptr;
+        const qint64 nodeCount = batch.vector(1, 16, &nodes);
+        const qint64 bufferCount = batch.vector(2, 16, &buffers);
+        const qint64 length = batch.scalar<qint64>(0);
+        if(nodeCount != types.size() || bufferCount < 0 || length < 0) return false;
+
+        qint64 buffer = 0;
+        for(qsizetype col = 0; col < types.size(); ++col)
+        {
+            const FieldType& type = types.at(col);
+
+            Piece piece;
+            piece.length = qFromLittleEndian<qint64>(nodes + col * 16);
+            piece.nullCount = qFromLittleEndian<qint64>(nodes + col * 16 + 8);
+            if(piece.length != length) return false;
+
+            if(buffer + type.bufferCount() > bufferCount) return false;
+
+            const char *data[3] = {};
+            qint64 sizes[3] = {};
+            for(int i = 0; i < type.bufferCount(); ++i, ++buffer)
+            {
+                const qint64 offset = qFromLittleEndian<qint64>(buffers + buffer * 16);
+                const qint64 length = qFromLittleEndian<qint64>(buffers + buffer * 16 + 8);
+                if(offset < 0 || length < 0 || offset + length > message.bodyLength) return false;
+
+                data[i] = (length > 0) ? message.body + offset : nullptr;
+                sizes[i] = length;
+            }
+
+            const qint64 bitmapSize = (piece.length + 7) / 8;
+            piece.validity = data[0];
+            if(piece.validity && sizes[0] < bitmapSize) return false;
+
+            switch(type.kind)
+            {
+            case FieldType::Kind::Null:
+                piece.nullCount = piece.length;
+                break;
+            case FieldType::Kind::Integer:
+            case FieldType::Kind::Floating:
+                piece.values = data[1];
+                if(sizes[1] < piece.length * type.byteWidth) return false;
+                break;
+            case FieldType::Kind::Bool:
+                piece.values = data[1];
+                if(sizes[1] < bitmapSize) return false;
+                break;
+            case FieldType::Kind::Text:
+                piece.offsets = data[1];
+                piece.values = data[2];
+                piece.valuesSize = sizes[2];
+                if(piece.length > 0 && sizes[1] < (piece.length + 1) * ((type.largeOffsets) ? 8 : 4)) return false;
+                break;
+            }
+
+            pieces[col].append(piece);
+        }
+
+        return true;
+    }
+
+    SheetColumn ArrowReader::column(const qsizetype col, const QSharedPointer<QFile>& mapping) const
+    {
+        const FieldType& type = types.at(col);
+        const QList<Piece>& list = pieces.at(col);
+
+        qint64 rows = 0;
+        qint64 nulls = 0;
+        for(const Piece& piece : list) { rows += piece.length; nulls += piece.nullCount; }
+
+        const bool isInt64 = (type.kind == FieldType::Kind::Integer && type.byteWidth == 8 && type.isSigned);
+        const bool isFloat64 = (type.kind == FieldType::Kind::Floating && type.byteWidth == 8);
+
+        /* ファイル上のバッファをそのまま列として参照する */
+        if(mapping && list.size() == 1 && rows > 0 && nulls == 0 && (isInt64 || isFloat64) &&
+           reinterpret_cast<quintptr>(list.first().values) % alignof(double) == 0)
+        {
+            return SheetColumn::fromMapped((isFloat64) ? SheetColumn::Type::Double : SheetColumn::Type::Int64,
+                                           list.first().values, rows, mapping);
+        }
+
+        if(type.kind == FieldType::Kind::Text)
+        {
+            SheetColumn column;
+            for(const Piece& piece : list)
+            {
+                for(qint64 i = 0; i < piece.length; ++i)
+                {
+                    qint64 begin = 0;
+                    qint64 end = 0;
+                    if(type.largeOffsets)
+                    {
+                        begin = qFromLittleEndian<qint64>(piece.offsets + i * 8);
+                        end = qFromLittleEndian<qint64>(piece.offsets + (i + 1) * 8);
+                    }
+                    else
+                    {
+                        begin = qFromLittleEndian<qint32>(piece.offsets + i * 4);
+                        end = qFromLittleEndian<qint32>(piece.offsets + (i + 1) * 4);
+                    }
+
+                    if(!piece.isValid(i) || begin < 0 || begin > end || end > piece.valuesSize)
+                        column.append(QByteArrayView());
+                    else
+                        column.append(QByteArrayView(piece.values + begin, end - begin));
+                }
+            }
+            column.squeeze();
+            return column;
+        }
+
+        /* 数値の配列は連結してコピーする */
+        if(nulls == 0 && (isInt64 || isFloat64))
+        {
+            if(isInt64)
+            {
+                QList<qint64> values(rows);
+                qint64 row = 0;
+                for(const Piece& piece : list)
+                {
+                    if(piece.length > 0) std::memcpy(values.data() + row, piece.values, piece.length * 8);
+                    row += piece.length;
+                }
+                return SheetColumn::fromValues(values);
+            }
+            else
+            {
+                QList<double> values(rows);
+                qint64 row = 0;
+                for(const Piece& piece : list)
+                {
+                    if(piece.length > 0) std::memcpy(values.data() + row, piece.values, piece.length * 8);
+                    row += piece.length;
+                }
+                return SheetColumn::fromValues(values);
+            }
+        }
+
+        /* NULLのある整数列と，int64に収まらないuint64の列は浮動小数点の列にする */
+        bool asDouble = (type.kind == FieldType::Kind::Floating || type.kind == FieldType::Kind::Null || nulls > 0);
+        if(!asDouble && type.kind == FieldType::Kind::Integer && type.byteWidth == 8 && !type.isSigned)
+        {
+            for(const Piece& piece : list)
+                for(qint64 i = 0; i < piece.length && !asDouble; ++i)
+                    asDouble = (qFromLittleEndian<quint64>(piece.values + i * 8) > quint64(std::numeric_limits<qint64>::max()));
+        }
+
+        if(asDouble)
+        {
+            QList<double> values;
+            values.reserve(rows);
+            for(const Piece& piece : list)
+            {
+                for(qint64 i = 0; i < piece.length; ++i)
+                {
+                    if(type.kind == FieldType::Kind::Null || !piece.isValid(i))
+                        values << qQNaN();
+                    else if(type.kind == FieldType::Kind::Floating)
+                        values << floatingAt(piece, i, type.byteWidth);
+                    else if(type.byteWidth == 8 && !type.isSigned)
+                        values << double(qFromLittleEndian<quint64>(piece.values + i * 8));
+                    else
+                        values << double(integerAt(piece, i, type));
+                }
+            }
+            return SheetColumn::fromValues(values);
+        }
+
+        QList<qint64> values;
+        values.reserve(rows);
+        for(const Piece& piece : list)
+            for(qint64 i = 0; i < piece.length; ++i)
+                values << integerAt(piece, i, type);
+
+        return SheetColumn::fromValues(values);
+    }
+
+    SheetData ArrowReader::sheet(const QSharedPointer<QFile>& mapping) const
+    {
+        QList<SheetColumn> columns;
+        for(qsizetype col = 0; col < types.size(); ++col)
+            columns << column(col, mapping);
+
+        SheetData data = SheetData::fromColumns(columns);
+        data.setColumnNames(names);
+        return data;
+    }
+
+
+
+
+    /* flatbuffersの組み立て．
+     * テーブルはvtableの直後に置き，子(文字列，ベクター，テーブル)はすべて親より後ろに書くため，オフセットは常に正になる */
+    struct FlatNode;
+    using FlatNodePtr = QSharedPointer<FlatNode>;
+
+    struct FlatNode
+    {
+        enum class Kind { Table, String, Structs, Tables };
+
+        struct Field
+        {
+            QByteArray scalar;
+            FlatNodePtr child;
+        };
+
+        Kind kind = Kind::Table;
+        QList<Field> fields;            //Table．scalarもchildもないフィールドは省略する
+        QByteArray bytes;               //String, Structs
+        qint64 count = 0;               //Structs
+        QList<FlatNodePtr> tables;      //Tables
+
+        template <typename T>
+        FlatNode *set(const int field, const T value)
+        {
+            if(fields.size() <= field) fields.resize(field + 1);
+            fields[field].scalar = QByteArray(sizeof(T), '\0');
+            qToLittleEndian<T>(value, fields[field].scalar.data());
+            return this;
+        }
+
+        FlatNode *set(const int field, const FlatNodePtr& child)
+        {
+            if(fields.size() <= field) fields.resize(field + 1);
+            fields[field].child = child;
+            return this;
+        }
+
+        static FlatNodePtr table() { return FlatNodePtr(new FlatNode); }
+        static FlatNodePtr string(const QByteArray& text)
+        {
+            FlatNodePtr node(new FlatNode);
+            node->kind = Kind::String;
+            node->bytes = text;
+            return node;
+        }
+        static FlatNodePtr structs(const QByteArray& bytes, const qint64 count)
+        {
+            FlatNodePtr node(new FlatNode);
+            node->kind = Kind::Structs;
+            node->bytes = bytes;
+            node->count = count;
+            return node;
+        }
+        static FlatNodePtr vector(const QList<FlatNodePtr>& tables)
+        {
+            FlatNodePtr node(new FlatNode);
+            node->kind = Kind::Tables;
+            node->tables = tables;
+            return node;
+        }
+    };
+
+    class FlatBuilder
+    {
+    public:
+        QByteArray finish(const FlatNodePtr& root)
+        {
+            buffer = QByteArray(4, '\0');
+            const qint64 pos = write(root);
+            qToLittleEndian<quint32>(quint32(pos), buffer.data());
+            pad(alignment);
+            return buffer;
+        }
+
+    private:
+        void pad(const qint64 align, const qint64 extra = 0)
+        {
+            while((buffer.size() + extra) % align != 0) buffer.append('\0');
+        }
+
+        void patch(const qint64 at, const qint64 target)
+        {
+            qToLittleEndian<quint32>(quint32(target - at), buffer.data() + at);
+        }
+
+        void append32(const quint32 value)
+        {
+            char bytes[4];
+            qToLittleEndian<quint32>(value, bytes);
+            buffer.append(bytes, 4);
+        }
+
+        void append16(const quint16 value)
+        {
+            char bytes[2];
+            qToLittleEndian<quint16>(value, bytes);
+            buffer.append(bytes, 2);
+        }
+
+        qint64 write(const FlatNodePtr& node);
+
+        QByteArray buffer;
+    };
+
+    qint64 FlatBuilder::write(const FlatNodePtr& node)
+    {
+        switch(node->kind)
+        {
+        case FlatNode::Kind::String:
+        {
+            pad(4);
+            const qint64 pos = buffer.size();
+            append32(quint32(node->bytes.size()));
+            buffer.append(node->bytes);
+            buffer.append('\0');
+            return pos;
+        }
+        case FlatNode::Kind::Structs:
+        {
+            pad(8, 4);  //要素(int64を含む構造体)を8の倍数の位置に置く
+            const qint64 pos = buffer.size();
+            append32(quint32(node->count));
+            buffer.append(node->bytes);
+            return pos;
+        }
+        case FlatNode::Kind::Tables:
+        {
+            pad(4);
+            const qint64 pos = buffer.size();
+            append32(quint32(node->tables.size()));
+            const qint64 entries = buffer.size();
+            buffer.append(QByteArray(node->tables.size() * 4, '\0'));
+
+            for(qsizetype i = 0; i < node->tables.size(); ++i)
+                patch(entries + i * 4, write(node->tables.at(i)));
+
+            return pos;
+        }
+        default:
+            break;
+        }
+
+        /* テーブルの先頭を8の倍数の位置に置き，各値をその大きさの倍数の位置に揃える */
+        const qsizetype fieldCount = node->fields.size();
+        QList<qint64> offsets(fieldCount, 0);
+        qint64 tableSize = 4;
+        for(qsizetype i = 0; i < fieldCount; ++i)
+        {
+            const FlatNode::Field& field = node->fields.at(i);
+            const qint64 size = (field.child) ? 4 : field.scalar.size();
+            if(size == 0) continue;
+
+            tableSize = (tableSize + size - 1) / size * size;
+            offsets[i] = tableSize;
+            tableSize += size;
+        }
+
+        pad(2);
+        const qint64 vtable = buffer.size();
+        append16(quint16(4 + 2 * fieldCount));
+        append16(quint16(tableSize));
+        for(const qint64 offset : offsets) append16(quint16(offset));
+
+        pad(8);
+        const qint64 table = buffer.size();
+        buffer.append(QByteArray(tableSize, '\0'));
+        qToLittleEndian<qint32>(qint32(table - vtable), buffer.data() + table);
+
+        for(qsizetype i = 0; i < fieldCount; ++i)
+        {
+            const QByteArray& scalar = node->fields.at(i).scalar;
+            if(!scalar.isEmpty()) std::memcpy(buffer.data() + table + offsets.at(i), scalar.constData(), scalar.size());
+        }
+
+        for(qsizetype i = 0; i < fieldCount; ++i)
+        {
+            const FlatNodePtr& child = node->fields.at(i).child;
+            if(child) patch(table + offsets.at(i), write(child));
+        }
+
+        return table;
+    }
+
+    FlatNodePtr messageNode(const MessageHeader headerType, const FlatNodePtr& header, const qint64 bodyLength)
+    {
+        FlatNodePtr message = FlatNode::table();
+        message->set<qint16>(0, metadataVersion)
+               ->set<quint8>(1, headerType)
+               ->set(2, header)
+               ->set<qint64>(3, bodyLength);
+        return message;
+    }
+
+    void appendStruct64(QByteArray& bytes, const qint64 value)
+    {
+        char data[8];
+        qToLittleEndian<qint64>(value, data);
+        bytes.append(data, 8);
+    }
+
+
+
+
+    /* 書き出す1列分のバッファ */
+    struct OutColumn
+    {
+        enum class Kind { Int64, Double, Text };
+
+        Kind kind = Kind::Double;
+        QString name;
+        qint64 nullCount = 0;
+        QByteArray validity;            //NULLがなければ空
+        QByteArray offsets;             //Text
+        QByteArray text;                //Text
+        bool largeOffsets = false;
+        const char *values = nullptr;   //Int64, Double．シートの配列をそのまま書き出す
+
+        QList<QByteArrayView> buffers() const
+        {
+            if(kind == Kind::Text) return { validity, offsets, text };
+            return { validity, QByteArrayView(values, (values) ? length * 8 : 0) };
+        }
+
+        qint64 length = 0;
+    };
+
+    OutColumn toOutColumn(const SheetColumn& column, const qint64 rows)
+    {
+        OutColumn out;
+        out.length = rows;
+
+        QList<qint64> nullRows;
+        bool hasText = (column.type() == SheetColumn::Type::String);
+
+        if(column.type() == SheetColumn::Type::Int64)
+        {
+            out.kind = OutColumn::Kind::Int64;
+            out.values = reinterpret_cast<const char*>(column.int64Data());
+            return out;
+        }
+
+        /* NaNのセルのうち，空のセルはNULLにする．数値でない文字列があれば文字列の列にする */
+        if(!hasText)
+        {
+            const double *values = column.doubleData();
+            for(qint64 row = 0; row < rows && !hasText; ++row)
+            {
+                if(!qIsNaN(values[row])) continue;
+
+                const QString text = column.text(row);
+                if(text.isEmpty()) { nullRows << row; continue; }
+
+                bool ok = false;
+                text.toDouble(&ok);     //"nan"などはNULLではない値
+                hasText = !ok;
+            }
+        }
+
+        if(!hasText)
+        {
+            out.kind = OutColumn::Kind::Double;
+            out.values = reinterpret_cast<const char*>(column.doubleData());
+        }
+        else
+        {
+            out.kind = OutColumn::Kind::Text;
+            nullRows.clear();
+
+            QList<qint64> offsets;
+            offsets.reserve(rows + 1);
+            offsets << 0;
+            for(qint64 row = 0; row < rows; ++row)
+            {
+                const QString text = column.text(row);
+                if(text.isEmpty()) nullRows << row;
+                out.text += text.toUtf8();
+                offsets << out.text.size();
+            }
+
+            out.largeOffsets = (out.text.size() > std::numeric_limits<qint32>::max());
+            const int offsetSize = (out.largeOffsets) ? 8 : 4;
+            out.offsets = QByteArray((rows + 1) * offsetSize, Qt::Uninitialized);
+            for(qint64 i = 0; i <= rows; ++i)
+            {
+                if(out.largeOffsets) qToLittleEndian<qint64>(offsets.at(i), out.offsets.data() + i * 8);
+                else qToLittleEndian<qint32>(qint32(offsets.at(i)), out.offsets.data() + i * 4);
+            }
+        }
+
+        if(!nullRows.isEmpty())
+        {
+            out.nullCount = nullRows.size();
+            out.validity = QByteArray((rows + 7) / 8, char(0xFF));
+            for(const qint64 row : nullRows)
+                out.validity[row >> 3] = char(quint8(out.validity.at(row >> 3)) & ~(1 << (row & 7)));
+        }
+
+        return out;
+    }
+
+    FlatNodePtr schemaNode(const QList<OutColumn>& columns)
+    {
+        QList<FlatNodePtr> fields;
+        for(const OutColumn& column : columns)
+        {
+            FlatNodePtr type = FlatNode::table();
+            quint8 typeId = TypeUtf8;
+
+            switch(column.kind)
+            {
+            case OutColumn::Kind::Int64:
+                typeId = TypeInt;
+                type->set<qint32>(0, 64)->set<quint8>(1, 1);
+                break;
+            case OutColumn::Kind::Double:
+                typeId = TypeFloatingPoint;
+                type->set<qint16>(0, 2);
+                break;
+            case OutColumn::Kind::Text:
+                typeId = (column.largeOffsets) ? TypeLargeUtf8 : TypeUtf8;
+                break;
+            }
+
+            FlatNodePtr field = FlatNode::table();
+            field->set(0, FlatNode::string(column.name.toUtf8()))
+                 ->set<quint8>(1, 1)
+                 ->set<quint8>(2, typeId)
+                 ->set(3, type)
+                 ->set(5, FlatNode::vector({}));
+            fields << field;
+        }
+
+        FlatNodePtr schema = FlatNode::table();
+        schema->set<qint16>(0, 0)->set(1, FlatNode::vector(fields));
+        return schema;
+    }
+}
+
+
+
+
+bool ArrowFile::read(const QString& path, SheetData& sheet)
+{
+    //バッファをそのまま数値の配列として参照するため，リトルエンディアンの環境でのみ使う
+    if(QSysInfo::ByteOrder != QSysInfo::LittleEndian) return false;
+
+    QSharedPointer<QFile> file(new QFile(path));
+    if(!file->open(QIODevice::ReadOnly)) return false;
+
+    QByteArray buffer;
+    qint64 size = file->size();
+    const char *data = (size > 0) ? reinterpret_cast<const char*>(file->map(0, size)) : nullptr;
+    if(!data)
+    {
+        buffer = file->readAll();
+        data = buffer.constData();
+        size = buffer.size();
+        file.reset();
+    }
+
+    ArrowReader reader;
+    Message message;
+
+    if(size >= magicSize && std::memcmp(data, magic, magicSize) == 0)
+    {
+        /* ファイル形式: "ARROW1" パディング ストリーム フッター フッターの長さ "ARROW1" */
+        if(size < 2 * alignment + 4 || std::memcmp(data + size - magicSize, magic, magicSize) != 0) return false;
+
+        const qint64 footerLength = qFromLittleEndian<qint32>(data + size - magicSize - 4);
+        const qint64 footerStart = size - magicSize - 4 - footerLength;
+        if(footerLength <= 0 || footerStart < alignment) return false;
+
+        const FlatTable footer = FlatTable::root(data + footerStart, footerLength);
+        if(!footer.isValid() || !reader.readSchema(footer.table(1))) return false;
+
+        const char *blocks = nullptr;
+        if(footer.vector(2, 24, &blocks) != 0) return false;   //辞書
+
+        const qint64 blockCount = footer.vector(3, 24, &blocks);
+        if(blockCount < 0) return false;
+
+        for(qint64 i = 0; i < blockCount; ++i)
+        {
+            qint64 pos = qFromLittleEndian<qint64>(blocks + i * 24);
+            if(!readMessage(data, footerStart, pos, message) || message.headerType != HeaderRecordBatch) return false;
+            if(!reader.readRecordBatch(message)) return false;
+        }
+    }
+    else
+    {
+        /* ストリーム形式: スキーマ，レコードバッチ...，終わりのマーカー */
+        qint64 pos = 0;
+        if(!readMessage(data, size, pos, message) || message.headerType != HeaderSchema) return false;
+        if(!reader.readSchema(message.header)) return false;
+
+        for(;;)
+        {
+            if(!readMessage(data, size, pos, message)) return false;
+            if(message.headerType == HeaderNone) break;
+            if(message.headerType == HeaderDictionaryBatch) return false;
+            if(message.headerType == HeaderRecordBatch && !reader.readRecordBatch(message)) return false;
+        }
+    }
+
+    sheet = reader.sheet(file);
+    return true;
+}
+
+bool ArrowFile::write(const QString& path, const SheetData& sheet)
+{
+    if(QSysInfo::ByteOrder != QSysInfo::LittleEndian) return false;
+
+    const qint64 rows = sheet.rowCount();
+
+    QList<OutColumn> columns;
+    for(qsizetype col = 0; col < sheet.columnCount(); ++col)
+    {
+        OutColumn column = toOutColumn(sheet.column(col), rows);
+        column.name = sheet.columnNames().value(col);
+        if(column.name.isEmpty()) column.name = ExcelDocument::intToAlphabet(col);
+        columns << column;
+    }
+
+    /* レコードバッチのボディ内のバッファの位置 */
+    QByteArray nodes;
+    QByteArray buffers;
+    qint64 bodyLength = 0;
+    for(const OutColumn& column : columns)
+    {
+        appendStruct64(nodes, rows);
+        appendStruct64(nodes, column.nullCount);
+
+        for(const QByteArrayView data : column.buffers())
+        {
+            appendStruct64(buffers, bodyLength);
+            appendStruct64(buffers, data.size());
+            bodyLength += paddedSize(data.size());
+        }
+    }
+
+    FlatNodePtr batch = FlatNode::table();
+    batch->set<qint64>(0, rows)
+         ->set(1, FlatNode::structs(nodes, columns.size()))
+         ->set(2, FlatNode::structs(buffers, buffers.size() / 16));
+
+    const QByteArray schemaMessage = FlatBuilder().finish(messageNode(HeaderSchema, schemaNode(columns), 0));
+    const QByteArray batchMessage = FlatBuilder().finish(messageNode(HeaderRecordBatch, batch, bodyLength));
+
+    /* 書き込み中に他のシートがmmapしているファイルを壊さないように，一時ファイルに書いてから置き換える．
+     * 置き換えるファイル自身をmmapしている列があれば，呼び出し側がSheetModel::detachMapping()で切り離しておく */
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)) return false;
+
+    qint64 written = 0;
+    bool ok = true;
+    auto write = [&](QByteArrayView data) {
+        if(ok && data.size() > 0) ok = (file.write(data.data(), data.size()) == data.size());
+        written += data.size();
+    };
+    auto writeMessage = [&](const QByteArray& metadata) {
+        char prefix[8];
+        qToLittleEndian<quint32>(0xFFFFFFFF, prefix);
+        qToLittleEndian<qint32>(qint32(metadata.size()), prefix + 4);
+        write(QByteArrayView(prefix, 8));
+        write(metadata);
+    };
+    static const char zeros[alignment] = {};
+
+    write(QByteArrayView(magic, magicSize));
+    write(QByteArrayView(zeros, alignment - magicSize));
+    writeMessage(schemaMessage);
+
+    const qint64 batchOffset = written;
+    writeMessage(batchMessage);
+    for(const OutColumn& column : columns)
+    {
+        for(const QByteArrayView data : column.buffers())
+        {
+            write(data);
+            write(QByteArrayView(zeros, paddedSize(data.size()) - data.size()));
+        }
+    }
+
+    /* 終わりのマーカー */
+    write(QByteArrayView("\xFF\xFF\xFF\xFF\0\0\0\0", 8));
+
+    QByteArray block;
+    appendStruct64(block, batchOffset);
+    appendStruct64(block, 8 + batchMessage.size());     //metaDataLength(int32)と4バイトのパディング
+    appendStruct64(block, bodyLength);
+
+    FlatNodePtr footer = FlatNode::table();
+    footer->set<qint16>(0, metadataVersion)
+          ->set(1, schemaNode(columns))
+          ->set(2, FlatNode::structs(QByteArray(), 0))
+          ->set(3, FlatNode::structs(block, 1));
+    const QByteArray footerData = FlatBuilder().finish(footer);
+
+    char footerLength[4];
+    qToLittleEndian<qint32>(qint32(footerData.size()), footerLength);
+    write(footerData);
+    write(QByteArrayView(footerLength, 4));
+    write(QByteArrayView(magic, magicSize));
+
+    if(!ok)
+    {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
@@ -0,0 +1,36 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef ARROWFILE_H
+#define ARROWFILE_H
+
+#include <QString>
+#include "sheetdata.h"
+
+
+
+/* Apache ArrowのIPC形式(Feather v2の.arrow/.featherのファイル形式と，ストリーム形式)の読み書き．
+ * 圧縮されたボディと辞書エンコードされた列には対応していない．
+ *
+ * 読み込みはファイルをmmapし，NULLのないint64/float64の列は，レコードバッチが1つであればファイル上のバッファを
+ * そのまま列として参照する(解析もコピーもしない)．複数のレコードバッチに分かれた列はバッファを連結する．
+ * その他の整数・浮動小数点数，bool，日時(整数のまま)，文字列は読み込み時に変換し，NULLは空のセルにする．
+ * フィールド名はSheetData::columnNames()になる．
+ *
+ * 書き出しは1つのレコードバッチのファイル形式で，Int64列をint64，Double列をfloat64(空のセルはNULL)，
+ * 数値でないセルを含む列をutf8にする．数値の列は配列をそのまま書き出す．
+ */
+class ArrowFile
+{
+public:
+    static bool read(const QString& path, SheetData& sheet);
+    static bool write(const QString& path, const SheetData& sheet);
+};
+
+#endif // ARROWFILE_H
@@ -0,0 +1,737 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "bigfileviewer.h"
+
+#include <QVBoxLayout>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QTimer>
+#include <QPainter>
+#include <QScrollBar>
+#include <QWheelEvent>
+#include <QKeyEvent>
+#include <QFontDatabase>
+#include <QRegularExpressionValidator>
+#include <QLocale>
+#include <cstring>
+#include <algorithm>
+
+#include "ioscheduler.h"
+#include "logger.h"
+
+
+
+FileWindow::FileWindow(const QString& path)
+{
+    if(!path.isEmpty()) open(path);
+}
+
+FileWindow::~FileWindow()
+{
+    close();
+}
+
+bool FileWindow::open(const QString& path)
+{
+    close();
+
+    file.setFileName(path);
+    if(!file.open(QIODevice::ReadOnly)) return false;
+
+    fileSize = file.size();
+    return true;
+}
+
+void FileWindow::close()
+{
+    unmap();
+    file.close();
+    fileSize = 0;
+}
+
+void FileWindow::unmap()
+{
+    if(base) file.unmap(base);
+
+    base = nullptr;
+    start = 0;
+    mappedSize = 0;
+}
+
+const char *FileWindow::map(const qint64 offset, qint64& length)
+{
+    if(offset < 0 || offset >= fileSize || length <= 0) { length = 0; return nullptr; }
+
+    length = qMin(length, fileSize - offset);
+
+    if(!base || offset < start || offset + length > start + mappedSize)
+    {
+        unmap();
+
+        /* 割り当ての開始位置はページの境界に揃える */
+        constexpr qint64 granularity = 64 * 1024;
+        start = offset / granularity * granularity;
+        mappedSize = qMin(qMax(windowSize, offset + length - start), fileSize - start);
+        base = file.map(start, mappedSize);
+
+        if(!base)
+        {
+            start = 0;
+            mappedSize = 0;
+            length = 0;
+            return nullptr;
+        }
+    }
+
+    return reinterpret_cast<const char*>(base) + (offset - start);
+}
+
+
+
+
+bool LineIndex::build(const QString& path)
+{
+    FileWindow window;
+    if(!window.open(path)) return false;
+
+    const qint64 size = window.size();
+
+    qint64 pos = 0;
+    qint64 lines = 0;
+    qint64 lastStart = 0;
+    {
+        QMutexLocker locker(&mutex);
+
+        /* 索引済みの範囲が書き換えられていれば初めから作り直す */
+        bool appended = (size >= bytes);
+        if(appended && !tail.isEmpty())
+        {
+            qint64 length = tail.size();
+            const char *data = window.map(bytes - length, length);
+            appended = (data && length == tail.size() && std::memcmp(data, tail.constData(), length) == 0);
+        }
+
+        if(!appended)
+        {
+            checkpoints = { 0 };
+            bytes = 0;
+            newlines = 0;
+            lastLineStart = 0;
+            tail.clear();
+        }
+
+        finished = false;
+        pos = bytes;
+        lines = newlines;
+        lastStart = lastLineStart;
+    }
+
+    constexpr qint64 chunkSize = 8 * 1024 * 1024;   //この大きさごとに索引を公開する
+    QList<qint64> found;
+
+    while(pos < size)
+    {
+        if(canceled) return false;
+
+        qint64 length = qMin(chunkSize, size - pos);
+        const char *data = window.map(pos, length);
+        if(!data) return false;
+
+        const char *end = data + length;
+        for(const char *p = data; (p = static_cast<const char*>(std::memchr(p, '\n', end - p))) != nullptr; )
+        {
+            ++p;
+            ++lines;
+            lastStart = pos + (p - data);
+            if(lines % interval == 0) found << lastStart;
+        }
+
+        pos += length;
+
+        const qint64 tailSize = qMin<qint64>(64, length);
+
+        QMutexLocker locker(&mutex);
+        checkpoints << found;
+        bytes = pos;
+        newlines = lines;
+        lastLineStart = lastStart;
+        tail = QByteArray(end - tailSize, tailSize);
+        found.clear();
+    }
+
+    QMutexLocker locker(&mutex);
+    finished = true;
+    return true;
+}
+
+qint64 LineIndex::indexedBytes() const
+{
+    QMutexLocker locker(&mutex);
+    return bytes;
+}
+
+bool LineIndex::isFinished() const
+{
+    QMutexLocker locker(&mutex);
+    return finished;
+}
+
+qint64 LineIndex::lineCount() const
+{
+    QMutexLocker locker(&mutex);
+    return newlines + ((bytes > lastLineStart) ? 1 : 0);
+}
+
+bool LineIndex::locate(const qint64 offset, qint64& line, qint64& start) const
+{
+    QMutexLocker locker(&mutex);
+
+    if(offset < 0 || offset > bytes) return false;
+
+    const qsizetype i = std::upper_bound(checkpoints.cbegin(), checkpoints.cend(), offset) - checkpoints.cbegin() - 1;
+    line = i * interval;
+    start = checkpoints.at(i);
+    return true;
+}
+
+bool LineIndex::checkpoint(const qint64 line, qint64& checkpointLine, qint64& start) const
+{
+    QMutexLocker locker(&mutex);
+
+    //line行目の行頭がわかるのは，その前の改行まで索引されている場合
+    if(line < 0 || line > newlines) return false;
+
+    const qsizetype i = qMin<qsizetype>(line / interval, checkpoints.size() - 1);
+    checkpointLine = i * interval;
+    start = checkpoints.at(i);
+    return true;
+}
+
+
+
+
+BigFileView::BigFileView(QWidget *parent)
+    : QAbstractScrollArea(parent)
+{
+    setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    setFocusPolicy(Qt::FocusPolicy::StrongFocus);
+
+    verticalScrollBar()->setRange(0, 0);
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, this, &BigFileView::receiveScrollValue);
+}
+
+bool BigFileView::setFile(const QString& path, const QSharedPointer<LineIndex>& index)
+{
+    this->index = index;
+
+    const bool ok = window.open(path);
+
+    verticalScrollBar()->setRange(0, (window.size() > 0) ? scrollSteps : 0);
+    setTop(0, 0);
+
+    return ok;
+}
+
+void BigFileView::closeFile()
+{
+    window.close();
+    index.reset();
+    verticalScrollBar()->setRange(0, 0);
+    setTop(0, 0);
+}
+
+qint64 BigFileView::lineStart(const qint64 offset)
+{
+    const qint64 end = qMin(offset, window.size());
+    if(end <= 0) return 0;
+
+    const qint64 from = qMax<qint64>(0, end - maxLineBytes);
+    qint64 length = end - from;
+    const char *data = window.map(from, length);
+    if(!data) return end;
+
+    for(qint64 i = length - 1; i >= 0; --i)
+        if(data[i] == '\n') return from + i + 1;
+
+    return from;    //長すぎる行は途中から表示する
+}
+
+qint64 BigFileView::nextLine(const qint64 offset, bool *terminated)
+{
+    if(terminated) *terminated = false;
+
+    qint64 length = maxLineBytes;
+    const char *data = window.map(offset, length);
+    if(!data) return window.size();
+
+    const char *p = static_cast<const char*>(std::memchr(data, '\n', length));
+    if(!p) return offset + length;
+
+    if(terminated) *terminated = true;
+    return offset + (p - data) + 1;
+}
+
+qint64 BigFileView::previousLine(const qint64 offset, bool *terminated)
+{
+    if(terminated) *terminated = false;
+    if(offset <= 0) return 0;
+
+    if(terminated) *terminated = isLineStart(offset);
+    return lineStart(offset - 1);
+}
+
+bool BigFileView::isLineStart(const qint64 offset)
+{
+    if(offset <= 0) return true;
+
+    qint64 length = 1;
+    const char *data = window.map(offset - 1, length);
+    return data && *data == '\n';
+}
+
+QString BigFileView::lineText(const qint64 offset)
+{
+    qint64 length = nextLine(offset) - offset;
+    const char *data = window.map(offset, length);
+    if(!data) return QString();
+
+    while(length > 0 && (data[length - 1] == '\n' || data[length - 1] == '\r')) --length;
+
+    QString text = QString::fromUtf8(data, length);
+    text.replace('\t', "    ");
+    return text;
+}
+
+qint64 BigFileView::countNewlines(const qint64 from, const qint64 to)
+{
+    qint64 count = 0;
+
+    for(qint64 pos = from; pos < to; )
+    {
+        qint64 length = qMin(FileWindow::windowSize, to - pos);
+        const char *data = window.map(pos, length);
+        if(!data) break;
+
+        const char *end = data + length;
+        for(const char *p = data; (p = static_cast<const char*>(std::memchr(p, '\n', end - p))) != nullptr; ++p) ++count;
+
+        pos += length;
+    }
+
+    return count;
+}
+
+qint64 BigFileView::lineNumberAt(const qint64 offset)
+{
+    if(offset == 0) return 0;
+
+    qint64 line = 0;
+    qint64 start = 0;
+    if(!index || !index->locate(offset, line, start)) return -1;
+
+    return line + countNewlines(start, offset);
+}
+
+int BigFileView::visibleRowCount() const
+{
+    return qMax(1, viewport()->height() / fontMetrics().lineSpacing());
+}
+
+void BigFileView::setTop(const qint64 offset, const qint64 line, const bool syncScrollBar)
+{
+    top = offset;
+    topLineNumber = line;
+
+    if(syncScrollBar)
+    {
+        const int value = (window.size() > 0) ? int(double(top) / window.size() * scrollSteps) : 0;
+
+        QSignalBlocker blocker(verticalScrollBar());
+        verticalScrollBar()->setValue(value);
+    }
+
+    updateLines();
+    viewport()->update();
+
+    emit positionChanged();
+}
+
+void BigFileView::updateLines()
+{
+    lines.clear();
+
+    const int rows = visibleRowCount() + 1;
+    qint64 offset = top;
+    qint64 number = topLineNumber;
+    bool startsLine = isLineStart(top);
+    int textWidth = 0;
+
+    for(int row = 0; row < rows && offset < window.size(); ++row)
+    {
+        bool terminated = false;
+        const qint64 next = nextLine(offset, &terminated);
+
+        Line line{ (startsLine) ? number : -1, lineText(offset) };
+        textWidth = qMax(textWidth, fontMetrics().horizontalAdvance(line.text));
+        lines << line;
+
+        if(terminated && number >= 0) ++number;
+        startsLine = terminated;
+        offset = next;
+    }
+
+    /* 行番号の欄は，ファイル全体の行数(わからなければ見えている行番号)の桁数に合わせる */
+    const qint64 maxNumber = qMax(number, (index) ? index->lineCount() : 0);
+    gutterWidth = fontMetrics().horizontalAdvance(QString(qMax(4, int(QString::number(maxNumber).size())), '9')) + 8;
+
+    horizontalScrollBar()->setRange(0, qMax(0, gutterWidth + textWidth + 8 - viewport()->width()));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+
+    if(window.size() > 0)
+        verticalScrollBar()->setPageStep(int(qBound<double>(1, double(offset - top) / window.size() * scrollSteps, scrollSteps)));
+}
+
+void BigFileView::paintEvent(QPaintEvent *)
+{
+    QPainter painter(viewport());
+
+    const int height = fontMetrics().lineSpacing();
+    const int ascent = fontMetrics().ascent();
+    const int x = gutterWidth + 4 - horizontalScrollBar()->value();
+
+    painter.fillRect(QRect(0, 0, gutterWidth, viewport()->height()), palette().alternateBase());
+
+    for(qsizetype row = 0; row < lines.size(); ++row)
+    {
+        const int y = row * height;
+        const Line& line = lines.at(row);
+
+        if(line.number >= 0)
+        {
+            painter.setPen(palette().color(QPalette::ColorRole::PlaceholderText));
+            painter.drawText(QRect(0, y, gutterWidth - 4, height), Qt::AlignRight | Qt::AlignVCenter, QString::number(line.number + 1));
+        }
+
+        painter.setPen(palette().color(QPalette::ColorRole::Text));
+        painter.setClipRect(gutterWidth, 0, viewport()->width() - gutterWidth, viewport()->height());
+        painter.drawText(x, y + ascent, line.text);
+        painter.setClipping(false);
+    }
+}
+
+void BigFileView::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+
+    updateLines();
+}
+
+void BigFileView::wheelEvent(QWheelEvent *event)
+{
+    const int delta = event->angleDelta().y();
+    if(delta == 0)
+    {
+        QAbstractScrollArea::wheelEvent(event);
+        return;
+    }
+
+    qint64 count = -delta * 3 / 120;
+    if(count == 0) count = (delta < 0) ? 1 : -1;
+
+    scrollLines(count);
+    event->accept();
+}
+
+void BigFileView::keyPressEvent(QKeyEvent *event)
+{
+    const bool ctrl = event->modifiers().testFlag(Qt::KeyboardModifier::ControlModifier);
+
+    switch(event->key())
+    {
+    case Qt::Key_Up: scrollLines(-1); break;
+    case Qt::Key_Down: scrollLines(1); break;
+    case Qt::Key_PageUp: scrollLines(-qMax(1, visibleRowCount() - 1)); break;
+    case Qt::Key_PageDown: scrollLines(qMax(1, visibleRowCount() - 1)); break;
+    case Qt::Key_Home: if(ctrl) moveToHead(); else horizontalScrollBar()->setValue(0); break;
+    case Qt::Key_End: if(ctrl) moveToTail(); else horizontalScrollBar()->setValue(horizontalScrollBar()->maximum()); break;
+    default:
+        QAbstractScrollArea::keyPressEvent(event);
+        return;
+    }
+
+    event->accept();
+}
+
+void BigFileView::receiveScrollValue(const int value)
+{
+    const qint64 offset = lineStart(qint64(double(value) / scrollSteps * window.size()));
+
+    //スクロールバーを動かしている最中なので，スクロールバーの位置は変えない
+    setTop(offset, lineNumberAt(offset), false);
+}
+
+void BigFileView::scrollLines(qint64 count)
+{
+    qint64 offset = top;
+    qint64 line = topLineNumber;
+
+    for(; count > 0; --count)
+    {
+        bool terminated = false;
+        const qint64 next = nextLine(offset, &terminated);
+        if(next >= window.size()) break;    //最後の行は残す
+
+        if(terminated && line >= 0) ++line;
+        offset = next;
+    }
+
+    for(; count < 0 && offset > 0; ++count)
+    {
+        bool terminated = false;
+        offset = previousLine(offset, &terminated);
+
+        if(terminated && line >= 0) --line;
+    }
+
+    if(offset != top) setTop(offset, line);
+}
+
+void BigFileView::moveToOffset(const qint64 offset)
+{
+    const qint64 start = lineStart(qBound<qint64>(0, offset, window.size()));
+
+    setTop(start, lineNumberAt(start));
+}
+
+bool BigFileView::moveToLine(qint64 line)
+{
+    if(!index) return false;
+
+    line = qMax<qint64>(0, line);
+    if(index->isFinished()) line = qMin(line, qMax<qint64>(0, index->lineCount() - 1));
+
+    qint64 current = 0;
+    qint64 offset = 0;
+    if(!index->checkpoint(line, current, offset)) return false;
+
+    while(current < line && offset < window.size())
+    {
+        bool terminated = false;
+        offset = nextLine(offset, &terminated);
+        if(terminated) ++current;
+    }
+
+    setTop(offset, line);
+    return true;
+}
+
+void BigFileView::moveToHead()
+{
+    setTop(0, 0);
+}
+
+void BigFileView::moveToTail()
+{
+    qint64 offset = previousLine(window.size());
+
+    for(int row = 1; row < visibleRowCount() && offset > 0; ++row)
+        offset = previousLine(offset);
+
+    setTop(offset, lineNumberAt(offset));
+}
+
+void BigFileView::resolveLineNumber()
+{
+    const qint64 line = lineNumberAt(top);
+    if(line == topLineNumber) return;
+
+    topLineNumber = line;
+    updateLines();
+    viewport()->update();
+
+    emit positionChanged();
+}
+
+
+
+
+BigFileViewer::BigFileViewer(QWidget *parent)
+    : QWidget(parent)
+    , view(new BigFileView(this))
+    , lineEdit(new QLineEdit(this))
+    , offsetEdit(new QLineEdit(this))
+    , statusLabel(new QLabel(this))
+    , progressTimer(new QTimer(this))
+{
+    QVBoxLayout *vLayout = new QVBoxLayout(this);
+    QHBoxLayout *hLayout = new QHBoxLayout;
+    QLabel *lineLabel = new QLabel("Line", this);
+    QLabel *offsetLabel = new QLabel("Offset", this);
+    QPushButton *headButton = new QPushButton("Head", this);
+    QPushButton *tailButton = new QPushButton("Tail", this);
+    QPushButton *reloadButton = new QPushButton("Reload", this);
+
+    setLayout(vLayout);
+    vLayout->addLayout(hLayout);
+    vLayout->addWidget(view);
+    hLayout->addWidget(lineLabel);
+    hLayout->addWidget(lineEdit);
+    hLayout->addWidget(offsetLabel);
+    hLayout->addWidget(offsetEdit);
+    hLayout->addWidget(headButton);
+    hLayout->addWidget(tailButton);
+    hLayout->addWidget(reloadButton);
+    hLayout->addSpacerItem(new QSpacerItem(0, 0, QSizePolicy::Expanding, QSizePolicy::Preferred));
+    hLayout->addWidget(statusLabel);
+
+    vLayout->setSpacing(0);
+    hLayout->setSpacing(5);
+    vLayout->setContentsMargins(0, 0, 0, 0);
+    hLayout->setContentsMargins(5, 0, 5, 0);
+
+    lineEdit->setValidator(new QRegularExpressionValidator(QRegularExpression("[0-9]*"), lineEdit));
+    offsetEdit->setValidator(new QRegularExpressionValidator(QRegularExpression("[0-9]*|0[xX][0-9a-fA-F]*"), offsetEdit));
+    offsetEdit->setPlaceholderText("bytes or 0x...");
+
+    progressTimer->setInterval(250);
+
+    connect(lineEdit, &QLineEdit::returnPressed, this, &BigFileViewer::jumpToLine);
+    connect(offsetEdit, &QLineEdit::returnPressed, this, &BigFileViewer::jumpToOffset);
+    connect(headButton, &QPushButton::released, view, &BigFileView::moveToHead);
+    connect(tailButton, &QPushButton::released, view, &BigFileView::moveToTail);
+    connect(reloadButton, &QPushButton::released, this, &BigFileViewer::reload);
+    connect(view, &BigFileView::positionChanged, this, &BigFileViewer::updateStatus);
+    connect(progressTimer, &QTimer::timeout, this, [this]() {
+        if(view->topLine() < 0) view->resolveLineNumber();
+        updateStatus();
+    });
+}
+
+BigFileViewer::~BigFileViewer()
+{
+    if(index) index->cancel();
+}
+
+void BigFileViewer::setFilePath(const QString& path)
+{
+    closeFile();
+
+    filePath = path;
+    index = QSharedPointer<LineIndex>(new LineIndex);
+
+    if(!view->setFile(path, index))
+    {
+        __LOGOUT__("failed to open \"" + path + "\".", Logger::LogLevel::Error);
+        return;
+    }
+
+    buildIndex();
+}
+
+void BigFileViewer::closeFile()
+{
+    if(index) index->cancel();
+
+    view->closeFile();
+    index.reset();
+    building = false;
+    progressTimer->stop();
+    updateStatus();
+}
+
+/* 末尾に追記されただけであれば，表示している位置を保ったまま索引を続きから作る */
+void BigFileViewer::reload()
+{
+    if(filePath.isEmpty() || !index) return;
+
+    const qint64 offset = view->topOffset();
+
+    if(!view->setFile(filePath, index))
+    {
+        __LOGOUT__("failed to open \"" + filePath + "\".", Logger::LogLevel::Error);
+        return;
+    }
+
+    view->moveToOffset(offset);
+
+    if(!building) buildIndex();
+}
+
+void BigFileViewer::buildIndex()
+{
+    building = true;
+    progressTimer->start();
+
+    const QSharedPointer<LineIndex> index = this->index;
+
+    IoScheduler::schedule(filePath, IoScheduler::Operation::Read, IoScheduler::Priority::Background, this,
+                          [index](const QString& path, bool& ok) {
+                              ok = index->build(path);
+                              return QVariant();
+                          },
+                          [this, index](const QVariant&, const bool ok) {
+                              if(index != this->index) return;    //別のファイルに切り替えられた
+
+                              building = false;
+                              progressTimer->stop();
+
+                              if(!ok) __LOGOUT__("failed to index \"" + filePath + "\".", Logger::LogLevel::Warn);
+
+                              view->resolveLineNumber();
+                              updateStatus();
+                          });
+}
+
+void BigFileViewer::jumpToLine()
+{
+    bool ok = false;
+    const qint64 line = lineEdit->text().toLongLong(&ok);
+    if(!ok) return;
+
+    //行番号は1から
+    if(!view->moveToLine(line - 1))
+        __LOGOUT__("line " + QString::number(line) + " is not indexed yet.", Logger::LogLevel::Info);
+}
+
+void BigFileViewer::jumpToOffset()
+{
+    bool ok = false;
+    const qint64 offset = offsetEdit->text().toLongLong(&ok, 0);
+    if(!ok) return;
+
+    view->moveToOffset(offset);
+}
+
+void BigFileViewer::updateStatus()
+{
+    if(!index)
+    {
+        statusLabel->clear();
+        return;
+    }
+
+    const QLocale locale;
+    const qint64 size = view->fileSize();
+    const qint64 lines = index->lineCount();
+
+    QString status = locale.formattedDataSize(size) + "  ";
+
+    if(index->isFinished())
+        status += locale.toString(lines) + " lines";
+    else
+        status += locale.toString(lines) + "+ lines (indexing "
+                + QString::number((size > 0) ? 100 * index->indexedBytes() / size : 100) + "%)";
+
+    status += "  offset " + locale.toString(view->topOffset());
+
+    statusLabel->setText(status);
+}
@@ -0,0 +1,193 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef BIGFILEVIEWER_H
+#define BIGFILEVIEWER_H
+
+#include <QWidget>
+#include <QAbstractScrollArea>
+#include <QFile>
+#include <QMutex>
+#include <QSharedPointer>
+#include <atomic>
+
+class QLineEdit;
+class QLabel;
+class QTimer;
+
+
+
+/* ファイルの一部だけをmmapする．要求された範囲が今の窓の外であれば窓を移し替えるため，
+ * ファイルの大きさによらず割り当てるのは窓の大きさ(windowSize)程度 */
+class FileWindow
+{
+public:
+    explicit FileWindow(const QString& path = QString());
+    ~FileWindow();
+
+    bool open(const QString& path);
+    void close();
+    qint64 size() const { return fileSize; }
+
+    /* [offset, offset + length)を割り当ててoffsetの位置を返す．lengthはファイルの終わりで切り詰める */
+    const char *map(const qint64 offset, qint64& length);
+
+    static constexpr qint64 windowSize = 32 * 1024 * 1024;
+
+private:
+    void unmap();
+
+    QFile file;
+    qint64 fileSize = 0;
+    uchar *base = nullptr;
+    qint64 start = 0;
+    qint64 mappedSize = 0;
+};
+
+
+
+
+/* 改行の位置の索引．interval行ごとに行頭のバイト位置だけを記録するため，20GBのファイルでも数MB程度．
+ * build()は別スレッドで実行し，GUIのスレッドからは索引済みの範囲をいつでも参照できる．
+ * ファイルが末尾に追記されただけであれば，続きから索引を作る．
+ */
+class LineIndex
+{
+public:
+    static constexpr qint64 interval = 1024;
+
+    bool build(const QString& path);
+    void cancel() { canceled = true; }
+
+    qint64 indexedBytes() const;
+    bool isFinished() const;
+    qint64 lineCount() const;       //索引済みの範囲の行数．最後の改行のない行も数える
+
+    /* offsetを含む範囲の直前の記録．lineにその行番号(0から)，startに行頭を入れる．offsetが索引済みの範囲の外ならfalse */
+    bool locate(const qint64 offset, qint64& line, qint64& start) const;
+    /* lineの直前の記録．行がまだ索引されていなければfalse */
+    bool checkpoint(const qint64 line, qint64& checkpointLine, qint64& start) const;
+
+private:
+    mutable QMutex mutex;
+    QList<qint64> checkpoints = { 0 };  //interval * i行目の行頭
+    qint64 bytes = 0;                   //索引済みのバイト数
+    qint64 newlines = 0;
+    qint64 lastLineStart = 0;
+    QByteArray tail;                    //索引済みの範囲の末尾．追記されただけかどうかの確認に使う
+    bool finished = false;
+    std::atomic_bool canceled = false;
+};
+
+
+
+
+/* 見えている行だけを描画する読み取り専用のテキストの表示．位置はバイト単位で持ち，
+ * スクロールバーはファイル上の位置に比例させるため，索引ができていなくても全体を移動できる */
+class BigFileView : public QAbstractScrollArea
+{
+    Q_OBJECT
+public:
+    explicit BigFileView(QWidget *parent);
+
+    bool setFile(const QString& path, const QSharedPointer<LineIndex>& index);
+    void closeFile();
+
+    qint64 fileSize() const { return window.size(); }
+    qint64 topOffset() const { return top; }
+    qint64 topLine() const { return topLineNumber; }    //-1は不明(まだ索引されていない)
+
+    void moveToOffset(const qint64 offset);
+    bool moveToLine(const qint64 line);
+    void moveToHead();
+    void moveToTail();
+    void scrollLines(qint64 count);
+
+    /* 索引が進んだあと，先頭の行の行番号を求め直す */
+    void resolveLineNumber();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+
+private slots:
+    void receiveScrollValue(const int value);
+
+private:
+    struct Line
+    {
+        qint64 number;      //-1は不明
+        QString text;
+    };
+
+    qint64 lineStart(const qint64 offset);
+    qint64 nextLine(const qint64 offset, bool *terminated = nullptr);
+    qint64 previousLine(const qint64 offset, bool *terminated = nullptr);
+    QString lineText(const qint64 offset);
+    qint64 countNewlines(const qint64 from, const qint64 to);
+    qint64 lineNumberAt(const qint64 offset);
+    bool isLineStart(const qint64 offset);
+
+    int visibleRowCount() const;
+    void setTop(const qint64 offset, const qint64 line, const bool syncScrollBar = true);
+    void updateLines();
+
+    static constexpr qint64 maxLineBytes = 64 * 1024;  //これより長い行は分けて表示する
+    static constexpr int scrollSteps = 1 << 20;
+
+    FileWindow window;
+    QSharedPointer<LineIndex> index;
+    qint64 top = 0;
+    qint64 topLineNumber = 0;
+    QList<Line> lines;
+    int gutterWidth = 0;
+
+signals:
+    void positionChanged();
+};
+
+
+
+
+/* 編集するには大きすぎるデータファイルの表示．索引はバックグラウンドで作り，
+ * 先頭・末尾，行番号，バイト位置へすぐに移動できる．メモリの使用量はファイルの大きさによらない */
+class BigFileViewer : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit BigFileViewer(QWidget *parent);
+    ~BigFileViewer();
+
+public slots:
+    void setFilePath(const QString& path);
+    void closeFile();
+    void reload();
+
+private slots:
+    void jumpToLine();
+    void jumpToOffset();
+    void updateStatus();
+
+private:
+    void buildIndex();
+
+    QString filePath;
+    QSharedPointer<LineIndex> index;
+    bool building = false;
+
+    BigFileView *view;
+    QLineEdit *lineEdit;
+    QLineEdit *offsetEdit;
+    QLabel *statusLabel;
+    QTimer *progressTimer;
+};
+
+#endif // BIGFILEVIEWER_H
@@ -0,0 +1,669 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "columnexpression.h"
+
+#include <QThread>
+#include <QThreadPool>
+#include <cmath>
+#include <cstring>
+#include "gnuplotcompletion.h"
+
+
+
+namespace
+{
+    constexpr double pi = 3.14159265358979323846;
+
+    double sgn(const double x)
+    {
+        if(qIsNaN(x)) return x;
+        return (x > 0.0) ? 1.0 : (x < 0.0) ? -1.0 : 0.0;
+    }
+
+    double norm(const double x)
+    {
+        return 0.5 * std::erfc(-x / std::sqrt(2.0));
+    }
+
+    /* 標準正規分布の累積分布関数の逆関数(Acklamの近似を1回Halley法で補正する) */
+    double invnorm(const double p)
+    {
+        if(!(p > 0.0 && p < 1.0)) return (p == 0.0) ? -qInf() : (p == 1.0) ? qInf() : qQNaN();
+
+        static constexpr double a[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+                                         1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+        static constexpr double b[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+                                         6.680131188771972e+01, -1.328068155288572e+01 };
+        static constexpr double c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                                        -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+        static constexpr double d[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+                                        3.754408661907416e+00 };
+        static constexpr double low = 0.02425;
+
+        double x;
+        if(p < low || p > 1.0 - low)
+        {
+            const double q = std::sqrt(-2.0 * std::log((p < low) ? p : 1.0 - p));
+            x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+                ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+            if(p > 1.0 - low) x = -x;
+        }
+        else
+        {
+            const double q = p - 0.5;
+            const double r = q * q;
+            x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+                (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+        }
+
+        const double e = norm(x) - p;
+        const double u = e * std::sqrt(2.0 * pi) * std::exp(x * x / 2.0);
+        return x - u / (1.0 + x * u / 2.0);
+    }
+
+    /* ビット演算のための整数．qint64で表せなければfalse */
+    bool toInteger(const double x, qint64& value)
+    {
+        if(!(std::fabs(x) < 9.2e18)) return false;
+        value = qint64(x);
+        return true;
+    }
+
+    template <class F>
+    void unary(double *a, const qsizetype size, F f)
+    {
+        for(qsizetype i = 0; i < size; ++i) a[i] = f(a[i]);
+    }
+
+    template <class F>
+    void binary(double *a, const double *b, const qsizetype size, F f)
+    {
+        for(qsizetype i = 0; i < size; ++i) a[i] = f(a[i], b[i]);
+    }
+
+    template <class F>
+    void bitwise(double *a, const double *b, const qsizetype size, F f)
+    {
+        for(qsizetype i = 0; i < size; ++i)
+        {
+            qint64 x, y;
+            a[i] = (toInteger(a[i], x) && toInteger(b[i], y)) ? double(f(x, y)) : qQNaN();
+        }
+    }
+
+    /* 列colの[first, first + size)の値．範囲外や数値でない列はNaN */
+    void loadColumn(const SheetData& sheet, const int col, const qsizetype first, const qsizetype size, double *out)
+    {
+        qsizetype loaded = 0;
+
+        if(col < sheet.columnCount())
+        {
+            const SheetColumn& column = sheet.column(col);
+            loaded = qBound<qsizetype>(0, column.size() - first, size);
+
+            switch(column.type())
+            {
+            case SheetColumn::Type::Int64:
+            {
+                const qint64 *data = column.int64Data() + first;
+                for(qsizetype i = 0; i < loaded; ++i) out[i] = double(data[i]);
+                break;
+            }
+            case SheetColumn::Type::Double:
+                std::memcpy(out, column.doubleData() + first, loaded * sizeof(double));
+                break;
+            default:
+                loaded = 0;
+                break;
+            }
+        }
+
+        for(qsizetype i = loaded; i < size; ++i) out[i] = qQNaN();
+    }
+}
+
+
+
+
+struct ColumnExpression::Function
+{
+    const char *name;
+    int argumentCount;
+    double (*function1)(double);
+    double (*function2)(double, double);
+};
+
+const ColumnExpression::Function *ColumnExpression::functions(int *count)
+{
+    static const Function list[] = {
+        { "abs", 1, [](double x) { return std::fabs(x); }, nullptr },
+        { "acos", 1, [](double x) { return std::acos(x); }, nullptr },
+        { "acosh", 1, [](double x) { return std::acosh(x); }, nullptr },
+        { "arg", 1, [](double x) { return (qIsNaN(x)) ? x : (x < 0.0) ? pi : 0.0; }, nullptr },
+        { "asin", 1, [](double x) { return std::asin(x); }, nullptr },
+        { "asinh", 1, [](double x) { return std::asinh(x); }, nullptr },
+        { "atan", 1, [](double x) { return std::atan(x); }, nullptr },
+        { "atan2", 2, nullptr, [](double y, double x) { return std::atan2(y, x); } },
+        { "atanh", 1, [](double x) { return std::atanh(x); }, nullptr },
+        { "ceil", 1, [](double x) { return std::ceil(x); }, nullptr },
+        { "cos", 1, [](double x) { return std::cos(x); }, nullptr },
+        { "cosh", 1, [](double x) { return std::cosh(x); }, nullptr },
+        { "erf", 1, [](double x) { return std::erf(x); }, nullptr },
+        { "erfc", 1, [](double x) { return std::erfc(x); }, nullptr },
+        { "exp", 1, [](double x) { return std::exp(x); }, nullptr },
+        { "floor", 1, [](double x) { return std::floor(x); }, nullptr },
+        { "gamma", 1, [](double x) { return std::tgamma(x); }, nullptr },
+        { "imag", 1, [](double x) { return (qIsNaN(x)) ? x : 0.0; }, nullptr },
+        { "int", 1, [](double x) { return std::trunc(x); }, nullptr },
+        { "inverf", 1, [](double x) { return invnorm((x + 1.0) / 2.0) / std::sqrt(2.0); }, nullptr },
+        { "invnorm", 1, [](double x) { return invnorm(x); }, nullptr },
+        { "lgamma", 1, [](double x) { return std::lgamma(x); }, nullptr },
+        { "log", 1, [](double x) { return std::log(x); }, nullptr },
+        { "log10", 1, [](double x) { return std::log10(x); }, nullptr },
+        { "norm", 1, [](double x) { return norm(x); }, nullptr },
+        { "real", 1, [](double x) { return x; }, nullptr },
+        { "sgn", 1, [](double x) { return sgn(x); }, nullptr },
+        { "sin", 1, [](double x) { return std::sin(x); }, nullptr },
+        { "sinh", 1, [](double x) { return std::sinh(x); }, nullptr },
+        { "sqrt", 1, [](double x) { return std::sqrt(x); }, nullptr },
+        { "tan", 1, [](double x) { return std::tan(x); }, nullptr },
+        { "tanh", 1, [](double x) { return std::tanh(x); }, nullptr },
+    };
+
+    if(count) *count = int(sizeof(list) / sizeof(list[0]));
+    return list;
+}
+
+QStringList ColumnExpression::functionNames()
+{
+    int count = 0;
+    const Function *list = functions(&count);
+
+    QStringList names { "column", "valid" };
+    for(int i = 0; i < count; ++i) names.append(QString::fromLatin1(list[i].name));
+    return names;
+}
+
+
+
+
+/* 再帰下降で解析し，後置記法の命令列を作る．演算子の優先順位はgnuplotと同じ */
+class ColumnExpression::Parser
+{
+public:
+    Parser(const QString& text, QList<Instruction>& code) : text(text), code(code) { next(); }
+
+    bool parse(QString *error, int& stackSize)
+    {
+        ternary();
+        if(message.isEmpty() && token != Token::End) fail(QString("unexpected \"%1\"").arg(tokenText));
+
+        if(!message.isEmpty())
+        {
+            if(error) *error = message;
+            code.clear();
+            return false;
+        }
+
+        stackSize = maxDepth;
+        return true;
+    }
+
+private:
+    enum class Token { End, Number, Identifier, Dollar, Operator, LeftParen, RightParen, Comma };
+
+    void fail(const QString& error)
+    {
+        if(message.isEmpty()) message = error + QString(" (at %1)").arg(tokenStart + 1);
+        token = Token::End;
+    }
+
+    void next()
+    {
+        while(position < text.size() && text.at(position).isSpace()) ++position;
+
+        tokenStart = position;
+        tokenText.clear();
+
+        if(position >= text.size()) { token = Token::End; return; }
+
+        const QChar c = text.at(position);
+
+        if(c.isDigit() || (c == '.' && position + 1 < text.size() && text.at(position + 1).isDigit()))
+        {
+            qsizetype end = position;
+            while(end < text.size() && (text.at(end).isDigit() || text.at(end) == '.')) ++end;
+            if(end < text.size() && (text.at(end) == 'e' || text.at(end) == 'E'))
+            {
+                qsizetype exponent = end + 1;
+                if(exponent < text.size() && (text.at(exponent) == '+' || text.at(exponent) == '-')) ++exponent;
+                if(exponent < text.size() && text.at(exponent).isDigit())
+                {
+                    end = exponent;
+                    while(end < text.size() && text.at(end).isDigit()) ++end;
+                }
+            }
+
+            tokenText = text.mid(position, end - position);
+            position = end;
+
+            bool ok = false;
+            number = tokenText.toDouble(&ok);
+            if(!ok) { fail(QString("invalid number \"%1\"").arg(tokenText)); return; }
+            token = Token::Number;
+            return;
+        }
+
+        if(c.isLetter() || c == '_')
+        {
+            qsizetype end = position;
+            while(end < text.size() && (text.at(end).isLetterOrNumber() || text.at(end) == '_')) ++end;
+            tokenText = text.mid(position, end - position);
+            position = end;
+            token = Token::Identifier;
+            return;
+        }
+
+        static const QStringList twoCharOperators { "**", "&&", "||", "==", "!=", "<=", ">=" };
+        const QString pair = text.mid(position, 2);
+        if(twoCharOperators.contains(pair))
+        {
+            tokenText = pair;
+            position += 2;
+            token = Token::Operator;
+            return;
+        }
+
+        tokenText = QString(c);
+        position++;
+
+        switch(c.unicode())
+        {
+        case '$': token = Token::Dollar; return;
+        case '(': token = Token::LeftParen; return;
+        case ')': token = Token::RightParen; return;
+        case ',': token = Token::Comma; return;
+        default: break;
+        }
+
+        if(QString("+-*/%<>&^|!~?:").contains(c)) { token = Token::Operator; return; }
+
+        fail(QString("unexpected \"%1\"").arg(tokenText));
+    }
+
+    bool isOperator(const char *op) const { return token == Token::Operator && tokenText == QLatin1String(op); }
+
+    void expect(const Token expected, const char *what)
+    {
+        if(token != expected) { fail(QString("\"%1\" expected").arg(what)); return; }
+        next();
+    }
+
+    void push(const OpCode op, const int index = 0, const double value = 0.0)
+    {
+        switch(op)
+        {
+        case OpCode::Constant: case OpCode::Column: case OpCode::Valid: case OpCode::Row:
+            depth++; break;
+        case OpCode::Negate: case OpCode::Not: case OpCode::BitNot: case OpCode::Function1:
+            break;
+        case OpCode::Select:
+            depth -= 2; break;
+        default:
+            depth--; break;
+        }
+        maxDepth = qMax(maxDepth, depth);
+
+        Instruction instruction;
+        instruction.op = op;
+        instruction.index = index;
+        instruction.value = value;
+        code.append(instruction);
+    }
+
+    /* cond ? a : b (右結合) */
+    void ternary()
+    {
+        binary(0);
+        if(!isOperator("?")) return;
+
+        next();
+        ternary();
+        if(!isOperator(":")) { fail("\":\" expected"); return; }
+        next();
+        ternary();
+        push(OpCode::Select);
+    }
+
+    /* 優先順位の低い順 */
+    void binary(const int level)
+    {
+        static const QList<QList<QPair<QString, OpCode> > > levels {
+            { { "||", OpCode::Or } },
+            { { "&&", OpCode::And } },
+            { { "|", OpCode::BitOr } },
+            { { "^", OpCode::BitXor } },
+            { { "&", OpCode::BitAnd } },
+            { { "==", OpCode::Equal }, { "!=", OpCode::NotEqual } },
+            { { "<", OpCode::Less }, { "<=", OpCode::LessEqual }, { ">", OpCode::Greater }, { ">=", OpCode::GreaterEqual } },
+            { { "+", OpCode::Add }, { "-", OpCode::Subtract } },
+            { { "*", OpCode::Multiply }, { "/", OpCode::Divide }, { "%", OpCode::Modulo } },
+        };
+
+        if(level >= levels.size()) { unary(); return; }
+
+        binary(level + 1);
+
+        for(;;)
+        {
+            if(token != Token::Operator) return;
+
+            bool matched = false;
+            for(const QPair<QString, OpCode>& op : levels.at(level))
+            {
+                if(tokenText != op.first) continue;
+                next();
+                binary(level + 1);
+                push(op.second);
+                matched = true;
+                break;
+            }
+            if(!matched) return;
+        }
+    }
+
+    void unary()
+    {
+        if(isOperator("-")) { next(); unary(); push(OpCode::Negate); return; }
+        if(isOperator("+")) { next(); unary(); return; }
+        if(isOperator("!")) { next(); unary(); push(OpCode::Not); return; }
+        if(isOperator("~")) { next(); unary(); push(OpCode::BitNot); return; }
+        power();
+    }
+
+    /* a ** b (右結合．-2**2は-4) */
+    void power()
+    {
+        primary();
+        if(!isOperator("**")) return;
+
+        next();
+        unary();
+        push(OpCode::Power);
+    }
+
+    /* column(n), valid(n)の引数．列の番号の定数だけを受け付ける */
+    int columnArgument(const QString& name)
+    {
+        const qsizetype start = code.size();
+        ternary();
+
+        if(code.size() != start + 1 || code.last().op != OpCode::Constant ||
+           code.last().value < 0 || code.last().value != std::floor(code.last().value))
+        {
+            fail(QString("%1() takes a constant column number").arg(name));
+            return 0;
+        }
+
+        const int col = int(code.last().value);
+        code.removeLast();
+        depth--;
+        return col;
+    }
+
+    void call(const QString& name)
+    {
+        next();     //'('
+
+        if(name == "column" || name == "valid")
+        {
+            const int col = columnArgument(name);
+            expect(Token::RightParen, ")");
+            if(name == "valid") push(OpCode::Valid, col - 1);
+            else if(col == 0) push(OpCode::Row);
+            else push(OpCode::Column, col - 1);
+            return;
+        }
+
+        int count = 0;
+        const Function *list = functions(&count);
+        int index = -1;
+        for(int i = 0; i < count; ++i)
+            if(name == QLatin1String(list[i].name)) { index = i; break; }
+
+        if(index < 0)
+        {
+            if(gnuplot_cpl::GnuplotCompletionModel::expression().contains(name))
+                fail(QString("%1() can not be used in column expressions").arg(name));
+            else
+                fail(QString("unknown function \"%1\"").arg(name));
+            return;
+        }
+
+        int arguments = 0;
+        if(token != Token::RightParen)
+        {
+            for(;;)
+            {
+                ternary();
+                arguments++;
+                if(token != Token::Comma) break;
+                next();
+            }
+        }
+        expect(Token::RightParen, ")");
+
+        if(arguments != list[index].argumentCount)
+        {
+            fail(QString("%1() takes %2 argument(s)").arg(name).arg(list[index].argumentCount));
+            return;
+        }
+
+        push((arguments == 1) ? OpCode::Function1 : OpCode::Function2, index);
+    }
+
+    void primary()
+    {
+        switch(token)
+        {
+        case Token::Number:
+            push(OpCode::Constant, 0, number);
+            next();
+            return;
+        case Token::Dollar:
+        {
+            next();
+            if(token != Token::Number || number != std::floor(number)) { fail("column number expected after \"$\""); return; }
+            const int col = int(number);
+            if(col == 0) push(OpCode::Row);
+            else push(OpCode::Column, col - 1);
+            next();
+            return;
+        }
+        case Token::LeftParen:
+            next();
+            ternary();
+            expect(Token::RightParen, ")");
+            return;
+        case Token::Identifier:
+        {
+            const QString name = tokenText;
+            next();
+            if(token == Token::LeftParen) { call(name); return; }
+            if(name == "pi") { push(OpCode::Constant, 0, pi); return; }
+            if(name == "NaN") { push(OpCode::Constant, 0, qQNaN()); return; }
+            fail(QString("unknown variable \"%1\"").arg(name));
+            return;
+        }
+        case Token::End:
+            fail("unexpected end of expression");
+            return;
+        default:
+            fail(QString("unexpected \"%1\"").arg(tokenText));
+            return;
+        }
+    }
+
+    const QString& text;
+    QList<Instruction>& code;
+
+    qsizetype position = 0;
+    qsizetype tokenStart = 0;
+    Token token = Token::End;
+    QString tokenText;
+    double number = 0.0;
+
+    int depth = 0;
+    int maxDepth = 0;
+    QString message;
+};
+
+
+
+
+bool ColumnExpression::compile(const QString& text, QString *error)
+{
+    source = text.trimmed();
+    code.clear();
+    stackSize = 0;
+
+    Parser parser(source, code);
+    return parser.parse(error, stackSize);
+}
+
+QList<double> ColumnExpression::evaluate(const SheetData& sheet) const
+{
+    const qsizetype rows = sheet.rowCount();
+    QList<double> values(rows, qQNaN());
+    if(!isValid() || rows == 0) return values;
+
+    double *out = values.data();
+    const qsizetype blocks = (rows + blockSize - 1) / blockSize;
+
+    const auto run = [&](const qsizetype firstBlock, const qsizetype lastBlock) {
+        QList<QList<double> > stack(stackSize, QList<double>(blockSize));
+        for(qsizetype block = firstBlock; block < lastBlock; ++block)
+        {
+            const qsizetype first = block * blockSize;
+            evaluateBlock(sheet, first, qMin(blockSize, rows - first), out + first, stack);
+        }
+    };
+
+    const int threads = (rows < parallelThreshold) ? 1 : int(qMin<qsizetype>(QThread::idealThreadCount(), blocks));
+    if(threads <= 1)
+    {
+        run(0, blocks);
+        return values;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for(int i = 0; i < threads; ++i)
+        pool.start([&, i]() { run(blocks * i / threads, blocks * (i + 1) / threads); });
+    pool.waitForDone();
+
+    return values;
+}
+
+/* 命令ごとにブロック全体を計算する．ループは分岐のない単純な形にし，コンパイラがベクトル化できるようにする */
+void ColumnExpression::evaluateBlock(const SheetData& sheet, const qsizetype first, const qsizetype size,
+                                     double *out, QList<QList<double> >& stack) const
+{
+    int top = 0;
+
+    for(const Instruction& instruction : code)
+    {
+        switch(instruction.op)
+        {
+        case OpCode::Constant:
+        {
+            double *a = stack[top++].data();
+            const double value = instruction.value;
+            for(qsizetype i = 0; i < size; ++i) a[i] = value;
+            break;
+        }
+        case OpCode::Column:
+            loadColumn(sheet, instruction.index, first, size, stack[top++].data());
+            break;
+        case OpCode::Valid:
+        {
+            double *a = stack[top++].data();
+            loadColumn(sheet, instruction.index, first, size, a);
+            unary(a, size, [](double x) { return (qIsNaN(x)) ? 0.0 : 1.0; });
+            break;
+        }
+        case OpCode::Row:
+        {
+            double *a = stack[top++].data();
+            for(qsizetype i = 0; i < size; ++i) a[i] = double(first + i);
+            break;
+        }
+        case OpCode::Negate:
+            unary(stack[top - 1].data(), size, [](double x) { return -x; });
+            break;
+        case OpCode::Not:
+            unary(stack[top - 1].data(), size, [](double x) { return (x == 0.0) ? 1.0 : 0.0; });
+            break;
+        case OpCode::BitNot:
+            unary(stack[top - 1].data(), size, [](double x) { qint64 v; return (toInteger(x, v)) ? double(~v) : qQNaN(); });
+            break;
+        case OpCode::Function1:
+            unary(stack[top - 1].data(), size, functions()[instruction.index].function1);
+            break;
+        case OpCode::Select:
+        {
+            double *c = stack[top - 3].data();
+            const double *a = stack[top - 2].data();
+            const double *b = stack[top - 1].data();
+            for(qsizetype i = 0; i < size; ++i) c[i] = (c[i] != 0.0) ? a[i] : b[i];
+            top -= 2;
+            break;
+        }
+        default:
+        {
+            double *a = stack[top - 2].data();
+            const double *b = stack[top - 1].data();
+            top--;
+
+            switch(instruction.op)
+            {
+            case OpCode::Power: binary(a, b, size, [](double x, double y) { return std::pow(x, y); }); break;
+            case OpCode::Multiply: binary(a, b, size, [](double x, double y) { return x * y; }); break;
+            case OpCode::Divide: binary(a, b, size, [](double x, double y) { return (y != 0.0) ? x / y : qQNaN(); }); break;
+            case OpCode::Modulo: binary(a, b, size, [](double x, double y) { return std::fmod(std::trunc(x), std::trunc(y)); }); break;
+            case OpCode::Add: binary(a, b, size, [](double x, double y) { return x + y; }); break;
+            case OpCode::Subtract: binary(a, b, size, [](double x, double y) { return x - y; }); break;
+            case OpCode::Less: binary(a, b, size, [](double x, double y) { return (x < y) ? 1.0 : 0.0; }); break;
+            case OpCode::LessEqual: binary(a, b, size, [](double x, double y) { return (x <= y) ? 1.0 : 0.0; }); break;
+            case OpCode::Greater: binary(a, b, size, [](double x, double y) { return (x > y) ? 1.0 : 0.0; }); break;
+            case OpCode::GreaterEqual: binary(a, b, size, [](double x, double y) { return (x >= y) ? 1.0 : 0.0; }); break;
+            case OpCode::Equal: binary(a, b, size, [](double x, double y) { return (x == y) ? 1.0 : 0.0; }); break;
+            case OpCode::NotEqual: binary(a, b, size, [](double x, double y) { return (x != y) ? 1.0 : 0.0; }); break;
+            case OpCode::And: binary(a, b, size, [](double x, double y) { return (x != 0.0 && y != 0.0) ? 1.0 : 0.0; }); break;
+            case OpCode::Or: binary(a, b, size, [](double x, double y) { return (x != 0.0 || y != 0.0) ? 1.0 : 0.0; }); break;
+            case OpCode::BitAnd: bitwise(a, b, size, [](qint64 x, qint64 y) { return x & y; }); break;
+            case OpCode::BitXor: bitwise(a, b, size, [](qint64 x, qint64 y) { return x ^ y; }); break;
+            case OpCode::BitOr: bitwise(a, b, size, [](qint64 x, qint64 y) { return x | y; }); break;
+            case OpCode::Function2:
+            {
+                double (*function)(double, double) = functions()[instruction.index].function2;
+                for(qsizetype i = 0; i < size; ++i) a[i] = function(a[i], b[i]);
+                break;
+            }
+            default:
+                break;
+            }
+            break;
+        }
+        }
+    }
+
+    std::memcpy(out, stack[0].constData(), size * sizeof(double));
+}
@@ -0,0 +1,79 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef COLUMNEXPRESSION_H
+#define COLUMNEXPRESSION_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "sheetdata.h"
+
+
+
+/* シートの列から新しい列を計算する式．gnuplotのusingの式と同じく書く．
+ *   $1, column(1)    1列目の値(数値でなければNaN)．$0は0から数えた行の番号
+ *   valid(1)         1列目が数値なら1
+ *   pi, NaN, 数値, 演算子(** * / % + - < <= > >= == != & ^ | && || ?: ! ~)
+ *   関数はGnuplotCompletionModel::expression()のうち，実数の引数と値のもの
+ * 値はすべてdoubleで計算する(gnuplotと異なり，1/2は0.5)．0での割り算はgnuplotの未定義と同じくNaN．
+ *
+ * 式は一度スタックマシンの命令列に変換し，blockSize行ごとに，命令ごとにブロック全体をまとめて計算する．
+ * ブロックは複数のスレッドに分けて計算する．
+ */
+class ColumnExpression
+{
+public:
+    ColumnExpression() {}
+
+    /* textを命令列に変換する．失敗すればerrorに理由を入れてfalse */
+    bool compile(const QString& text, QString *error = nullptr);
+    bool isValid() const { return !code.isEmpty(); }
+    const QString& text() const { return source; }
+
+    /* すべての行の値．シートは読むだけなので，別スレッドから呼べる */
+    QList<double> evaluate(const SheetData& sheet) const;
+
+    /* 使える関数の名前 */
+    static QStringList functionNames();
+
+    static constexpr qsizetype blockSize = 1024;
+    static constexpr qsizetype parallelThreshold = 1 << 15;    //これより少ない行は1スレッドで計算する
+
+private:
+    enum class OpCode : quint8
+    {
+        Constant, Column, Valid, Row,
+        Negate, Not, BitNot,
+        Power, Multiply, Divide, Modulo, Add, Subtract,
+        Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual,
+        BitAnd, BitXor, BitOr, And, Or,
+        Select, Function1, Function2
+    };
+
+    struct Instruction
+    {
+        OpCode op;
+        int index = 0;          //列の番号か関数の番号
+        double value = 0.0;     //Constantの値
+    };
+
+    class Parser;
+    struct Function;
+    static const Function *functions(int *count = nullptr);
+
+    void evaluateBlock(const SheetData& sheet, const qsizetype first, const qsizetype size,
+                       double *out, QList<QList<double> >& stack) const;
+
+    QString source;
+    QList<Instruction> code;
+    int stackSize = 0;
+};
+
+#endif // COLUMNEXPRESSION_H
@@ -0,0 +1,231 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "columnhistogram.h"
+
+#include <QThread>
+#include <QThreadPool>
+#include <QtNumeric>
+#include <functional>
+#include <vector>
+#include <cmath>
+#include "columnstats.h"
+
+
+
+namespace
+{
+    constexpr double pi = 3.14159265358979323846;
+
+    int threadCount(const qsizetype rows)
+    {
+        return (rows < ColumnHistogram::parallelThreshold) ? 1 : qMax(1, QThread::idealThreadCount());
+    }
+
+    /* 行をthreads個に分けてfunction(first, last, chunk)を呼ぶ */
+    void runChunks(const qsizetype rows, const int threads, const std::function<void(qsizetype, qsizetype, int)>& function)
+    {
+        if(threads <= 1) { function(0, rows, 0); return; }
+
+        QThreadPool pool;
+        pool.setMaxThreadCount(threads);
+        for(int i = 0; i < threads; ++i)
+            pool.start([&, i]() { function(rows * i / threads, rows * (i + 1) / threads, i); });
+        pool.waitForDone();
+    }
+
+    /* [first, last)の数値のセルごとにfunction(x)を呼ぶ．Int64列はすべて数値 */
+    template <typename Function>
+    void forEachValue(const SheetColumn& column, const qsizetype first, const qsizetype last, Function function)
+    {
+        if(column.type() == SheetColumn::Type::Int64)
+        {
+            const qint64 *data = column.int64Data();
+            for(qsizetype i = first; i < last; ++i) function(double(data[i]));
+        }
+        else
+        {
+            const double *data = column.doubleData();
+            for(qsizetype i = first; i < last; ++i)
+                if(!qIsNaN(data[i])) function(data[i]);
+        }
+    }
+
+    /* スレッドごとの箱にadd(x, bins)で振り分け，足し合わせる */
+    template <typename T, typename Add>
+    std::vector<T> parallelBins(const SheetColumn& column, const int size, Add add)
+    {
+        const qsizetype rows = column.size();
+        const int threads = threadCount(rows);
+
+        std::vector<std::vector<T> > local(threads, std::vector<T>(size, T(0)));
+        runChunks(rows, threads, [&](const qsizetype first, const qsizetype last, const int chunk) {
+            T *bins = local[chunk].data();
+            forEachValue(column, first, last, [&](const double x) { add(x, bins); });
+        });
+
+        for(int i = 1; i < threads; ++i)
+            for(int j = 0; j < size; ++j) local[0][j] += local[i][j];
+
+        return local[0];
+    }
+
+    /* 数値のセルの数と範囲．分位点のいらない等幅，対数の箱ではColumnStatisticsの代わりに使う */
+    struct Range
+    {
+        qsizetype count = 0;
+        double min = qInf();
+        double max = -qInf();
+        double positiveMin = qInf();
+    };
+
+    Range valueRange(const SheetColumn& column)
+    {
+        const int threads = threadCount(column.size());
+        std::vector<Range> ranges(threads);
+
+        runChunks(column.size(), threads, [&](const qsizetype first, const qsizetype last, const int chunk) {
+            Range range;
+            forEachValue(column, first, last, [&range](const double x) {
+                range.count++;
+                range.min = qMin(range.min, x);
+                range.max = qMax(range.max, x);
+                if(x > 0.0) range.positiveMin = qMin(range.positiveMin, x);
+            });
+            ranges[chunk] = range;
+        });
+
+        Range total;
+        for(const Range& range : ranges)
+        {
+            total.count += range.count;
+            total.min = qMin(total.min, range.min);
+            total.max = qMax(total.max, range.max);
+            total.positiveMin = qMin(total.positiveMin, range.positiveMin);
+        }
+        return total;
+    }
+}
+
+
+
+
+ColumnHistogram::Table ColumnHistogram::histogram(const SheetColumn& column, const Binning binning, const int _bins)
+{
+    Table table;
+    table.skipped = column.size();
+
+    if(!column.isNumeric()) { table.error = "no numeric cells"; return table; }
+
+    const Range range = valueRange(column);
+    if(range.count == 0) { table.error = "no numeric cells"; return table; }
+
+    int bins = qBound(1, _bins, maxBins);
+    double lower = range.min, upper = range.max;
+
+    if(binning == Binning::Log)
+    {
+        if(qIsInf(range.positiveMin)) { table.error = "no positive values for log bins"; return table; }
+        lower = std::log(range.positiveMin);
+        upper = std::log(range.max);
+    }
+    else if(binning == Binning::FreedmanDiaconis)
+    {
+        const ColumnStats stats = ColumnStatistics().update(column);
+        const double width = 2.0 * (stats.upperQuartile - stats.lowerQuartile) / std::cbrt(double(range.count));
+        if(width > 0.0) bins = int(qBound(1.0, std::ceil((range.max - range.min) / width), double(maxBins)));
+    }
+
+    /* 値がすべて等しければ，その値を中心とする幅1の箱にする */
+    if(!(upper > lower)) bins = 1;
+    const double scale = (upper > lower) ? double(bins) / (upper - lower) : 0.0;
+
+    const bool logBins = (binning == Binning::Log);
+    const std::vector<qsizetype> counts = parallelBins<qsizetype>(column, bins + 1, [&](const double x, qsizetype *bin) {
+        if(logBins && !(x > 0.0)) { bin[bins]++; return; }      //最後の要素は数えなかった値
+        const int k = int(((logBins) ? std::log(x) - lower : x - lower) * scale);
+        bin[qMin(k, bins - 1)]++;
+    });
+
+    table.x.resize(bins);
+    table.y.resize(bins);
+    table.width.resize(bins);
+    for(int i = 0; i < bins; ++i)
+    {
+        double left = lower + double(i) / double(bins) * (upper - lower);
+        double right = lower + double(i + 1) / double(bins) * (upper - lower);
+        if(logBins) { left = std::exp(left); right = std::exp(right); }
+        if(!(right > left)) { left -= 0.5; right += 0.5; }
+
+        table.x[i] = 0.5 * (left + right);      //boxesはxを中心に幅の箱を描く
+        table.y[i] = double(counts[i]);
+        table.width[i] = right - left;
+    }
+    table.skipped = column.size() - range.count + counts[bins];
+
+    return table;
+}
+
+ColumnHistogram::Table ColumnHistogram::density(const SheetColumn& column)
+{
+    Table table;
+    table.skipped = column.size();
+
+    const ColumnStats stats = (column.isNumeric()) ? ColumnStatistics().update(column) : ColumnStats();
+    if(stats.count < 2) { table.error = "at least 2 numeric cells are needed"; return table; }
+
+    const double sigma = std::sqrt(stats.variance);
+    const double iqr = (stats.upperQuartile - stats.lowerQuartile) / 1.34;
+    const double spread = (iqr > 0.0) ? qMin(sigma, iqr) : sigma;
+    if(!(spread > 0.0)) { table.error = "all values are the same"; return table; }
+
+    const double n = double(stats.count);
+    const double h = 0.9 * spread * std::pow(n, -0.2);
+    const double lower = stats.min - 3.0 * h;
+    const double upper = stats.max + 3.0 * h;
+    const double delta = (upper - lower) / double(kdePoints - 1);
+
+    /* 両隣の格子点に距離で按分する */
+    const std::vector<double> weights = parallelBins<double>(column, kdePoints, [&](const double x, double *grid) {
+        const double position = (x - lower) / delta;
+        const int k = qBound(0, int(position), kdePoints - 2);
+        const double fraction = position - double(k);
+        grid[k] += 1.0 - fraction;
+        grid[k + 1] += fraction;
+    });
+
+    /* 4hより遠い格子点の重みは無視する */
+    const int reach = int(qMin(double(kdePoints - 1), std::ceil(4.0 * h / delta)));
+    std::vector<double> kernel(reach + 1);
+    for(int j = 0; j <= reach; ++j)
+    {
+        const double u = double(j) * delta / h;
+        kernel[j] = std::exp(-0.5 * u * u);
+    }
+
+    const double norm = 1.0 / (n * h * std::sqrt(2.0 * pi));
+
+    /* 畳み込みは格子の点の数だけなので1スレッドで行う */
+    table.x.resize(kdePoints);
+    table.y.resize(kdePoints);
+    for(int i = 0; i < kdePoints; ++i)
+    {
+        const int from = qMax(0, i - reach);
+        const int to = qMin(kdePoints - 1, i + reach);
+
+        double sum = 0.0;
+        for(int k = from; k <= to; ++k) sum += weights[k] * kernel[qAbs(k - i)];
+
+        table.x[i] = lower + double(i) * delta;
+        table.y[i] = sum * norm;
+    }
+    table.skipped = stats.nanCount;
+
+    return table;
+}
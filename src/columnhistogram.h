@@ -0,0 +1,52 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef COLUMNHISTOGRAM_H
+#define COLUMNHISTOGRAM_H
+
+#include <QList>
+#include <QString>
+#include "sheetdata.h"
+
+
+
+/* 1列の数値のセルのヒストグラムと密度(カーネル密度推定)をシート側で求める．gnuplotには結果の表だけを送る．
+ *   Fixed             最小から最大までをbins個の等しい幅に分ける
+ *   FreedmanDiaconis  幅を 2 IQR n^(-1/3) とする(IQRが0ならFixed)
+ *   Log               正の値の最小から最大までを対数で等しい幅に分ける．0以下の値は数えない
+ * 値を箱に振り分けるのは行を分けてスレッドごとに数え，最後に足し合わせる．
+ *
+ * 密度はガウスカーネルで，幅はSilvermanの目安 0.9 min(σ, IQR/1.34) n^(-1/5)．
+ * 値を等間隔の格子(kdePoints点)に線形に振り分けてからカーネルを畳み込むので，行が多くても格子の点の数で済む．
+ */
+class ColumnHistogram
+{
+public:
+    enum class Binning { Fixed, FreedmanDiaconis, Log };
+
+    /* ヒストグラムなら(箱の中心，度数，箱の幅)，密度なら(x，密度)の列．数えられなければ行がなく，errorに理由を入れる */
+    struct Table
+    {
+        QList<double> x;
+        QList<double> y;
+        QList<double> width;
+        qsizetype skipped = 0;      //数えなかったセル(数値でない，Logで0以下)の数
+        QString error;
+    };
+
+    static Table histogram(const SheetColumn& column, const Binning binning, const int bins = defaultBins);
+    static Table density(const SheetColumn& column);
+
+    static constexpr int defaultBins = 100;
+    static constexpr int maxBins = 10000;                      //FreedmanDiaconisで外れ値があっても箱が増えすぎないように
+    static constexpr int kdePoints = 2048;
+    static constexpr qsizetype parallelThreshold = 1 << 16;    //これより少ない行は1スレッドで数える
+};
+
+#endif // COLUMNHISTOGRAM_H
@@ -0,0 +1,291 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "columnstats.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COLUMNSTATS_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define COLUMNSTATS_NEON
+#endif
+
+
+
+namespace
+{
+    /* Int64列のブロックをdoubleに変換する */
+    void toDouble(const qint64 *data, const qsizetype size, double *out)
+    {
+        for(qsizetype i = 0; i < size; ++i) out[i] = double(data[i]);
+    }
+
+    /* values[first, last)にfirst番目からlast - 1番目に小さい値が入っていて，last番目に小さい値がafterのとき，
+     * h番目(小数部は線形補間)に小さい値 */
+    double selectValue(std::vector<double>& values, const qsizetype first, const qsizetype last, const double h, const double after)
+    {
+        const qsizetype k = qsizetype(h);
+        std::nth_element(values.begin() + first, values.begin() + k, values.begin() + last);
+
+        const double lower = values[k];
+        if(h == double(k)) return lower;
+
+        const double upper = (k + 1 < last) ? *std::min_element(values.begin() + k + 1, values.begin() + last) : after;
+        return lower + (h - double(k)) * (upper - lower);
+    }
+}
+
+
+
+
+void ColumnStatistics::invalidate(const qsizetype firstRow, const qsizetype lastRow)
+{
+    const qsizetype first = qMax<qsizetype>(0, firstRow / blockSize);
+    const qsizetype last = qMin(blocks.size() - 1, lastRow / blockSize);
+
+    for(qsizetype i = first; i <= last; ++i) blocks[i].valid = false;
+}
+
+ColumnStats ColumnStatistics::update(const SheetColumn& column)
+{
+    ColumnStats stats;
+    stats.nanCount = column.size();
+
+    if(column.type() != type || column.size() != rows)
+    {
+        type = column.type();
+        rows = column.size();
+        blocks.clear();
+    }
+
+    if(!column.isNumeric() || rows == 0) return stats;
+
+    blocks.resize((rows + blockSize - 1) / blockSize);
+
+    std::vector<double> buffer;
+    if(type == SheetColumn::Type::Int64) buffer.resize(blockSize);
+
+    Block total;
+    for(qsizetype i = 0; i < blocks.size(); ++i)
+    {
+        Block& block = blocks[i];
+
+        if(!block.valid)
+        {
+            const qsizetype first = i * blockSize;
+            const qsizetype size = qMin(blockSize, rows - first);
+
+            if(type == SheetColumn::Type::Int64)
+            {
+                toDouble(column.int64Data() + first, size, buffer.data());
+                block = accumulate(buffer.data(), size);
+            }
+            else
+                block = accumulate(column.doubleData() + first, size);
+        }
+
+        total = merge(total, block);
+    }
+
+    stats.count = total.count;
+    stats.nanCount = rows - total.count;
+    if(total.count == 0) return stats;
+
+    stats.min = total.min;
+    stats.max = total.max;
+    stats.mean = total.mean;
+    if(total.count > 1) stats.variance = total.m2 / double(total.count - 1);
+
+    quantiles(column, stats);
+
+    return stats;
+}
+
+/* 2回に分けて，平均を求めてから偏差平方和を求める．ブロックはキャッシュに収まるため2回目は速い．
+ * NaNは個数，和，偏差平方和に含めないようにマスクする */
+ColumnStatistics::Block ColumnStatistics::accumulate(const double *data, const qsizetype size)
+{
+    Block block;
+    block.valid = true;
+
+    double sum = 0.0;
+    qsizetype i = 0;
+
+#if defined(COLUMNSTATS_SSE2)
+    {
+        static constexpr int orderedCount[4] = { 0, 1, 1, 2 };
+
+        __m128d vmin = _mm_set1_pd(qInf());
+        __m128d vmax = _mm_set1_pd(-qInf());
+        __m128d vsum = _mm_setzero_pd();
+
+        for(; i + 2 <= size; i += 2)
+        {
+            const __m128d x = _mm_loadu_pd(data + i);
+            const __m128d ordered = _mm_cmpord_pd(x, x);
+            vmin = _mm_min_pd(x, vmin);         //どちらかがNaNなら2番目を返す
+            vmax = _mm_max_pd(x, vmax);
+            vsum = _mm_add_pd(vsum, _mm_and_pd(x, ordered));
+            block.count += orderedCount[_mm_movemask_pd(ordered)];
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, vmin); block.min = qMin(lanes[0], lanes[1]);
+        _mm_storeu_pd(lanes, vmax); block.max = qMax(lanes[0], lanes[1]);
+        _mm_storeu_pd(lanes, vsum); sum = lanes[0] + lanes[1];
+    }
+#elif defined(COLUMNSTATS_NEON)
+    {
+        float64x2_t vmin = vdupq_n_f64(qInf());
+        float64x2_t vmax = vdupq_n_f64(-qInf());
+        float64x2_t vsum = vdupq_n_f64(0.0);
+        int64x2_t vcount = vdupq_n_s64(0);
+
+        for(; i + 2 <= size; i += 2)
+        {
+            const float64x2_t x = vld1q_f64(data + i);
+            const uint64x2_t ordered = vceqq_f64(x, x);
+            vmin = vminnmq_f64(vmin, x);        //NaNでない方を返す
+            vmax = vmaxnmq_f64(vmax, x);
+            vsum = vaddq_f64(vsum, vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(x), ordered)));
+            vcount = vsubq_s64(vcount, vreinterpretq_s64_u64(ordered));     //真は-1
+        }
+
+        block.min = vminvq_f64(vmin);
+        block.max = vmaxvq_f64(vmax);
+        sum = vaddvq_f64(vsum);
+        block.count = qsizetype(vaddvq_s64(vcount));
+    }
+#endif
+
+    for(; i < size; ++i)
+    {
+        const double x = data[i];
+        if(qIsNaN(x)) continue;
+        block.min = qMin(block.min, x);
+        block.max = qMax(block.max, x);
+        sum += x;
+        block.count++;
+    }
+
+    if(block.count == 0) return block;
+
+    block.mean = sum / double(block.count);
+
+    double m2 = 0.0;
+    i = 0;
+
+#if defined(COLUMNSTATS_SSE2)
+    {
+        const __m128d vmean = _mm_set1_pd(block.mean);
+        __m128d vm2 = _mm_setzero_pd();
+
+        for(; i + 2 <= size; i += 2)
+        {
+            const __m128d x = _mm_loadu_pd(data + i);
+            const __m128d d = _mm_and_pd(_mm_sub_pd(x, vmean), _mm_cmpord_pd(x, x));
+            vm2 = _mm_add_pd(vm2, _mm_mul_pd(d, d));
+        }
+
+        double lanes[2];
+        _mm_storeu_pd(lanes, vm2);
+        m2 = lanes[0] + lanes[1];
+    }
+#elif defined(COLUMNSTATS_NEON)
+    {
+        const float64x2_t vmean = vdupq_n_f64(block.mean);
+        float64x2_t vm2 = vdupq_n_f64(0.0);
+
+        for(; i + 2 <= size; i += 2)
+        {
+            const float64x2_t x = vld1q_f64(data + i);
+            const uint64x2_t ordered = vceqq_f64(x, x);
+            const float64x2_t d = vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(vsubq_f64(x, vmean)), ordered));
+            vm2 = vfmaq_f64(vm2, d, d);
+        }
+
+        m2 = vaddvq_f64(vm2);
+    }
+#endif
+
+    for(; i < size; ++i)
+    {
+        const double x = data[i];
+        if(qIsNaN(x)) continue;
+        m2 += (x - block.mean) * (x - block.mean);
+    }
+
+    block.m2 = m2;
+
+    return block;
+}
+
+/* 平均と偏差平方和を桁落ちしないように合わせる(Chanらの方法) */
+ColumnStatistics::Block ColumnStatistics::merge(const Block& a, const Block& b)
+{
+    if(a.count == 0) return b;
+    if(b.count == 0) return a;
+
+    Block block;
+    block.valid = true;
+    block.count = a.count + b.count;
+
+    const double delta = b.mean - a.mean;
+    const double ratio = double(b.count) / double(block.count);
+    block.mean = a.mean + delta * ratio;
+    block.m2 = a.m2 + b.m2 + delta * delta * double(a.count) * ratio;
+    block.min = qMin(a.min, b.min);
+    block.max = qMax(a.max, b.max);
+
+    return block;
+}
+
+/* 中央値で分けてから，下側と上側の四分位点をそれぞれの半分から選ぶ．補間はRのtype 7と同じ */
+void ColumnStatistics::quantiles(const SheetColumn& column, ColumnStats& stats)
+{
+    std::vector<double> values;
+    values.reserve(stats.count);
+
+    if(column.type() == SheetColumn::Type::Int64)
+    {
+        const qint64 *data = column.int64Data();
+        for(qsizetype i = 0; i < column.size(); ++i) values.push_back(double(data[i]));
+    }
+    else
+    {
+        const double *data = column.doubleData();
+        for(qsizetype i = 0; i < column.size(); ++i)
+            if(!qIsNaN(data[i])) values.push_back(data[i]);
+    }
+
+    const qsizetype n = qsizetype(values.size());
+    if(n == 0) return;
+
+    const double hMedian = double(n - 1) * 0.5;
+    const qsizetype kMedian = qsizetype(hMedian);
+    std::nth_element(values.begin(), values.begin() + kMedian, values.end());
+    const double medianLower = values[kMedian];
+    const double medianUpper = (kMedian + 1 < n) ? *std::min_element(values.begin() + kMedian + 1, values.end()) : medianLower;
+    stats.median = medianLower + (hMedian - double(kMedian)) * (medianUpper - medianLower);
+
+    /* 中央値と同じ位置に落ちる場合(値が少ないとき)は中央値の両側の値で補間する */
+    const double hLower = double(n - 1) * 0.25;
+    stats.lowerQuartile = (qsizetype(hLower) < kMedian)
+            ? selectValue(values, 0, kMedian, hLower, medianLower)
+            : medianLower + (hLower - double(kMedian)) * (medianUpper - medianLower);
+
+    const double hUpper = double(n - 1) * 0.75;
+    stats.upperQuartile = (qsizetype(hUpper) > kMedian)
+            ? selectValue(values, kMedian + 1, n, hUpper, qQNaN())
+            : medianLower + (hUpper - double(kMedian)) * (medianUpper - medianLower);
+}
@@ -0,0 +1,78 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef COLUMNSTATS_H
+#define COLUMNSTATS_H
+
+#include <QList>
+#include <QtNumeric>
+#include "sheetdata.h"
+
+
+
+/* 列の統計量．数値のセルがなければ値はNaN */
+struct ColumnStats
+{
+    qsizetype count = 0;            //数値のセルの数
+    qsizetype nanCount = 0;         //空のセル，数値でないセル，NaNの数
+    double min = qQNaN();
+    double max = qQNaN();
+    double mean = qQNaN();
+    double variance = qQNaN();      //不偏分散
+    double lowerQuartile = qQNaN();
+    double median = qQNaN();
+    double upperQuartile = qQNaN();
+};
+
+
+
+
+/* 1列の統計量を求める．
+ * 列をblockSize行ごとのブロックに分け，ブロックごとの集計(個数，平均，偏差平方和，最小，最大)を保持する．
+ * セルが変わったときはinvalidate()したブロックだけ集計し直し，ブロックの集計を合わせる．
+ * 分位点はその都度すべての値から選ぶ．
+ *
+ * 値のコピーなので，別スレッドでupdate()したものをGUIのスレッドに戻して次の更新に使う．
+ */
+class ColumnStatistics
+{
+public:
+    static constexpr qsizetype blockSize = 1 << 14;
+
+    /* [firstRow, lastRow]のセルが変わった */
+    void invalidate(const qsizetype firstRow, const qsizetype lastRow);
+    void invalidateAll() { blocks.clear(); }
+
+    /* 変わったブロックを集計し直して統計量を求める．列の型や行数が前回と異なればすべて集計し直す */
+    ColumnStats update(const SheetColumn& column);
+
+    /* 値の集まりの個数，平均，偏差平方和，最小，最大 */
+    struct Block
+    {
+        qsizetype count = 0;
+        double mean = 0.0;
+        double m2 = 0.0;            //偏差平方和
+        double min = qInf();
+        double max = -qInf();
+        bool valid = false;
+    };
+
+    /* 2つの集まりを合わせた集計(Chanの方法) */
+    static Block merge(const Block& a, const Block& b);
+
+private:
+    static Block accumulate(const double *data, const qsizetype size);
+    static void quantiles(const SheetColumn& column, ColumnStats& stats);
+
+    SheetColumn::Type type = SheetColumn::Type::String;
+    qsizetype rows = -1;
+    QList<Block> blocks;
+};
+
+#endif // COLUMNSTATS_H
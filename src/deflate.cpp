@@ -0,0 +1,1067 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "deflate.h"
+
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+
+
+
+namespace
+{
+    constexpr quint16 lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                         35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    constexpr quint8 lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    constexpr quint16 distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                           257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                           8193, 12289, 16385, 24577 };
+    constexpr quint8 distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                           7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    constexpr quint8 codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    constexpr qsizetype inputBufferSize = 1 << 16;
+    constexpr qsizetype outputBufferSize = 1 << 16;
+
+    constexpr int minMatch = 3;
+    constexpr int maxMatch = 258;
+    constexpr int maxChain = 48;            //一致を探すチェーンの長さの上限
+    constexpr int niceMatch = 128;          //これ以上一致すれば探索をやめる
+    constexpr int maxInsertLength = 32;     //これより長い一致ではハッシュに登録しない
+
+    /* 長さ(3..258) -> 長さ符号(0..28)，距離(1..32768) -> 距離符号(0..29) */
+    struct CodeTables
+    {
+        quint8 lengthCode[maxMatch + 1];
+        quint8 distanceCode[32769];
+
+        CodeTables()
+        {
+            for(int code = 0; code < 29; ++code)
+            {
+                const int end = (code == 28) ? 259 : lengthBase[code] + (1 << lengthExtra[code]);
+                for(int length = lengthBase[code]; length < end && length <= maxMatch; ++length)
+                    lengthCode[length] = quint8(code);
+            }
+            lengthCode[258] = 28;
+
+            for(int code = 0; code < 30; ++code)
+            {
+                const int end = distanceBase[code] + (1 << distanceExtra[code]);
+                for(int dist = distanceBase[code]; dist < end && dist <= 32768; ++dist)
+                    distanceCode[dist] = quint8(code);
+            }
+        }
+    };
+
+    const CodeTables& codeTables()
+    {
+        static const CodeTables tables;
+        return tables;
+    }
+
+    /* 4バイトずつ処理するCRC-32の表 */
+    struct CrcTables
+    {
+        quint32 table[4][256];
+
+        CrcTables()
+        {
+            for(quint32 i = 0; i < 256; ++i)
+            {
+                quint32 c = i;
+                for(int k = 0; k < 8; ++k) c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+                table[0][i] = c;
+            }
+            for(quint32 i = 0; i < 256; ++i)
+                for(int t = 1; t < 4; ++t)
+                    table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+        }
+    };
+}
+
+
+
+
+
+quint32 Crc32::update(const quint32 crc, const char *data, const qsizetype size)
+{
+    static const CrcTables tables;
+    const auto& t = tables.table;
+
+    quint32 c = ~crc;
+    const uchar *p = reinterpret_cast<const uchar*>(data);
+    const uchar *end = p + size;
+
+    while(end - p >= 4)
+    {
+        c ^= quint32(p[0]) | (quint32(p[1]) << 8) | (quint32(p[2]) << 16) | (quint32(p[3]) << 24);
+        c = t[3][c & 0xFF] ^ t[2][(c >> 8) & 0xFF] ^ t[1][(c >> 16) & 0xFF] ^ t[0][c >> 24];
+        p += 4;
+    }
+
+    while(p < end)
+        c = t[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+
+    return ~c;
+}
+
+
+
+Inflater::Inflater(QIODevice *source, const qint64 sourceSize)
+    : source(source)
+    , sourceRemaining(sourceSize)
+    , input(inputBufferSize, Qt::Uninitialized)
+    , window(windowSize, Qt::Uninitialized)
+{
+}
+
+/* 符号長の列から正準ハフマン符号の表を作る．
+ * deflateの符号は下位ビットから読むため，ビット反転した符号で表を引けるようにする．
+ */
+bool Inflater::buildTable(HuffmanTable& table, const quint8 *lengths, const int count)
+{
+    int lengthCount[16] = {};
+    for(int i = 0; i < count; ++i) lengthCount[lengths[i]]++;
+    lengthCount[0] = 0;
+
+    table.maxBits = 0;
+    for(int bits = 15; bits > 0; --bits)
+        if(lengthCount[bits] > 0) { table.maxBits = bits; break; }
+
+    /* 符号が一つもない(距離符号を使わないブロック)場合は，引いても無効になる表にする */
+    if(table.maxBits == 0)
+    {
+        table.maxBits = 1;
+        table.entries.fill(0, 2);
+        return true;
+    }
+
+    /* 符号の割り当てが多すぎないか */
+    int left = 1;
+    for(int bits = 1; bits <= 15; ++bits)
+    {
+        left <<= 1;
+        left -= lengthCount[bits];
+        if(left < 0) return false;
+    }
+
+    int nextCode[16] = {};
+    int code = 0;
+    for(int bits = 1; bits <= 15; ++bits)
+    {
+        code = (code + lengthCount[bits - 1]) << 1;
+        nextCode[bits] = code;
+    }
+
+    const int tableSize = 1 << table.maxBits;
+    table.entries.fill(0, tableSize);
+
+    for(int symbol = 0; symbol < count; ++symbol)
+    {
+        const int length = lengths[symbol];
+        if(length == 0) continue;
+
+        int reversed = 0;
+        for(int i = 0, c = nextCode[length]++; i < length; ++i, c >>= 1)
+            reversed = (reversed << 1) | (c & 1);
+
+        const quint16 entry = quint16(length | (symbol << 4));
+        for(int index = reversed; index < tableSize; index += (1 << length))
+            table.entries[index] = entry;
+    }
+
+    return true;
+}
+
+const Inflater::HuffmanTable& Inflater::fixedLiteralTable()
+{
+    static const HuffmanTable table = []()
+    {
+        quint8 lengths[288];
+        for(int i = 0; i < 144; ++i) lengths[i] = 8;
+        for(int i = 144; i < 256; ++i) lengths[i] = 9;
+        for(int i = 256; i < 280; ++i) lengths[i] = 7;
+        for(int i = 280; i < 288; ++i) lengths[i] = 8;
+
+        HuffmanTable t;
+        buildTable(t, lengths, 288);
+        return t;
+    }();
+
+    return table;
+}
+
+const Inflater::HuffmanTable& Inflater::fixedDistanceTable()
+{
+    static const HuffmanTable table = []()
+    {
+        quint8 lengths[30];
+        for(int i = 0; i < 30; ++i) lengths[i] = 5;
+
+        HuffmanTable t;
+        buildTable(t, lengths, 30);
+        return t;
+    }();
+
+    return table;
+}
+
+/* ビットバッファを可能な限り(56ビット以上になるまで)埋める */
+void Inflater::refill()
+{
+    while(bitCount <= 56)
+    {
+        if(inputPos == inputEnd)
+        {
+            if(inputEof) return;
+
+            qint64 request = input.size();
+            if(sourceRemaining >= 0 && sourceRemaining < request) request = sourceRemaining;
+
+            const qint64 size = (request > 0) ? source->read(input.data(), request) : 0;
+            if(size <= 0) { inputEof = true; return; }
+
+            if(sourceRemaining >= 0) sourceRemaining -= size;
+            inputPos = 0;
+            inputEnd = size;
+        }
+
+        bitBuffer |= quint64(uchar(input.at(inputPos++))) << bitCount;
+        bitCount += 8;
+    }
+}
+
+bool Inflater::getBits(const int count, quint32& value)
+{
+    if(bitCount < count)
+    {
+        refill();
+        if(bitCount < count) return false;
+    }
+
+    value = quint32(bitBuffer & ((quint64(1) << count) - 1));
+    bitBuffer >>= count;
+    bitCount -= count;
+    return true;
+}
+
+bool Inflater::decode(const HuffmanTable& table, int& symbol)
+{
+    if(bitCount < table.maxBits) refill();
+
+    //ストリームの終端付近では足りないビットを0とみなして引き，符号長で確かめる
+    const quint16 entry = table.entries.at(int(bitBuffer & ((quint64(1) << table.maxBits) - 1)));
+    const int length = entry & 0xF;
+    if(length == 0 || length > bitCount) return false;
+
+    symbol = entry >> 4;
+    bitBuffer >>= length;
+    bitCount -= length;
+    return true;
+}
+
+void Inflater::fail()
+{
+    state = State::Error;
+}
+
+bool Inflater::readBlockHeader()
+{
+    quint32 header = 0;
+    if(!getBits(3, header)) return false;
+
+    lastBlock = (header & 1);
+
+    switch(header >> 1)
+    {
+    case 0:
+    {
+        /* 無圧縮ブロック．バイト境界にそろえてLEN, NLENを読む */
+        bitBuffer >>= (bitCount & 7);
+        bitCount -= (bitCount & 7);
+
+        quint32 length = 0, nlength = 0;
+        if(!getBits(16, length) || !getBits(16, nlength)) return false;
+        if((length ^ 0xFFFF) != nlength) return false;
+
+        storedRemaining = length;
+        state = State::Stored;
+        return true;
+    }
+    case 1:
+        literal = &fixedLiteralTable();
+        distance = &fixedDistanceTable();
+        state = State::Huffman;
+        return true;
+    case 2:
+        if(!readDynamicTables()) return false;
+        literal = &literalTable;
+        distance = &distanceTable;
+        state = State::Huffman;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool Inflater::readDynamicTables()
+{
+    quint32 hlit = 0, hdist = 0, hclen = 0;
+    if(!getBits(5, hlit) || !getBits(5, hdist) || !getBits(4, hclen)) return false;
+    hlit += 257;
+    hdist += 1;
+    hclen += 4;
+    if(hlit > 286 || hdist > 30) return false;
+
+    quint8 codeLengths[19] = {};
+    for(quint32 i = 0; i < hclen; ++i)
+    {
+        quint32 length = 0;
+        if(!getBits(3, length)) return false;
+        codeLengths[codeLengthOrder[i]] = quint8(length);
+    }
+
+    HuffmanTable codeLengthTable;
+    if(!buildTable(codeLengthTable, codeLengths, 19)) return false;
+
+    quint8 lengths[286 + 30] = {};
+    const quint32 total = hlit + hdist;
+
+    for(quint32 i = 0; i < total;)
+    {
+        int symbol = 0;
+        if(!decode(codeLengthTable, symbol)) return false;
+
+        if(symbol < 16)
+        {
+            lengths[i++] = quint8(symbol);
+            continue;
+        }
+
+        quint8 repeated = 0;
+        quint32 repeat = 0;
+        switch(symbol)
+        {
+        case 16:
+            if(i == 0 || !getBits(2, repeat)) return false;
+            repeated = lengths[i - 1];
+            repeat += 3;
+            break;
+        case 17:
+            if(!getBits(3, repeat)) return false;
+            repeat += 3;
+            break;
+        default:
+            if(!getBits(7, repeat)) return false;
+            repeat += 11;
+            break;
+        }
+
+        if(i + repeat > total) return false;
+        while(repeat-- > 0) lengths[i++] = repeated;
+    }
+
+    if(lengths[256] == 0) return false; //ブロックの終端符号がない
+
+    return buildTable(literalTable, lengths, int(hlit)) &&
+           buildTable(distanceTable, lengths + hlit, int(hdist));
+}
+
+qint64 Inflater::readStored(char *data, const qint64 maxSize)
+{
+    qint64 produced = 0;
+
+    while(produced < maxSize && storedRemaining > 0)
+    {
+        char c;
+
+        /* ビットバッファに残っているバイトを先に使う */
+        if(bitCount >= 8)
+        {
+            c = char(bitBuffer & 0xFF);
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+        else
+        {
+            refill();
+            if(bitCount < 8) { fail(); return produced; }
+            continue;
+        }
+
+        data[produced++] = c;
+        window[windowPos] = c;
+        windowPos = (windowPos + 1) & (windowSize - 1);
+        storedRemaining--;
+    }
+
+    if(storedRemaining == 0) state = State::BlockHeader;
+
+    totalOut += produced;
+    return produced;
+}
+
+qint64 Inflater::readHuffman(char *data, const qint64 maxSize)
+{
+    qint64 produced = 0;
+    char *w = window.data();
+
+    while(produced < maxSize)
+    {
+        /* 前回出力しきれなかった一致の続き */
+        if(copyLength > 0)
+        {
+            quint32 from = (windowPos - quint32(copyDistance)) & (windowSize - 1);
+            while(copyLength > 0 && produced < maxSize)
+            {
+                const char c = w[from];
+                data[produced++] = c;
+                w[windowPos] = c;
+                windowPos = (windowPos + 1) & (windowSize - 1);
+                from = (from + 1) & (windowSize - 1);
+                copyLength--;
+            }
+            continue;
+        }
+
+        int symbol = 0;
+        if(!decode(*literal, symbol)) { fail(); break; }
+
+        if(symbol < 256)
+        {
+            const char c = char(symbol);
+            data[produced++] = c;
+            w[windowPos] = c;
+            windowPos = (windowPos + 1) & (windowSize - 1);
+            continue;
+        }
+
+        if(symbol == 256)
+        {
+            state = State::BlockHeader;
+            break;
+        }
+
+        symbol -= 257;
+        if(symbol >= 29) { fail(); break; }
+
+        quint32 extra = 0;
+        if(!getBits(lengthExtra[symbol], extra)) { fail(); break; }
+        const int length = lengthBase[symbol] + int(extra);
+
+        int distanceSymbol = 0;
+        if(!decode(*distance, distanceSymbol) || distanceSymbol >= 30) { fail(); break; }
+        if(!getBits(distanceExtra[distanceSymbol], extra)) { fail(); break; }
+        const int dist = distanceBase[distanceSymbol] + int(extra);
+
+        if(dist > totalOut + produced) { fail(); break; } //出力より前を参照している
+
+        copyLength = length;
+        copyDistance = dist;
+    }
+
+    totalOut += produced;
+    return produced;
+}
+
+bool Inflater::readBytes(char *data, const qsizetype size)
+{
+    bitBuffer >>= (bitCount & 7);
+    bitCount -= (bitCount & 7);
+
+    for(qsizetype i = 0; i < size; ++i)
+    {
+        quint32 byte = 0;
+        if(!getBits(8, byte)) return false;
+        data[i] = char(byte);
+    }
+
+    return true;
+}
+
+bool Inflater::hasMoreInput()
+{
+    bitBuffer >>= (bitCount & 7);
+    bitCount -= (bitCount & 7);
+
+    refill();
+    return bitCount >= 8;
+}
+
+void Inflater::restart()
+{
+    state = State::BlockHeader;
+    lastBlock = false;
+    storedRemaining = 0;
+    windowPos = 0;
+    totalOut = 0;
+    copyLength = 0;
+    copyDistance = 0;
+}
+
+qint64 Inflater::read(char *data, const qint64 maxSize)
+{
+    qint64 produced = 0;
+
+    while(produced < maxSize)
+    {
+        switch(state)
+        {
+        case State::BlockHeader:
+            if(lastBlock) { state = State::Finished; break; }
+            if(!readBlockHeader()) fail();
+            break;
+        case State::Stored:
+            produced += readStored(data + produced, maxSize - produced);
+            break;
+        case State::Huffman:
+            produced += readHuffman(data + produced, maxSize - produced);
+            break;
+        case State::Finished:
+            return produced;
+        case State::Error:
+            return (produced > 0) ? produced : -1;
+        }
+    }
+
+    return produced;
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+Deflater::Deflater(QIODevice *sink)
+    : sink(sink)
+    , head(1 << hashBits, -1)
+    , prev(windowSize, -1)
+{
+    window.reserve(windowSize * 3);
+    output.reserve(outputBufferSize + 1024);
+    symbols.reserve(maxSymbols);
+}
+
+bool Deflater::write(const char *data, const qsizetype size)
+{
+    const char *p = data;
+    const char *end = data + size;
+
+    while(p < end)
+    {
+        /* 先読みの分を残して圧縮する */
+        const qsizetype chunk = qMin<qsizetype>(end - p, windowSize);
+        window.append(p, chunk);
+        p += chunk;
+
+        compress(window.size() - maxMatch - minMatch);
+        slideWindow();
+    }
+
+    return ok;
+}
+
+bool Deflater::finish()
+{
+    compress(window.size());
+    flushBlock(true);
+
+    /* 最後のバイトの残りのビット */
+    if(bitCount > 0) output.append(char(bitBuffer & 0xFF));
+    bitBuffer = 0;
+    bitCount = 0;
+
+    flushOutput(true);
+    return ok;
+}
+
+inline void Deflater::insertHash(const qsizetype pos)
+{
+    const uchar *p = reinterpret_cast<const uchar*>(window.constData()) + pos;
+    const quint32 hash = ((quint32(p[0]) << 10) ^ (quint32(p[1]) << 5) ^ quint32(p[2])) & ((1 << hashBits) - 1);
+
+    prev[pos & (windowSize - 1)] = head[hash];
+    head[hash] = qint32(pos);
+}
+
+void Deflater::compress(const qsizetype limit)
+{
+    const char *data = window.constData();
+    const qsizetype size = window.size();
+
+    while(position < limit)
+    {
+        int bestLength = 0;
+        int bestDistance = 0;
+
+        if(position + minMatch <= size)
+        {
+            const uchar *p = reinterpret_cast<const uchar*>(data) + position;
+            const quint32 hash = ((quint32(p[0]) << 10) ^ (quint32(p[1]) << 5) ^ quint32(p[2])) & ((1 << hashBits) - 1);
+            const int available = int(qMin<qsizetype>(maxMatch, size - position));
+
+            qint32 candidate = head[hash];
+            for(int chain = maxChain; chain > 0 && candidate >= 0 && position - candidate <= windowSize; --chain)
+            {
+                const char *a = data + candidate;
+                const char *b = data + position;
+
+                /* 今の最長より長くなりうるものだけを比べる */
+                if(a[bestLength] == b[bestLength] && a[0] == b[0])
+                {
+                    int length = 0;
+                    while(length < available && a[length] == b[length]) ++length;
+
+                    if(length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = int(position - candidate);
+                        if(length >= niceMatch || length == available) break;
+                    }
+                }
+
+                const qint32 next = prev[candidate & (windowSize - 1)];
+                if(next >= candidate) break;
+                candidate = next;
+            }
+
+            insertHash(position);
+        }
+
+        if(bestLength >= minMatch)
+        {
+            symbols.append({ quint16(bestLength), quint16(bestDistance) });
+
+            if(bestLength <= maxInsertLength)
+            {
+                for(int i = 1; i < bestLength; ++i)
+                    if(position + i + minMatch <= size) insertHash(position + i);
+            }
+            position += bestLength;
+        }
+        else
+        {
+            symbols.append({ quint16(uchar(data[position])), 0 });
+            position++;
+        }
+
+        if(symbols.size() >= maxSymbols) flushBlock(false);
+    }
+}
+
+/* 位置がwindowSizeの倍数だけずれるように捨てるので，prevの添字(pos % windowSize)は変わらない */
+void Deflater::slideWindow()
+{
+    if(position < windowSize * 2) return;
+
+    const qsizetype shift = ((position - windowSize) / windowSize) * windowSize;
+
+    window.remove(0, shift);
+    position -= shift;
+
+    for(qint32& value : head) value = (value >= shift) ? qint32(value - shift) : -1;
+    for(qint32& value : prev) value = (value >= shift) ? qint32(value - shift) : -1;
+}
+
+/* 頻度から符号長を求める．maxBitsを超える場合は頻度を均して作り直す */
+void Deflater::buildLengths(const quint32 *frequencies, const int count, const int maxBits, quint8 *lengths)
+{
+    QList<quint32> freq(frequencies, frequencies + count);
+
+    /* 符号が1つ以下だと不完全な符号になるため，少なくとも2つ使う */
+    int used = 0;
+    for(int i = 0; i < count; ++i) if(freq.at(i) > 0) used++;
+    for(int i = 0; i < count && used < 2; ++i) if(freq.at(i) == 0) { freq[i] = 1; used++; }
+
+    for(;;)
+    {
+        struct Node { quint64 weight; int left; int right; };
+        QList<Node> nodes;
+        QList<int> heap;    //nodesの添字の最小ヒープ
+        nodes.reserve(count * 2);
+
+        for(int i = 0; i < count; ++i)
+        {
+            if(freq.at(i) == 0) continue;
+            nodes.append({ freq.at(i), -1, i });
+            heap.append(int(nodes.size()) - 1);
+        }
+
+        const auto greater = [&nodes](const int a, const int b) { return nodes.at(a).weight > nodes.at(b).weight; };
+        std::make_heap(heap.begin(), heap.end(), greater);
+
+        while(heap.size() > 1)
+        {
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            const int a = heap.takeLast();
+            std::pop_heap(heap.begin(), heap.end(), greater);
+            const int b = heap.takeLast();
+
+            nodes.append({ nodes.at(a).weight + nodes.at(b).weight, a, b });
+            heap.append(int(nodes.size()) - 1);
+            std::push_heap(heap.begin(), heap.end(), greater);
+        }
+
+        /* 葉の深さが符号長．葉はleft == -1でrightがシンボル */
+        std::fill(lengths, lengths + count, 0);
+        int maxLength = 0;
+        QList<std::pair<int, int> > stack = { { heap.first(), 0 } };
+        while(!stack.isEmpty())
+        {
+            const std::pair<int, int> item = stack.takeLast();
+            const Node& node = nodes.at(item.first);
+            if(node.left < 0)
+            {
+                lengths[node.right] = quint8(qMax(item.second, 1));
+                maxLength = qMax(maxLength, item.second);
+            }
+            else
+            {
+                stack.append({ node.left, item.second + 1 });
+                stack.append({ node.right, item.second + 1 });
+            }
+        }
+
+        if(maxLength <= maxBits) return;
+
+        for(quint32& f : freq) if(f > 0) f = (f >> 1) | 1;
+    }
+}
+
+/* 正準ハフマン符号．下位ビットから書き出すためビットを反転しておく */
+void Deflater::buildCodes(const quint8 *lengths, const int count, quint16 *codes)
+{
+    int lengthCount[16] = {};
+    for(int i = 0; i < count; ++i) lengthCount[lengths[i]]++;
+    lengthCount[0] = 0;
+
+    int nextCode[16] = {};
+    int code = 0;
+    for(int bits = 1; bits <= 15; ++bits)
+    {
+        code = (code + lengthCount[bits - 1]) << 1;
+        nextCode[bits] = code;
+    }
+
+    for(int i = 0; i < count; ++i)
+    {
+        const int length = lengths[i];
+        if(length == 0) { codes[i] = 0; continue; }
+
+        int reversed = 0;
+        for(int k = 0, c = nextCode[length]++; k < length; ++k, c >>= 1)
+            reversed = (reversed << 1) | (c & 1);
+        codes[i] = quint16(reversed);
+    }
+}
+
+void Deflater::putBits(const quint32 value, const int count)
+{
+    bitBuffer |= quint64(value) << bitCount;
+    bitCount += count;
+
+    while(bitCount >= 32)
+    {
+        char bytes[4];
+        qToLittleEndian(quint32(bitBuffer & 0xFFFFFFFF), bytes);
+        output.append(bytes, 4);
+        bitBuffer >>= 32;
+        bitCount -= 32;
+    }
+}
+
+void Deflater::flushOutput(const bool all)
+{
+    if(output.isEmpty() || (!all && output.size() < outputBufferSize)) return;
+
+    if(sink->write(output) != output.size()) ok = false;
+    written += output.size();
+    output.resize(0);
+}
+
+void Deflater::flushBlock(const bool final)
+{
+    const CodeTables& tables = codeTables();
+
+    quint32 literalFreq[286] = {};
+    quint32 distanceFreq[30] = {};
+    for(const Symbol& symbol : symbols)
+    {
+        if(symbol.distance == 0)
+            literalFreq[symbol.length]++;
+        else
+        {
+            literalFreq[257 + tables.lengthCode[symbol.length]]++;
+            distanceFreq[tables.distanceCode[symbol.distance]]++;
+        }
+    }
+    literalFreq[256] = 1;
+
+    quint8 literalLengths[286];
+    quint8 distanceLengths[30];
+    buildLengths(literalFreq, 286, 15, literalLengths);
+    buildLengths(distanceFreq, 30, 15, distanceLengths);
+
+    quint16 literalCodes[286];
+    quint16 distanceCodes[30];
+    buildCodes(literalLengths, 286, literalCodes);
+    buildCodes(distanceLengths, 30, distanceCodes);
+
+    int hlit = 286;
+    while(hlit > 257 && literalLengths[hlit - 1] == 0) --hlit;
+    int hdist = 30;
+    while(hdist > 1 && distanceLengths[hdist - 1] == 0) --hdist;
+
+    /* 符号長の列を16(直前の繰り返し), 17, 18(0の繰り返し)で縮める */
+    quint8 allLengths[286 + 30];
+    std::memcpy(allLengths, literalLengths, hlit);
+    std::memcpy(allLengths + hlit, distanceLengths, hdist);
+    const int total = hlit + hdist;
+
+    struct Run { quint8 symbol; quint8 extra; };
+    QList<Run> runs;
+    quint32 codeLengthFreq[19] = {};
+
+    for(int i = 0; i < total;)
+    {
+        const quint8 value = allLengths[i];
+        int n = 1;
+        while(i + n < total && allLengths[i + n] == value) ++n;
+        i += n;
+
+        if(value == 0)
+        {
+            while(n >= 11) { const int k = qMin(n, 138); runs.append({ 18, quint8(k - 11) }); n -= k; }
+            if(n >= 3) { runs.append({ 17, quint8(n - 3) }); n = 0; }
+            while(n-- > 0) runs.append({ 0, 0 });
+        }
+        else
+        {
+            runs.append({ value, 0 });
+            --n;
+            while(n >= 3) { const int k = qMin(n, 6); runs.append({ 16, quint8(k - 3) }); n -= k; }
+            while(n-- > 0) runs.append({ value, 0 });
+        }
+    }
+    for(const Run& run : runs) codeLengthFreq[run.symbol]++;
+
+    quint8 codeLengthLengths[19];
+    quint16 codeLengthCodes[19];
+    buildLengths(codeLengthFreq, 19, 7, codeLengthLengths);
+    buildCodes(codeLengthLengths, 19, codeLengthCodes);
+
+    int hclen = 19;
+    while(hclen > 4 && codeLengthLengths[codeLengthOrder[hclen - 1]] == 0) --hclen;
+
+    /* ブロックヘッダー */
+    putBits(final ? 1 : 0, 1);
+    putBits(2, 2);
+    putBits(quint32(hlit - 257), 5);
+    putBits(quint32(hdist - 1), 5);
+    putBits(quint32(hclen - 4), 4);
+    for(int i = 0; i < hclen; ++i) putBits(codeLengthLengths[codeLengthOrder[i]], 3);
+
+    for(const Run& run : runs)
+    {
+        putBits(codeLengthCodes[run.symbol], codeLengthLengths[run.symbol]);
+        if(run.symbol == 16) putBits(run.extra, 2);
+        else if(run.symbol == 17) putBits(run.extra, 3);
+        else if(run.symbol == 18) putBits(run.extra, 7);
+    }
+
+    /* データ */
+    for(const Symbol& symbol : symbols)
+    {
+        if(symbol.distance == 0)
+        {
+            putBits(literalCodes[symbol.length], literalLengths[symbol.length]);
+            continue;
+        }
+
+        const int lengthCode = tables.lengthCode[symbol.length];
+        putBits(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+        putBits(quint32(symbol.length - lengthBase[lengthCode]), lengthExtra[lengthCode]);
+
+        const int distanceCode = tables.distanceCode[symbol.distance];
+        putBits(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+        putBits(quint32(symbol.distance - distanceBase[distanceCode]), distanceExtra[distanceCode]);
+
+        flushOutput(false);
+    }
+
+    putBits(literalCodes[256], literalLengths[256]);
+
+    /* 32ビット単位で書き出しているので，8ビット単位まで出しておく */
+    while(bitCount >= 8)
+    {
+        output.append(char(bitBuffer & 0xFF));
+        bitBuffer >>= 8;
+        bitCount -= 8;
+    }
+
+    symbols.resize(0);
+    flushOutput(false);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+GzipReader::GzipReader(QIODevice *source)
+    : inflater(source)
+{
+}
+
+bool GzipReader::isGzip(QIODevice *device)
+{
+    char magic[2];
+    return device->peek(magic, 2) == 2 && uchar(magic[0]) == 0x1F && uchar(magic[1]) == 0x8B;
+}
+
+bool GzipReader::readHeader()
+{
+    char header[10];
+    if(!inflater.readBytes(header, 10)) return false;
+    if(uchar(header[0]) != 0x1F || uchar(header[1]) != 0x8B || header[2] != 8) return false;
+
+    const uchar flags = uchar(header[3]);
+    char skip[2];
+
+    if(flags & 0x04) //FEXTRA
+    {
+        if(!inflater.readBytes(skip, 2)) return false;
+        const quint16 length = qFromLittleEndian<quint16>(skip);
+        for(quint16 i = 0; i < length; ++i) if(!inflater.readBytes(skip, 1)) return false;
+    }
+
+    for(const uchar flag : { uchar(0x08), uchar(0x10) }) //FNAME, FCOMMENT
+    {
+        if(!(flags & flag)) continue;
+        do { if(!inflater.readBytes(skip, 1)) return false; } while(skip[0] != '\0');
+    }
+
+    if(flags & 0x02) //FHCRC
+        if(!inflater.readBytes(skip, 2)) return false;
+
+    return true;
+}
+
+qint64 GzipReader::read(char *data, const qint64 maxSize)
+{
+    for(;;)
+    {
+        switch(state)
+        {
+        case State::Header:
+        {
+            if(!readHeader())
+            {
+                //2つ目以降のメンバーの位置にあるgzipでないデータは無視する(gzipと同じ扱い)
+                state = (firstMember) ? State::Error : State::Finished;
+                break;
+            }
+            firstMember = false;
+            crc = 0;
+            size = 0;
+            state = State::Body;
+            break;
+        }
+        case State::Body:
+        {
+            const qint64 count = inflater.read(data, maxSize);
+            if(count < 0) { state = State::Error; break; }
+            if(count > 0)
+            {
+                crc = Crc32::update(crc, data, count);
+                size += quint32(count);
+                return count;
+            }
+
+            /* メンバーの終わり．CRC-32と元のサイズを確かめる */
+            char trailer[8];
+            if(!inflater.readBytes(trailer, 8) ||
+               qFromLittleEndian<quint32>(trailer) != crc ||
+               qFromLittleEndian<quint32>(trailer + 4) != size)
+            {
+                state = State::Error;
+                break;
+            }
+
+            if(inflater.hasMoreInput())
+            {
+                inflater.restart();
+                state = State::Header;
+            }
+            else
+                state = State::Finished;
+            break;
+        }
+        case State::Finished:
+            return 0;
+        case State::Error:
+            return -1;
+        }
+    }
+}
+
+
+
+
+
+GzipWriter::GzipWriter(QIODevice *sink)
+    : sink(sink)
+    , deflater(sink)
+{
+}
+
+bool GzipWriter::writeHeader()
+{
+    headerWritten = true;
+
+    static const char header[10] = { char(0x1F), char(0x8B), 8, 0, 0, 0, 0, 0, 0, char(0xFF) };
+    return sink->write(header, 10) == 10;
+}
+
+bool GzipWriter::write(const char *data, const qsizetype size)
+{
+    if(!headerWritten && !writeHeader()) return false;
+
+    crc = Crc32::update(crc, data, size);
+    this->size += quint32(size);
+
+    return deflater.write(data, size);
+}
+
+bool GzipWriter::finish()
+{
+    if(!headerWritten && !writeHeader()) return false;
+    if(!deflater.finish()) return false;
+
+    char trailer[8];
+    qToLittleEndian(crc, trailer);
+    qToLittleEndian(size, trailer + 4);
+    return sink->write(trailer, 8) == 8;
+}
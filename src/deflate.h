@@ -0,0 +1,210 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QIODevice>
+
+
+
+/* CRC-32(gzip, zipのチェックサム) */
+class Crc32
+{
+public:
+    static quint32 update(const quint32 crc, const char *data, const qsizetype size);
+};
+
+
+
+
+
+/* deflate(RFC1951)形式の圧縮データを展開する．
+ * 入力はsourceから必要な分だけ読み込み，展開したデータはread()で少しずつ取り出すため，
+ * ファイル全体をメモリに展開することはない．
+ */
+class Inflater
+{
+public:
+    explicit Inflater(QIODevice *source, const qint64 sourceSize = -1);
+
+    /* 最大maxSizeバイトを展開する．終端では0，エラーでは-1を返す */
+    qint64 read(char *data, const qint64 maxSize);
+
+    bool isFinished() const { return state == State::Finished; }
+    bool hasError() const { return state == State::Error; }
+
+    /* バイト境界から圧縮されていないデータを読む(gzipのヘッダーやトレーラー) */
+    bool readBytes(char *data, const qsizetype size);
+    bool hasMoreInput();
+    /* 同じ入力の続きから次のdeflateストリームを始める */
+    void restart();
+
+private:
+    enum class State { BlockHeader, Stored, Huffman, Finished, Error };
+
+    struct HuffmanTable
+    {
+        QList<quint16> entries;     //(符号の長さ) | (シンボル << 4)
+        int maxBits = 0;
+    };
+
+    static bool buildTable(HuffmanTable& table, const quint8 *lengths, const int count);
+    static const HuffmanTable& fixedLiteralTable();
+    static const HuffmanTable& fixedDistanceTable();
+
+    void refill();
+    bool getBits(const int count, quint32& value);
+    bool decode(const HuffmanTable& table, int& symbol);
+    bool readBlockHeader();
+    bool readDynamicTables();
+    void fail();
+
+    qint64 readStored(char *data, const qint64 maxSize);
+    qint64 readHuffman(char *data, const qint64 maxSize);
+
+private:
+    static constexpr int windowSize = 1 << 15;
+
+    QIODevice *source;
+    qint64 sourceRemaining;         //-1なら制限なし
+
+    QByteArray input;
+    qsizetype inputPos = 0;
+    qsizetype inputEnd = 0;
+    bool inputEof = false;
+
+    quint64 bitBuffer = 0;
+    int bitCount = 0;
+
+    State state = State::BlockHeader;
+    bool lastBlock = false;
+    quint32 storedRemaining = 0;
+
+    HuffmanTable literalTable;
+    HuffmanTable distanceTable;
+    const HuffmanTable *literal = nullptr;
+    const HuffmanTable *distance = nullptr;
+
+    QByteArray window;              //直近32KBの出力
+    quint32 windowPos = 0;
+    qint64 totalOut = 0;
+    int copyLength = 0;             //出力しきれなかった一致の残り
+    int copyDistance = 0;
+};
+
+
+
+
+
+
+/* deflate形式に圧縮してsinkに書き出す．
+ * LZ77(ハッシュチェーンによる貪欲法)と，ブロックごとの動的ハフマン符号で圧縮する．
+ * 入力は少しずつwrite()で渡せばよく，直近の32KB(と先読みの分)以外は保持しない．
+ */
+class Deflater
+{
+public:
+    explicit Deflater(QIODevice *sink);
+
+    bool write(const char *data, const qsizetype size);
+    bool finish();
+    qint64 bytesWritten() const { return written; }
+
+private:
+    struct Symbol
+    {
+        quint16 length;             //一致の長さ．距離が0ならリテラルのバイト
+        quint16 distance;
+    };
+
+    static void buildLengths(const quint32 *frequencies, const int count, const int maxBits, quint8 *lengths);
+    static void buildCodes(const quint8 *lengths, const int count, quint16 *codes);
+
+    void compress(const qsizetype limit);
+    void insertHash(const qsizetype position);
+    void slideWindow();
+    void flushBlock(const bool final);
+    void putBits(const quint32 value, const int count);
+    void flushOutput(const bool all);
+
+private:
+    static constexpr int windowSize = 1 << 15;
+    static constexpr int hashBits = 15;
+    static constexpr int maxSymbols = 1 << 15;
+
+    QIODevice *sink;
+    qint64 written = 0;
+    bool ok = true;
+
+    QByteArray window;              //直近32KB + まだ圧縮していないデータ
+    qsizetype position = 0;         //次に圧縮する位置
+    QList<qint32> head;
+    QList<qint32> prev;
+    QList<Symbol> symbols;
+
+    quint64 bitBuffer = 0;
+    int bitCount = 0;
+    QByteArray output;
+};
+
+
+
+
+
+/* gzip(RFC1952)形式の展開．複数のメンバーを連結したファイルにも対応する */
+class GzipReader
+{
+public:
+    explicit GzipReader(QIODevice *source);
+
+    static bool isGzip(QIODevice *device);
+
+    /* 最大maxSizeバイトを展開する．終端では0，エラーでは-1を返す */
+    qint64 read(char *data, const qint64 maxSize);
+    bool hasError() const { return state == State::Error; }
+
+private:
+    enum class State { Header, Body, Finished, Error };
+
+    bool readHeader();
+
+    Inflater inflater;
+    State state = State::Header;
+    bool firstMember = true;
+    quint32 crc = 0;
+    quint32 size = 0;
+};
+
+
+
+
+
+/* gzip形式の圧縮 */
+class GzipWriter
+{
+public:
+    explicit GzipWriter(QIODevice *sink);
+
+    bool write(const char *data, const qsizetype size);
+    bool finish();
+
+private:
+    bool writeHeader();
+
+    QIODevice *sink;
+    Deflater deflater;
+    bool headerWritten = false;
+    quint32 crc = 0;
+    quint32 size = 0;
+};
+
+#endif // DEFLATE_H
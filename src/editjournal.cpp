@@ -0,0 +1,841 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "editjournal.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QMutex>
+#include <QTimer>
+#include <QTextDocument>
+#include <QTextCursor>
+#include <QtEndian>
+#include <cstring>
+#include "sheetmodel.h"
+#include "settings.h"
+#include "xxhash.h"
+#include "ioscheduler.h"
+#include "logger.h"
+
+/* ジャーナルファイルの形式(リトルエンディアン)
+ *
+ *   "GEJOURN\0", version(u32), kind(u32), 基準の内容のハッシュ(u64), 文書のパス(u32 + UTF-8)
+ *   記録ごとに
+ *     type(u8), payloadの長さ(u32), payload, チェックサム(u32: type以降のXXHash64の下位32ビット)
+ *     payload: a(u64), b(u64), 続きはtypeごとに
+ *       Text, Cell        文字列(u32 + UTF-8)
+ *       Range, Snapshot   行数(u32), 列数(u32), 列ごとにセルの文字列(u32 + UTF-8)...
+ *       RowOrder          行数(u32), 並べ替える前の行(u32)...
+ *
+ * 書き込みの途中で終了した場合は，チェックサムの合わない記録とその後ろを捨てる．
+ */
+
+namespace
+{
+    constexpr char magic[8] = { 'G', 'E', 'J', 'O', 'U', 'R', 'N', '\0' };
+    constexpr quint32 version = 2;
+    constexpr qint64 headerSize = 24;
+
+    void put32(QByteArray& out, const quint32 value) { char b[4]; qToLittleEndian(value, b); out.append(b, 4); }
+    void put64(QByteArray& out, const quint64 value) { char b[8]; qToLittleEndian(value, b); out.append(b, 8); }
+    void putString(QByteArray& out, const QString& text)
+    {
+        const QByteArray utf8 = text.toUtf8();
+        put32(out, quint32(utf8.size()));
+        out.append(utf8);
+    }
+
+    struct Reader
+    {
+        const char *data;
+        qint64 size;
+        qint64 pos = 0;
+        bool ok = true;
+
+        const char *take(const qint64 count)
+        {
+            if(!ok || count < 0 || size - pos < count) { ok = false; return nullptr; }
+            const char *p = data + pos;
+            pos += count;
+            return p;
+        }
+
+        quint32 get32() { const char *p = take(4); return (p) ? qFromLittleEndian<quint32>(p) : 0; }
+        quint64 get64() { const char *p = take(8); return (p) ? qFromLittleEndian<quint64>(p) : 0; }
+
+        QString getString()
+        {
+            const quint32 length = get32();
+            const char *p = take(length);
+            return (p) ? QString::fromUtf8(p, length) : QString();
+        }
+    };
+
+    /* QTextDocument::toPlainText()と同じく段落と行の区切りを改行にする */
+    void normalizeText(QString& text)
+    {
+        for(QChar& c : text)
+        {
+            if(c == QChar::ParagraphSeparator || c == QChar::LineSeparator) c = '\n';
+            else if(c == QChar::Nbsp) c = ' ';
+        }
+    }
+}
+
+
+
+
+struct EditJournal::Record
+{
+    enum class Type : quint8 { Text = 1, Cell, InsertRows, RemoveRows, InsertColumns, RemoveColumns, Snapshot, Checkpoint, Range, RowOrder };
+
+    Type type;
+    qint64 a = 0;           //Text: 位置，Cell: 行，Insert/Remove: 最初の行か列，Range: 上の行，Checkpoint: 印の番号
+    qint64 b = 0;           //Text: 削除した文字数，Cell: 列，Insert/Remove: 数，Range: 左の列
+    QString text;           //Text: 挿入した文字列，Cell: セルの文字列
+    SheetData cells;        //Range: 範囲のセル，Snapshot: シート全体．文字列にするのは書き込むスレッドで行う
+    QList<qsizetype> order; //RowOrder: i行目にした並べ替える前の行(SheetModel::setRowOrder())
+
+    void encode(QByteArray& out) const
+    {
+        const qsizetype start = out.size();
+        out.append(char(type));
+        put32(out, 0);          //payloadの長さは後で書く
+
+        put64(out, quint64(a));
+        put64(out, quint64(b));
+        switch(type)
+        {
+        case Type::Text:
+        case Type::Cell:
+            putString(out, text);
+            break;
+        case Type::Range:
+        case Type::Snapshot:
+            put32(out, quint32(cells.rowCount()));
+            put32(out, quint32(cells.columnCount()));
+            for(qsizetype col = 0; col < cells.columnCount(); ++col)
+            {
+                const SheetColumn& column = cells.column(col);
+                for(qsizetype row = 0; row < cells.rowCount(); ++row)
+                {
+                    const qsizetype length = out.size();
+                    put32(out, 0);
+                    if(row < column.size()) column.appendText(out, row);
+                    qToLittleEndian(quint32(out.size() - length - 4), out.data() + length);
+                }
+            }
+            break;
+        case Type::RowOrder:
+            put32(out, quint32(order.size()));
+            for(const qsizetype row : order) put32(out, quint32(row));
+            break;
+        default:
+            break;
+        }
+
+        qToLittleEndian(quint32(out.size() - start - 5), out.data() + start + 1);
+        put32(out, quint32(XXHash64::hash(QByteArrayView(out).sliced(start))));
+    }
+
+    static bool decode(Reader& in, Record& record)
+    {
+        const qint64 start = in.pos;
+        const char *type = in.take(1);
+        const quint32 size = in.get32();
+        const char *payload = in.take(size);
+        const quint32 checksum = in.get32();
+        if(!in.ok) return false;
+        if(quint32(XXHash64::hash(QByteArrayView(in.data + start, 5 + qint64(size)))) != checksum) return false;
+
+        if(uchar(*type) < uchar(Type::Text) || uchar(*type) > uchar(Type::RowOrder)) return false;
+        record.type = Type(*type);
+
+        Reader body{ payload, size };
+        record.a = qint64(body.get64());
+        record.b = qint64(body.get64());
+        switch(record.type)
+        {
+        case Type::Text:
+        case Type::Cell:
+            record.text = body.getString();
+            break;
+        case Type::Range:
+        case Type::Snapshot:
+        {
+            const quint32 rows = body.get32();
+            const quint32 cols = body.get32();
+            if(!body.ok || quint64(rows) * cols * 4 > quint64(body.size - body.pos)) return false;   //セルごとに少なくとも長さがある
+
+            record.cells.resize(rows, cols);
+            for(quint32 col = 0; col < cols && body.ok; ++col)
+                for(quint32 row = 0; row < rows && body.ok; ++row)
+                    record.cells.setText(row, col, body.getString());
+            break;
+        }
+        case Type::RowOrder:
+        {
+            const quint32 rows = body.get32();
+            if(!body.ok || quint64(rows) * 4 > quint64(body.size - body.pos)) return false;
+
+            record.order.resize(rows);
+            for(quint32 i = 0; i < rows; ++i) record.order[i] = body.get32();
+            break;
+        }
+        default:
+            break;
+        }
+
+        return body.ok && body.pos == body.size;
+    }
+};
+
+
+
+
+/* 連続した編集を1つの記録にまとめる．同じセルの変更は最後の値だけを残し，
+ * 続けて入力した文字や続けて削除した文字は1つの差分にする．印(Checkpoint)はまたいでまとめない */
+struct EditJournal::Coalescer
+{
+    QList<Record> records;
+    QHash<QPair<qint64, qint64>, qsizetype> cells;     //変更したセルのrecordsでの位置．行や列の挿入・削除まで有効
+
+    void clear() { records.clear(); cells.clear(); }
+
+    static bool mergeText(Record& last, const Record& next)
+    {
+        if(last.type != Record::Type::Text) return false;
+
+        const qint64 end = last.a + last.text.size();
+
+        //続けて入力した
+        if(next.b == 0 && next.a == end) { last.text += next.text; return true; }
+        //入力した文字をBackspaceで消した
+        if(next.text.isEmpty() && next.a + next.b == end && next.b <= last.text.size()) { last.text.chop(next.b); return true; }
+
+        if(last.text.isEmpty() && next.text.isEmpty())
+        {
+            if(next.a + next.b == last.a) { last.a = next.a; last.b += next.b; return true; }  //Backspaceを続けた
+            if(next.a == last.a) { last.b += next.b; return true; }                            //Deleteを続けた
+        }
+
+        return false;
+    }
+
+    void add(const Record& record)
+    {
+        switch(record.type)
+        {
+        case Record::Type::Cell:
+        {
+            const QPair<qint64, qint64> key(record.a, record.b);
+            const auto found = cells.constFind(key);
+            if(found != cells.constEnd())
+            {
+                records[found.value()].text = record.text;
+                return;
+            }
+            cells.insert(key, records.size());
+            break;
+        }
+        case Record::Type::Text:
+            if(!records.isEmpty() && mergeText(records.last(), record)) return;
+            break;
+        case Record::Type::Snapshot:
+            /* 全体を置き換えるため，それより前の編集は要らない．保存の印は残す */
+            records.removeIf([](const Record& r) { return r.type != Record::Type::Checkpoint; });
+            cells.clear();
+            break;
+        default:
+            cells.clear();
+            break;
+        }
+
+        records.append(record);
+    }
+};
+
+
+
+
+struct EditJournal::Shared
+{
+    struct Command
+    {
+        enum class Type { Append, Commit, Remove, Move, Compact };
+
+        Type type;
+        QString path;           //文書のパス．Moveでは移動先
+        QString from;           //Move: 移動元の文書のパス
+        QList<Record> records;  //Append: 追記する記録．符号化はprocess()のスレッドで行う
+        quint64 baseHash = 0;
+        quint32 mark = 0;
+    };
+
+    explicit Shared(const Kind& kind) : kind(kind) {}
+
+    const Kind kind;
+
+    QMutex mutex;               //commands
+    QList<Command> commands;
+
+    QMutex io;                  //ファイルの操作．process()は同時に1つだけ実行する
+    qint64 compactedSize = 0;   //最後にまとめ直した後の大きさ
+
+    struct Journal
+    {
+        quint64 baseHash = 0;
+        QList<Record> records;
+    };
+
+    bool read(const QString& journal, const QString& path, Journal& content) const
+    {
+        QFile file(journal);
+        if(!file.open(QIODevice::ReadOnly)) return false;
+
+        const QByteArray data = file.readAll();
+        Reader in{ data.constData(), data.size() };
+
+        const char *head = in.take(8);
+        if(!head || std::memcmp(head, magic, 8) != 0) return false;
+        if(in.get32() != version) return false;
+        if(in.get32() != quint32(kind)) return false;
+        content.baseHash = in.get64();
+        if(in.getString() != path || !in.ok) return false;     //ファイル名のハッシュの衝突
+
+        Record record;
+        while(in.pos < in.size && Record::decode(in, record))
+        {
+            content.records.append(record);
+            record = Record();
+        }
+
+        if(in.pos < in.size)
+            __LOGOUT__("discarded a broken record in the edit journal of \"" + path + "\".", Logger::LogLevel::Warn);
+
+        return true;
+    }
+
+    bool write(const QString& journal, const QString& path, const Journal& content)
+    {
+        QDir().mkpath(EditJournal::journalDirPath());
+
+        QByteArray data(magic, 8);
+        put32(data, version);
+        put32(data, quint32(kind));
+        put64(data, content.baseHash);
+        putString(data, path);
+        for(const Record& record : content.records) record.encode(data);
+
+        QSaveFile file(journal);
+        if(!file.open(QIODevice::WriteOnly)) return false;
+        if(file.write(data) != data.size()) { file.cancelWriting(); return false; }
+        if(!file.commit()) return false;
+
+        compactedSize = data.size();
+        return true;
+    }
+
+    bool append(const QString& journal, const Command& command)
+    {
+        QByteArray bytes;
+        for(const Record& record : command.records) record.encode(bytes);
+
+        QFile file(journal);
+
+        if(file.exists() && file.size() > headerSize)
+        {
+            if(!file.open(QIODevice::WriteOnly | QIODevice::Append)) return false;
+            return file.write(bytes) == bytes.size();
+        }
+
+        QDir().mkpath(EditJournal::journalDirPath());
+
+        QByteArray data(magic, 8);
+        put32(data, version);
+        put32(data, quint32(kind));
+        put64(data, command.baseHash);
+        putString(data, command.path);
+        data.append(bytes);
+
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+        return file.write(data) == data.size();
+    }
+
+    void compact(const QString& journal, const QString& path)
+    {
+        Journal content;
+        if(!read(journal, path, content)) return;
+
+        Coalescer coalescer;
+        for(const Record& record : qAsConst(content.records)) coalescer.add(record);
+        content.records = coalescer.records;
+
+        write(journal, path, content);
+    }
+
+    void execute(const Command& command)
+    {
+        const QString journal = EditJournal::journalFilePath(command.path);
+
+        switch(command.type)
+        {
+        case Command::Type::Append:
+            if(!append(journal, command))
+                __LOGOUT__("failed to write the edit journal of \"" + command.path + "\".", Logger::LogLevel::Warn);
+            break;
+        case Command::Type::Remove:
+            QFile::remove(journal);
+            compactedSize = 0;
+            break;
+        case Command::Type::Commit:
+        {
+            /* 保存した内容の印より後の記録だけを残す */
+            Journal content;
+            if(!read(journal, command.path, content)) break;
+
+            qsizetype next = -1;
+            for(qsizetype i = 0; i < content.records.size(); ++i)
+            {
+                const Record& record = content.records.at(i);
+                if(record.type == Record::Type::Checkpoint && quint32(record.a) == command.mark) next = i + 1;
+            }
+            if(next < 0) break;
+
+            content.records.remove(0, next);
+            content.baseHash = command.baseHash;
+
+            //後の保存の印だけが残っている
+            bool edited = false;
+            for(const Record& record : qAsConst(content.records))
+                if(record.type != Record::Type::Checkpoint) edited = true;
+
+            if(!edited)
+            {
+                QFile::remove(journal);
+                compactedSize = 0;
+            }
+            else
+                write(journal, command.path, content);
+            break;
+        }
+        case Command::Type::Move:
+        {
+            const QString source = EditJournal::journalFilePath(command.from);
+            Journal content;
+            if(read(source, command.from, content) && write(journal, command.path, content))
+                QFile::remove(source);
+            break;
+        }
+        case Command::Type::Compact:
+            compact(journal, command.path);
+            break;
+        }
+    }
+};
+
+
+
+
+EditJournal::EditJournal(const Kind& kind, const QString& path, QObject *parent)
+    : QObject(parent)
+    , kind(kind)
+    , filePath(QFileInfo(path).absoluteFilePath())
+    , shared(new Shared(kind))
+    , batch(new Coalescer)
+    , flushTimer(new QTimer(this))
+{
+    flushTimer->setSingleShot(true);
+    flushTimer->setInterval(flushInterval);
+
+    connect(flushTimer, &QTimer::timeout, this, &EditJournal::flush);
+}
+
+EditJournal::~EditJournal()
+{
+    //書き込みは別スレッドでsharedを持って続くため，待たない
+    flush();
+}
+
+QString EditJournal::journalDirPath()
+{
+    return Settings::applicationSettingsDirPath() + "/journal";
+}
+
+QString EditJournal::journalFilePath(const QString& path)
+{
+    return journalDirPath() + '/' + QString::number(XXHash64::hash(path.toUtf8()), 16) + ".journal";
+}
+
+void EditJournal::setDocument(QTextDocument *document)
+{
+    if(this->document) disconnect(this->document, nullptr, this, nullptr);
+
+    this->document = document;
+    if(!document) return;
+
+    shadowText = document->toPlainText();
+    connect(document, &QTextDocument::contentsChange, this, &EditJournal::receiveContentsChange);
+}
+
+void EditJournal::setModel(SheetModel *model)
+{
+    if(this->model) disconnect(this->model, nullptr, this, nullptr);
+
+    this->model = model;
+    if(!model) return;
+
+    connect(model, &SheetModel::dataChanged, this, [this](const QModelIndex& topLeft, const QModelIndex& bottomRight, const QList<int>& roles) {
+        if(!roles.isEmpty() && !roles.contains(Qt::DisplayRole) && !roles.contains(Qt::EditRole)) return;  //色などの書式
+        recordCells(topLeft.row(), topLeft.column(), bottomRight.row(), bottomRight.column());
+    });
+    connect(model, &SheetModel::rowsInserted, this, [this](const QModelIndex&, int first, int last) {
+        append(Record{ Record::Type::InsertRows, first, last - first + 1 });
+    });
+    connect(model, &SheetModel::rowsRemoved, this, [this](const QModelIndex&, int first, int last) {
+        append(Record{ Record::Type::RemoveRows, first, last - first + 1 });
+    });
+    connect(model, &SheetModel::columnsInserted, this, [this](const QModelIndex&, int first, int last) {
+        append(Record{ Record::Type::InsertColumns, first, last - first + 1 });
+    });
+    connect(model, &SheetModel::columnsRemoved, this, [this](const QModelIndex&, int first, int last) {
+        append(Record{ Record::Type::RemoveColumns, first, last - first + 1 });
+    });
+
+    /* 並べ替えは置換の配列だけを記録する．シートの置き換えは全体を記録する */
+    connect(model, &SheetModel::rowOrderChanged, this, [this](const QList<qsizetype>& permutation) {
+        Record record{ Record::Type::RowOrder };
+        record.order = permutation;
+        append(record);
+    });
+    connect(model, &SheetModel::modelReset, this, &EditJournal::recordSnapshot);
+}
+
+void EditJournal::setFilePath(const QString& path)
+{
+    const QString absolutePath = QFileInfo(path).absoluteFilePath();
+    if(absolutePath == filePath) return;
+
+    flush();
+
+    {
+        QMutexLocker locker(&shared->mutex);
+        Shared::Command command{ Shared::Command::Type::Move, absolutePath };
+        command.from = filePath;
+        shared->commands.append(command);
+    }
+
+    filePath = absolutePath;
+    schedule();
+}
+
+void EditJournal::reset(const quint64 baseHash)
+{
+    flushTimer->stop();
+    batch->clear();
+
+    this->baseHash = baseHash;
+    recorded = 0;
+    started = true;
+    if(document) shadowText = document->toPlainText();
+
+    {
+        QMutexLocker locker(&shared->mutex);
+        shared->commands.append(Shared::Command{ Shared::Command::Type::Remove, filePath });
+    }
+    schedule();
+}
+
+quint32 EditJournal::checkpoint()
+{
+    if(recorded == 0) return 0;
+
+    const quint32 mark = ++lastMark;
+    recordedAtMark = recorded;
+
+    const bool wasEnabled = enabled;
+    enabled = true;
+    append(Record{ Record::Type::Checkpoint, mark });
+    enabled = wasEnabled;
+
+    flush();
+
+    return mark;
+}
+
+void EditJournal::commit(const quint32 mark, const quint64 baseHash)
+{
+    this->baseHash = baseHash;
+    if(mark == 0) return;
+
+    //印の後に編集していない
+    if(mark == lastMark && recorded == recordedAtMark) recorded = 0;
+
+    {
+        QMutexLocker locker(&shared->mutex);
+        Shared::Command command{ Shared::Command::Type::Commit, filePath };
+        command.baseHash = baseHash;
+        command.mark = mark;
+        shared->commands.append(command);
+    }
+    schedule();
+}
+
+bool EditJournal::canRecover(const quint64 baseHash) const
+{
+    if(started) return false;
+
+    QMutexLocker locker(&shared->io);
+
+    Shared::Journal content;
+    if(!shared->read(journalFilePath(filePath), filePath, content)) return false;
+
+    for(const Record& record : qAsConst(content.records))
+        if(record.type != Record::Type::Checkpoint) return content.baseHash == baseHash;
+
+    return false;
+}
+
+bool EditJournal::recover()
+{
+    Shared::Journal content;
+    {
+        QMutexLocker locker(&shared->io);
+        if(!shared->read(journalFilePath(filePath), filePath, content)) return false;
+    }
+
+    started = true;
+    enabled = false;
+
+    const qint64 baseLength = (document) ? document->characterCount() - 1 : 0;
+
+    /* 復元した編集を1回で元に戻せるようにする */
+    QTextCursor cursor;
+    if(document)
+    {
+        cursor = QTextCursor(document);
+        cursor.beginEditBlock();
+    }
+
+    bool ok = true;
+    for(const Record& record : qAsConst(content.records))
+    {
+        if(!apply(record)) { ok = false; break; }
+    }
+
+    if(document)
+    {
+        cursor.endEditBlock();
+        shadowText = document->toPlainText();
+    }
+
+    enabled = true;
+    baseHash = content.baseHash;
+    recorded = content.records.size();
+
+    if(ok)
+    {
+        /* 途中で切れていた記録の後ろに追記しないように，まとめ直しておく */
+        QMutexLocker locker(&shared->mutex);
+        shared->commands.append(Shared::Command{ Shared::Command::Type::Compact, filePath });
+    }
+    else
+    {
+        /* 文書と合わない記録は捨てて，復元できたところまでを1つの記録にする */
+        __LOGOUT__("the edit journal of \"" + filePath + "\" does not match the file. recovered partially.", Logger::LogLevel::Warn);
+        {
+            QMutexLocker locker(&shared->mutex);
+            shared->commands.append(Shared::Command{ Shared::Command::Type::Remove, filePath });
+        }
+        if(document)
+            append(Record{ Record::Type::Text, 0, baseLength, shadowText });
+        else
+            recordSnapshot();
+        flush();
+    }
+    schedule();
+
+    return ok;
+}
+
+bool EditJournal::apply(const Record& record)
+{
+    switch(record.type)
+    {
+    case Record::Type::Text:
+    {
+        if(!document) return false;
+        if(record.a < 0 || record.b < 0 || record.a + record.b > document->characterCount() - 1) return false;
+
+        QTextCursor cursor(document);
+        cursor.setPosition(int(record.a));
+        cursor.setPosition(int(record.a + record.b), QTextCursor::KeepAnchor);
+        cursor.insertText(record.text);
+        return true;
+    }
+    case Record::Type::Cell:
+    {
+        if(!model) return false;
+        const QModelIndex index = model->index(int(record.a), int(record.b));
+        if(!index.isValid()) return false;
+        return model->setData(index, record.text, Qt::EditRole);
+    }
+    case Record::Type::InsertRows:
+        return model && record.a <= model->rowCount() && model->insertRows(int(record.a), int(record.b));
+    case Record::Type::RemoveRows:
+        return model && record.a + record.b <= model->rowCount() && model->removeRows(int(record.a), int(record.b));
+    case Record::Type::InsertColumns:
+        return model && record.a <= model->columnCount() && model->insertColumns(int(record.a), int(record.b));
+    case Record::Type::RemoveColumns:
+        return model && record.a + record.b <= model->columnCount() && model->removeColumns(int(record.a), int(record.b));
+    case Record::Type::Range:
+        if(!model || record.a < 0 || record.b < 0) return false;
+        model->setCells(int(record.a), int(record.b), record.cells);
+        return true;
+    case Record::Type::Snapshot:
+    {
+        if(!model) return false;
+
+        const SheetModel::EditGroup group(model);
+        model->resize(int(record.cells.rowCount()), int(record.cells.columnCount()));
+        model->setCells(0, 0, record.cells);
+        return true;
+    }
+    case Record::Type::RowOrder:
+    {
+        if(!model || record.order.size() != model->rowCount()) return false;
+
+        QList<bool> used(record.order.size(), false);
+        for(const qsizetype row : record.order)
+        {
+            if(row < 0 || row >= used.size() || used.at(row)) return false;
+            used[row] = true;
+        }
+        model->setRowOrder(record.order);
+        return true;
+    }
+    case Record::Type::Checkpoint:
+        return true;
+    }
+
+    return false;
+}
+
+void EditJournal::append(const Record& record)
+{
+    if(!enabled) return;
+
+    if(record.type != Record::Type::Checkpoint) recorded++;
+    batch->add(record);
+
+    /* 範囲や全体の記録，大量の変更はすぐに書き込みに回してメモリに溜めない */
+    if(record.type == Record::Type::Snapshot || record.type == Record::Type::Range || record.type == Record::Type::RowOrder
+            || batch->records.size() >= 4096)
+        flush();
+    else if(!flushTimer->isActive())
+        flushTimer->start();
+}
+
+void EditJournal::flush()
+{
+    flushTimer->stop();
+    if(batch->records.isEmpty()) return;
+
+    {
+        QMutexLocker locker(&shared->mutex);
+        Shared::Command command{ Shared::Command::Type::Append, filePath };
+        command.records = batch->records;
+        command.baseHash = baseHash;
+        shared->commands.append(command);
+    }
+    batch->clear();
+    schedule();
+}
+
+void EditJournal::schedule()
+{
+    /* 同じパスのまだ始まっていない要求はIoSchedulerがまとめるが，
+     * どの要求もその時点までのcommandsをすべて実行するため，記録は失われない */
+    const QSharedPointer<Shared> shared = this->shared;
+    IoScheduler::schedule(journalFilePath(filePath), IoScheduler::Operation::Write, IoScheduler::Priority::Background, this,
+                          [shared](const QString&, bool& ok) { process(shared); ok = true; return QVariant(); });
+}
+
+void EditJournal::process(const QSharedPointer<Shared>& shared)
+{
+    QMutexLocker io(&shared->io);
+
+    QList<Shared::Command> commands;
+    {
+        QMutexLocker locker(&shared->mutex);
+        commands.swap(shared->commands);
+    }
+    if(commands.isEmpty()) return;
+
+    for(const Shared::Command& command : qAsConst(commands))
+        shared->execute(command);
+
+    /* 大きくなれば記録をまとめ直す．まとめても小さくならない場合に繰り返さないよう，前回の2倍を超えたときだけ */
+    const QString path = commands.last().path;
+    const qint64 size = QFileInfo(journalFilePath(path)).size();
+    if(size > compactSize && size > 2 * shared->compactedSize)
+        shared->compact(journalFilePath(path), path);
+}
+
+void EditJournal::receiveContentsChange(int position, int removed, int added)
+{
+    if(!enabled || !document) return;
+
+    /* 全体を置き換えた(setPlainText())場合などは，最後の段落の区切りの分だけ大きく通知される */
+    const int length = document->characterCount() - 1;
+    position = qBound(0, position, length);
+    added = qBound(0, added, length - position);
+    removed = qBound(0, removed, int(shadowText.size()) - qMin(position, int(shadowText.size())));
+
+    QTextCursor cursor(document);
+    cursor.setPosition(position);
+    cursor.setPosition(position + added, QTextCursor::KeepAnchor);
+    QString text = cursor.selectedText();
+    normalizeText(text);
+
+    //ハイライトの書式だけが変わった
+    if(removed == text.size() && QStringView(shadowText).mid(position, removed) == text) return;
+
+    shadowText.replace(position, removed, text);
+    append(Record{ Record::Type::Text, position, removed, text });
+}
+
+/* 1つのセルはその文字列を，範囲は列の配列のままコピーして記録する．文字列にするのは書き込むスレッドで行う */
+void EditJournal::recordCells(int top, int left, int bottom, int right)
+{
+    if(!enabled || !model) return;
+
+    if(top == bottom && left == right)
+    {
+        Record record{ Record::Type::Cell, top, left };
+        record.text = model->text(top, left);
+        append(record);
+        return;
+    }
+
+    Record record{ Record::Type::Range, top, left };
+    record.cells = model->sheet().mid(top, left, bottom - top + 1, right - left + 1);
+    append(record);
+}
+
+void EditJournal::recordSnapshot()
+{
+    if(!enabled || !model) return;
+
+    Record record{ Record::Type::Snapshot };
+    record.cells = model->sheet();      //列の配列を共有する
+    append(record);
+}
@@ -0,0 +1,103 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QScopedPointer>
+#include <QHash>
+
+class QTextDocument;
+class SheetModel;
+class QTimer;
+
+
+
+/* 開いている文書ごとの編集の記録．異常終了しても保存していない編集を復元できるようにする．
+ * Settings::applicationSettingsDirPath()/journal に文書のパスごとに1ファイル作り，
+ * 最後に読み込んだ，または保存した内容(基準)からの編集(テキストの差分，セルの変更，行と列の挿入・削除)を追記する．
+ * 範囲の書き換えは範囲の列，行の並べ替えは置換の配列として記録し，セルを文字列にするのは書き込むスレッドで行う．
+ *
+ * 編集はまとめてflushIntervalごとにIoSchedulerで書き込み，ファイルが大きくなれば同じスレッドで記録をまとめ直す．
+ * 保存の前にcheckpoint()で印を付け，保存できたらcommit()でそこまでの記録を捨てるため，保存中の編集も失わない．
+ */
+class EditJournal : public QObject
+{
+    Q_OBJECT
+public:
+    enum class Kind : quint32 { Text = 1, Sheet = 2 };
+
+    explicit EditJournal(const Kind& kind, const QString& path, QObject *parent);
+    ~EditJournal();
+
+    /* 記録する文書．Textはdocument，Sheetはmodelを使う */
+    void setDocument(QTextDocument *document);
+    void setModel(SheetModel *model);
+
+    void setFilePath(const QString& path);
+    /* 読み込み中などの記録しない変更の間はfalseにする */
+    void setEnabled(const bool enable) { enabled = enable; }
+
+    /* 今の内容を基準とし，これまでの記録を捨てる．baseHashは基準を表すハッシュ(テキストは内容，シートはファイルのサイズと更新日時) */
+    void reset(const quint64 baseHash);
+    /* 保存する内容の位置に印を付ける．保存できたらその番号をcommit()に渡す．記録がなければ0 */
+    quint32 checkpoint();
+    void commit(const quint32 mark, const quint64 baseHash);
+
+    /* 前回の記録が残っていて，その基準がbaseHashと一致する．この実行で最初に読み込んだときだけ */
+    bool canRecover(const quint64 baseHash) const;
+    /* 残っていた記録を文書に適用する．適用した記録は基準からの編集としてそのまま残す */
+    bool recover();
+
+    static QString journalDirPath();
+
+    static constexpr int flushInterval = 1000;          //msec
+    static constexpr qint64 compactSize = 1 << 20;      //これより大きくなれば記録をまとめ直す
+
+private slots:
+    void flush();
+
+private:
+    struct Record;
+    struct Coalescer;
+    struct Shared;
+
+    static QString journalFilePath(const QString& path);
+    static void process(const QSharedPointer<Shared>& shared);
+
+    void append(const Record& record);
+    void schedule();
+    void receiveContentsChange(int position, int removed, int added);
+    void recordCells(int top, int left, int bottom, int right);
+    void recordSnapshot();
+    bool apply(const Record& record);
+
+    Kind kind;
+    QString filePath;
+    QSharedPointer<Shared> shared;
+    QScopedPointer<Coalescer> batch;
+    QTimer *flushTimer;
+    bool enabled = true;
+    quint64 baseHash = 0;
+    quint32 lastMark = 0;
+    qint64 recorded = 0;        //基準からの記録の数
+    qint64 recordedAtMark = 0;  //最後の印を付けたときのrecorded
+    bool started = false;       //reset()かrecover()をした．それ以降の記録はこの実行のもの
+
+    QPointer<QTextDocument> document;
+    QPointer<SheetModel> model;
+    QString shadowText;         //記録済みの内容．ハイライトなどの書式だけの変更を除くため
+};
+
+#endif // EDITJOURNAL_H
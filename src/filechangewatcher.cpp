@@ -0,0 +1,116 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "filechangewatcher.h"
+
+#include <QFileSystemWatcher>
+#include <QFileInfo>
+#include <QTimer>
+#include "ioscheduler.h"
+#include "xxhash.h"
+
+
+FileChangeWatcher::FileChangeWatcher(QObject *parent)
+    : QObject(parent)
+    , watcher(new QFileSystemWatcher(this))
+    , timer(new QTimer(this))
+{
+    //ファイルに変更があった瞬間に読み込んでも書き込み途中のことがあるため，通知が落ち着くまで待つ
+    timer->setSingleShot(true);
+    timer->setInterval(500);
+
+    connect(watcher, &QFileSystemWatcher::fileChanged, this, &FileChangeWatcher::receiveFileChanged);
+    connect(timer, &QTimer::timeout, this, &FileChangeWatcher::checkPendingFiles);
+}
+
+void FileChangeWatcher::addPath(const QString& path)
+{
+    if(path.isEmpty()) return;
+
+    watcher->addPath(path);
+
+    /* 呼び出し側は追加と同時に読み込むので，その内容を基準にする */
+    hashes.remove(path);
+    updateHash(path, false);
+}
+
+void FileChangeWatcher::removePath(const QString& path)
+{
+    watcher->removePath(path);
+    pendingPaths.remove(path);
+    hashes.remove(path);
+}
+
+void FileChangeWatcher::removePaths(const QStringList& paths)
+{
+    for(const QString& path : paths)
+        removePath(path);
+}
+
+QStringList FileChangeWatcher::files() const
+{
+    return watcher->files();
+}
+
+void FileChangeWatcher::setDelay(const int msec)
+{
+    timer->setInterval(msec);
+}
+
+void FileChangeWatcher::receiveFileChanged(const QString& path)
+{
+    if(!QFileInfo::exists(path))
+    {
+        /* 一時ファイルからの置き換えなどで一瞬だけ存在しない場合もあるので，ハッシュは残しておく */
+        emit fileRemoved(path);
+    }
+
+    pendingPaths.insert(path);
+    timer->start();
+}
+
+void FileChangeWatcher::checkPendingFiles()
+{
+    const QSet<QString> paths = pendingPaths;
+    pendingPaths.clear();
+
+    for(const QString& path : paths)
+    {
+        if(!QFileInfo::exists(path)) continue;
+
+        //置き換えられたファイルは監視から外れるため，追加し直す
+        if(!watcher->files().contains(path)) watcher->addPath(path);
+
+        if(!hashes.contains(path))
+        {
+            //基準のハッシュがまだ求まっていなければ比べられないので，変更されたものとする
+            emit contentChanged(path);
+            updateHash(path, false);
+            continue;
+        }
+
+        updateHash(path, true);
+    }
+}
+
+void FileChangeWatcher::updateHash(const QString& path, const bool notify)
+{
+    IoScheduler::schedule(path, IoScheduler::Operation::Hash, IoScheduler::Priority::Background, this,
+                          [](const QString& path, bool& ok) { return QVariant::fromValue(XXHash64::hashFile(path, &ok)); },
+                          [this, path, notify](const QVariant& result, const bool ok) {
+        if(!ok || !watcher->files().contains(path)) return;
+
+        const quint64 hash = result.value<quint64>();
+        const auto iter = hashes.constFind(path);
+        const bool changed = (iter == hashes.constEnd() || iter.value() != hash);
+
+        hashes.insert(path, hash);
+        if(notify && changed) emit contentChanged(path);
+    });
+}
@@ -0,0 +1,59 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef FILECHANGEWATCHER_H
+#define FILECHANGEWATCHER_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+
+class QFileSystemWatcher;
+class QTimer;
+
+
+
+/* QFileSystemWatcherの代わりに使う，内容が変わったときだけ通知するファイルの監視．
+ * gnuplotが同じ画像を書き直した場合や，更新日時だけが変わった場合には何もしない．
+ *
+ * 監視するファイルごとに内容のハッシュ(XXH64)を保持し，変更の通知が落ち着いてから(delay)
+ * 別スレッドでハッシュを計算し直して，前回と異なればcontentChanged()を発する．
+ */
+class FileChangeWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FileChangeWatcher(QObject *parent);
+
+    void addPath(const QString& path);
+    void removePath(const QString& path);
+    void removePaths(const QStringList& paths);
+    QStringList files() const;
+
+    void setDelay(const int msec);
+
+private slots:
+    void receiveFileChanged(const QString& path);
+    void checkPendingFiles();
+
+private:
+    void updateHash(const QString& path, const bool notify);
+
+    QFileSystemWatcher *watcher;
+    QTimer *timer;
+    QSet<QString> pendingPaths;
+    QHash<QString, quint64> hashes;     //最後に確認した内容のハッシュ
+
+signals:
+    void contentChanged(const QString& path);
+    void fileRemoved(const QString& path);
+};
+
+#endif // FILECHANGEWATCHER_H
@@ -30,6 +30,12 @@ FileTreeSettingWidget::FileTreeSettingWidget(QWidget *parent)
     setupLayout();
 
     loadXmlSetting();
+
+    /* NumPyの配列とArrowのファイルは設定になくても開けるようにする */
+    if(!TreeSheetItem::suffix.contains("npy")) addSheetExt("npy", int(TreeSheetItem::ReadType::Npy));
+    if(!TreeSheetItem::suffix.contains("npz")) addSheetExt("npz", int(TreeSheetItem::ReadType::Npz));
+    if(!TreeSheetItem::suffix.contains("arrow")) addSheetExt("arrow", int(TreeSheetItem::ReadType::Arrow));
+    if(!TreeSheetItem::suffix.contains("feather")) addSheetExt("feather", int(TreeSheetItem::ReadType::Arrow));
 }
 
 FileTreeSettingWidget::~FileTreeSettingWidget()
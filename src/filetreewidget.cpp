@@ -14,7 +14,6 @@
 #include <QInputDialog>
 #include <QFileDialog>
 #include <QFileSystemWatcher>
-#include <QThread>
 #include <QMenu>
 #include <QAction>
 #include <QTimer>
@@ -24,17 +23,22 @@
 
 #include "imagedisplay.h"
 #include "pdfviewer.h"
+#include "bigfileviewer.h"
 #include "gnuplot.h"
 #include "tablesettingwidget.h"
 #include "textedit.h"
 #include "iofile.h"
+#include "editjournal.h"
+#include "ioscheduler.h"
 #include "standardpixmap.h"
 #include "logger.h"
+#include "xxhash.h"
+#include "deflate.h"
+#include "sheetcache.h"
 #include "utility.h"
 
 
 
-QThread TreeFileItem::iothread = QThread();
 QHash<QString, TreeScriptItem::ReadType> TreeScriptItem::suffix = QHash<QString, TreeScriptItem::ReadType>();
 QHash<QString, TreeSheetItem::ReadType> TreeSheetItem::suffix = QHash<QString, TreeSheetItem::ReadType>();
 QHash<QString, TreeFileItem*> TreeFileItem::list = QHash<QString, TreeFileItem*>();
@@ -135,6 +139,26 @@ void TreeFileItem::setSavedState(const bool isSaved)
     }
 }
 
+/* 前回の異常終了で保存されなかった編集が残っていれば，復元するか確認する．hashは読み込んだ内容を表すハッシュ(EditJournal::reset()) */
+void TreeFileItem::recoverJournal(EditJournal *journal, const quint64 hash)
+{
+    if(journal->canRecover(hash))
+    {
+        const QMessageBox::StandardButton reply = QMessageBox::question(nullptr, "Recovery",
+                                                                        "\"" + info.fileName() + "\" has unsaved changes from the last session.\n"
+                                                                        "Do you want to recover them??", QMessageBox::Yes | QMessageBox::No);
+        if(reply == QMessageBox::Yes)
+        {
+            if(!journal->recover())
+                __LOGOUT__("some changes of \"" + info.absoluteFilePath() + "\" could not be recovered.", Logger::LogLevel::Warn);
+            setSavedState(false);
+            return;
+        }
+    }
+
+    journal->reset(hash);
+}
+
 
 
 
@@ -270,7 +294,10 @@ TreeScriptItem::TreeScriptItem(QTreeWidgetItem *parent, const QFileInfo& info)
     : TreeFileItem(parent, (int)FileTreeWidget::TreeItemType::Script, info)
     , editor(new TextEdit)
     , process(new GnuplotProcess(nullptr))
+    , journal(new EditJournal(EditJournal::Kind::Text, info.absoluteFilePath(), this))
 {
+    journal->setDocument(editor->document());
+
     connect(editor, &TextEdit::textChanged, this, &TreeScriptItem::setEdited);
     connect(process, &GnuplotProcess::standardOutputRead, logger, QOverload<const QString&, const Logger::LogLevel&>::of(&Logger::output));
     connect(process, &GnuplotProcess::aboutToExecute, editor, &TextEdit::resetErrorLineNumber);
@@ -280,6 +307,7 @@ TreeScriptItem::TreeScriptItem(QTreeWidgetItem *parent, const QFileInfo& info)
     connect(this, &TreeScriptItem::destroyed, process, &GnuplotProcess::close);
     connect(this, &TreeScriptItem::destroyed, process, &GnuplotProcess::deleteLater);
     connect(this, &TreeScriptItem::pathChanged, [this](){ if(editor) editor->setParentFolderPath(this->info.absolutePath()); });
+    connect(this, &TreeScriptItem::pathChanged, journal, [this](const QString&, const QString& newPath){ journal->setFilePath(newPath); });
 
     editor->setParentFolderPath(info.absolutePath());
     process->moveToThread(gnuplotExecutor->gnuplotThread());
@@ -297,6 +325,14 @@ TreeScriptItem::~TreeScriptItem()
 }
 
 void TreeScriptItem::save()
+{
+    IoScheduler::Batch batch;
+    appendSaveJob(batch);
+
+    IoScheduler::schedule(batch, IoScheduler::Operation::Write, IoScheduler::Priority::Background);
+}
+
+void TreeScriptItem::appendSaveJob(IoScheduler::Batch& batch)
 {
     if(!editor) return; //まだ一度も選択されていない場合など
 
@@ -306,11 +342,26 @@ void TreeScriptItem::save()
     {
     case ReadType::Text:
     {
-        WriteTxtFile *writeTxt = new WriteTxtFile(nullptr);
-        writeTxt->moveToThread(&iothread);
-        connect(this, &TreeScriptItem::saveRequested, writeTxt, &WriteTxtFile::write);
-        connect(writeTxt, &WriteTxtFile::finished, this, &TreeScriptItem::receiveSavedResult);
-        connect(writeTxt, &WriteTxtFile::finished, writeTxt, &WriteTxtFile::deleteLater);
+        const QString text = editor->toPlainText();
+        const quint64 hash = XXHash64::hash(text.toUtf8());
+
+        /* 保存中の編集は保存できた後も記録に残す */
+        const quint32 mark = journal->checkpoint();
+
+        /* 編集した後に元に戻した場合など，内容が変わっていなければ書き込まない */
+        if(hash == savedHash)
+        {
+            journal->commit(mark, hash);
+            receiveSavedResult(true);
+            break;
+        }
+
+        batch.append({ info.absoluteFilePath(), this,
+                       [text](const QString& path, bool& ok) { WriteTxtFile::toTxt(path, text, ok); return QVariant(); },
+                       [this, hash, mark](const QVariant&, const bool ok) {
+                           if(ok) { savedHash = hash; journal->commit(mark, hash); }
+                           receiveSavedResult(ok);
+                       } });
         break;
     }
     case ReadType::Html:
@@ -320,8 +371,6 @@ void TreeScriptItem::save()
         emit saved();
         return;
     }
-
-    emit saveRequested(info.absoluteFilePath(), editor->toPlainText());
 }
 
 void TreeScriptItem::load()
@@ -331,11 +380,9 @@ void TreeScriptItem::load()
     case ReadType::Text:
     case ReadType::Html:
     {
-        ReadTxtFile *readTxt = new ReadTxtFile(nullptr);
-        readTxt->moveToThread(&iothread);
-        connect(this, &TreeScriptItem::loadRequested, readTxt, &ReadTxtFile::read);
-        connect(readTxt, &ReadTxtFile::finished, this, &TreeScriptItem::receiveLoadedResult);
-        connect(readTxt, &ReadTxtFile::finished, readTxt, &ReadTxtFile::deleteLater);
+        IoScheduler::schedule(info.absoluteFilePath(), IoScheduler::Operation::Read, IoScheduler::Priority::Interactive, this,
+                              [](const QString& path, bool& ok) { QString text; ReadTxtFile::getTxt(path, text, ok); return QVariant(text); },
+                              [this](const QVariant& text, const bool ok) { receiveLoadedResult(text.toString(), ok); });
         break;
     }
     default:
@@ -343,8 +390,6 @@ void TreeScriptItem::load()
         return;
     }
 
-    emit loadRequested(info.absoluteFilePath());
-
     TreeFileItem::load();
 }
 
@@ -384,11 +429,16 @@ void TreeScriptItem::receiveLoadedResult(const QString& text, const bool& ok)
         {
         case ReadType::Text:
         {
+            journal->setEnabled(false);
             editor->setPlainText(text);
+            savedHash = XXHash64::hash(editor->toPlainText().toUtf8());
+            journal->setEnabled(true);
             break;
         }
         case ReadType::Html:
         {
+            /* htmlとしては保存できないため記録しない */
+            journal->setEnabled(false);
             editor->clear();
             editor->appendHtml(text);
             break;
@@ -399,6 +449,9 @@ void TreeScriptItem::receiveLoadedResult(const QString& text, const bool& ok)
 
         setSavedState(true); //データをセットしてから
 
+        if(suffix.value(info.suffix()) == ReadType::Text)
+            recoverJournal(journal, savedHash);
+
         return;
     }
 
@@ -416,10 +469,15 @@ void TreeScriptItem::receiveLoadedResult(const QString& text, const bool& ok)
 TreeSheetItem::TreeSheetItem(QTreeWidgetItem *parent, const QFileInfo &info)
     : TreeFileItem(parent, (int)FileTreeWidget::TreeItemType::Sheet, info)
     , table(new TableArea(nullptr))
+    , journal(new EditJournal(EditJournal::Kind::Sheet, info.absoluteFilePath(), this))
 {
     setIcon(0, StandardPixmap::File::document());
 
+    journal->setModel(table->tableWidget()->sheetModel());
+
     connect(table->tableWidget(), &GnuplotTable::cellChanged, this, &TreeSheetItem::setEdited);
+    connect(table->tableWidget(), &GnuplotTable::groupedSheetReady, this, [this](const SheetData& sheet){ emit derivedSheetCreated(this, sheet, "group"); });
+    connect(this, &TreeSheetItem::pathChanged, journal, [this](const QString&, const QString& newPath){ journal->setFilePath(newPath); });
 }
 
 TreeSheetItem::~TreeSheetItem()
@@ -427,73 +485,174 @@ TreeSheetItem::~TreeSheetItem()
     delete table; table = nullptr;
 }
 
+/* "data.csv.gz"のように圧縮されたファイルは，圧縮前の拡張子で種類を決める */
+QString TreeSheetItem::sheetSuffix(const QFileInfo& info)
+{
+    if(info.suffix().compare("gz", Qt::CaseInsensitive) == 0)
+        return QFileInfo(info.completeBaseName()).suffix();
+
+    return info.suffix();
+}
+
 void TreeSheetItem::save()
+{
+    IoScheduler::Batch batch;
+    appendSaveJob(batch);
+
+    IoScheduler::schedule(batch, IoScheduler::Operation::Write, IoScheduler::Priority::Background);
+}
+
+void TreeSheetItem::appendSaveJob(IoScheduler::Batch& batch)
 {
     if(!table) return;  //まだ一度も表示されていない場合
 
     emit aboutToSave();
 
-    switch(suffix.value(info.suffix()))
+    /* 読み込んだファイルをmmapしている列は，置き換える前にファイルから切り離す */
+    table->tableWidget()->sheetModel()->detachMapping(info.absoluteFilePath());
+
+    const SheetData sheet = table->tableWidget()->sheet();
+
+    /* 保存中の編集は保存できた後も記録に残す */
+    const quint32 mark = journal->checkpoint();
+
+    std::function<void(const QString&, const SheetData&, bool&)> write;
+
+    switch(suffix.value(sheetSuffix(info)))
     {
     case ReadType::Csv:
-    {
-        WriteCsvFile *writeCsv = new WriteCsvFile(nullptr);
-        writeCsv->moveToThread(&iothread);
-        connect(this, &TreeSheetItem::saveRequested, writeCsv, &WriteCsvFile::write);
-        connect(writeCsv, &WriteCsvFile::finished, this, &TreeSheetItem::receiveSavedResult);
-        connect(writeCsv, &WriteCsvFile::finished, writeCsv, &WriteCsvFile::deleteLater);
+        write = &WriteCsvFile::toCsv;
         break;
-    }
     case ReadType::Tsv:
-    {
-        WriteTsvFile *writeTsv = new WriteTsvFile(nullptr);
-        writeTsv->moveToThread(&iothread);
-        connect(this, &TreeSheetItem::saveRequested, writeTsv, &WriteTsvFile::write);
-        connect(writeTsv, &WriteTsvFile::finished, this, &TreeSheetItem::receiveSavedResult);
-        connect(writeTsv, &WriteTsvFile::finished, writeTsv, &WriteTsvFile::deleteLater);
+        write = &WriteTsvFile::toTsv;
+        break;
+    case ReadType::Npy:
+        write = [](const QString& path, const SheetData& sheet, bool& ok) {
+            NumpyFile::Layout like;
+            NumpyFile::readNpyLayout(path, like);   //元のファイルの型と並びで書き出す．読めなければfloat64
+            ok = NumpyFile::writeNpy(path, sheet, like);
+        };
+        break;
+    case ReadType::Arrow:
+        write = [](const QString& path, const SheetData& sheet, bool& ok) { ok = ArrowFile::write(path, sheet); };
         break;
-    }
     default:
         __LOGOUT__("Failed to save this file \"" + info.absoluteFilePath() + "\".", Logger::LogLevel::Error);
         emit saved();
         return;
     }
 
-    emit saveRequested(info.absoluteFilePath(), table->tableWidget()->getData<QString>());
+    /* 内容のハッシュは書き込むスレッドで求め，変わっていなければ書き込まずに保存できたことにする．
+     * 読み込んだ後の最初の保存ではまだハッシュがないため，必ず書き込む */
+    const quint64 lastHash = savedHash;
+    IoScheduler::Task task = [sheet, lastHash, write](const QString& path, bool& ok) {
+        const quint64 hash = sheet.contentHash();
+        if(hash == lastHash) ok = true;
+        else write(path, sheet, ok);
+        return QVariant(QVariantList{ QVariant::fromValue(hash), QVariant::fromValue(fileStamp(path)) });
+    };
+
+    batch.append({ info.absoluteFilePath(), this, task,
+                   [this, mark](const QVariant& result, const bool ok) {
+                       const QVariantList values = result.toList();
+                       if(ok)
+                       {
+                           savedHash = values.at(0).value<quint64>();
+                           savedStamp = values.at(1).value<quint64>();
+                           journal->commit(mark, savedStamp);
+                       }
+                       receiveSavedResult(ok);
+                   } });
 }
 
 void TreeSheetItem::load()
 {
-    switch(suffix.value(info.suffix()))
+    std::function<void(const QString&, SheetData&, bool&)> getSheet;
+
+    switch(suffix.value(sheetSuffix(info)))
     {
     case ReadType::Csv:
-    {
-        ReadCsvFile *readCsv = new ReadCsvFile(nullptr);
-        readCsv->moveToThread(&iothread);
-        connect(this, &TreeSheetItem::loadRequested, readCsv, &ReadCsvFile::read);
-        connect(readCsv, &ReadCsvFile::finished, this, &TreeSheetItem::receiveLoadResult);
-        connect(readCsv, &ReadCsvFile::finished, readCsv, &ReadCsvFile::deleteLater);
+        getSheet = &ReadCsvFile::getSheet;
         break;
-    }
     case ReadType::Tsv:
+        getSheet = &ReadTsvFile::getSheet;
+        break;
+    case ReadType::Xlsx:
+        getSheet = &ReadXlsxFile::getSheet;
+        break;
+    case ReadType::Npy:
+        getSheet = [](const QString& path, SheetData& sheet, bool& ok) { ok = NumpyFile::readNpy(path, sheet); };
+        break;
+    case ReadType::Npz:
+        getSheet = [](const QString& path, SheetData& sheet, bool& ok) { ok = NumpyFile::readNpz(path, sheet); };
+        break;
+    case ReadType::Raw:
     {
-        ReadTsvFile *readTsv = new ReadTsvFile(nullptr);
-        readTsv->moveToThread(&iothread);
-        connect(this, &TreeSheetItem::loadRequested, readTsv, &ReadTsvFile::read);
-        connect(readTsv, &ReadTsvFile::finished, this, &TreeSheetItem::receiveLoadResult);
-        connect(readTsv, &ReadTsvFile::finished, readTsv, &ReadTsvFile::deleteLater);
+        NumpyFile::Layout layout;
+        if(!requestRawLayout(layout)) return;
+        getSheet = [layout](const QString& path, SheetData& sheet, bool& ok) { ok = NumpyFile::readRaw(path, layout, sheet); };
         break;
     }
+    case ReadType::Arrow:
+        getSheet = [](const QString& path, SheetData& sheet, bool& ok) { ok = ArrowFile::read(path, sheet); };
+        break;
     default:
         __LOGOUT__("Fialed to load this file \"" + info.absoluteFilePath() + "\".", Logger::LogLevel::Error);
         return;
     }
 
-    emit loadRequested(info.absoluteFilePath());
+    IoScheduler::schedule(info.absoluteFilePath(), IoScheduler::Operation::Read, IoScheduler::Priority::Interactive, this,
+                          [getSheet](const QString& path, bool& ok) {
+                              /* 内容のハッシュはすべてのセルを文字列にするため，mmapで読んだシートでは読み込みよりずっと遅い．
+                               * 編集の記録の基準には読み込む前のファイルのfileStamp()を使い，ハッシュは保存するときに求める */
+                              const quint64 stamp = fileStamp(path);
+                              SheetData sheet;
+                              getSheet(path, sheet, ok);
+                              return QVariant(QVariantList{ QVariant::fromValue(sheet), QVariant::fromValue(stamp) });
+                          },
+                          [this](const QVariant& result, const bool ok) {
+                              const QVariantList values = result.toList();
+                              if(ok)
+                              {
+                                  savedHash = 0;
+                                  savedStamp = values.at(1).value<quint64>();
+                              }
+                              receiveLoadResult(values.at(0).value<SheetData>(), ok);
+                          });
 
     TreeFileItem::load();
 }
 
+quint64 TreeSheetItem::fileStamp(const QString& path)
+{
+    const SheetCache::Stamp stamp = SheetCache::stamp(path);
+    return XXHash64::hash(QByteArray::number(stamp.size) + ':' + QByteArray::number(stamp.modified));
+}
+
+/* ヘッダーのないバイナリは型と形状を指定してもらい，アイテムごとに覚えておく */
+bool TreeSheetItem::requestRawLayout(NumpyFile::Layout& layout)
+{
+    while(!NumpyFile::parseRawLayout(rawLayoutSpec, layout))
+    {
+        if(!rawLayoutSpec.isEmpty())
+            __LOGOUT__("invalid raw binary layout \"" + rawLayoutSpec + "\".", Logger::LogLevel::Error);
+
+        bool ok = false;
+        const QString spec = QInputDialog::getText(nullptr, "Raw Binary",
+                                                   "Enter the layout of \"" + info.fileName() + "\".\n"
+                                                   "dtype: f4, f8, i1-i8, u1-u8, b1 (prefix > for big endian)\n"
+                                                   "shape: -1x3 for 3 columns, order: C (row major) or F (column major)",
+                                                   QLineEdit::EchoMode::Normal,
+                                                   (rawLayoutSpec.isEmpty()) ? "dtype=<f8 shape=-1 offset=0 order=C" : rawLayoutSpec,
+                                                   &ok);
+        if(!ok || spec.isEmpty()) return false;
+
+        rawLayoutSpec = spec;
+    }
+
+    return true;
+}
+
 void TreeSheetItem::remove()
 {
     QFile file(info.absoluteFilePath());
@@ -517,12 +676,16 @@ void TreeSheetItem::receiveSavedResult(const bool& ok)
     }
 }
 
-void TreeSheetItem::receiveLoadResult(const QList<QList<QString> >& data, const bool& ok)
+void TreeSheetItem::receiveLoadResult(const SheetData& data, const bool& ok)
 {
     if(ok)
     {
-        table->tableWidget()->setData(data);
+        journal->setEnabled(false);
+        table->tableWidget()->setSheet(data);
+        journal->setEnabled(true);
         setSavedState(true);  //データをセットしてから
+
+        recoverJournal(journal, savedStamp);
     }
     else
     {
@@ -677,6 +840,96 @@ void TreePdfItem::setPdfPath(const QString &, const QString &path)
 
 
 
+TreeBigFileItem::TreeBigFileItem(QTreeWidgetItem *parent, const QFileInfo &info)
+    : TreeFileItem(parent, (int)FileTreeWidget::TreeItemType::BigFile, info)
+    , viewer(new BigFileViewer(nullptr))
+{
+    setIcon(0, StandardPixmap::File::document());
+
+    connect(this, &TreeBigFileItem::pathChanged, this, &TreeBigFileItem::setViewerPath);
+}
+
+bool TreeBigFileItem::isBigFile(const QFileInfo &info)
+{
+    if(info.size() < sizeThreshold) return false;
+
+    /* 圧縮されたファイルはバイト列のままでは表示できない．"data.csv.gz"はシートとして展開しながら読み込む */
+    if(info.suffix().compare("gz", Qt::CaseInsensitive) == 0) return false;
+    QFile file(info.absoluteFilePath());
+    if(file.open(QIODevice::ReadOnly) && GzipReader::isGzip(&file)) return false;
+
+    const QString suffix = TreeSheetItem::sheetSuffix(info);
+    if(TreeSheetItem::suffix.contains(suffix))
+    {
+        const TreeSheetItem::ReadType type = TreeSheetItem::suffix.value(suffix);
+        return type == TreeSheetItem::ReadType::Csv || type == TreeSheetItem::ReadType::Tsv;
+    }
+
+    return !TreeScriptItem::suffix.contains(info.suffix()) &&
+           !ImageDisplay::isValidExtension(info.suffix()) &&
+           info.suffix() != "pdf";
+}
+
+void TreeBigFileItem::save()
+{
+    __LOGOUT__("no supported to save.", Logger::LogLevel::Warn);
+}
+
+void TreeBigFileItem::load()
+{
+    if(!isLoaded())
+        viewer->setFilePath(info.absoluteFilePath());
+    else
+        viewer->reload();
+
+    TreeFileItem::load();
+}
+
+void TreeBigFileItem::remove()
+{
+    //mmapしたままでは削除できない環境がある
+    viewer->closeFile();
+
+    QFile file(info.absoluteFilePath());
+
+    emit removed(file.remove());
+}
+
+void TreeBigFileItem::cancelLoading()
+{
+    if(viewer && isLoaded())
+        viewer->closeFile();
+}
+
+TreeBigFileItem::~TreeBigFileItem()
+{
+    if(viewer)
+    {
+        delete viewer;
+        viewer = nullptr;
+    }
+}
+
+QWidget *TreeBigFileItem::widget() const
+{
+    return viewer;
+}
+
+void TreeBigFileItem::setViewerPath(const QString &, const QString &path)
+{
+    if(viewer && isLoaded())
+        viewer->setFilePath(path);
+}
+
+
+
+
+
+
+
+
+
+
 
 
 
@@ -698,8 +951,6 @@ FileTreeWidget::FileTreeWidget(QWidget *parent)
     , fileMenu(nullptr)
     , dirMenu(nullptr)
 {
-    TreeFileItem::iothread.start();
-
     setContextMenuPolicy(Qt::ContextMenuPolicy::CustomContextMenu);
     connect(this, &FileTreeWidget::customContextMenuRequested, this, &FileTreeWidget::onCustomContextMenu);
     initializeContextMenu();
@@ -713,8 +964,14 @@ FileTreeWidget::FileTreeWidget(QWidget *parent)
 
 FileTreeWidget::~FileTreeWidget()
 {
-    TreeFileItem::iothread.quit();
-    TreeFileItem::iothread.wait();
+    /* 大きなファイルの索引の作成は保存と違って途中でやめてよいので，終わるのを待たない */
+    foreach(TreeFileItem *item, TreeFileItem::list)
+    {
+        if(item->type() == (int)TreeItemType::BigFile)
+            static_cast<TreeBigFileItem*>(item)->cancelLoading();
+    }
+
+    IoScheduler::waitForDone();
 }
 
 void FileTreeWidget::initializeContextMenu()
@@ -733,6 +990,7 @@ void FileTreeWidget::initializeContextMenu()
         QAction *actAdd = new QAction("Add", dirMenu);
         QAction *actNew = new QAction("New", dirMenu);
         QAction *actCopyFullPath = new QAction("Copy Full Path", fileMenu);
+        QAction *actCopyGnuplotBinary = new QAction("Copy Gnuplot Binary Clause", fileMenu);
         QAction *actOpenInExplorer = new QAction("Open in Explorer", fileMenu);
         QAction *actOpenInDefaultApp = new QAction("Open in Default App", fileMenu);
 
@@ -742,6 +1000,7 @@ void FileTreeWidget::initializeContextMenu()
         connect(actAdd, &QAction::triggered, this, &FileTreeWidget::addFileFromDialog);
         connect(actNew, &QAction::triggered, this, &FileTreeWidget::newFileFromDialog);
         connect(actCopyFullPath, &QAction::triggered, this, &FileTreeWidget::copyFullPath);
+        connect(actCopyGnuplotBinary, &QAction::triggered, this, &FileTreeWidget::copyGnuplotBinaryClause);
         connect(actOpenInExplorer, &QAction::triggered, this, &FileTreeWidget::openInExplorer);
         connect(actOpenInDefaultApp, &QAction::triggered, this, &FileTreeWidget::openInDefaultApp);
 
@@ -750,6 +1009,7 @@ void FileTreeWidget::initializeContextMenu()
         fileMenu->addAction(actExport);
         fileMenu->addSeparator();
         fileMenu->addAction(actCopyFullPath);
+        fileMenu->addAction(actCopyGnuplotBinary);
         fileMenu->addAction(actOpenInExplorer);
         fileMenu->addAction(actOpenInDefaultApp);
 
@@ -777,6 +1037,7 @@ void FileTreeWidget::onCustomContextMenu(const QPoint& pos)
     case TreeItemType::Image:
     case TreeItemType::Pdf:
     case TreeItemType::NoCategorized:
+    case TreeItemType::BigFile:
     {
         fileMenu->exec(viewport()->mapToGlobal(pos));
         break;
@@ -1091,7 +1352,9 @@ void FileTreeWidget::updateGnuplotModelTree(const QString &path)
 
         if(TreeScriptItem::suffix.contains(info.suffix()))
             item = new TreeScriptItem(scriptFolderItem, info);
-        else if(TreeSheetItem::suffix.contains(info.suffix()))
+        else if(TreeBigFileItem::isBigFile(info))
+            item = new TreeBigFileItem(TreeSheetItem::suffix.contains(TreeSheetItem::sheetSuffix(info)) ? sheetFolderItem : otherFolderItem, info);
+        else if(TreeSheetItem::suffix.contains(TreeSheetItem::sheetSuffix(info)))
             item = new TreeSheetItem(sheetFolderItem, info);
         else if(ImageDisplay::isValidExtension(info.suffix()))
             item = new TreeImageItem(otherFolderItem, info);
@@ -1139,7 +1402,9 @@ void FileTreeWidget::updateFileSystemModelTree(const QString &path, QTreeWidgetI
 
         if(TreeScriptItem::suffix.contains(info.suffix()))
             item = new TreeScriptItem(parent, info);
-        else if(TreeSheetItem::suffix.contains(info.suffix()))
+        else if(TreeBigFileItem::isBigFile(info))
+            item = new TreeBigFileItem(parent, info);
+        else if(TreeSheetItem::suffix.contains(TreeSheetItem::sheetSuffix(info)))
             item = new TreeSheetItem(parent, info);
         else if(ImageDisplay::isValidExtension(info.suffix()))
             item = new TreeImageItem(parent, info);
@@ -1181,6 +1446,41 @@ void FileTreeWidget::addTreeFileItem(TreeFileItem *item)
     TreeFileItem::list.insert(item->fileInfo().absoluteFilePath(), item);
     connect(item, &TreeFileItem::aboutToSave, this, &FileTreeWidget::countUpSaving);
     connect(item, &TreeFileItem::saved, this, &FileTreeWidget::countDownSaving);
+
+    if(TreeSheetItem *sheetItem = qobject_cast<TreeSheetItem*>(item))
+        connect(sheetItem, &TreeSheetItem::derivedSheetCreated, this, &FileTreeWidget::addDerivedSheet);
+}
+
+/* 元のシートと同じフォルダに"<元の名前>_<tag>.csv"として書き出し，ツリーに加えて開く．列の名前は1行目に書く */
+void FileTreeWidget::addDerivedSheet(TreeSheetItem *source, const SheetData& sheet, const QString& tag)
+{
+    const QString csvSuffix = TreeSheetItem::suffix.key(TreeSheetItem::ReadType::Csv, "csv");
+    const QFileInfo& sourceInfo = source->fileInfo();
+    const QString baseName = QFileInfo(sourceInfo.completeBaseName()).completeBaseName();   //data.csv.gzならdata
+
+    QString path = sourceInfo.absolutePath() + "/" + baseName + "_" + tag + "." + csvSuffix;
+    for(int i = 1; QFileInfo::exists(path) || TreeFileItem::list.contains(path); ++i)
+        path = sourceInfo.absolutePath() + "/" + baseName + "_" + tag + QString::number(i) + "." + csvSuffix;
+
+    SheetData data = sheet;
+    const QStringList& names = sheet.columnNames();
+    if(!names.isEmpty())
+    {
+        data.insertRows(0, 1);
+        for(qsizetype col = 0; col < qMin(names.size(), data.columnCount()); ++col)
+            data.setText(0, col, names.at(col));
+    }
+
+    if(!writeSheetFile(path, data, ','))
+    {
+        __LOGOUT__("failed to write \"" + path + "\".", Logger::LogLevel::Error);
+        return;
+    }
+
+    TreeSheetItem *item = new TreeSheetItem(source->parent(), QFileInfo(path));
+    addTreeFileItem(item);
+    setCurrentItem(item);
+    emit itemDoubleClicked(item, 0);
 }
 
 void FileTreeWidget::detectRemovedFile(const QString &path)
@@ -1232,18 +1532,76 @@ void FileTreeWidget::setFolderPath(const QString& folderPath)
 
 void FileTreeWidget::saveAllFile()
 {
-    int count = 0;
+    /* 内容が変わっていない項目ではsaved()がすぐに発せられるため，すべて要求し終わるまでallSaved()を発しないようにする */
+    countUpSaving();
+
+    IoScheduler::Batch batch;
+    foreach(TreeFileItem *item, TreeFileItem::list)
+    {
+        if(!item->isSaved())
+            item->appendSaveJob(batch);
+    }
+
+    //書き込みは1つの要求にまとめる
+    IoScheduler::schedule(batch, IoScheduler::Operation::Write, IoScheduler::Priority::Background);
+
+    countDownSaving();
+}
 
+/* scriptの実行に必要なファイルを先に書き込み，書き込まれたらscriptDependenciesSaved()を発する．
+ * 他の未保存のファイルは，その後に別の要求として書き込む */
+void FileTreeWidget::saveForExecution(TreeScriptItem *script)
+{
+    QList<TreeFileItem*> unsaved;
     foreach(TreeFileItem *item, TreeFileItem::list)
     {
         if(!item->isSaved())
+            unsaved.append(item);
+    }
+
+    const QSet<TreeFileItem*> dependencies = scriptDependencies(script, unsaved);
+
+    countUpSaving();
+
+    IoScheduler::Batch required;
+    IoScheduler::Batch others;
+    for(TreeFileItem *item : unsaved)
+        item->appendSaveJob((dependencies.contains(item)) ? required : others);
+
+    IoScheduler::schedule(required, IoScheduler::Operation::Write, IoScheduler::Priority::Interactive,
+                          this, [this, script]() { emit scriptDependenciesSaved(script); });
+    IoScheduler::schedule(others, IoScheduler::Operation::Write, IoScheduler::Priority::Background);
+
+    countDownSaving();
+}
+
+/* candidatesのうち，scriptが使うもの(scriptの中にファイル名が現れるもの)．
+ * loadやcallで呼ばれるスクリプトの中に現れるものも含む．gnuplotは実行したscriptのフォルダーで動くため，
+ * 相対パスかどうかは区別せずにファイル名で判定する */
+QSet<TreeFileItem*> FileTreeWidget::scriptDependencies(TreeScriptItem *script, const QList<TreeFileItem*>& candidates)
+{
+    QSet<TreeFileItem*> dependencies = { script };
+    QList<TreeScriptItem*> stack = { script };
+
+    while(!stack.isEmpty())
+    {
+        TreeScriptItem *item = stack.takeLast();
+        if(!item->editor) continue;
+
+        const QString text = item->editor->toPlainText();
+
+        for(TreeFileItem *candidate : candidates)
         {
-            count++;
-            item->save();
+            if(dependencies.contains(candidate)) continue;
+            if(!text.contains(candidate->fileInfo().fileName())) continue;
+
+            dependencies.insert(candidate);
+            if(TreeScriptItem *child = qobject_cast<TreeScriptItem*>(candidate))
+                stack.append(child);
         }
     }
 
-    if(count == 0) emit allSaved();
+    return dependencies;
 }
 
 void FileTreeWidget::saveAndLoad()
@@ -1451,6 +1809,49 @@ void FileTreeWidget::copyFullPath()
     QApplication::clipboard()->setText(item->fileInfo().absoluteFilePath());
 }
 
+/* npyやヘッダーのないバイナリを，テキストに変換せずにgnuplotで直接読むための指定をクリップボードに貼り付ける．
+ * "file" binary skip=128 format="%float64%float64" record=N endian=little using 1:2
+ */
+void FileTreeWidget::copyGnuplotBinaryClause()
+{
+    if(selectedItems().count() < 1) return;
+    if(TreeItemType(selectedItems().at(0)->type()) != TreeItemType::Sheet) return;
+
+    TreeSheetItem *item = static_cast<TreeSheetItem*>(selectedItems().at(0));
+    const QString path = item->fileInfo().absoluteFilePath();
+
+    NumpyFile::Layout layout;
+    bool ok = false;
+
+    switch(TreeSheetItem::suffix.value(TreeSheetItem::sheetSuffix(item->fileInfo())))
+    {
+    case TreeSheetItem::ReadType::Npy:
+        ok = NumpyFile::readNpyLayout(path, layout);
+        break;
+    case TreeSheetItem::ReadType::Raw:
+        ok = NumpyFile::parseRawLayout(item->rawLayout(), layout) && NumpyFile::resolveRawLayout(path, layout);
+        break;
+    default:
+        __LOGOUT__("gnuplot binary clause is available for npy and raw binary files.", Logger::LogLevel::Warn);
+        return;
+    }
+
+    const QString clause = (ok) ? NumpyFile::gnuplotBinaryClause(layout) : QString();
+    if(clause.isEmpty())
+    {
+        __LOGOUT__("failed to make gnuplot binary clause of \"" + path + "\".", Logger::LogLevel::Error);
+        return;
+    }
+
+    QString cmd = "\"" + path + "\" " + clause + " using ";
+    for(qint64 col = 0; col < layout.columnCount(); ++col)
+        cmd += QString::number(col + 1) + ((col != layout.columnCount() - 1) ? ":" : "");
+
+    QApplication::clipboard()->setText(cmd);
+
+    __LOGOUT__("gnuplot binary clause pasted to the clipboard.", Logger::LogLevel::Info);
+}
+
 void FileTreeWidget::openInExplorer()
 {
     if(selectedItems().count() < 1) return;
@@ -1466,6 +1867,7 @@ void FileTreeWidget::openInExplorer()
     case TreeItemType::Pdf:
     case TreeItemType::Image:
     case TreeItemType::NoCategorized:
+    case TreeItemType::BigFile:
         /* ファイルが存在するフォルダーを開く
          * QDesktopServicesにファイルをしていた場合は既定のアプリケーションで開かれてしまう.*/
         if(!QDesktopServices::openUrl(QUrl::fromLocalFile(item->fileInfo().absolutePath())))
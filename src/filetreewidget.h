@@ -14,8 +14,13 @@
 #include <QTreeWidgetItem>
 #include <QComboBox>
 #include <QFileInfo>
+#include <QSet>
 #include <QApplication>
 #include <QStyle>
+#include "sheetdata.h"
+#include "ioscheduler.h"
+#include "numpyfile.h"
+#include "arrowfile.h"
 
 class TableArea;
 class QFileSystemWatcher;
@@ -23,6 +28,8 @@ class TextEdit;
 class GnuplotProcess;
 class ImageDisplay;
 class PdfViewer;
+class BigFileViewer;
+class EditJournal;
 
 
 
@@ -35,6 +42,8 @@ public:
 
 public:
     virtual void save() = 0;
+    /* save()の書き込みをすぐに要求せずbatchに加える．複数のファイルを1つの要求でまとめて書き込むため */
+    virtual void appendSaveJob(IoScheduler::Batch& batch) { Q_UNUSED(batch); save(); }
     virtual void load() { isLoadedFlag = true; }
     virtual void remove() = 0;
     virtual QWidget* widget() const = 0;
@@ -49,13 +58,13 @@ public:
     const QFileInfo& fileInfo() const { return info; }
 
     static QHash<QString, TreeFileItem*> list;
-    static QThread iothread;
 
 public slots:
     void setEdited() { setSavedState(false); }
 
 protected:
     void setSavedState(const bool isSaved);
+    void recoverJournal(EditJournal *journal, const quint64 hash);
     QFileInfo info;
 
 private:
@@ -150,6 +159,7 @@ public:
 
 public:
     void save() override;
+    void appendSaveJob(IoScheduler::Batch& batch) override;
     void load() override;
     void remove() override;
     QWidget* widget() const override;
@@ -166,9 +176,11 @@ public:
     TextEdit *editor;
     GnuplotProcess *process;
 
+private:
+    quint64 savedHash = 0;      //最後に読み込んだ，または保存した内容のハッシュ
+    EditJournal *journal;
+
 signals:
-    void saveRequested(const QString& path, const QString& text);
-    void loadRequested(const QString& path);
     void closeProcessRequested();
 };
 
@@ -184,25 +196,40 @@ public:
 
     ~TreeSheetItem();
 
-    enum class ReadType { Csv, Tsv };
+    enum class ReadType { Csv, Tsv, Xlsx, Npy, Npz, Raw, Arrow };
     Q_ENUM(ReadType)
 
     void save() override;
+    void appendSaveJob(IoScheduler::Batch& batch) override;
     void load() override;
     void remove() override;
     QWidget *widget() const override;
 
 private slots:
     void receiveSavedResult(const bool& ok);
-    void receiveLoadResult(const QList<QList<QString> >& data, const bool& ok);
+    void receiveLoadResult(const SheetData& data, const bool& ok);
 
 public:
     static QHash<QString, ReadType> suffix;
+    static QString sheetSuffix(const QFileInfo& info);
     TableArea *table;
 
+    const QString& rawLayout() const { return rawLayoutSpec; }
+
+private:
+    bool requestRawLayout(NumpyFile::Layout& layout);
+    /* ファイルのサイズと更新日時のハッシュ．内容のハッシュと違いセルを読まないため，編集の記録の基準にする */
+    static quint64 fileStamp(const QString& path);
+
+private:
+    quint64 savedHash = 0;      //最後に保存した内容のハッシュ．読み込んだ後はまだ求めていない(0)
+    quint64 savedStamp = 0;     //最後に読み込んだ，または保存したファイルのfileStamp()
+    EditJournal *journal;
+    QString rawLayoutSpec;      //ヘッダーのないバイナリの型と形状．NumpyFile::parseRawLayout()の形式
+
 signals:
-    void saveRequested(const QString& path, const QList<QList<QString> >& data);
-    void loadRequested(const QString& path);
+    /* シートから作ったシート(集計の結果など)．tagはファイル名に付ける */
+    void derivedSheetCreated(TreeSheetItem *source, const SheetData& sheet, const QString& tag);
 };
 
 
@@ -261,6 +288,39 @@ private:
 
 
 
+/* 編集するには大きすぎるデータファイル．TableWidgetに読み込まず，読み取り専用で表示する */
+class TreeBigFileItem : public TreeFileItem
+{
+    Q_OBJECT
+public:
+    explicit TreeBigFileItem(QTreeWidgetItem *parent, const QFileInfo& info);
+    ~TreeBigFileItem();
+
+public:
+    void save() override;
+    void load() override;
+    void remove() override;
+    QWidget *widget() const override;
+
+    void cancelLoading();
+
+    /* sizeThreshold以上のテキストのシート(csv, tsv)と，分類されないファイル */
+    static bool isBigFile(const QFileInfo& info);
+    inline static qint64 sizeThreshold = 256 * 1024 * 1024;
+
+private:
+    void setViewerPath(const QString&, const QString& path);
+
+private:
+    BigFileViewer *viewer;
+};
+
+
+
+
+
+
+
 
 class FileTreeWidget : public QTreeWidget
 {
@@ -270,7 +330,7 @@ public:
     ~FileTreeWidget();
 
     enum class FileTreeModel { FileSystem, Gnuplot };
-    enum class TreeItemType { Script = 1000, Sheet, Image, Pdf, NoCategorized, Dir, Category };
+    enum class TreeItemType { Script = 1000, Sheet, Image, Pdf, NoCategorized, Dir, Category, BigFile };
     Q_ENUM(FileTreeModel)
 
     static QStringList fileFilter;
@@ -283,6 +343,7 @@ public slots:
     void setFolderPath(const QString& folderPath);
     void updateFileTree();
     void saveAllFile();
+    void saveForExecution(TreeScriptItem *script);
     void saveAndLoad();
     void addFolder();
     void saveFolder();
@@ -305,12 +366,15 @@ private slots:
     void removeFile(); //File & Dir
     void exportFile(); //File
     void copyFullPath(); //File & Dir
+    void copyGnuplotBinaryClause(); //File
     void openInExplorer(); //File & Dir
     void openInDefaultApp(); //File & Dir
 
     void countUpSaving() { savingCount++; }
     void countDownSaving() { if(--savingCount == 0) emit allSaved(); }
 
+    void addDerivedSheet(TreeSheetItem *source, const SheetData& sheet, const QString& tag);
+
 private:
     void initializeContextMenu();
 
@@ -327,6 +391,8 @@ private:
     void removeItemFromTree(TreeFileItem *item);
     void removeItemFromList(TreeFileItem *item);
 
+    static QSet<TreeFileItem*> scriptDependencies(TreeScriptItem *script, const QList<TreeFileItem*>& candidates);
+
 
 private:
     FileTreeModel treeModel;
@@ -347,6 +413,7 @@ private:
 signals:
     void folderPathChanged(const QString& path);
     void allSaved();
+    void scriptDependenciesSaved(TreeScriptItem *script);
 };
 
 
@@ -272,6 +272,8 @@ void GnuplotExecutor::Gnuplot::execute(GnuplotProcess *process, const QList<QStr
 
 GnuplotProcess::GnuplotProcess(QObject *parent)
     : QProcess(parent)
+    , stdOutDecoder(charCode)
+    , stdErrDecoder(charCode)
 {
     connect(this, &GnuplotProcess::readyReadStandardOutput, this, &GnuplotProcess::readStdOut);
     connect(this, &GnuplotProcess::readyReadStandardError, this, &GnuplotProcess::readStdErr);;
@@ -284,7 +286,8 @@ void GnuplotProcess::setCharCode(const TextCodec::CharCode &code)
 
 void GnuplotProcess::readStdOut()
 {
-    _stdOut = TextCodec::QStringFrom(readAllStandardOutput(), charCode);
+    stdOutDecoder.setCharCode(charCode);
+    _stdOut = stdOutDecoder.decode(readAllStandardOutput());
 
     if(!_stdOut.isEmpty())
     {
@@ -299,7 +302,8 @@ void GnuplotProcess::readStdErr()
 
     _stdErr = "";
 
-    const QString err = TextCodec::QStringFrom(readAllStandardError(), charCode);
+    stdErrDecoder.setCharCode(charCode);
+    const QString err = stdErrDecoder.decode(readAllStandardError());
 
     QRegularExpressionMatchIterator iter(QRegularExpression("line \\d+:").globalMatch(err));
     while(iter.hasNext())
@@ -153,6 +153,8 @@ private:
 
 private:
     inline static TextCodec::CharCode charCode = TextCodec::CharCode::Shift_JIS;
+    TextDecoder stdOutDecoder;      //読み込みの境界で分かれた文字を次の読み込みとつなげる
+    TextDecoder stdErrDecoder;
     QString _stdOut;
     QString _stdErr;
 
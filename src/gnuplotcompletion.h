@@ -83,7 +83,9 @@ private:
                                                           << "ARG8"
                                                           << "ARG9"
                                                           << "ARGC"; }
-    inline QStringList expression() { return QStringList() << "abs"
+public:
+    /* 式で使える関数の名前．表の数式の列でも使う */
+    static QStringList expression() { return QStringList() << "abs"
                                                            << "acos"
                                                            << "acosh"
                                                            << "airy"
@@ -159,6 +161,8 @@ private:
                                                            << "tm_year"
                                                            << "time"
                                                            << "valid";}
+
+private:
     inline QStringList modifiers() { return QStringList() << "binary"
                                                           << "nonuniform"
                                                           << "matrix"
@@ -97,7 +97,7 @@ GnuplotEditor::GnuplotEditor(QWidget *parent)
     connect(gnuplotSetting, &GnuplotSettingWidget::preCmdSet, gnuplotExecutor, &GnuplotExecutor::setPreProcessingCmd);
     gnuplotSetting->loadXmlSetting(); //connectしてから読み込む
 
-    connect(fileTree, &FileTreeWidget::allSaved, this, &GnuplotEditor::sendGnuplotCmd);
+    connect(fileTree, &FileTreeWidget::scriptDependenciesSaved, this, &GnuplotEditor::sendGnuplotCmd);
 }
 
 GnuplotEditor::~GnuplotEditor()
@@ -359,18 +359,18 @@ void GnuplotEditor::executeGnuplot(TreeScriptItem *item)
         textEdit->highlightLine();
     }
 
-    /* FileTreeWidget::allSaved()が発せられたら，GnuplotEditor::sendGnuplotCmd()を実行
-     * すべてセーブしてからでないと，gnuplot実行時にセーブされていないファイルを読み込んで実行してしまう */
+    /* FileTreeWidget::scriptDependenciesSaved()が発せられたら，GnuplotEditor::sendGnuplotCmd()を実行
+     * 使うファイルをセーブしてからでないと，gnuplot実行時にセーブされていないファイルを読み込んで実行してしまう．
+     * 関係のないファイルの保存は待たない */
     requestedItem = item;
-    fileTree->saveAllFile();
+    fileTree->saveForExecution(item);
 }
 
-void GnuplotEditor::sendGnuplotCmd()
+void GnuplotEditor::sendGnuplotCmd(TreeScriptItem *item)
 {
-    /* FileTreeWidget::allSaved() が発せられたら呼ばれるが，これが他のクラスから発せられたものである可能性があるため，
-     * requestedItemを確認することで，これが実行時にFileTreeWidget::saveAllFile()を呼ぶことによって発せられたことが
-     * 確認できる． */
-    if(requestedItem)
+    /* 続けて実行した場合，前の実行の要求で発せられたものである可能性があるため，
+     * requestedItemを確認することで，最後に実行を要求したスクリプトのものであることが確認できる． */
+    if(requestedItem && requestedItem == item)
     {
         editorArea->singleShotLoading();
 
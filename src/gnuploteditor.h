@@ -82,7 +82,7 @@ private slots:
     /* execute */
     void executeItem(TreeFileItem *item);
     void executeGnuplot(TreeScriptItem *item);
-    void sendGnuplotCmd();
+    void sendGnuplotCmd(TreeScriptItem *item);
 
     /* menu bar */
     void findKeyword();
@@ -13,8 +13,15 @@
 #include <QMouseEvent>
 #include <QMenu>
 #include <QAction>
+#include <QtNumeric>
+#include <QFileDialog>
+#include <QFileInfo>
 #include "gnuplot.h"
+#include "iofile.h"
+#include "arrowfile.h"
 #include "logger.h"
+#include "columnhistogram.h"
+#include "plotdownsampler.h"
 
 
 
@@ -40,6 +47,8 @@ void GnuplotTable::mousePressEvent(QMouseEvent *event)
 {
     TableWidget::mousePressEvent(event);
 
+    if(isFiltered()) return;   //絞り込んでいる間は表示の行数が元の行数と異なるので，ドラッグで行数を変えない
+
     const int cursorX = event->pos().x();
     const int cursorY = event->pos().y();
 
@@ -99,10 +108,10 @@ void GnuplotTable::keyPressEvent(QKeyEvent *event)
 {
     if(event->key() == Qt::Key::Key_Backspace)
     {
-        if(QTableWidgetItem *item = currentItem()) item->setText("");
+        if(currentIndex().isValid()) model()->setData(currentIndex(), QString());
     }
 
-    QTableWidget::keyPressEvent(event);
+    TableWidget::keyPressEvent(event);
 }
 
 
@@ -121,6 +130,19 @@ void GnuplotTable::initializeContextMenu()
 
     normalMenu = new QMenu(this);
 
+    /* undo, redo */
+    QAction *actUndo = new QAction("undo", normalMenu);
+    QAction *actRedo = new QAction("redo", normalMenu);
+    normalMenu->addAction(actUndo);
+    normalMenu->addAction(actRedo);
+    connect(actUndo, &QAction::triggered, this, &GnuplotTable::undo);
+    connect(actRedo, &QAction::triggered, this, &GnuplotTable::redo);
+    connect(normalMenu, &QMenu::aboutToShow, [this, actUndo, actRedo]() {
+        actUndo->setEnabled(sheetModel()->canUndo());
+        actRedo->setEnabled(sheetModel()->canRedo());
+    });
+    normalMenu->addSeparator();
+
     /* copy */
     QAction *actCopy = new QAction("copy", normalMenu);
     normalMenu->addAction(actCopy);
@@ -187,11 +209,22 @@ void GnuplotTable::initializeContextMenu()
     QMenu *gnuplotMenu = new QMenu(normalMenu);
     gnuplotMenu->setTitle("gnuplot");
     QAction *actPlot = new QAction("plot", gnuplotMenu);
+    QAction *actPlotErrorBars = new QAction("plot with errorbars", gnuplotMenu);
     QAction *actPlotClip = new QAction("clipboard", gnuplotMenu);
+    QAction *actDownsampling = new QAction("downsample preview", gnuplotMenu);
     gnuplotMenu->addAction(actPlot);
+    gnuplotMenu->addAction(actPlotErrorBars);
     gnuplotMenu->addAction(actPlotClip);
+    gnuplotMenu->addSeparator();
+    gnuplotMenu->addAction(actDownsampling);
+    actDownsampling->setCheckable(true);
+    actDownsampling->setChecked(downsampling);
+    actDownsampling->setToolTip("send about " + QString::number(previewWidth) + " buckets of rows instead of all rows. uncheck for exact plots");
     connect(actPlot, &QAction::triggered, [this](){ plotSelectedData(PlotType::Custom); });
+    actPlotErrorBars->setToolTip("plot the selected columns (x, y, error) with yerrorbars");
+    connect(actPlotErrorBars, &QAction::triggered, [this](){ plotSelectedData(PlotType::YErrorBars2D); });
     connect(actPlotClip, &QAction::triggered, this, &GnuplotTable::gnuplotClip);
+    connect(actDownsampling, &QAction::toggled, this, &GnuplotTable::setDownsampling);
     normalMenu->addMenu(gnuplotMenu);
 
     /* export */
@@ -199,7 +232,19 @@ void GnuplotTable::initializeContextMenu()
     exportMenu->setTitle("export");
     QAction *actLatexCode = new QAction("latex code", exportMenu);
     exportMenu->addAction(actLatexCode);
+    QAction *actBinaryDouble = new QAction("gnuplot binary (double)", exportMenu);
+    QAction *actBinaryFloat = new QAction("gnuplot binary (float)", exportMenu);
+    exportMenu->addAction(actBinaryDouble);
+    exportMenu->addAction(actBinaryFloat);
+    QAction *actArrow = new QAction("arrow (feather)", exportMenu);
+    exportMenu->addAction(actArrow);
+    QAction *actExcel = new QAction("excel (xlsx)", exportMenu);
+    exportMenu->addAction(actExcel);
     connect(actLatexCode, &QAction::triggered, this, &GnuplotTable::toLatexCode);
+    connect(actBinaryDouble, &QAction::triggered, [this](){ exportGnuplotBinary(false); });
+    connect(actBinaryFloat, &QAction::triggered, [this](){ exportGnuplotBinary(true); });
+    connect(actArrow, &QAction::triggered, this, &GnuplotTable::exportArrow);
+    connect(actExcel, &QAction::triggered, this, &GnuplotTable::exportExcel);
     normalMenu->addMenu(exportMenu);
 }
 
@@ -239,6 +284,32 @@ void GnuplotTable::plotSelectedData(const GnuplotTable::PlotType &plotType)
     case PlotType::Impulses2D:
         cmd = "plot \"-\" with impulses"; break;
 
+    /* 集計した(平均，標準偏差)などの列．列の数からusingを決める */
+    case PlotType::YErrorBars2D:
+        switch(ranges.size())
+        {
+        case 2: cmd = "plot \"-\" using 0:1:2 with yerrorbars"; break;      //y, ydelta
+        case 3: cmd = "plot \"-\" using 1:2:3 with yerrorbars"; break;      //x, y, ydelta
+        case 4: cmd = "plot \"-\" using 1:2:3:4 with yerrorbars"; break;    //x, y, ylow, yhigh
+        default:
+            __LOGOUT__("select 2 to 4 columns (x, y, error) to plot with errorbars.", Logger::LogLevel::Warn);
+            return;
+        }
+        break;
+
+    /* ヒストグラムと密度は箱に数えた表だけを送る */
+    case PlotType::Histogram2D:
+    case PlotType::HistogramFD2D:
+    case PlotType::HistogramLog2D:
+    case PlotType::Density2D:
+        if(ranges.size() != 1)
+        {
+            __LOGOUT__("select one column to plot a histogram.", Logger::LogLevel::Warn);
+            return;
+        }
+        plotHistogram(ranges.at(0), plotType);
+        return;
+
     case PlotType::Custom:
         cmd = optionCmd; break;
     default:
@@ -247,10 +318,10 @@ void GnuplotTable::plotSelectedData(const GnuplotTable::PlotType &plotType)
 
     cmd += "\n";
 
-    plotCellPoints(ranges, cmd);
+    plotCellPoints(ranges, cmd, plotType);
 }
 
-void GnuplotTable::plotCellPoints(const QList<std::array<int, 3> > &ranges, const QString& _cmd)
+void GnuplotTable::plotCellPoints(const QList<std::array<int, 3> > &ranges, const QString& _cmd, const GnuplotTable::PlotType& plotType)
 {
     QString cmd = _cmd;
 
@@ -260,19 +331,49 @@ void GnuplotTable::plotCellPoints(const QList<std::array<int, 3> > &ranges, cons
 
     const int rowCount = ranges.at(0).at(2) - ranges.at(0).at(1) + 1;
 
-    for(int i = 0; i < rowCount; ++i)
+    /* 選択された列ごとに型を推定した列データから送る．
+     * 数値列の中の数値でないセル(ヘッダーなど)はgnuplotの欠損値NaNとして送り，インラインデータが崩れないようにする */
+    QList<SheetColumn> columns(colCount);
+    for(int j = 0; j < colCount; ++j)
+    {
+        const int column = ranges.at(j).at(0);
+        const int topRow = ranges.at(j).at(1);
+
+        columns[j] = sheet(QTableWidgetSelectionRange(topRow, column, topRow + rowCount - 1, column)).column(0);
+    }
+
+    /* 点を描くプロットは形の残るLTTB，線や箱で描くプロットは極値の残る最小・最大で間引く．誤差棒は集計した少ない行なので間引かない */
+    QList<qsizetype> rows;
+    if(downsampling && plotType != PlotType::Custom && plotType != PlotType::YErrorBars2D)
     {
+        const bool drawsPoints = (plotType == PlotType::Scatter2D || plotType == PlotType::LinesPoints2D);
+        rows = PlotDownsampler::sample(columns, rowCount, previewWidth,
+                                       (drawsPoints) ? PlotDownsampler::Method::Lttb : PlotDownsampler::Method::MinMax);
+    }
+    const bool downsampled = !rows.isEmpty() && rows.size() < rowCount;
+
+    /* 1列だけのときgnuplotは送った順の番号をxにするので，間引いたり行を絞り込んだりしていれば元の行の番号をxとして送る */
+    const bool sendRowNumber = (downsampled || isFiltered()) && colCount == 1;
+    const int topRow = ranges.at(0).at(1);
+
+    const qsizetype sendCount = (downsampled) ? rows.size() : rowCount;
+    for(qsizetype k = 0; k < sendCount; ++k)
+    {
+        const qsizetype i = (downsampled) ? rows.at(k) : k;
+
+        if(sendRowNumber) cmd += QString::number(sourceRow(topRow + int(i)) - sourceRow(topRow)) + ", ";
+
         for(int j = 0; j < colCount; ++j)
         {
-            const int column = ranges.at(j).at(0);
-            const int topRow = ranges.at(j).at(1);
+            const SheetColumn& column = columns.at(j);
+            const QString text = column.text(i);
 
-            if(QTableWidgetItem *item = this->item(topRow + i, column))
-            {
-                cmd += item->text();
-            }
-            else
+            if(text.isEmpty())
                 cmd += "0";
+            else if(column.isNumeric() && qIsNaN(column.value(i)))
+                cmd += "NaN";
+            else
+                cmd += text;
 
             if(j == colCount - 1)
                 cmd += "\n";
@@ -283,7 +384,50 @@ void GnuplotTable::plotCellPoints(const QList<std::array<int, 3> > &ranges, cons
 
     cmd += "e\n";
 
-    __LOGOUT__("execute cell data requested.", Logger::LogLevel::Info);
+    if(downsampled)
+        __LOGOUT__("execute cell data requested (" + QString::number(sendCount) + " of " + QString::number(rowCount) + " rows, downsampled).", Logger::LogLevel::Info);
+    else
+        __LOGOUT__("execute cell data requested.", Logger::LogLevel::Info);
+
+    gnuplotExecutor->execGnuplot(QStringList() << cmd, false);
+}
+
+void GnuplotTable::plotHistogram(const std::array<int, 3>& range, const GnuplotTable::PlotType& plotType)
+{
+    const SheetColumn column = sheet(QTableWidgetSelectionRange(range.at(1), range.at(0), range.at(2), range.at(0))).column(0);
+
+    ColumnHistogram::Table table;
+    switch(plotType)
+    {
+    case PlotType::HistogramFD2D:
+        table = ColumnHistogram::histogram(column, ColumnHistogram::Binning::FreedmanDiaconis); break;
+    case PlotType::HistogramLog2D:
+        table = ColumnHistogram::histogram(column, ColumnHistogram::Binning::Log); break;
+    case PlotType::Density2D:
+        table = ColumnHistogram::density(column); break;
+    default:
+        table = ColumnHistogram::histogram(column, ColumnHistogram::Binning::Fixed); break;
+    }
+
+    if(table.x.isEmpty())
+    {
+        __LOGOUT__("failed to make a histogram: " + table.error + ".", Logger::LogLevel::Warn);
+        return;
+    }
+
+    /* 箱は(中心，度数，幅)，密度は(x，密度)の行 */
+    const bool boxes = (plotType != PlotType::Density2D);
+    QString cmd = (boxes) ? "plot \"-\" using 1:2:3 with boxes\n" : "plot \"-\" with lines\n";
+    for(qsizetype i = 0; i < table.x.size(); ++i)
+    {
+        cmd += QString::number(table.x.at(i), 'g', 12) + ", " + QString::number(table.y.at(i), 'g', 12);
+        if(boxes) cmd += ", " + QString::number(table.width.at(i), 'g', 12);
+        cmd += "\n";
+    }
+    cmd += "e\n";
+
+    __LOGOUT__("execute histogram requested (" + QString::number(table.x.size()) + " points, "
+               + QString::number(table.skipped) + " cells skipped).", Logger::LogLevel::Info);
 
     gnuplotExecutor->execGnuplot(QStringList() << cmd, false);
 }
@@ -293,6 +437,14 @@ void GnuplotTable::gnuplotClip()
     /* 選択された範囲 */
     const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
     if(selectedRangeList.size() < 1) { return; }
+
+    /* everyでは飛び飛びの行を表せない */
+    if(isFiltered())
+    {
+        __LOGOUT__("plot range of filtered rows cannot be written with every.", Logger::LogLevel::Warn);
+        return;
+    }
+
     const int startBlockNumber = 0;
     const int endBlockNumber = 0;
     const int startRowNumber = selectedRangeList.at(0).topRow();
@@ -320,6 +472,105 @@ void GnuplotTable::gnuplotClip()
     __LOGOUT__("plot range pasted to the clipboard.", Logger::LogLevel::Info);
 }
 
+/* 選択された列を1行1レコードのバイナリで書き出し，gnuplotで読むためのファイル名とbinaryの指定をクリップボードに貼り付ける．
+ * テキストのデータファイルより読み込みが速い．
+ */
+void GnuplotTable::exportGnuplotBinary(const bool singlePrecision)
+{
+    const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
+    if(selectedRangeList.size() < 1) { return; }
+
+    const QTableWidgetSelectionRange range = selectedRangeList.at(0);
+
+    const QString fileName = QFileDialog::getSaveFileName(this, "Export gnuplot binary", QString(), "Binary (*.bin *.dat);;All Files (*)");
+    if(fileName.isEmpty()) return;
+
+    const SheetData sheet = this->sheet(range);
+
+    if(!writeGnuplotBinaryFile(fileName, sheet, singlePrecision))
+    {
+        __LOGOUT__("failed to export gnuplot binary \"" + fileName + "\".", Logger::LogLevel::Error);
+        return;
+    }
+
+    /* "file" binary format="%float64%float64" record=N endian=little using 1:2 */
+    QString cmd = "\"" + QFileInfo(fileName).absoluteFilePath() + "\" "
+                + gnuplotBinaryClause(sheet.columnCount(), sheet.rowCount(), singlePrecision)
+                + " using ";
+    for(qsizetype col = 0; col < sheet.columnCount(); ++col)
+        cmd += QString::number(col + 1) + ((col != sheet.columnCount() - 1) ? ":" : "");
+
+    /* クリップボードに貼り付け */
+    QApplication::clipboard()->setText(cmd);
+
+    __LOGOUT__("gnuplot binary exported and plot clause pasted to the clipboard.", Logger::LogLevel::Info);
+}
+
+/* 選択された範囲をArrowのファイルで書き出す．
+ * 列の見出しがなく，選択範囲の先頭の行がすべて数値でない文字列であれば，その行を列名とする．
+ */
+void GnuplotTable::exportArrow()
+{
+    const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
+    if(selectedRangeList.size() < 1) { return; }
+
+    const QTableWidgetSelectionRange range = selectedRangeList.at(0);
+
+    const QString fileName = QFileDialog::getSaveFileName(this, "Export arrow", QString(), "Arrow (*.arrow *.feather);;All Files (*)");
+    if(fileName.isEmpty()) return;
+
+    //開いているファイル自身に書き出す場合
+    sheetModel()->detachMapping(fileName);
+    SheetData sheet = this->sheet(range);
+
+    if(sheet.columnNames().isEmpty() && sheet.rowCount() > 1)
+    {
+        QStringList names;
+        for(qsizetype col = 0; col < sheet.columnCount(); ++col)
+        {
+            const QString text = sheet.text(0, col);
+            bool isNumber = false;
+            text.toDouble(&isNumber);
+            if(text.isEmpty() || isNumber) { names.clear(); break; }
+            names << text;
+        }
+
+        if(!names.isEmpty())
+        {
+            sheet = this->sheet(QTableWidgetSelectionRange(range.topRow() + 1, range.leftColumn(), range.bottomRow(), range.rightColumn()));
+            sheet.setColumnNames(names);
+        }
+    }
+
+    if(!ArrowFile::write(fileName, sheet))
+    {
+        __LOGOUT__("failed to export arrow \"" + fileName + "\".", Logger::LogLevel::Error);
+        return;
+    }
+
+    __LOGOUT__("arrow exported \"" + fileName + "\".", Logger::LogLevel::Info);
+}
+
+/* 選択された範囲をExcelのブックで書き出す */
+void GnuplotTable::exportExcel()
+{
+    const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
+    if(selectedRangeList.size() < 1) { return; }
+
+    const QTableWidgetSelectionRange range = selectedRangeList.at(0);
+
+    const QString fileName = QFileDialog::getSaveFileName(this, "Export excel", QString(), "Excel (*.xlsx);;All Files (*)");
+    if(fileName.isEmpty()) return;
+
+    if(!ExcelDocument::writeSheet(fileName, sheet(range), QFileInfo(fileName).completeBaseName()))
+    {
+        __LOGOUT__("failed to export excel \"" + fileName + "\".", Logger::LogLevel::Error);
+        return;
+    }
+
+    __LOGOUT__("excel exported \"" + fileName + "\".", Logger::LogLevel::Info);
+}
+
 void GnuplotTable::toLatexCode()
 {
     /* 選択された範囲を取得 */
@@ -335,6 +586,7 @@ void GnuplotTable::toLatexCode()
         const int startCol = selected.leftColumn();
         const int endRow = selected.bottomRow();
         const int endCol = selected.rightColumn();
+        const SheetData cells = sheet(selected);     //絞り込んでいれば表示している行
 
         clip += "\\begin{table}[h]\n";
         clip += "\t\\centering\n";
@@ -349,19 +601,9 @@ void GnuplotTable::toLatexCode()
             for(int col = startCol; col <= endCol; ++col)
             {
                 if(col != endCol)
-                {
-                    if(QTableWidgetItem *item = this->item(row, col))
-                        clip += item->text() + " & ";
-                    else
-                        clip += " & ";
-                }
+                    clip += cells.text(row - startRow, col - startCol) + " & ";
                 else
-                {
-                    if(QTableWidgetItem *item = this->item(row, col))
-                        clip += item->text() + " \\\\\n";
-                    else
-                        clip += " \\\\\n";
-                }
+                    clip += cells.text(row - startRow, col - startCol) + " \\\\\n";
             }
         }
         clip += "\t\t\\hline\n";
@@ -10,7 +10,7 @@
 #ifndef TableWidget_H
 #define TableWidget_H
 
-#include <QTableWidget>
+#include <QTableView>
 #include "tablewidget.h"
 
 
@@ -25,6 +25,8 @@ public:
 
     enum class PlotType { Scatter2D, Lines2D, LinesPoints2D,
                           Boxes2D, Steps2D, FSteps2D, FillSteps2D, HiSteps2D, Impulses2D,
+                          YErrorBars2D,
+                          Histogram2D, HistogramFD2D, HistogramLog2D, Density2D,
                           Custom };
     Q_ENUM(PlotType)
 
@@ -37,7 +39,11 @@ public slots:
     void setOptionCmd(const QString& option) { this->optionCmd = option; }
     void gnuplotClip();
     void toLatexCode();
+    void exportGnuplotBinary(const bool singlePrecision);
+    void exportArrow();
+    void exportExcel();
     void plotSelectedData(const GnuplotTable::PlotType& plotType);
+    void setDownsampling(const bool enable) { this->downsampling = enable; }
 
 protected:
     void mousePressEvent(QMouseEvent *event) override;
@@ -48,7 +54,8 @@ protected:
 private slots:
     void onCustomContextMenu(const QPoint& point);
 
-    void plotCellPoints(const QList<std::array<int, 3>>& ranges, const QString& cmd);
+    void plotCellPoints(const QList<std::array<int, 3>>& ranges, const QString& cmd, const GnuplotTable::PlotType& plotType);
+    void plotHistogram(const std::array<int, 3>& range, const GnuplotTable::PlotType& plotType);
 
 private:
     void initializeContextMenu();
@@ -59,6 +66,10 @@ private:
 private:
     QMenu *normalMenu = nullptr;
     QString optionCmd;
+
+    /* 選択範囲のプロットでは，行が多ければ横のピクセル程度まで間引いて送る(Customは式がわからないので間引かない) */
+    bool downsampling = true;
+    static constexpr qsizetype previewWidth = 1000;    //間引くときのバケットの数
 };
 
 #endif // TableWidget_H
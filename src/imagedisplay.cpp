@@ -9,8 +9,6 @@
 
 #include "imagedisplay.h"
 #include <QHBoxLayout>
-#include <QFileSystemWatcher>
-#include <QTimer>
 #include <QLabel>
 #include <QLineEdit>
 #include <QPushButton>
@@ -18,6 +16,7 @@
 #include "layoutparts.h"
 #include "standardpixmap.h"
 #include "imageviewer.h"
+#include "filechangewatcher.h"
 
 
 
@@ -61,8 +60,7 @@ void PaintImage::paintEvent(QPaintEvent*)
 
 ImageDisplay::ImageDisplay(QWidget *parent)
     : QWidget(parent)
-    , fileWatcher(new QFileSystemWatcher(this))
-    , timer(new QTimer(this))
+    , fileWatcher(new FileChangeWatcher(this))
     , painter(new PaintImage(this))
     , imageEditor(nullptr)
 
@@ -71,12 +69,9 @@ ImageDisplay::ImageDisplay(QWidget *parent)
     , currentHeightEdit(new QLineEdit(this))
     , currentWidthEdit(new QLineEdit(this))
 {
-    //対象の画像ファイルが変更されたら，画像画面が更新するようにする．
-    //ファイルに変更があった瞬間に読み込んでも画像はNULLになるのでtimer->setInterval()だけ待つ．
-    timer->setSingleShot(true);
-    timer->setInterval(500);
-    connect(fileWatcher, &QFileSystemWatcher::fileChanged, timer, QOverload<>::of(&QTimer::start));
-    connect(timer, &QTimer::timeout, this, &ImageDisplay::updateImage);
+    //対象の画像ファイルの内容が変更されたら，画像画面が更新するようにする．
+    //FileChangeWatcherは変更の通知が落ち着いてから確認するため，書き込み途中の画像は読み込まない．
+    connect(fileWatcher, &FileChangeWatcher::contentChanged, this, &ImageDisplay::updateImage);
 
     QVBoxLayout *vLayout = new QVBoxLayout(this);
     QSpacerItem *spacer = new QSpacerItem(0, 0, QSizePolicy::Expanding, QSizePolicy::Minimum);
@@ -12,7 +12,7 @@
 
 #include <QGraphicsView>
 
-class QFileSystemWatcher;
+class FileChangeWatcher;
 class QLineEdit;
 class QHBoxLayout;
 class ImageViewWidget;
@@ -66,8 +66,7 @@ private slots:
     void openImageEditor();
 
 private:
-    QFileSystemWatcher *fileWatcher;
-    QTimer *timer;
+    FileChangeWatcher *fileWatcher;
     QString imagePath;
     PaintImage *painter;
     ImageViewWidget *imageEditor;
@@ -3,8 +3,6 @@
 #include <QHBoxLayout>
 #include <QVBoxLayout>
 #include <QTreeWidget>
-#include <QFileSystemWatcher>
-#include <QTimer>
 #include <QGraphicsPixmapItem>
 #include <QApplication>
 #include <QPainterPath>
@@ -26,6 +24,7 @@
 #include "layoutparts.h"
 #include "standardpixmap.h"
 #include "logger.h"
+#include "filechangewatcher.h"
 
 
 
@@ -171,8 +170,7 @@ ImageViewWidget::ImageViewWidget(QWidget *parent)
     , imageView(new ImageView(contents))
     , imageScene(new ImageScene(imageView, pixmapItem))
 
-    , watcher(new QFileSystemWatcher(this))
-    , timer(new QTimer(this))
+    , watcher(new FileChangeWatcher(this))
 
     , controlPanel(new ImageViewControlPanel(contents))
     , settingWidget(new GraphicsItemSettingWidget(contents))
@@ -196,9 +194,6 @@ ImageViewWidget::ImageViewWidget(QWidget *parent)
 
     imageView->setScene(imageScene);
 
-    timer->setInterval(500);
-    timer->setSingleShot(true);
-
     QVBoxLayout *vLayout = new QVBoxLayout(contents);
     //QHBoxLayout *hLayout = new QHBoxLayout;
 
@@ -224,8 +219,7 @@ ImageViewWidget::ImageViewWidget(QWidget *parent)
     //hLayout->setContentsMargins(0, 0, 0, 0);
     hSplitter->setContentsMargins(0, 0, 0, 0);
 
-    connect(watcher, &QFileSystemWatcher::fileChanged, timer, QOverload<void>::of(&QTimer::start));
-    connect(timer, &QTimer::timeout, this, &ImageViewWidget::updateImage);
+    connect(watcher, &FileChangeWatcher::contentChanged, this, &ImageViewWidget::updateImage);
 
     connect(imageScene, &ImageScene::currentItemChanged, settingWidget, &GraphicsItemSettingWidget::setCurrentItems);
     connect(controlPanel, &ImageViewControlPanel::scaleChanged, imageView, &ImageView::setAbsoluteScale);
@@ -9,7 +9,7 @@
 
 
 class QGraphicsPixmapItem;
-class QFileSystemWatcher;
+class FileChangeWatcher;
 class GraphicsItemSettingWidget;
 class QLabel;
 class QLineEdit;
@@ -98,8 +98,7 @@ private:
     ImageView *imageView;
     ImageScene *imageScene;
 
-    QFileSystemWatcher *watcher;
-    QTimer *timer;
+    FileChangeWatcher *watcher;
     QString imgPath;
 
     class ImageViewControlPanel;
@@ -1,5 +1,11 @@
 #include "iofile.h"
 
+#include <QXmlStreamReader>
+#include <QSaveFile>
+#include <QtEndian>
+#include "sheetcache.h"
+#include "deflate.h"
+
 
 void ReadTxtFile::getTxt(const QString& path, QString& text, bool& ok)
 {
@@ -53,124 +59,502 @@ void WriteTxtFile::write(const QString& path, const QString& text)
 }
 
 
-void ReadCsvFile::read(const QString& path)
+SheetParser::SheetParser(const SheetFormat& format)
+    : format(format)
+    , delimiter(format.delimiter)
 {
-    QString data;
-    bool ok = false;
-    ReadTxtFile::getTxt(path, data, ok);                 //ファイルの内容(text)をQString型で保持
+    /* 推定した型の列を用意しておき，読み込み中に型を変えないようにする */
+    sheet.setColumnTypes(format.columnTypes);
+}
+
+void SheetParser::parse(const char *data, const qsizetype size)
+{
+    const char *p = data;
+    const char *end = data + size;
 
-    /* ファイルの読み取り失敗 または 空文字だった場合 */
-    if(!ok || data.isEmpty())
+    /* UTF-8のBOMを読み飛ばす */
+    if(atStart)
     {
-        emit finished(QList<QList<QString> >(), ok);
-        return;
+        if(size >= 3 && uchar(p[0]) == 0xEF && uchar(p[1]) == 0xBB && uchar(p[2]) == 0xBF) p += 3;
+        atStart = false;
     }
+
+    if(format.isPlain())
+        parsePlain(p, end);
     else
+        parseLines(p, end);
+}
+
+void SheetParser::parsePlain(const char *p, const char *end)
+{
+    const char *fieldBegin = p;
+
+    for(; p < end; ++p)
     {
-        QList<QList<QString> > sheet(1);                 //csvデータを2次元のQString型で返す
-        qsizetype row = 0;                               //行数
-        QString stack = "";                              //スタック
+        const char c = *p;
+        if(c != delimiter && c != '\n') continue;
 
-        for(const QChar& c : data)
+        QByteArrayView field(fieldBegin, p - fieldBegin);
+        if(!pending.isEmpty())
         {
-            if(c == '\n'){
-                sheet[row] << stack;
-                stack.clear();
-                sheet.append(QList<QString>(0));
-                row++;
-            }
-            else if(c == ','){
-                sheet[row] << stack;
-                stack.clear();
-            }
-            else
-                stack += c;
+            pending.append(field);
+            field = pending;
         }
-        sheet[row] << stack;
 
-        emit finished(sheet, true);
+        /* 改行コード"\r\n"の'\r'を取り除く */
+        if(c == '\n' && field.endsWith('\r')) field = field.chopped(1);
+
+        pushField(field);
+        pending.clear();
+
+        if(c == '\n') pushRow();
+
+        fieldBegin = p + 1;
     }
+
+    pending.append(fieldBegin, end - fieldBegin);
 }
 
-void WriteCsvFile::write(const QString& path, const QList<QList<QString> >& sheet)
+/* 引用符の中の改行を行の終わりとしないように，引用符と注釈の状態を追いながら行の終わりを探す */
+void SheetParser::parseLines(const char *p, const char *end)
 {
-    QString data;
-    for(qsizetype row = 0; row < sheet.size(); ++row){
-        for(qsizetype col = 0; col < sheet.at(row).size(); ++col)
+    const char quote = format.quote;
+    const char comment = format.comment;
+    const char *lineBegin = p;
+
+    for(; p < end; ++p)
+    {
+        const char c = *p;
+
+        if(c == '\n' && !inQuotes)
         {
-            data += sheet.at(row).at(col);
-            if(col != sheet.at(row).size() - 1) { data += ','; }
+            QByteArrayView line(lineBegin, p - lineBegin);
+            if(!pending.isEmpty())
+            {
+                pending.append(line);
+                line = pending;
+            }
+
+            parseLine(line);
+            pending.clear();
+
+            lineBegin = p + 1;
+            quoteClosed = false;
+            fieldStart = true;
+            lineStarted = false;
+            inComment = false;
+            continue;
+        }
+
+        if(inComment) continue;
+
+        if(inQuotes)
+        {
+            if(c == quote) { inQuotes = false; quoteClosed = true; }
+            continue;
+        }
+
+        const bool isBlank = (c == ' ' || c == '\t');
+        if(!lineStarted && !isBlank)
+        {
+            lineStarted = true;
+            if(comment != '\0' && c == comment) { inComment = true; continue; }
         }
-        if(row != sheet.size() - 1) { data += '\n'; }
+
+        //引用符はセルの始まりか，閉じた引用符の直後(2つ続いた引用符)でだけ開く
+        if(quote != '\0' && c == quote && (fieldStart || quoteClosed))
+        {
+            inQuotes = true;
+            fieldStart = false;
+        }
+        else
+            fieldStart = (format.mergeDelimiters) ? isBlank : (c == delimiter);
+
+        quoteClosed = false;
     }
 
-    bool ok = false;
-    WriteTxtFile::toTxt(path, data, ok);
+    pending.append(lineBegin, end - lineBegin);
+}
 
-    emit finished(ok);
+void SheetParser::parseLine(QByteArrayView line)
+{
+    if(line.endsWith('\r')) line = line.chopped(1);
+
+    /* 注釈の行は1つのセルとして残す */
+    if(format.comment != '\0' && line.trimmed().startsWith(format.comment))
+        pushField(line);
+    else
+        format.forEachField(line, [this](QByteArrayView field, bool) { pushField(field); });
+
+    pushRow();
 }
 
-void ReadTsvFile::read(const QString& path)
+SheetData SheetParser::finish()
 {
-    bool ok = false;
-    QString data;
+    /* 最後の行が改行で終わっていない場合 */
+    if(!format.isPlain())
+    {
+        if(!pending.isEmpty()) parseLine(pending);
+        pending.clear();
+    }
+    else if(!pending.isEmpty() || col > 0)
+    {
+        if(pending.endsWith('\r')) pending.chop(1);
+        pushField(pending);
+        pending.clear();
+        pushRow();
+    }
+
+    sheet.squeeze();
+    return sheet;
+}
 
-    ReadTxtFile::getTxt(path, data, ok);
+void SheetParser::pushField(QByteArrayView field)
+{
+    sheet.appendCell(col++, field);
+}
 
-    if(!ok || data.isEmpty())
+void SheetParser::pushRow()
+{
+    sheet.endRow();
+    col = 0;
+}
+
+SheetData readSheetFile(const QString& fileName, const char delimiter, bool *ok)
+{
+    return readSheetFile(fileName, SheetFormat(delimiter), ok);
+}
+
+SheetData readSheetFile(const QString& fileName, const SheetFormat& format, bool *ok)
+{
+    static constexpr qsizetype chunkSize = 1 << 20;
+
+    QFile file(fileName);
+
+    if(!file.open(QIODevice::ReadOnly))
     {
-        emit finished(QList<QList<QString> >(), ok);
-        return;
+        if(ok) *ok = false;
+        return SheetData();
+    }
+
+    /* zstdは展開器を持たないので読み込めない */
+    char magic[4];
+    if(file.peek(magic, 4) == 4 && uchar(magic[0]) == 0x28 && uchar(magic[1]) == 0xB5 && uchar(magic[2]) == 0x2F && uchar(magic[3]) == 0xFD)
+    {
+        if(ok) *ok = false;
+        return SheetData();
+    }
+
+    SheetParser parser(format);
+    QByteArray chunk(chunkSize, Qt::Uninitialized);
+    qint64 size = 0;
+
+    /* gzipで圧縮されていれば展開しながら解析する(拡張子ではなく先頭のバイトで判定する) */
+    if(GzipReader::isGzip(&file))
+    {
+        GzipReader gzip(&file);
+        while((size = gzip.read(chunk.data(), chunkSize)) > 0)
+            parser.parse(chunk.constData(), size);
     }
     else
     {
-        QList<QList<QString> > sheet(1);   //tsvデータを2次元のQString型で返す
-        qsizetype row = 0;
-        QString stack = "";
+        while((size = file.read(chunk.data(), chunkSize)) > 0)
+            parser.parse(chunk.constData(), size);
+    }
+
+    file.close();
 
-        for(const QChar& c : data)
+    if(ok) *ok = (size == 0);
+    return parser.finish();
+}
+
+/* 全体から等間隔に選んだ行の長さで大きさを見積もり，1つのバッファに列の配列から直接書く */
+QByteArray sheetToText(const SheetData& sheet, const char delimiter)
+{
+    static constexpr qsizetype sampleRows = 64;
+
+    const qsizetype rowCount = sheet.rowCount();
+    const qsizetype colCount = sheet.columnCount();
+
+    QByteArray buffer;
+    if(rowCount == 0 || colCount == 0) return buffer;
+
+    const qsizetype sampled = qMin(rowCount, sampleRows);
+    for(qsizetype i = 0; i < sampled; ++i)
+        for(qsizetype col = 0; col < colCount; ++col) sheet.column(col).appendText(buffer, rowCount * i / sampled);
+    const qsizetype estimate = (buffer.size() + sampled * colCount) * rowCount / sampled;
+    buffer.resize(0);
+    buffer.reserve(estimate + estimate / 8);
+
+    for(qsizetype row = 0; row < rowCount; ++row)
+    {
+        for(qsizetype col = 0; col < colCount; ++col)
         {
-            if(c == '\n'){
-                sheet[row] << stack;
-                stack.clear();
-                sheet.append(QList<QString>(0));
-                row++;
+            sheet.column(col).appendText(buffer, row);
+            if(col != colCount - 1) { buffer += delimiter; }
+        }
+        if(row != rowCount - 1) { buffer += '\n'; }
+    }
+
+    return buffer;
+}
+
+/* 書式を推定すると，","を含む1列や"#"，'"'で始まるセルを貼り付けたときに列や行が変わってしまうため，区切り文字だけで分ける */
+SheetData sheetFromText(const QByteArray& text, const char delimiter)
+{
+    SheetParser parser(delimiter);
+    parser.parse(text.constData(), text.size());
+
+    return parser.finish();
+}
+
+bool writeSheetFile(const QString& fileName, const SheetData& sheet, const char delimiter)
+{
+    return writeSheetFile(fileName, sheet, SheetFormat(delimiter));
+}
+
+bool writeSheetFile(const QString& fileName, const SheetData& sheet, const SheetFormat& format)
+{
+    static constexpr qsizetype flushSize = 1 << 20;
+
+    QFile file(fileName);
+
+    /* 拡張子が.gzならgzipで圧縮して書き出す */
+    const bool compressed = fileName.endsWith(".gz", Qt::CaseInsensitive);
+
+    if(!file.open((compressed) ? QIODevice::WriteOnly : QIODevice::WriteOnly | QIODevice::Text)) return false;
+
+    GzipWriter gzip(&file);
+    const auto write = [&](const QByteArray& data)
+    {
+        return (compressed) ? gzip.write(data.constData(), data.size()) : file.write(data) == data.size();
+    };
+
+    const qsizetype rowCount = sheet.rowCount();
+    const qsizetype colCount = sheet.columnCount();
+    const char delimiter = format.delimiter;
+    const bool plain = format.isPlain();
+
+    QByteArray buffer;
+    buffer.reserve(flushSize + 1024);
+    QByteArray cell;
+
+    /* 引用符で囲む必要のあるセル */
+    const auto needsQuote = [&](QByteArrayView text)
+    {
+        if(format.quoteAll) return true;
+        for(const char c : text)
+        {
+            if(c == delimiter || c == '\n' || c == '\r' || (c == format.quote && format.quote != '\0')) return true;
+            if(format.mergeDelimiters && (c == ' ' || c == '\t')) return true;
+        }
+        return format.mergeDelimiters && text.isEmpty();
+    };
+
+    for(qsizetype row = 0; row < rowCount; ++row)
+    {
+        if(plain)
+        {
+            for(qsizetype col = 0; col < colCount; ++col)
+            {
+                sheet.column(col).appendText(buffer, row);
+                if(col != colCount - 1) { buffer += delimiter; }
             }
-            else if(c == '\t'){
-                sheet[row] << stack;
-                stack.clear();
+        }
+        else
+        {
+            qsizetype lastFilled = colCount - 1;
+            for(; lastFilled > 0; --lastFilled)
+            {
+                cell.resize(0);
+                sheet.column(lastFilled).appendText(cell, row);
+                if(!cell.isEmpty()) break;
+            }
+
+            //空白で区切る書式では行末の空のセルを書かない
+            const qsizetype lastCol = (format.mergeDelimiters) ? lastFilled : colCount - 1;
+
+            for(qsizetype col = 0; col <= lastCol; ++col)
+            {
+                cell.resize(0);
+                sheet.column(col).appendText(cell, row);
+
+                /* 注釈の行(1列目だけのセル)は区切らずにそのまま書く */
+                if(col == 0 && lastFilled == 0 && format.comment != '\0' && cell.trimmed().startsWith(format.comment))
+                {
+                    buffer += cell;
+                    break;
+                }
+                else if(format.quote != '\0' && needsQuote(cell))
+                {
+                    buffer += format.quote;
+                    for(const char c : cell)
+                    {
+                        if(c == format.quote) buffer += c;
+                        buffer += c;
+                    }
+                    buffer += format.quote;
+                }
+                else
+                    buffer += cell;
+
+                if(col != lastCol) { buffer += delimiter; }
             }
-            else
-                stack += c;
         }
-        sheet[row] << stack;
+        if(row != rowCount - 1) { buffer += '\n'; }
 
-        emit finished(sheet, true);
+        /* 一定量ごとに書き出して，シート全体の文字列を作らないようにする */
+        if(buffer.size() >= flushSize)
+        {
+            if(!write(buffer)) return false;
+            buffer.resize(0);
+        }
     }
+
+    if(!write(buffer)) return false;
+    if(compressed && !gzip.finish()) return false;
+
+    file.close();
+    return true;
 }
 
-void WriteTsvFile::write(const QString& path, const QList<QList<QString> >& sheet)
+/* 有効なキャッシュがあればそれを使い，なければreaderで読み込んでキャッシュをバックグラウンドで作り直す */
+template <class Reader>
+static SheetData readSheetWithCache(const QString& path, bool& ok, Reader reader)
 {
-    QString data;
-    for(qsizetype row = 0; row < sheet.size(); ++row){
-        for(qsizetype col = 0; col < sheet.at(row).size(); ++col)
+    SheetData sheet;
+    if(SheetCache::load(path, sheet))
+    {
+        ok = true;
+        return sheet;
+    }
+
+    const SheetCache::Stamp stamp = SheetCache::stamp(path);
+    sheet = reader();
+    if(ok) SheetCache::storeLater(path, sheet, stamp);
+
+    return sheet;
+}
+
+bool writeGnuplotBinaryFile(const QString& fileName, const SheetData& sheet, const bool singlePrecision)
+{
+    static constexpr qsizetype flushSize = 1 << 20;
+
+    QFile file(fileName);
+
+    if(!file.open(QIODevice::WriteOnly)) return false;
+
+    const qsizetype rowCount = sheet.rowCount();
+    const qsizetype colCount = sheet.columnCount();
+
+    QByteArray buffer;
+    buffer.reserve(flushSize + colCount * sizeof(double));
+
+    for(qsizetype row = 0; row < rowCount; ++row)
+    {
+        for(qsizetype col = 0; col < colCount; ++col)
         {
-            data += sheet.at(row).at(col);
-            if(col != sheet.at(row).size() - 1) { data += '\t'; }
+            const double value = sheet.column(col).value(row);
+
+            if(singlePrecision)
+            {
+                char bytes[sizeof(float)];
+                qToLittleEndian(float(value), bytes);
+                buffer.append(bytes, sizeof(bytes));
+            }
+            else
+            {
+                char bytes[sizeof(double)];
+                qToLittleEndian(value, bytes);
+                buffer.append(bytes, sizeof(bytes));
+            }
+        }
+
+        if(buffer.size() >= flushSize)
+        {
+            if(file.write(buffer) != buffer.size()) return false;
+            buffer.resize(0);
         }
-        if(row != sheet.size() - 1) { data += '\n'; }
     }
 
-    bool ok = false;
-    WriteTxtFile::toTxt(path, data, ok);
+    if(file.write(buffer) != buffer.size()) return false;
+
+    file.close();
+    return true;
+}
+
+/* binary format="%float64%float64" record=N endian=little */
+QString gnuplotBinaryClause(const qsizetype columnCount, const qsizetype recordCount, const bool singlePrecision)
+{
+    QString format;
+    for(qsizetype i = 0; i < columnCount; ++i)
+        format += (singlePrecision) ? "%float32" : "%float64";
+
+    return "binary format=\"" + format + "\" record=" + QString::number(recordCount) + " endian=little";
+}
+
+void ReadCsvFile::getSheet(const QString& path, SheetData& sheet, bool& ok)
+{
+    ok = false;
+    sheet = readSheetWithCache(path, ok, [&]() { return readSheetFile(path, SheetFormat::sniff(path, ','), &ok); });
+}
+
+void ReadCsvFile::read(const QString& path)
+{
+    SheetData sheet;
+    bool ok;
+
+    getSheet(path, sheet, ok);
+
+    emit finished(sheet, ok);
+}
+
+void WriteCsvFile::toCsv(const QString& path, const SheetData& sheet, bool& ok)
+{
+    //読み込んだときの区切り文字や引用符のまま書き出す
+    ok = writeSheetFile(path, sheet, SheetFormat::sniff(path, ','));
+    if(ok) SheetCache::storeLater(path, sheet, SheetCache::stamp(path));
+}
+
+void WriteCsvFile::write(const QString& path, const SheetData& sheet)
+{
+    bool ok;
+
+    toCsv(path, sheet, ok);
 
     emit finished(ok);
 }
 
+void ReadTsvFile::getSheet(const QString& path, SheetData& sheet, bool& ok)
+{
+    ok = false;
+    sheet = readSheetWithCache(path, ok, [&]() { return readSheetFile(path, SheetFormat::sniff(path, '\t'), &ok); });
+}
+
+void ReadTsvFile::read(const QString& path)
+{
+    SheetData sheet;
+    bool ok;
+
+    getSheet(path, sheet, ok);
+
+    emit finished(sheet, ok);
+}
 
+void WriteTsvFile::toTsv(const QString& path, const SheetData& sheet, bool& ok)
+{
+    ok = writeSheetFile(path, sheet, SheetFormat::sniff(path, '\t'));
+    if(ok) SheetCache::storeLater(path, sheet, SheetCache::stamp(path));
+}
 
+void WriteTsvFile::write(const QString& path, const SheetData& sheet)
+{
+    bool ok;
 
+    toTsv(path, sheet, ok);
 
+    emit finished(ok);
+}
 
 
 
@@ -180,84 +564,274 @@ void WriteTsvFile::write(const QString& path, const QList<QList<QString> >& shee
 
 
 
+void ReadXlsxFile::getSheet(const QString& path, SheetData& sheet, bool& ok)
+{
+    ok = false;
+    sheet = readSheetWithCache(path, ok, [&]() { return ExcelDocument(path).readSheet(0, &ok); });
+}
 
-void ExcelDocument::readXml()
+void ReadXlsxFile::read(const QString& path)
 {
-    QDomDocument doc("test");
-    QFile file("F:/repos/book1/xl/worksheets/sheet1.xml");
+    SheetData sheet;
+    bool ok;
 
-    if(!file.open(QIODevice::ReadOnly))
+    getSheet(path, sheet, ok);
+
+    emit finished(sheet, ok);
+}
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+namespace
+{
+    const QString relationshipNamespace = "http://schemas.openxmlformats.org/officeDocument/2006/relationships";
+
+    /* パーツのパスを基準に，リレーションシップのTargetをzip内のパスにする */
+    QString resolvePartPath(const QString& basePath, const QString& target)
     {
-        return;
+        if(target.startsWith('/')) return target.mid(1);
+
+        QStringList parts = basePath.split('/');
+        parts.removeLast();
+
+        for(const QString& part : target.split('/'))
+        {
+            if(part == "..") { if(!parts.isEmpty()) parts.removeLast(); }
+            else if(part != ".") parts.append(part);
+        }
+
+        return parts.join('/');
     }
-    if(!doc.setContent(&file))
+
+    /* <t>の文字列を連結する．ふりがな(<rPh>)は含めない */
+    void readRichText(QXmlStreamReader& xml, QString& text)
     {
-        file.close();
-        return;
+        while(xml.readNextStartElement())
+        {
+            if(xml.name() == QLatin1String("t"))
+                text += xml.readElementText();
+            else if(xml.name() == QLatin1String("r"))
+                readRichText(xml, text);
+            else
+                xml.skipCurrentElement();
+        }
     }
-    file.close();
+}
 
+ExcelDocument::ExcelDocument(const QString& path)
+    : path(path)
+    , zip(path)
+{
+    if(zip.isValid()) readWorkbook();
+}
+
+/* partPathのリレーションシップ(Id -> zip内のパス)を読む．typeSuffixを指定すると，Typeがそれで終わるものだけを返す */
+QHash<QString, QString> ExcelDocument::readRelationships(const QString& partPath, const QString& typeSuffix) const
+{
+    const qsizetype slash = partPath.lastIndexOf('/');
+    const QString relsPath = partPath.left(slash + 1) + "_rels/" + partPath.mid(slash + 1) + ".rels";
+
+    QHash<QString, QString> relationships;
+
+    bool ok = false;
+    const QByteArray data = zip.readEntry(relsPath, &ok);
+    if(!ok) return relationships;
+
+    QXmlStreamReader xml(data);
+    while(!xml.atEnd())
+    {
+        if(xml.readNext() != QXmlStreamReader::StartElement || xml.name() != QLatin1String("Relationship")) continue;
+
+        const QXmlStreamAttributes attributes = xml.attributes();
+        if(!typeSuffix.isEmpty() && !attributes.value("Type").endsWith(typeSuffix)) continue;
 
-    static const QString tag_sheet = "sheetData";
-    static const QString tag_row = "row";
-    static const QString tag_col = "c";
-    static const QString tag_index = "r";
-    static const QString tag_value = "v";
+        relationships.insert(attributes.value("Id").toString(),
+                             resolvePartPath(partPath, attributes.value("Target").toString()));
+    }
 
+    return relationships;
+}
 
-    const QDomNodeList sheetData_list = doc.elementsByTagName(tag_sheet);
-    if(sheetData_list.count() < 1) return;
+void ExcelDocument::readWorkbook()
+{
+    /* ブック本体の場所はパッケージのリレーションシップに書かれている */
+    QString workbookPath = "xl/workbook.xml";
+    const QHash<QString, QString> documents = readRelationships("", "/officeDocument");
+    if(!documents.isEmpty()) workbookPath = documents.begin().value();
 
-    const QDomNodeList row_list = sheetData_list.at(0).childNodes();
+    const QHash<QString, QString> relationships = readRelationships(workbookPath);
+    const QHash<QString, QString> sharedStrings = readRelationships(workbookPath, "/sharedStrings");
+    sharedStringsPath = (sharedStrings.isEmpty()) ? "xl/sharedStrings.xml" : sharedStrings.begin().value();
+
+    bool ok = false;
+    const QByteArray data = zip.readEntry(workbookPath, &ok);
 
-    const int rowCount = row_list.count();
-    for(int i = 0; i < rowCount; ++i)
+    if(ok)
     {
-        const QDomNode row = row_list.at(i);
-        if(row.nodeName() == tag_row)
+        QXmlStreamReader xml(data);
+        while(!xml.atEnd())
         {
-            const QString row_str = row.attributes().namedItem(tag_index).nodeValue();
+            if(xml.readNext() != QXmlStreamReader::StartElement || xml.name() != QLatin1String("sheet")) continue;
 
-            const QDomNodeList col_list = row.childNodes();
-            const size_t colCount = col_list.count();
+            const QXmlStreamAttributes attributes = xml.attributes();
+            const QString id = attributes.value(relationshipNamespace, "id").toString();
+            const QString sheetPath = relationships.value(id);
+            if(sheetPath.isEmpty() || zip.indexOf(sheetPath) < 0) continue;
 
-            for(int j = 0; j < colCount; ++j)
+            names.append(attributes.value("name").toString());
+            sheetPaths.append(sheetPath);
+        }
+    }
+
+    /* ブックが読めない場合はワークシートのxmlを直接探す */
+    if(sheetPaths.isEmpty())
+    {
+        for(const ZipReader::Entry& entry : zip.entries())
+        {
+            if(entry.name.startsWith("xl/worksheets/") && entry.name.endsWith(".xml"))
             {
-                const QDomNode col = col_list.at(j);
+                names.append(entry.name.section('/', -1).chopped(4));
+                sheetPaths.append(entry.name);
+            }
+        }
+    }
+}
 
-                if(col.nodeName() == tag_col)
-                {
-                    const QString col_str = col.attributes().namedItem(tag_index).nodeValue();
+/* 共有文字列はセルから番号で参照されるため，SheetDataへそのまま渡せるUTF-8で持っておく */
+QList<QByteArray> ExcelDocument::readSharedStrings() const
+{
+    QList<QByteArray> strings;
 
-                    QString value_str;
-                    const QDomNodeList value_list = col.firstChildElement(tag_value).childNodes();
-                    const int valueCount = value_list.size();
+    QIODevice *device = zip.openEntry(zip.indexOf(sharedStringsPath));
+    if(!device) return strings;
 
-                    for(int k = 0; k < valueCount; ++k)
-                    {
-                        const QDomNode value = value_list.at(k);
-                        if(value.nodeType() == QDomNode::NodeType::TextNode)
-                        {
-                            value_str += value.nodeValue();
-                        }
+    QXmlStreamReader xml(device);
+    while(!xml.atEnd())
+    {
+        if(xml.readNext() != QXmlStreamReader::StartElement) continue;
 
-                        setTableData(row_str, col_str, value_str);
-                    }
-                }
-            }
+        if(xml.name() == QLatin1String("sst"))
+        {
+            const qsizetype count = xml.attributes().value("uniqueCount").toLongLong();
+            if(count > 0) strings.reserve(qMin(count, qsizetype(1) << 24));
+        }
+        else if(xml.name() == QLatin1String("si"))
+        {
+            QString text;
+            readRichText(xml, text);
+            strings.append(text.toUtf8());
         }
     }
+
+    delete device;
+    return strings;
 }
 
-void ExcelDocument::setTableData(const QString &row, const QString& col, const QString &value)
+SheetData ExcelDocument::readSheet(const qsizetype index, bool *ok) const
 {
-    const int rowIndex = row.toInt();
-    const int colIndex = alphabetToInt(col.left(col.length() - row.length()));
+    if(index < 0 || index >= sheetPaths.size())
+    {
+        if(ok) *ok = false;
+        return SheetData();
+    }
+
+    QIODevice *device = zip.openEntry(zip.indexOf(sheetPaths.at(index)));
+    if(!device)
+    {
+        if(ok) *ok = false;
+        return SheetData();
+    }
+
+    const QList<QByteArray> sharedStrings = readSharedStrings();
+
+    SheetData sheet;
+    QXmlStreamReader xml(device);
+    qsizetype lastCol = -1;
+
+    while(!xml.atEnd())
+    {
+        const QXmlStreamReader::TokenType token = xml.readNext();
+
+        if(token == QXmlStreamReader::EndElement && xml.name() == QLatin1String("row"))
+        {
+            sheet.endRow();
+            continue;
+        }
+
+        if(token != QXmlStreamReader::StartElement) continue;
+
+        if(xml.name() == QLatin1String("row"))
+        {
+            /* 省略された空の行を埋める．行番号は1から始まる */
+            const qsizetype row = xml.attributes().value("r").toLongLong() - 1;
+            while(sheet.rowCount() < row) sheet.endRow();
+            lastCol = -1;
+        }
+        else if(xml.name() == QLatin1String("c"))
+        {
+            const QXmlStreamAttributes attributes = xml.attributes();
+
+            /* セル参照("B3"など)の列の部分．省略されていれば前のセルの次の列 */
+            qsizetype col = lastCol + 1;
+            const QStringView reference = attributes.value("r");
+            qsizetype letters = 0;
+            while(letters < reference.size() && reference.at(letters).isLetter()) ++letters;
+            if(letters > 0) col = alphabetToInt(reference.left(letters));
+
+            const QString type = attributes.value("t").toString();
+
+            QString value;
+            bool hasValue = false;
+            while(xml.readNextStartElement())
+            {
+                if(xml.name() == QLatin1String("v"))
+                {
+                    value = xml.readElementText();
+                    hasValue = true;
+                }
+                else if(xml.name() == QLatin1String("is"))
+                {
+                    readRichText(xml, value);
+                    hasValue = true;
+                }
+                else
+                    xml.skipCurrentElement(); //数式<f>など．計算済みの値<v>だけを使う
+            }
 
-    if(tableData.size() < rowIndex + 1) tableData.resize(rowIndex + 1);
-    if(tableData.at(rowIndex).size() < colIndex + 1) tableData[rowIndex].resize(colIndex + 1);
+            if(!hasValue || col <= lastCol) continue;
+            lastCol = col;
 
-    tableData[rowIndex][colIndex] = value;
+            if(type == QLatin1String("s"))
+            {
+                const qsizetype stringIndex = value.toLongLong();
+                if(stringIndex >= 0 && stringIndex < sharedStrings.size())
+                    sheet.appendCell(col, sharedStrings.at(stringIndex));
+            }
+            else if(type == QLatin1String("b"))
+                sheet.appendCell(col, (value == QLatin1String("1")) ? "TRUE" : "FALSE");
+            else
+                sheet.appendCell(col, value.toUtf8());
+        }
+    }
+
+    if(ok) *ok = !xml.hasError();
+
+    delete device;
+
+    sheet.squeeze();
+    return sheet;
 }
 
 QString ExcelDocument::intToAlphabet(int index)
@@ -278,22 +852,183 @@ QString ExcelDocument::intToAlphabet(int index)
     return result;
 }
 
+namespace
+{
+    /* xmlの文字データ．xml 1.0で使えない制御文字は取り除く */
+    void appendXmlText(QByteArray& out, QByteArrayView text)
+    {
+        for(const char c : text)
+        {
+            switch(c)
+            {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            default:
+                if(uchar(c) >= 0x20 || c == '\t' || c == '\n' || c == '\r') out += c;
+                break;
+            }
+        }
+    }
+
+    const char xmlDeclaration[] = "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n";
+    const char spreadsheetNamespace[] = "http://schemas.openxmlformats.org/spreadsheetml/2006/main";
+}
 
-int ExcelDocument::alphabetToInt(const QString& alphabet)
+bool ExcelDocument::writeSheet(const QString& path, const SheetData& sheet, const QString& sheetName)
 {
-    const size_t length = alphabet.length();
-    int index = 0;
+    static constexpr qsizetype flushSize = 1 << 20;
+
+    const qsizetype rowCount = sheet.rowCount();
+    const qsizetype colCount = sheet.columnCount();
+    const QStringList& columnNames = sheet.columnNames();
+    const bool hasNames = !columnNames.isEmpty();
+
+    if(rowCount + ((hasNames) ? 1 : 0) > maxRowCount || qMax(colCount, columnNames.size()) > maxColumnCount) return false;
+
+    /* シート名は31文字まで，[]:*?/\は使えない */
+    QString name = sheetName.left(31);
+    for(QChar& c : name)
+        if(QStringView(u"[]:*?/\\").contains(c)) c = '_';
+    if(name.trimmed().isEmpty()) name = "Sheet1";
+
+    QByteArray escapedName;
+    appendXmlText(escapedName, name.toUtf8());
+
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)) return false;
+
+    ZipWriter zip(&file);
+
+    bool ok = zip.addEntry("[Content_Types].xml", QByteArray(xmlDeclaration)
+        + "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+          "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+          "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+          "<Override PartName=\"/xl/workbook.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
+          "<Override PartName=\"/xl/worksheets/sheet1.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>"
+          "<Override PartName=\"/xl/styles.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.styles+xml\"/>"
+          "</Types>");
+
+    ok = ok && zip.addEntry("_rels/.rels", QByteArray(xmlDeclaration)
+        + "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+          "<Relationship Id=\"rId1\" Type=\"" + relationshipNamespace.toLatin1() + "/officeDocument\" Target=\"xl/workbook.xml\"/>"
+          "</Relationships>");
+
+    ok = ok && zip.addEntry("xl/workbook.xml", QByteArray(xmlDeclaration)
+        + "<workbook xmlns=\"" + spreadsheetNamespace + "\" xmlns:r=\"" + relationshipNamespace.toLatin1() + "\">"
+          "<sheets><sheet name=\"" + escapedName + "\" sheetId=\"1\" r:id=\"rId1\"/></sheets>"
+          "</workbook>");
+
+    ok = ok && zip.addEntry("xl/_rels/workbook.xml.rels", QByteArray(xmlDeclaration)
+        + "<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+          "<Relationship Id=\"rId1\" Type=\"" + relationshipNamespace.toLatin1() + "/worksheet\" Target=\"worksheets/sheet1.xml\"/>"
+          "<Relationship Id=\"rId2\" Type=\"" + relationshipNamespace.toLatin1() + "/styles\" Target=\"styles.xml\"/>"
+          "</Relationships>");
+
+    /* 既定の書式だけのスタイル．これがないと警告を出すアプリケーションがある */
+    ok = ok && zip.addEntry("xl/styles.xml", QByteArray(xmlDeclaration)
+        + "<styleSheet xmlns=\"" + spreadsheetNamespace + "\">"
+          "<fonts count=\"1\"><font><sz val=\"11\"/><name val=\"Calibri\"/></font></fonts>"
+          "<fills count=\"2\"><fill><patternFill patternType=\"none\"/></fill><fill><patternFill patternType=\"gray125\"/></fill></fills>"
+          "<borders count=\"1\"><border><left/><right/><top/><bottom/><diagonal/></border></borders>"
+          "<cellStyleXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\"/></cellStyleXfs>"
+          "<cellXfs count=\"1\"><xf numFmtId=\"0\" fontId=\"0\" fillId=\"0\" borderId=\"0\" xfId=\"0\"/></cellXfs>"
+          "<cellStyles count=\"1\"><cellStyle name=\"Normal\" xfId=\"0\" builtinId=\"0\"/></cellStyles>"
+          "</styleSheet>");
+
+    /* シートのxmlは一定量ごとに圧縮して書き出し，全体を文字列にしない */
+    ok = ok && zip.beginEntry("xl/worksheets/sheet1.xml");
+
+    QList<QByteArray> references(qMax(colCount, columnNames.size()));
+    for(qsizetype col = 0; col < references.size(); ++col)
+        references[col] = intToAlphabet(int(col)).toLatin1();
+
+    QByteArray buffer;
+    buffer.reserve(flushSize + 4096);
+    buffer += xmlDeclaration;
+    buffer += "<worksheet xmlns=\"";
+    buffer += spreadsheetNamespace;
+    buffer += "\"><sheetData>";
+
+    QByteArray cell;
+    QByteArray rowNumber;
+    qsizetype excelRow = 0;
+
+    const auto appendStringCell = [&](const qsizetype col, QByteArrayView text)
+    {
+        buffer += "<c r=\"";
+        buffer += references.at(col);
+        buffer += rowNumber;
+        buffer += "\" t=\"inlineStr\"><is><t xml:space=\"preserve\">";
+        appendXmlText(buffer, text);
+        buffer += "</t></is></c>";
+    };
+
+    if(hasNames)
+    {
+        rowNumber = QByteArray::number(++excelRow);
+        buffer += "<row r=\"" + rowNumber + "\">";
+        for(qsizetype col = 0; col < columnNames.size(); ++col)
+            if(!columnNames.at(col).isEmpty()) appendStringCell(col, columnNames.at(col).toUtf8());
+        buffer += "</row>";
+    }
 
-    /* 最小桁以外 */
-    for(size_t i = 0; i < length - 1; ++i)
+    for(qsizetype row = 0; row < rowCount && ok; ++row)
     {
-        const QChar c = alphabet.at(i);
+        rowNumber = QByteArray::number(++excelRow);
+        buffer += "<row r=\"" + rowNumber + "\">";
 
-        index += ((int)c.toLatin1() - (int)'A' + 1) * std::pow(26, length - i - 1);
+        for(qsizetype col = 0; col < colCount; ++col)
+        {
+            const SheetColumn& column = sheet.column(col);
+
+            cell.resize(0);
+            column.appendText(cell, row);
+            if(cell.isEmpty()) continue;
+
+            /* 数値のセルは元の文字列のまま<v>に書く．NaNや文字列のセルは文字列とする */
+            if(column.isNumeric() && qIsFinite(column.value(row)))
+            {
+                buffer += "<c r=\"";
+                buffer += references.at(col);
+                buffer += rowNumber;
+                buffer += "\"><v>";
+                buffer += cell;
+                buffer += "</v></c>";
+            }
+            else
+                appendStringCell(col, cell);
+        }
+
+        buffer += "</row>";
+
+        if(buffer.size() >= flushSize)
+        {
+            ok = zip.write(buffer);
+            buffer.resize(0);
+        }
+    }
+
+    buffer += "</sheetData></worksheet>";
+    ok = ok && zip.write(buffer) && zip.endEntry() && zip.finish();
+
+    if(!ok)
+    {
+        file.cancelWriting();
+        return false;
     }
 
-    /* 最小桁 */
-    index += ((int)alphabet.at(length - 1).toLatin1() - (int)'A');
+    return file.commit();
+}
+
+/* "A" -> 0, "Z" -> 25, "AA" -> 26 */
+int ExcelDocument::alphabetToInt(QStringView alphabet)
+{
+    int index = 0;
+
+    for(const QChar c : alphabet)
+        index = index * 26 + (c.toUpper().unicode() - 'A' + 1);
 
-    return index;
+    return index - 1;
 }
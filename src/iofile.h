@@ -6,8 +6,10 @@
 #include <QFile>
 #include <QTextStream>
 #include <QObject>
-#include <QDomDocument>
 #include <QApplication>
+#include "sheetdata.h"
+#include "sheetformat.h"
+#include "zipfile.h"
 
 inline void toFileTxt(const QString& fileName, const QString& data, bool* ok = nullptr)
 {
@@ -24,34 +26,31 @@ inline void toFileTxt(const QString& fileName, const QString& data, bool* ok = n
         if(ok) *ok = false;
 }
 
-inline void toFileCsv(const QString& filename, const QList<QList<QString> >& sheet, bool *ok = nullptr)
-{
-    QString data;
-    for(qsizetype row = 0; row < sheet.size(); ++row){
-        for(qsizetype col = 0; col < sheet.at(row).size(); ++col)
-        {
-            data += sheet.at(row).at(col);
-            if(col != sheet.at(row).size() - 1) { data += ','; }
-        }
-        if(row != sheet.size() - 1) { data += '\n'; }
-    }
+SheetData readSheetFile(const QString& fileName, const char delimiter, bool *ok = nullptr);
+SheetData readSheetFile(const QString& fileName, const SheetFormat& format, bool *ok = nullptr);
+bool writeSheetFile(const QString& fileName, const SheetData& sheet, const char delimiter);
+/* 引用符が必要なセルは引用符で囲み，注釈の行はそのまま書き出す */
+bool writeSheetFile(const QString& fileName, const SheetData& sheet, const SheetFormat& format);
 
-    toFileTxt(filename, data, ok);
-}
+/* クリップボードとのやり取り．シートを区切り文字で区切ったUTF-8のテキストにする(引用符で囲まない) */
+QByteArray sheetToText(const SheetData& sheet, const char delimiter);
+/* sheetToText()の逆．区切り文字だけで分け(引用符と注釈は解釈せず，書式も推定しない)，ファイルの読み込みと同じ解析器で列にする */
+SheetData sheetFromText(const QByteArray& text, const char delimiter);
+
+/* gnuplotのbinaryで読める形式(1行を1レコードとしたリトルエンディアンのdouble/float)で書き出す．数値でないセルはNaN */
+bool writeGnuplotBinaryFile(const QString& fileName, const SheetData& sheet, const bool singlePrecision);
+QString gnuplotBinaryClause(const qsizetype columnCount, const qsizetype recordCount, const bool singlePrecision);
 
-inline void toFileTsv(const QString& filename, const QList<QList<QString> >& sheet, bool *ok = nullptr)
+inline void toFileCsv(const QString& filename, const SheetData& sheet, bool *ok = nullptr)
 {
-    QString data;
-    for(qsizetype row = 0; row < sheet.size(); ++row){
-        for(qsizetype col = 0; col < sheet.at(row).size(); ++col)
-        {
-            data += sheet.at(row).at(col);
-            if(col != sheet.at(row).size() - 1) { data += '\t'; }
-        }
-        if(row != sheet.size() - 1) { data += '\n'; }
-    }
+    const bool result = writeSheetFile(filename, sheet, ',');
+    if(ok) *ok = result;
+}
 
-    toFileTxt(filename, data, ok);
+inline void toFileTsv(const QString& filename, const SheetData& sheet, bool *ok = nullptr)
+{
+    const bool result = writeSheetFile(filename, sheet, '\t');
+    if(ok) *ok = result;
 }
 
 inline QString readFileTxt(const QString& fileName, bool *ok = nullptr)
@@ -88,78 +87,54 @@ inline void readFileTxt(const QString& fileName, QString& text, bool *ok = nullp
         if(ok) *ok = false;
 }
 
-inline QList<QList<QString> > readFileCsv(const QString& fileName, bool *ok = nullptr)
+inline SheetData readFileCsv(const QString& fileName, bool *ok = nullptr)
 {
-    const QString data = readFileTxt(fileName, ok);  //ファイルの内容(text)をQString型で保持
-
-    /* okがnullptrじゃなく、falseの場合 または 空文字だった場合 */
-    if((ok && !*ok) || data.isEmpty())
-    {
-        return QList<QList<QString> >();
-    }
-    else
-    {
-        QList<QList<QString> > sheet(1);                 //csvデータを2次元のQString型で返す
-        qsizetype row = 0;                               //行数
-        QString stack = "";                              //スタック
-
-        for(const QChar& c : data)
-        {
-            if(c == '\n'){
-                sheet[row] << stack;
-                stack.clear();
-                sheet.append(QList<QString>(0));
-                row++;
-            }
-            else if(c == ','){
-                sheet[row] << stack;
-                stack.clear();
-            }
-            else
-                stack += c;
-        }
-        sheet[row] << stack;
+    return readSheetFile(fileName, SheetFormat::sniff(fileName, ','), ok);
+}
 
-        if(ok) *ok = true;
-        return sheet;
-    }
+inline SheetData readFileTsv(const QString& fileName, bool *ok = nullptr)
+{
+    return readSheetFile(fileName, SheetFormat::sniff(fileName, '\t'), ok);
 }
 
-inline QList<QList<QString> > readFileTsv(const QString& fileName, bool *ok = nullptr)
+
+
+
+
+/* 区切り文字で区切られたテキストをチャンク単位で受け取り，SheetDataを直接組み立てる．
+ * テキストはUTF-8として扱い，数値のセルはQStringを経由せずに解釈される．
+ * 区切り文字だけの書式は1バイトずつ区切りを探し，引用符や注釈，空白の区切りのある書式は1行ずつ分ける．
+ */
+class SheetParser
 {
-    const QString data = readFileTxt(fileName, ok);
+public:
+    explicit SheetParser(const char delimiter) : SheetParser(SheetFormat(delimiter)) {}
+    explicit SheetParser(const SheetFormat& format);
 
-    if((ok && !*ok) || data.isEmpty())
-    {
-        return QList<QList<QString> >();
-    }
-    else
-    {
-        QList<QList<QString> > sheet(1);   //tsvデータを2次元のQString型で返す
-        qsizetype row = 0;
-        QString stack = "";
-
-        for(const QChar& c : data)
-        {
-            if(c == '\n'){
-                sheet[row] << stack;
-                stack.clear();
-                sheet.append(QList<QString>(0));
-                row++;
-            }
-            else if(c == '\t'){
-                sheet[row] << stack;
-                stack.clear();
-            }
-            else
-                stack += c;
-        }
-        sheet[row] << stack;
+    void parse(const char *data, const qsizetype size);
+    SheetData finish();
 
-        if(ok) *ok = true;
-        return sheet;
-    }
-}
+private:
+    void parsePlain(const char *p, const char *end);
+    void parseLines(const char *p, const char *end);
+    void parseLine(QByteArrayView line);
+    void pushField(QByteArrayView field);
+    void pushRow();
+
+    const SheetFormat format;
+    const char delimiter;
+    SheetData sheet;
+    QByteArray pending;         //チャンクをまたいだフィールド(parseLines()では行)
+    qsizetype col = 0;
+    bool atStart = true;
+
+    /* parseLines()の行の途中の状態 */
+    bool inQuotes = false;
+    bool quoteClosed = false;   //直前の文字が閉じた引用符("a""b"の2つ目の引用符)
+    bool fieldStart = true;
+    bool lineStarted = false;   //空白でない文字があった
+    bool inComment = false;
+};
 
 
 
@@ -210,11 +185,14 @@ class ReadCsvFile : public QObject
 public:
     explicit ReadCsvFile(QObject *parent) : QObject(parent) {}
 
+public:
+    static void getSheet(const QString& path, SheetData& sheet, bool& ok);
+
 public slots:
     void read(const QString& path);
 
 signals:
-    void finished(const QList<QList<QString> >& data, const bool& ok);
+    void finished(const SheetData& data, const bool& ok);
 };
 
 
@@ -227,8 +205,11 @@ class WriteCsvFile : public QObject
 public:
     explicit WriteCsvFile(QObject *parent) : QObject(parent) {}
 
+public:
+    static void toCsv(const QString& path, const SheetData& sheet, bool& ok);
+
 public slots:
-    void write(const QString& path, const QList<QList<QString> >& data);
+    void write(const QString& path, const SheetData& data);
 
 signals:
     void finished(const bool& ok);
@@ -244,11 +225,14 @@ class ReadTsvFile : public QObject
 public:
     explicit ReadTsvFile(QObject *parent) : QObject(parent) {}
 
+public:
+    static void getSheet(const QString& path, SheetData& sheet, bool& ok);
+
 public slots:
     void read(const QString& path);
 
 signals:
-    void finished(const QList<QList<QString> >& data, const bool& ok);
+    void finished(const SheetData& data, const bool& ok);
 };
 
 
@@ -261,8 +245,11 @@ class WriteTsvFile : public QObject
 public:
     explicit WriteTsvFile(QObject *parent) : QObject(parent) {}
 
+public:
+    static void toTsv(const QString& path, const SheetData& sheet, bool& ok);
+
 public slots:
-    void write(const QString& path, const QList<QList<QString> >& sheet);
+    void write(const QString& path, const SheetData& sheet);
 
 signals:
     void finished(const bool& ok);
@@ -272,6 +259,24 @@ signals:
 
 
 
+class ReadXlsxFile : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ReadXlsxFile(QObject *parent) : QObject(parent) {}
+
+public:
+    static void getSheet(const QString& path, SheetData& sheet, bool& ok);
+
+public slots:
+    void read(const QString& path);
+
+signals:
+    void finished(const SheetData& data, const bool& ok);
+};
+
+
+
 
 
 
@@ -285,24 +290,42 @@ signals:
 
 
 
+
+
+/* Excelのブック(.xlsx)．
+ * zipのエントリーを直接読み，シートのxmlはQXmlStreamReaderで先頭から順に処理してセルをSheetDataへ追加する．
+ * DOMを作らないため，大きなシートでもメモリの使用量はシートのデータと共有文字列の分だけで済む．
+ * 書き出しも行ごとにxmlを作ってそのまま圧縮し，文字列は共有文字列を使わずにセルへ直接書く．
+ */
 class ExcelDocument
 {
 public:
-    explicit ExcelDocument(const QString& path)
-        : path(path) {}
+    explicit ExcelDocument(const QString& path);
 
-public: //debug
-    void readXml();
-    void setTableData(const QString& row, const QString& col, const QString& value);
+    bool isValid() const { return zip.isValid() && !sheetPaths.isEmpty(); }
+    const QStringList& sheetNames() const { return names; }
+    SheetData readSheet(const qsizetype index, bool *ok = nullptr) const;
+
+    /* sheetを1枚のシートのブックとして書き出す．列名があれば最初の行にする．Excelの行数・列数の上限を超えればfalse */
+    static bool writeSheet(const QString& path, const SheetData& sheet, const QString& sheetName = "Sheet1");
+
+    static constexpr qsizetype maxRowCount = 1048576;
+    static constexpr qsizetype maxColumnCount = 16384;
 
-private:
     static QString intToAlphabet(int index);
-    static int alphabetToInt(const QString& alphabet);
+    static int alphabetToInt(QStringView alphabet);
+
+private:
+    QHash<QString, QString> readRelationships(const QString& partPath, const QString& typeSuffix = QString()) const;
+    void readWorkbook();
+    QList<QByteArray> readSharedStrings() const;
 
 private:
-    const QString unzipExpPath = QApplication::applicationDirPath() + "/unzip.exe";
     const QString path;
-    QList<QList<QString> > tableData;
+    ZipReader zip;
+    QStringList names;
+    QStringList sheetPaths;         //zip内でのシートのxmlのパス
+    QString sharedStringsPath;
 };
 
 
@@ -0,0 +1,344 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "ioscheduler.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QPointer>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+
+
+namespace
+{
+    /* 結果を受け取るオブジェクト．渡されなかった(nullptr)場合と，破棄された場合を区別する */
+    struct Context
+    {
+        Context(QObject *object = nullptr) : object(object), bound(object != nullptr) {}
+        bool isAlive() const { return !bound || object; }
+
+        QPointer<QObject> object;
+        bool bound;
+    };
+}
+
+using Receiver = QPair<Context, IoScheduler::Finished>;
+using Done = QPair<Context, std::function<void()> >;
+
+struct IoScheduler::Entry
+{
+    QString path;
+    Task task;
+    QList<Receiver> receivers;
+};
+
+struct IoScheduler::Request
+{
+    QList<Entry> entries;
+    Operation operation;
+    Priority priority;
+    QList<Done> done;
+    quint64 sequence;               //要求された順番
+    qint64 enqueued;                //nsec
+
+    bool contains(const QString& path) const
+    {
+        for(const Entry& entry : entries) if(entry.path == path) return true;
+        return false;
+    }
+};
+
+
+
+
+class IoScheduler::Queue
+{
+public:
+    Queue();
+    ~Queue();
+
+    void push(Request& request);
+    void waitForDone();
+
+    Statistics statistics(const Priority priority);
+    void resetStatistics();
+
+private:
+    void merge(Request& request, Entry& entry);
+    bool isDispatchable(const Request& request) const;
+    void dispatch();
+    void run(Request& request);
+
+    QMutex mutex;
+    QWaitCondition idle;
+    QThreadPool pool;
+    QElapsedTimer clock;
+
+    int maxThreadCount;
+    int running = 0;
+    int runningBackground = 0;      //実行中のInteractiveでない要求の数
+    quint64 nextSequence = 0;
+
+    QList<Request> pending;
+    QSet<QString> busyPaths;
+    Statistics stats[3];
+};
+
+IoScheduler::Queue::Queue()
+    : maxThreadCount(qBound(2, QThread::idealThreadCount() / 2, 4))
+{
+    pool.setMaxThreadCount(maxThreadCount);
+    clock.start();
+}
+
+IoScheduler::Queue::~Queue()
+{
+    waitForDone();
+}
+
+void IoScheduler::Queue::push(Request& request)
+{
+    QMutexLocker locker(&mutex);
+
+    request.sequence = nextSequence++;
+    request.enqueued = clock.nsecsElapsed();
+    stats[int(request.priority)].requested += request.entries.size();
+
+    for(Entry& entry : request.entries)
+        merge(request, entry);
+
+    pending.append(request);
+
+    dispatch();
+}
+
+/* 同じパスの最後の要求が同じ操作でまだ始まっていなければ，そのentryを新しい要求の方に移す．
+ * 途中に別の操作があればまとめない(読み込みが保存を追い越さないように) */
+void IoScheduler::Queue::merge(Request& request, Entry& entry)
+{
+    qsizetype last = -1;
+    for(qsizetype i = 0; i < pending.size(); ++i)
+    {
+        Request& other = pending[i];
+        if(!other.contains(entry.path)) continue;
+
+        //高い優先度の要求が，同じパスの先の要求を待つことにならないように優先度を引き上げる
+        if(request.priority < other.priority) other.priority = request.priority;
+        if(last < 0 || other.sequence > pending.at(last).sequence) last = i;
+    }
+
+    if(last < 0 || pending.at(last).operation != request.operation) return;
+
+    Request& other = pending[last];
+
+    /* 他のentryが残る要求のdoneは，移したentryの完了を待てないためまとめない */
+    if(!other.done.isEmpty() && other.entries.size() > 1) return;
+
+    for(qsizetype i = 0; i < other.entries.size(); ++i)
+    {
+        if(other.entries.at(i).path != entry.path) continue;
+
+        //書き込みは新しい内容(entry.task)だけを書けばよい．読み込みはどちらでも同じ
+        entry.receivers = other.entries.at(i).receivers + entry.receivers;
+        other.entries.removeAt(i);
+        break;
+    }
+
+    request.enqueued = qMin(request.enqueued, other.enqueued);
+    stats[int(request.priority)].merged++;
+
+    if(other.entries.isEmpty())
+    {
+        request.done = other.done + request.done;
+        pending.removeAt(last);
+    }
+}
+
+/* 同じパスの要求が実行中か，それより先の要求が待っていれば実行できない */
+bool IoScheduler::Queue::isDispatchable(const Request& request) const
+{
+    if(request.priority != Priority::Interactive && runningBackground >= maxThreadCount - 1) return false;
+
+    for(const Entry& entry : request.entries)
+    {
+        if(busyPaths.contains(entry.path)) return false;
+
+        for(const Request& other : pending)
+            if(other.sequence < request.sequence && other.contains(entry.path)) return false;
+    }
+
+    return true;
+}
+
+/* mutexをロックした状態で呼ぶ */
+void IoScheduler::Queue::dispatch()
+{
+    while(running < maxThreadCount)
+    {
+        qsizetype best = -1;
+        for(qsizetype i = 0; i < pending.size(); ++i)
+        {
+            const Request& request = pending.at(i);
+            if(!isDispatchable(request)) continue;
+
+            if(best < 0 ||
+               request.priority < pending.at(best).priority ||
+               (request.priority == pending.at(best).priority && request.sequence < pending.at(best).sequence))
+                best = i;
+        }
+
+        if(best < 0) return;
+
+        Request request = pending.takeAt(best);
+
+        Statistics& stat = stats[int(request.priority)];
+        const qint64 wait = (clock.nsecsElapsed() - request.enqueued) / 1000;
+        stat.started++;
+        stat.totalWait += wait;
+        stat.maxWait = qMax(stat.maxWait, wait);
+
+        for(const Entry& entry : qAsConst(request.entries)) busyPaths.insert(entry.path);
+        running++;
+        if(request.priority != Priority::Interactive) runningBackground++;
+
+        pool.start([this, request]() mutable { run(request); });
+    }
+}
+
+void IoScheduler::Queue::run(Request& request)
+{
+    QObject *application = QCoreApplication::instance();
+
+    for(const Entry& entry : qAsConst(request.entries))
+    {
+        bool ok = false;
+        const QVariant result = entry.task(entry.path, ok);
+
+        /* 結果はメインスレッドで受け取る．contextが破棄されていれば何もしない */
+        for(const Receiver& receiver : entry.receivers)
+        {
+            const Context context = receiver.first;
+            const Finished finished = receiver.second;
+            if(!finished) continue;
+
+            QMetaObject::invokeMethod(application, [context, finished, result, ok]() {
+                if(context.isAlive()) finished(result, ok);
+            }, Qt::QueuedConnection);
+        }
+    }
+
+    for(const Done& done : qAsConst(request.done))
+    {
+        const Context context = done.first;
+        const std::function<void()> finished = done.second;
+
+        QMetaObject::invokeMethod(application, [context, finished]() {
+            if(context.isAlive()) finished();
+        }, Qt::QueuedConnection);
+    }
+
+    QMutexLocker locker(&mutex);
+
+    for(const Entry& entry : qAsConst(request.entries)) busyPaths.remove(entry.path);
+    running--;
+    if(request.priority != Priority::Interactive) runningBackground--;
+
+    dispatch();
+
+    if(running == 0) idle.wakeAll();
+}
+
+void IoScheduler::Queue::waitForDone()
+{
+    QMutexLocker locker(&mutex);
+
+    //実行中の要求がなければdispatch()ですべて始まっているため，待っているものは残らない
+    while(running > 0) idle.wait(&mutex);
+}
+
+IoScheduler::Statistics IoScheduler::Queue::statistics(const Priority priority)
+{
+    QMutexLocker locker(&mutex);
+    return stats[int(priority)];
+}
+
+void IoScheduler::Queue::resetStatistics()
+{
+    QMutexLocker locker(&mutex);
+    for(Statistics& stat : stats) stat = Statistics();
+}
+
+
+
+
+
+
+IoScheduler::Queue& IoScheduler::queue()
+{
+    static Queue queue;
+    return queue;
+}
+
+void IoScheduler::schedule(const QString& path,
+                           const Operation operation,
+                           const Priority priority,
+                           QObject *context,
+                           const Task& task,
+                           const Finished& finished)
+{
+    schedule(Batch{ Job{ path, context, task, finished } }, operation, priority);
+}
+
+void IoScheduler::schedule(const Batch& batch,
+                           const Operation operation,
+                           const Priority priority,
+                           QObject *context,
+                           const std::function<void()>& done)
+{
+    Request request;
+    request.operation = operation;
+    request.priority = priority;
+
+    for(const Job& job : batch)
+        request.entries.append(Entry{ job.path, job.task, { Receiver(job.context, job.finished) } });
+
+    if(done) request.done.append(Done(context, done));
+
+    if(request.entries.isEmpty())
+    {
+        //書き込むものがなくても，doneは他の要求と同じく後から呼ぶ
+        const Context receiver(context);
+        if(done) QMetaObject::invokeMethod(QCoreApplication::instance(), [receiver, done]() {
+            if(receiver.isAlive()) done();
+        }, Qt::QueuedConnection);
+        return;
+    }
+
+    queue().push(request);
+}
+
+IoScheduler::Statistics IoScheduler::statistics(const Priority priority)
+{
+    return queue().statistics(priority);
+}
+
+void IoScheduler::resetStatistics()
+{
+    queue().resetStatistics();
+}
+
+void IoScheduler::waitForDone()
+{
+    queue().waitForDone();
+}
@@ -0,0 +1,90 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef IOSCHEDULER_H
+#define IOSCHEDULER_H
+
+#include <QString>
+#include <QVariant>
+#include <functional>
+
+class QObject;
+
+
+
+/* ファイルの読み書きを少数のスレッドで実行するスケジューラ．
+ * 要求は優先度(Interactive > Background > Prefetch)の順に実行し，同じ優先度の中では先着順．
+ * InteractiveでないものはmaxThreadCount - 1個までしか同時に実行しないため，
+ * 大きなファイルの保存中でも，開く操作は待たされない．
+ *
+ * 同じパス・同じ操作のまだ始まっていない要求は，新しい要求の方にまとめる(書き込みは新しい内容で置き換える)．
+ * 同じパスの要求は同時に実行せず，要求した順に実行する．
+ */
+class IoScheduler
+{
+public:
+    enum class Priority { Interactive, Background, Prefetch };
+    enum class Operation { Read, Write, Hash };    //同じ操作の要求だけをまとめる．Hashは内容のハッシュを求める読み込み
+
+    /* taskは別スレッドで実行される．finishedはメインスレッドで呼ばれる．
+     * contextを渡した場合，それが破棄されていれば呼ばれない．contextがnullptrであれば必ず呼ばれる */
+    using Task = std::function<QVariant(const QString& path, bool& ok)>;
+    using Finished = std::function<void(const QVariant& result, const bool ok)>;
+
+    static void schedule(const QString& path,
+                         const Operation operation,
+                         const Priority priority,
+                         QObject *context,
+                         const Task& task,
+                         const Finished& finished = Finished());
+
+    /* 複数のファイルへの要求を1つの要求として，1つのスレッドで順に実行する．
+     * すべて終わるとdoneがメインスレッドで呼ばれる(contextの扱いはfinishedと同じ) */
+    struct Job
+    {
+        QString path;
+        QObject *context;
+        Task task;
+        Finished finished;
+    };
+    using Batch = QList<Job>;
+
+    static void schedule(const Batch& batch,
+                         const Operation operation,
+                         const Priority priority,
+                         QObject *context = nullptr,
+                         const std::function<void()>& done = std::function<void()>());
+
+    /* 要求されてから実行が始まるまでの待ち時間 */
+    struct Statistics
+    {
+        qint64 requested = 0;
+        qint64 merged = 0;          //既存の要求にまとめられた数
+        qint64 started = 0;
+        qint64 totalWait = 0;       //usec
+        qint64 maxWait = 0;         //usec
+
+        double averageWait() const { return (started > 0) ? double(totalWait) / started : 0.0; }
+    };
+
+    static Statistics statistics(const Priority priority);
+    static void resetStatistics();
+
+    /* 実行中と待機中のすべての要求が終わるまで待つ */
+    static void waitForDone();
+
+private:
+    struct Entry;
+    struct Request;
+    class Queue;
+
+    static Queue& queue();
+};
+
+#endif // IOSCHEDULER_H
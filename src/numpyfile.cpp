@@ -0,0 +1,638 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "numpyfile.h"
+
+#include <QFileInfo>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSysInfo>
+#include <QtEndian>
+#include <QtNumeric>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include "zipfile.h"
+
+
+
+namespace
+{
+    constexpr char magic[] = "\x93NUMPY";
+    constexpr qint64 magicSize = 6;
+    constexpr qint64 headerAlignment = 64;
+
+    template <typename T>
+    inline T loadValue(const char *p, const bool bigEndian)
+    {
+        return (bigEndian) ? qFromBigEndian<T>(p) : qFromLittleEndian<T>(p);
+    }
+
+    template <typename T>
+    inline void storeValue(char *p, const T value, const bool bigEndian)
+    {
+        if(bigEndian) qToBigEndian<T>(value, p);
+        else qToLittleEndian<T>(value, p);
+    }
+
+    inline double doubleAt(const char *p, const NumpyFile::Layout& layout)
+    {
+        if(layout.itemSize == 4)
+        {
+            const quint32 bits = loadValue<quint32>(p, layout.bigEndian);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return SheetColumn::fromFloat(value);
+        }
+
+        const quint64 bits = loadValue<quint64>(p, layout.bigEndian);
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    /* 'i', 'u', 'b'．uint64でint64に収まらない値は呼び出し側で扱う */
+    inline qint64 integerAt(const char *p, const NumpyFile::Layout& layout)
+    {
+        const bool isSigned = (layout.kind == 'i');
+
+        switch(layout.itemSize)
+        {
+        case 1:
+            if(layout.kind == 'b') return (*p != 0) ? 1 : 0;
+            return (isSigned) ? qint64(qint8(*p)) : qint64(quint8(*p));
+        case 2:
+            return (isSigned) ? qint64(loadValue<qint16>(p, layout.bigEndian)) : qint64(loadValue<quint16>(p, layout.bigEndian));
+        case 4:
+            return (isSigned) ? qint64(loadValue<qint32>(p, layout.bigEndian)) : qint64(loadValue<quint32>(p, layout.bigEndian));
+        default:
+            return qint64(loadValue<quint64>(p, layout.bigEndian));
+        }
+    }
+
+    /* 数値でないセルは0，範囲外の値は型の範囲に丸める */
+    inline qint64 integerValue(const SheetColumn& column, const qsizetype row)
+    {
+        if(column.type() == SheetColumn::Type::Int64) return column.int64Data()[row];
+
+        const double value = column.value(row);
+        if(qIsNaN(value)) return 0;
+        if(value >= 9.2233720368547758e18) return std::numeric_limits<qint64>::max();
+        if(value <= -9.2233720368547758e18) return std::numeric_limits<qint64>::min();
+        return qint64(std::llround(value));
+    }
+
+    void storeElement(char *p, const SheetColumn& column, const qsizetype row, const NumpyFile::Layout& layout)
+    {
+        if(layout.kind == 'f')
+        {
+            const double value = column.value(row);  //数値でないセルはNaN
+            if(layout.itemSize == 4)
+            {
+                const float single = float(value);
+                quint32 bits;
+                std::memcpy(&bits, &single, sizeof(bits));
+                storeValue<quint32>(p, bits, layout.bigEndian);
+            }
+            else
+            {
+                quint64 bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                storeValue<quint64>(p, bits, layout.bigEndian);
+            }
+            return;
+        }
+
+        const qint64 value = integerValue(column, row);
+
+        switch(layout.itemSize)
+        {
+        case 1:
+            *p = (layout.kind == 'b') ? char(value != 0) : char(value);
+            break;
+        case 2:
+            storeValue<quint16>(p, quint16(value), layout.bigEndian);
+            break;
+        case 4:
+            storeValue<quint32>(p, quint32(value), layout.bigEndian);
+            break;
+        default:
+            storeValue<quint64>(p, quint64(value), layout.bigEndian);
+            break;
+        }
+    }
+
+    QString shapeString(const QList<qint64>& shape, const QString& separator)
+    {
+        QStringList dims;
+        for(const qint64 dim : shape) dims << QString::number(dim);
+        return dims.join(separator);
+    }
+}
+
+
+
+
+qint64 NumpyFile::Layout::rowCount() const
+{
+    return (shape.isEmpty()) ? 1 : shape.at(0);
+}
+
+qint64 NumpyFile::Layout::columnCount() const
+{
+    qint64 count = 1;
+    for(qsizetype i = 1; i < shape.size(); ++i) count *= shape.at(i);
+    return count;
+}
+
+/* "<f8"，"|u1"，">i4"のようなNumPyの型の表記か，"float32"のような型の名前 */
+bool NumpyFile::Layout::setDescr(const QString& descr)
+{
+    static const QHash<QString, QString> names = {
+        { "float32", "f4" }, { "float64", "f8" }, { "double", "f8" },
+        { "int8", "i1" }, { "int16", "i2" }, { "int32", "i4" }, { "int64", "i8" },
+        { "uint8", "u1" }, { "uint16", "u2" }, { "uint32", "u4" }, { "uint64", "u8" },
+        { "bool", "b1" }
+    };
+
+    static const QRegularExpression pattern("^([<>|=]?)([fiub])(\\d+)$");
+    const QRegularExpressionMatch match = pattern.match(names.value(descr, descr));
+    if(!match.hasMatch()) return false;
+
+    const char k = match.captured(2).at(0).toLatin1();
+    const int size = match.captured(3).toInt();
+
+    const bool supported = (k == 'f') ? (size == 4 || size == 8)
+                         : (k == 'b') ? (size == 1)
+                                      : (size == 1 || size == 2 || size == 4 || size == 8);
+    if(!supported) return false;
+
+    const QString order = match.captured(1);
+    kind = k;
+    itemSize = size;
+    bigEndian = (order == ">" || (order == "=" && QSysInfo::ByteOrder == QSysInfo::BigEndian));
+    return true;
+}
+
+QString NumpyFile::Layout::descr() const
+{
+    const QLatin1Char order = (itemSize == 1) ? QLatin1Char('|') : (bigEndian) ? QLatin1Char('>') : QLatin1Char('<');
+    return QString(order) + QLatin1Char(kind) + QString::number(itemSize);
+}
+
+
+
+
+
+/* "\x93NUMPY" major minor HEADER_LEN "{'descr': '<f8', 'fortran_order': False, 'shape': (100, 3), }" */
+bool NumpyFile::parseHeader(const char *data, const qint64 size, Layout& layout)
+{
+    if(size < magicSize + 4 || std::memcmp(data, magic, magicSize) != 0) return false;
+
+    const int major = quint8(data[6]);
+    qint64 headerStart = 0;
+    qint64 headerLength = 0;
+
+    if(major == 1)
+    {
+        headerStart = 10;
+        headerLength = qFromLittleEndian<quint16>(data + 8);
+    }
+    else if((major == 2 || major == 3) && size >= 12)
+    {
+        headerStart = 12;
+        headerLength = qFromLittleEndian<quint32>(data + 8);
+    }
+    else
+        return false;
+
+    if(headerStart + headerLength > size) return false;
+
+    const QString header = QString::fromUtf8(data + headerStart, headerLength);
+
+    static const QRegularExpression descrPattern("['\"]descr['\"]\\s*:\\s*['\"]([^'\"]*)['\"]");
+    static const QRegularExpression fortranPattern("['\"]fortran_order['\"]\\s*:\\s*(True|False)");
+    static const QRegularExpression shapePattern("['\"]shape['\"]\\s*:\\s*\\(([^)]*)\\)");
+
+    /* 構造化された型(descrがリスト)には対応していない */
+    const QRegularExpressionMatch descr = descrPattern.match(header);
+    const QRegularExpressionMatch fortran = fortranPattern.match(header);
+    const QRegularExpressionMatch shape = shapePattern.match(header);
+    if(!descr.hasMatch() || !fortran.hasMatch() || !shape.hasMatch()) return false;
+
+    if(!layout.setDescr(descr.captured(1))) return false;
+    layout.fortranOrder = (fortran.captured(1) == "True");
+
+    layout.shape.clear();
+    for(const QString& dim : shape.captured(1).split(',', Qt::SkipEmptyParts))
+    {
+        if(dim.trimmed().isEmpty()) continue;
+
+        bool ok = false;
+        const qint64 value = dim.trimmed().toLongLong(&ok);
+        if(!ok || value < 0) return false;
+        layout.shape << value;
+    }
+
+    layout.offset = headerStart + headerLength;
+    return true;
+}
+
+/* -1の軸をデータのサイズから決め，データが足りているか確かめる */
+bool NumpyFile::resolveShape(Layout& layout, const qint64 dataSize)
+{
+    if(dataSize < 0) return false;
+
+    qsizetype unknown = -1;
+    bool empty = false;
+    for(qsizetype i = 0; i < layout.shape.size(); ++i)
+    {
+        const qint64 dim = layout.shape.at(i);
+        if(dim == -1 && unknown < 0) { unknown = i; continue; }
+        if(dim < 0) return false;
+        if(dim == 0) empty = true;
+    }
+
+    if(empty)
+    {
+        if(unknown >= 0) layout.shape[unknown] = 0;
+        return true;
+    }
+
+    /* 積があふれないように，1軸ずつデータのサイズに収まるか確かめる */
+    qint64 known = layout.itemSize;
+    for(qsizetype i = 0; i < layout.shape.size(); ++i)
+    {
+        if(i == unknown) continue;
+        if(known > dataSize / layout.shape.at(i)) return false;
+        known *= layout.shape.at(i);
+    }
+
+    if(unknown >= 0) layout.shape[unknown] = dataSize / known;
+
+    return true;
+}
+
+bool NumpyFile::appendColumns(const char *data, const Layout& layout, const QSharedPointer<QFile>& mapping, QList<SheetColumn>& columns)
+{
+    const qint64 cols = layout.columnCount();
+    for(qint64 col = 0; col < cols; ++col)
+        columns.append(toColumn(data, layout, col, mapping));
+
+    return true;
+}
+
+SheetColumn NumpyFile::toColumn(const char *data, const Layout& layout, const qint64 col, const QSharedPointer<QFile>& mapping)
+{
+    const qint64 rows = layout.rowCount();
+    const qint64 stride = (layout.fortranOrder) ? layout.itemSize : layout.itemSize * layout.columnCount();
+    const char *first = data + ((layout.fortranOrder) ? col * rows : col) * layout.itemSize;
+
+    /* ファイル上の配列がそのまま列になる場合はコピーしない */
+    const bool native = (layout.bigEndian == (QSysInfo::ByteOrder == QSysInfo::BigEndian));
+    if(mapping && native && layout.itemSize == 8 && stride == 8 && (layout.kind == 'f' || layout.kind == 'i') &&
+       reinterpret_cast<quintptr>(first) % alignof(double) == 0)
+    {
+        return SheetColumn::fromMapped((layout.kind == 'f') ? SheetColumn::Type::Double : SheetColumn::Type::Int64,
+                                       first, rows, mapping);
+    }
+
+    if(layout.kind == 'f')
+    {
+        QList<double> values(rows);
+        for(qint64 row = 0; row < rows; ++row)
+            values[row] = doubleAt(first + row * stride, layout);
+        return SheetColumn::fromValues(values);
+    }
+
+    /* uint64でint64に収まらない値があれば，浮動小数点の列にする */
+    if(layout.kind == 'u' && layout.itemSize == 8)
+    {
+        bool fits = true;
+        for(qint64 row = 0; row < rows && fits; ++row)
+            fits = (loadValue<quint64>(first + row * stride, layout.bigEndian) <= quint64(std::numeric_limits<qint64>::max()));
+
+        if(!fits)
+        {
+            QList<double> values(rows);
+            for(qint64 row = 0; row < rows; ++row)
+                values[row] = double(loadValue<quint64>(first + row * stride, layout.bigEndian));
+            return SheetColumn::fromValues(values);
+        }
+    }
+
+    QList<qint64> values(rows);
+    for(qint64 row = 0; row < rows; ++row)
+        values[row] = integerAt(first + row * stride, layout);
+    return SheetColumn::fromValues(values);
+}
+
+
+
+
+
+bool NumpyFile::readNpy(const QString& path, SheetData& sheet, Layout *layout)
+{
+    QSharedPointer<QFile> file(new QFile(path));
+    if(!file->open(QIODevice::ReadOnly)) return false;
+
+    /* mmapできなければ読み込んだデータを変換する */
+    QByteArray buffer;
+    qint64 size = file->size();
+    const char *data = (size > 0) ? reinterpret_cast<const char*>(file->map(0, size)) : nullptr;
+    if(!data)
+    {
+        buffer = file->readAll();
+        data = buffer.constData();
+        size = buffer.size();
+        file.reset();
+    }
+
+    Layout header;
+    if(!parseHeader(data, size, header)) return false;
+    if(!resolveShape(header, size - header.offset)) return false;
+
+    QList<SheetColumn> columns;
+    if(!appendColumns(data + header.offset, header, file, columns)) return false;
+
+    sheet = SheetData::fromColumns(columns);
+    if(layout) *layout = header;
+
+    return true;
+}
+
+bool NumpyFile::readNpz(const QString& path, SheetData& sheet)
+{
+    ZipReader zip(path);
+    if(!zip.isValid()) return false;
+
+    QSharedPointer<QFile> file(new QFile(path));
+    if(!file->open(QIODevice::ReadOnly)) return false;
+
+    const qint64 fileSize = file->size();
+    const char *archive = (fileSize > 0) ? reinterpret_cast<const char*>(file->map(0, fileSize)) : nullptr;
+
+    QList<SheetColumn> columns;
+
+    for(qsizetype i = 0; i < zip.entries().size(); ++i)
+    {
+        const ZipReader::Entry& entry = zip.entries().at(i);
+        if(!entry.name.endsWith(".npy")) continue;
+
+        Layout layout;
+
+        if(entry.method == 0 && archive)
+        {
+            /* 無圧縮のエントリーはアーカイブ上の配列を直接参照する */
+            const qint64 offset = zip.dataOffset(i);
+            if(offset < 0 || offset + entry.size > fileSize) return false;
+
+            const char *data = archive + offset;
+            if(!parseHeader(data, entry.size, layout)) return false;
+            if(!resolveShape(layout, entry.size - layout.offset)) return false;
+            if(!appendColumns(data + layout.offset, layout, file, columns)) return false;
+        }
+        else
+        {
+            bool ok = false;
+            const QByteArray data = zip.readEntry(entry.name, &ok);
+            if(!ok) return false;
+
+            if(!parseHeader(data.constData(), data.size(), layout)) return false;
+            if(!resolveShape(layout, data.size() - layout.offset)) return false;
+            if(!appendColumns(data.constData() + layout.offset, layout, QSharedPointer<QFile>(), columns)) return false;
+        }
+    }
+
+    sheet = SheetData::fromColumns(columns);
+    return true;
+}
+
+bool NumpyFile::readRaw(const QString& path, const Layout& layout, SheetData& sheet)
+{
+    QSharedPointer<QFile> file(new QFile(path));
+    if(!file->open(QIODevice::ReadOnly)) return false;
+
+    QByteArray buffer;
+    qint64 size = file->size();
+    const char *data = (size > 0) ? reinterpret_cast<const char*>(file->map(0, size)) : nullptr;
+    if(!data)
+    {
+        buffer = file->readAll();
+        data = buffer.constData();
+        size = buffer.size();
+        file.reset();
+    }
+
+    if(layout.offset < 0 || layout.offset > size) return false;
+
+    Layout resolved = layout;
+    if(!resolveShape(resolved, size - layout.offset)) return false;
+
+    QList<SheetColumn> columns;
+    if(!appendColumns(data + layout.offset, resolved, file, columns)) return false;
+
+    sheet = SheetData::fromColumns(columns);
+    return true;
+}
+
+bool NumpyFile::writeNpy(const QString& path, const SheetData& sheet, const Layout& like)
+{
+    const qint64 rows = sheet.rowCount();
+    const qint64 cols = sheet.columnCount();
+
+    Layout layout = like;
+    if(rows != like.rowCount() || cols != like.columnCount())
+        layout.shape = (cols == 1 && like.shape.size() <= 1) ? QList<qint64>{ rows } : QList<qint64>{ rows, cols };
+
+    /* 1次元の形状は"(3,)"と書く */
+    const QString shape = (layout.shape.size() == 1) ? QString::number(layout.shape.at(0)) + ','
+                                                     : shapeString(layout.shape, ", ");
+
+    QByteArray header = ("{'descr': '" + layout.descr() + "', 'fortran_order': " + ((layout.fortranOrder) ? "True" : "False")
+                        + ", 'shape': (" + shape + "), }").toLatin1();
+
+    /* ヘッダーの終わり(改行を含む)がheaderAlignmentの倍数になるように空白で埋める */
+    const qint64 prefixSize = (header.size() + 1 + 10 + headerAlignment > 0xFFFF) ? 12 : 10;
+    const qint64 padding = (headerAlignment - (prefixSize + header.size() + 1) % headerAlignment) % headerAlignment;
+    header.append(QByteArray(padding, ' '));
+    header.append('\n');
+
+    QByteArray prefix(magic, magicSize);
+    if(prefixSize == 10)
+    {
+        prefix.append(char(1)).append(char(0));
+        char length[2];
+        qToLittleEndian<quint16>(quint16(header.size()), length);
+        prefix.append(length, 2);
+    }
+    else
+    {
+        prefix.append(char(2)).append(char(0));
+        char length[4];
+        qToLittleEndian<quint32>(quint32(header.size()), length);
+        prefix.append(length, 4);
+    }
+
+    /* 書き込み中に他のシートがmmapしているファイルを壊さないように，一時ファイルに書いてから置き換える．
+     * 置き換えるファイル自身をmmapしている列があれば，呼び出し側がSheetModel::detachMapping()で切り離しておく */
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly)) return false;
+
+    bool ok = (file.write(prefix) == prefix.size() && file.write(header) == header.size());
+
+    static constexpr qint64 chunkElements = 1 << 16;
+    const qint64 count = rows * cols;
+    QByteArray chunk;
+
+    for(qint64 begin = 0; begin < count && ok; begin += chunkElements)
+    {
+        const qint64 end = qMin(count, begin + chunkElements);
+        chunk.resize((end - begin) * layout.itemSize);
+
+        char *p = chunk.data();
+        for(qint64 i = begin; i < end; ++i, p += layout.itemSize)
+        {
+            const qint64 row = (layout.fortranOrder) ? i % rows : i / cols;
+            const qint64 col = (layout.fortranOrder) ? i / rows : i % cols;
+            storeElement(p, sheet.column(col), row, layout);
+        }
+
+        ok = (file.write(chunk) == chunk.size());
+    }
+
+    if(!ok)
+    {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+
+
+
+
+/* "dtype=<f8 shape=-1x3 offset=0 order=C"．dtype以外は省略できる */
+bool NumpyFile::parseRawLayout(const QString& spec, Layout& layout)
+{
+    Layout parsed;
+    parsed.shape = { -1 };
+    bool hasDescr = false;
+
+    static const QRegularExpression separator("\\s+");
+    for(const QString& token : spec.split(separator, Qt::SkipEmptyParts))
+    {
+        const qsizetype equal = token.indexOf('=');
+        if(equal < 0) return false;
+
+        const QString key = token.first(equal).toLower();
+        const QString value = token.sliced(equal + 1);
+
+        if(key == "dtype")
+        {
+            if(!parsed.setDescr(value)) return false;
+            hasDescr = true;
+        }
+        else if(key == "shape")
+        {
+            static const QRegularExpression dimSeparator("[x,]");
+            QString dims = value;
+            dims.remove('(').remove(')');
+
+            parsed.shape.clear();
+            qsizetype unknownCount = 0;
+            for(const QString& dim : dims.split(dimSeparator, Qt::SkipEmptyParts))
+            {
+                bool ok = false;
+                const qint64 size = dim.toLongLong(&ok);
+                if(!ok || size < -1) return false;
+                if(size == -1) unknownCount++;
+                parsed.shape << size;
+            }
+            if(parsed.shape.isEmpty() || unknownCount > 1) return false;
+        }
+        else if(key == "offset")
+        {
+            bool ok = false;
+            parsed.offset = value.toLongLong(&ok);
+            if(!ok || parsed.offset < 0) return false;
+        }
+        else if(key == "order")
+        {
+            if(value.compare("C", Qt::CaseInsensitive) == 0) parsed.fortranOrder = false;
+            else if(value.compare("F", Qt::CaseInsensitive) == 0) parsed.fortranOrder = true;
+            else return false;
+        }
+        else
+            return false;
+    }
+
+    if(!hasDescr) return false;
+
+    layout = parsed;
+    return true;
+}
+
+QString NumpyFile::rawLayoutString(const Layout& layout)
+{
+    return "dtype=" + layout.descr()
+            + " shape=" + shapeString(layout.shape, "x")
+            + " offset=" + QString::number(layout.offset)
+            + " order=" + ((layout.fortranOrder) ? "F" : "C");
+}
+
+bool NumpyFile::readNpyLayout(const QString& path, Layout& layout)
+{
+    QFile file(path);
+    if(!file.open(QIODevice::ReadOnly)) return false;
+
+    QByteArray data = file.read(12);
+    if(data.size() < 10) return false;
+
+    const qint64 headerLength = (quint8(data.at(6)) == 1) ? qFromLittleEndian<quint16>(data.constData() + 8)
+                                                          : (data.size() == 12) ? qFromLittleEndian<quint32>(data.constData() + 8) : 0;
+    if(headerLength > file.size()) return false;
+    data.append(file.read(headerLength));
+
+    Layout header;
+    if(!parseHeader(data.constData(), data.size(), header)) return false;
+    if(!resolveShape(header, file.size() - header.offset)) return false;
+
+    layout = header;
+    return true;
+}
+
+bool NumpyFile::resolveRawLayout(const QString& path, Layout& layout)
+{
+    const qint64 size = QFileInfo(path).size();
+    if(!QFileInfo::exists(path) || layout.offset > size) return false;
+
+    return resolveShape(layout, size - layout.offset);
+}
+
+QString NumpyFile::gnuplotBinaryClause(const Layout& layout)
+{
+    /* 1行を1レコードとするため，列が連続して並んでいるFortran順の2次元配列は読めない */
+    if(layout.fortranOrder && layout.columnCount() > 1) return QString();
+
+    const QString type = (layout.kind == 'f') ? "float" + QString::number(layout.itemSize * 8)
+                       : (layout.kind == 'i') ? "int" + QString::number(layout.itemSize * 8)
+                                              : "uint" + QString::number(layout.itemSize * 8);
+
+    QString format;
+    for(qint64 col = 0; col < layout.columnCount(); ++col)
+        format += "%" + type;
+
+    return "binary skip=" + QString::number(layout.offset)
+            + " format=\"" + format + "\""
+            + " record=" + QString::number(layout.rowCount())
+            + " endian=" + ((layout.bigEndian) ? "big" : "little");
+}
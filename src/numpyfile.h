@@ -0,0 +1,76 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef NUMPYFILE_H
+#define NUMPYFILE_H
+
+#include <QString>
+#include <QList>
+#include <QSharedPointer>
+#include <QFile>
+#include "sheetdata.h"
+
+
+
+/* NumPyの配列(.npy, .npz)と，ヘッダーのないバイナリの配列の読み書き．
+ * 2次元の配列は行と列をそのままシートの行と列に，1次元の配列は1列にする．3次元以上は2番目以降の軸をまとめて列とする．
+ *
+ * リトルエンディアンのfloat64, int64で，列のデータがファイル上で連続している(1次元またはFortran順)場合は，
+ * テキストに変換せずmmapしたファイルを列として直接参照する．それ以外の型や並びは読み込み時に変換する．
+ * .npzは無圧縮(np.savez)ならアーカイブ上の配列を直接参照し，圧縮されていれば(np.savez_compressed)展開して読む．
+ * .npzの複数の配列は，アーカイブ内の順に左から列として並べる．
+ */
+class NumpyFile
+{
+public:
+    /* 配列の型と形状．descrは"<f8"のようなNumPyの型の表記 */
+    struct Layout
+    {
+        char kind = 'f';            //'f': 浮動小数点, 'i': 符号付き整数, 'u': 符号なし整数, 'b': bool
+        int itemSize = 8;
+        bool bigEndian = false;
+        bool fortranOrder = false;
+        QList<qint64> shape;        //ヘッダーのないバイナリでは先頭の-1を残りのサイズから決める
+        qint64 offset = 0;          //ファイルの先頭から配列のデータまでのバイト数
+
+        qint64 rowCount() const;
+        qint64 columnCount() const;
+        qint64 byteSize() const { return rowCount() * columnCount() * itemSize; }
+
+        bool setDescr(const QString& descr);
+        QString descr() const;
+    };
+
+    static bool readNpy(const QString& path, SheetData& sheet, Layout *layout = nullptr);
+    static bool readNpz(const QString& path, SheetData& sheet);
+    static bool readRaw(const QString& path, const Layout& layout, SheetData& sheet);
+
+    /* likeの型と並びで書き出す．行と列の数が変わっていなければ元の形状(3次元以上も)を保つ */
+    static bool writeNpy(const QString& path, const SheetData& sheet, const Layout& like);
+
+    /* ヘッダーのないバイナリの形式の指定 "dtype=<f8 shape=-1x3 offset=0 order=C" */
+    static bool parseRawLayout(const QString& spec, Layout& layout);
+    static QString rawLayoutString(const Layout& layout);
+
+    /* ファイルのデータを読まずに型と形状を求める．ヘッダーのないバイナリは-1の軸をファイルのサイズから決める */
+    static bool readNpyLayout(const QString& path, Layout& layout);
+    static bool resolveRawLayout(const QString& path, Layout& layout);
+
+    /* gnuplotでファイルを直接読むためのbinaryの指定 binary skip=128 format="%float64%float64" record=N endian=little
+     * 1行を1レコードとして読めない(Fortran順の2次元配列)場合は空の文字列 */
+    static QString gnuplotBinaryClause(const Layout& layout);
+
+private:
+    static bool parseHeader(const char *data, const qint64 size, Layout& layout);
+    static bool resolveShape(Layout& layout, const qint64 dataSize);
+    static bool appendColumns(const char *data, const Layout& layout, const QSharedPointer<QFile>& mapping, QList<SheetColumn>& columns);
+    static SheetColumn toColumn(const char *data, const Layout& layout, const qint64 col, const QSharedPointer<QFile>& mapping);
+};
+
+#endif // NUMPYFILE_H
@@ -13,13 +13,12 @@
 #include <QtPdfWidgets/QPdfView>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
-#include <QTimer>
-#include <QFileSystemWatcher>
 #include <QSpinBox>
 #include <QLabel>
 #include <QPdfPageNavigator>
 
 #include "logger.h"
+#include "filechangewatcher.h"
 
 //DEBUG
 #include <QDebug>
@@ -31,19 +30,15 @@ PdfViewer::PdfViewer(QWidget *parent)
     , view(new QPdfView(this))
     , document(new QPdfDocument(this))
 
-    , timer(new QTimer(this))
-    , fileWatcher(new QFileSystemWatcher(this))
+    , fileWatcher(new FileChangeWatcher(this))
 
     , pageSpinBox(new QSpinBox(this))
     , zoomSpinBox(new QDoubleSpinBox(this))
 {
     view->setDocument(document);
     view->setPageMode(QPdfView::PageMode::MultiPage);
-    timer->setInterval(500);
-    timer->setSingleShot(true);
 
-    connect(fileWatcher, &QFileSystemWatcher::fileChanged, timer, QOverload<void>::of(&QTimer::start));
-    connect(timer, &QTimer::timeout, this, &PdfViewer::reload);
+    connect(fileWatcher, &FileChangeWatcher::contentChanged, this, &PdfViewer::reload);
 
     QVBoxLayout *vLayout = new QVBoxLayout(this);
     QHBoxLayout *hLayout = new QHBoxLayout;
@@ -15,8 +15,7 @@
 
 class QPdfDocument;
 class QPdfView;
-class QTimer;
-class QFileSystemWatcher;
+class FileChangeWatcher;
 class QSpinBox;
 class QDoubleSpinBox;
 
@@ -40,8 +39,7 @@ private:
     QPdfView *view;
     QPdfDocument *document;
 
-    QTimer *timer;
-    QFileSystemWatcher *fileWatcher;
+    FileChangeWatcher *fileWatcher;
 
     QSpinBox *pageSpinBox;
     QDoubleSpinBox *zoomSpinBox;
@@ -0,0 +1,174 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "plotdownsampler.h"
+
+#include <QtNumeric>
+#include <algorithm>
+#include <cmath>
+
+
+
+namespace
+{
+    /* 列の値．数値でないセルと足りない行はNaN */
+    QList<double> columnValues(const SheetColumn& column, const qsizetype rows)
+    {
+        QList<double> values(rows, qQNaN());
+        const qsizetype size = qMin(rows, column.size());
+
+        switch(column.type())
+        {
+        case SheetColumn::Type::Double:
+            std::copy(column.doubleData(), column.doubleData() + size, values.begin());
+            break;
+        case SheetColumn::Type::Int64:
+        {
+            const qint64 *ints = column.int64Data();
+            for(qsizetype row = 0; row < size; ++row) values[row] = double(ints[row]);
+            break;
+        }
+        default:
+            for(qsizetype row = 0; row < size; ++row) values[row] = column.value(row);
+            break;
+        }
+
+        return values;
+    }
+
+    /* i番目のバケットの先頭の行．先頭と最後の行は除いて分ける */
+    qsizetype bucketBegin(const qsizetype bucket, const qsizetype buckets, const qsizetype rows)
+    {
+        return 1 + (rows - 2) * bucket / buckets;
+    }
+}
+
+
+
+
+QList<qsizetype> PlotDownsampler::sample(const QList<SheetColumn>& columns, const qsizetype rows,
+                                         const qsizetype buckets, const Method method)
+{
+    /* 間引いても減る行が少なければ元のまま送る */
+    if(columns.isEmpty() || buckets < 1 || rows <= buckets * 4)
+    {
+        QList<qsizetype> all(rows);
+        for(qsizetype row = 0; row < rows; ++row) all[row] = row;
+        return all;
+    }
+
+    QList<QList<double> > y;
+    for(qsizetype col = (columns.size() == 1) ? 0 : 1; col < columns.size(); ++col)
+        y.append(columnValues(columns.at(col), rows));
+
+    if(method == Method::MinMax)
+        return minMax(y, rows, buckets);
+
+    QList<double> x;
+    if(columns.size() == 1)
+    {
+        x.resize(rows);
+        for(qsizetype row = 0; row < rows; ++row) x[row] = double(row);
+    }
+    else
+        x = columnValues(columns.at(0), rows);
+
+    return lttb(x, y.at(0), rows, buckets);
+}
+
+QList<qsizetype> PlotDownsampler::lttb(const QList<double>& x, const QList<double>& y, const qsizetype rows, const qsizetype buckets)
+{
+    QList<qsizetype> sampled;
+    sampled.reserve(buckets + 2);
+    sampled.append(0);
+
+    double ax = x.at(0), ay = y.at(0);      //前のバケットで選んだ点
+    bool hasPrevious = !qIsNaN(ax) && !qIsNaN(ay);
+
+    for(qsizetype bucket = 0; bucket < buckets; ++bucket)
+    {
+        const qsizetype first = bucketBegin(bucket, buckets, rows);
+        const qsizetype last = bucketBegin(bucket + 1, buckets, rows);
+
+        /* 次のバケットの平均．最後のバケットでは最後の行 */
+        double cx = 0.0, cy = 0.0;
+        qsizetype count = 0;
+        const qsizetype nextLast = (bucket + 1 < buckets) ? bucketBegin(bucket + 2, buckets, rows) : rows;
+        for(qsizetype row = last; row < nextLast; ++row)
+        {
+            if(qIsNaN(x.at(row)) || qIsNaN(y.at(row))) continue;
+            cx += x.at(row);
+            cy += y.at(row);
+            count++;
+        }
+        if(count > 0) { cx /= count; cy /= count; }
+
+        qsizetype selected = -1;
+        double maxArea = -1.0;
+        for(qsizetype row = first; row < last; ++row)
+        {
+            const double bx = x.at(row), by = y.at(row);
+            if(qIsNaN(bx) || qIsNaN(by)) continue;
+
+            /* 前の点か次の平均がなければ，面積は比べられないので最初の点にする */
+            const double area = (hasPrevious && count > 0) ? std::abs((ax - cx) * (by - ay) - (ax - bx) * (cy - ay)) : 0.0;
+            if(area > maxArea) { maxArea = area; selected = row; }
+        }
+
+        if(selected < 0) continue;
+
+        sampled.append(selected);
+        ax = x.at(selected);
+        ay = y.at(selected);
+        hasPrevious = true;
+    }
+
+    sampled.append(rows - 1);
+
+    return sampled;
+}
+
+QList<qsizetype> PlotDownsampler::minMax(const QList<QList<double> >& y, const qsizetype rows, const qsizetype buckets)
+{
+    QList<qsizetype> sampled;
+    sampled.reserve(buckets * (2 + 2 * y.size()) + 2);
+    sampled.append(0);
+
+    QList<qsizetype> picked;
+    for(qsizetype bucket = 0; bucket < buckets; ++bucket)
+    {
+        const qsizetype first = bucketBegin(bucket, buckets, rows);
+        const qsizetype last = bucketBegin(bucket + 1, buckets, rows);
+        if(first >= last) continue;
+
+        picked = { first, last - 1 };
+
+        for(const QList<double>& values : y)
+        {
+            qsizetype minRow = -1, maxRow = -1;
+            for(qsizetype row = first; row < last; ++row)
+            {
+                const double value = values.at(row);
+                if(qIsNaN(value)) continue;
+                if(minRow < 0 || value < values.at(minRow)) minRow = row;
+                if(maxRow < 0 || value > values.at(maxRow)) maxRow = row;
+            }
+            if(minRow >= 0) picked << minRow << maxRow;
+        }
+
+        /* 線で結ぶ順を変えないように，バケットの中でも行の順に並べる */
+        std::sort(picked.begin(), picked.end());
+        for(const qsizetype row : qAsConst(picked))
+            if(row != sampled.last()) sampled.append(row);
+    }
+
+    if(sampled.last() != rows - 1) sampled.append(rows - 1);
+
+    return sampled;
+}
@@ -0,0 +1,42 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef PLOTDOWNSAMPLER_H
+#define PLOTDOWNSAMPLER_H
+
+#include <QList>
+#include "sheetdata.h"
+
+
+
+/* プロットする行を見た目が変わらない程度に間引く．返すのは残す行の番号(昇順)．
+ * 列が1つならx座標は行の番号，2つ以上なら1列目をx，残りの列をyとする．
+ *
+ *   Lttb    Largest-Triangle-Three-Buckets．行を等分したバケットごとに，前に選んだ点と次のバケットの平均とで作る
+ *           三角形の面積が最大の点を1つ選ぶ．点の数を減らしても形が残るので，点を描くプロットに使う
+ *   MinMax  バケットごとに最初，最後と各yの最小，最大の行を残す．バケットを横のピクセルに合わせれば，線で結んだ
+ *           プロットは間引かない場合と同じになる
+ *
+ * 最初と最後の行は常に残す．それ以外で数値でないセルの行は，MinMaxのバケットの境目でなければ選ばない．
+ */
+class PlotDownsampler
+{
+public:
+    enum class Method { Lttb, MinMax };
+
+    /* columnsのrows行をbuckets個のバケットに分けて間引く．rowsがbucketsの数倍に満たなければすべての行を返す */
+    static QList<qsizetype> sample(const QList<SheetColumn>& columns, const qsizetype rows,
+                                   const qsizetype buckets, const Method method);
+
+private:
+    static QList<qsizetype> lttb(const QList<double>& x, const QList<double>& y, const qsizetype rows, const qsizetype buckets);
+    static QList<qsizetype> minMax(const QList<QList<double> >& y, const qsizetype rows, const qsizetype buckets);
+};
+
+#endif // PLOTDOWNSAMPLER_H
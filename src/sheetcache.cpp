@@ -0,0 +1,433 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "sheetcache.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QDateTime>
+#include <QSaveFile>
+#include <QSysInfo>
+#include <QtEndian>
+#include <cstring>
+#include "settings.h"
+#include "xxhash.h"
+#include "ioscheduler.h"
+
+/* キャッシュファイルの形式(リトルエンディアン，配列は8バイト境界)
+ *
+ *   "GESHEET\0", version(u32), reserved(u32)
+ *   元ファイルのサイズ(u64), 更新日時(i64), 内容のハッシュ(u64)
+ *   行数(u64), 列数(u64), 元ファイルのパス(u32 + UTF-8)
+ *   列ごとに
+ *     型(u32), precision(i32), 行数(u64), textCount(u64)
+ *     Int64/Double : 値の配列, verbatimの数(u64), (行(u64), u32 + UTF-8)...
+ *     String       : 辞書の数(u64), (u32 + UTF-8)..., codesの配列(i32)
+ */
+
+namespace
+{
+    constexpr char magic[8] = { 'G', 'E', 'S', 'H', 'E', 'E', 'T', '\0' };
+    constexpr quint32 version = 3;     //3: 'e'書式のprecision，文字列の列の判定の変更
+    constexpr qint64 headerSize = 56;
+}
+
+
+
+
+struct SheetCache::Reader
+{
+    const uchar *data;
+    qint64 size;
+    qint64 pos = 0;
+    bool ok = true;
+
+    const char *take(const qint64 count)
+    {
+        if(!ok || count < 0 || size - pos < count) { ok = false; return nullptr; }
+        const char *p = reinterpret_cast<const char*>(data + pos);
+        pos += count;
+        return p;
+    }
+
+    quint32 get32() { const char *p = take(4); return (p) ? qFromLittleEndian<quint32>(p) : 0; }
+    quint64 get64() { const char *p = take(8); return (p) ? qFromLittleEndian<quint64>(p) : 0; }
+    void align() { pos = (pos + 7) & ~qint64(7); if(pos > size) ok = false; }
+
+    QString getString()
+    {
+        const quint32 length = get32();
+        const char *p = take(length);
+        return (p) ? QString::fromUtf8(p, length) : QString();
+    }
+};
+
+
+
+
+struct SheetCache::Writer
+{
+    QIODevice *device;
+    QByteArray buffer;
+    qint64 pos = 0;
+    bool ok = true;
+
+    static constexpr qsizetype flushSize = 1 << 20;
+
+    void flush()
+    {
+        if(!buffer.isEmpty() && device->write(buffer) != buffer.size()) ok = false;
+        buffer.resize(0);
+    }
+
+    void put(const char *p, const qint64 count)
+    {
+        pos += count;
+
+        /* 大きな配列はバッファを経由せずに書く */
+        if(count >= flushSize)
+        {
+            flush();
+            if(device->write(p, count) != count) ok = false;
+            return;
+        }
+
+        buffer.append(p, count);
+        if(buffer.size() >= flushSize) flush();
+    }
+
+    void put32(const quint32 value) { char b[4]; qToLittleEndian(value, b); put(b, 4); }
+    void put64(const quint64 value) { char b[8]; qToLittleEndian(value, b); put(b, 8); }
+    void align() { static const char zeros[8] = {}; put(zeros, ((pos + 7) & ~qint64(7)) - pos); }
+
+    void putString(const QString& text)
+    {
+        const QByteArray utf8 = text.toUtf8();
+        put32(quint32(utf8.size()));
+        put(utf8.constData(), utf8.size());
+    }
+};
+
+
+
+
+
+
+SheetCache::Stamp SheetCache::stamp(const QString& path)
+{
+    const QFileInfo info(path);
+
+    Stamp stamp;
+    if(info.exists())
+    {
+        stamp.size = info.size();
+        stamp.modified = info.lastModified().toMSecsSinceEpoch();
+    }
+
+    return stamp;
+}
+
+QString SheetCache::cacheDirPath()
+{
+    return Settings::applicationSettingsDirPath() + "/sheetcache";
+}
+
+QString SheetCache::cacheFilePrefix(const QString& path)
+{
+    const QString absolutePath = QFileInfo(path).absoluteFilePath();
+    return QString::number(XXHash64::hash(absolutePath.toUtf8()), 16) + '-';
+}
+
+/* 版は元ファイルの内容とサイズ，更新日時から決める．同じ版のファイルは作り直さない */
+QString SheetCache::cacheFilePath(const QString& path, const quint64 contentHash, const Stamp& stamp)
+{
+    char key[16];
+    qToLittleEndian(quint64(stamp.size), key);
+    qToLittleEndian(quint64(stamp.modified), key + 8);
+    const quint64 generation = XXHash64::hash(QByteArrayView(key, 16), contentHash);
+
+    return cacheDirPath() + '/' + cacheFilePrefix(path) + QString::number(generation, 16) + ".sheet";
+}
+
+QString SheetCache::sourcePath(const QString& cacheFile)
+{
+    QFile file(cacheFile);
+    if(!file.open(QIODevice::ReadOnly)) return QString();
+
+    const QByteArray header = file.read(headerSize + 4);
+    Reader in{ reinterpret_cast<const uchar*>(header.constData()), header.size() };
+
+    const char *head = in.take(8);
+    if(!head || std::memcmp(head, magic, 8) != 0 || in.get32() != version) return QString();
+
+    const quint32 length = qFromLittleEndian<quint32>(header.constData() + headerSize);
+    if(!in.ok || header.size() < headerSize + 4 || length > quint32(file.size())) return QString();
+
+    return QString::fromUtf8(file.read(length));
+}
+
+void SheetCache::prune()
+{
+    /* 新しい順に見て，パスごとに最新の版だけを残す */
+    const QFileInfoList entries = QDir(cacheDirPath()).entryInfoList({ "*.sheet" }, QDir::Files, QDir::Time);
+
+    QSet<QString> kept;
+    qint64 total = 0;
+    for(const QFileInfo& entry : entries)
+    {
+        const QString fileName = entry.fileName();
+        const QString prefix = fileName.left(fileName.indexOf('-') + 1);
+
+        //最も新しいものは上限を超えても残す
+        bool keep = !prefix.isEmpty() && !kept.contains(prefix) && (kept.isEmpty() || total + entry.size() <= maxCacheSize);
+        if(keep)
+        {
+            const QString source = sourcePath(entry.absoluteFilePath());
+            keep = !source.isEmpty() && QFileInfo::exists(source) && cacheFilePrefix(source) == prefix;
+        }
+
+        if(keep)
+        {
+            kept.insert(prefix);
+            total += entry.size();
+        }
+        else
+            QFile::remove(entry.absoluteFilePath());
+    }
+}
+
+bool SheetCache::load(const QString& path, SheetData& sheet)
+{
+    //数値の配列をそのまま参照するため，リトルエンディアンの環境でのみ使う
+    if(QSysInfo::ByteOrder != QSysInfo::LittleEndian) return false;
+
+    const Stamp source = stamp(path);
+    if(source.size < minimumSourceSize) return false;
+
+    /* 最新の版を読む．古い版は消せなかったもの */
+    const QFileInfoList entries = QDir(cacheDirPath()).entryInfoList({ cacheFilePrefix(path) + "*.sheet" }, QDir::Files, QDir::Time);
+    if(entries.isEmpty()) return false;
+
+    QSharedPointer<QFile> file(new QFile(entries.first().absoluteFilePath()));
+    if(!file->open(QIODevice::ReadOnly)) return false;
+
+    const qint64 fileSize = file->size();
+    if(fileSize < headerSize) return false;
+
+    const uchar *data = file->map(0, fileSize);
+    if(!data) return false;
+
+    Reader in{ data, fileSize };
+
+    const char *head = in.take(8);
+    if(!head || std::memcmp(head, magic, 8) != 0) return false;
+    if(in.get32() != version) return false;
+    in.get32();
+
+    const qint64 sourceSize = qint64(in.get64());
+    const qint64 modified = qint64(in.get64());
+    const quint64 contentHash = in.get64();
+    const qint64 rows = qint64(in.get64());
+    const qint64 cols = qint64(in.get64());
+
+    if(sourceSize != source.size) return false;
+    if(in.getString() != QFileInfo(path).absoluteFilePath()) return false; //ファイル名のハッシュの衝突
+    in.align();
+    if(!in.ok) return false;
+
+    /* 更新日時だけが変わった(コピーや上書き保存で内容が同じ)場合は内容のハッシュで確かめる */
+    bool touched = false;
+    if(modified != source.modified)
+    {
+        bool ok = false;
+        if(XXHash64::hashFile(path, &ok) != contentHash || !ok) return false;
+        touched = true;
+    }
+
+    SheetData cached;
+    cached.columns.reserve(cols);
+    for(qint64 col = 0; col < cols; ++col)
+    {
+        SheetColumn column;
+        if(!readColumn(in, column) || column.size() != rows) return false;
+        if(column.isMapped()) column.mapping = file;
+        cached.columns.append(column);
+    }
+    cached.rows = rows;
+
+    sheet = cached;
+
+    /* prune()で使っていない順に消せるように，使った日時にする */
+    file->setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+    if(touched) storeLater(path, sheet, source);
+
+    return true;
+}
+
+bool SheetCache::readColumn(Reader& in, SheetColumn& column)
+{
+    const quint32 type = in.get32();
+    const qint32 precision = qint32(in.get32());
+    const qint64 size = qint64(in.get64());
+    const qint64 textCount = qint64(in.get64());
+    if(!in.ok || size < 0) return false;
+
+    column._size = size;
+    column.precision = precision;
+    column.textCount = textCount;
+
+    switch(SheetColumn::Type(type))
+    {
+    case SheetColumn::Type::Int64:
+    case SheetColumn::Type::Double:
+    {
+        column._type = SheetColumn::Type(type);
+        column.mapped = in.take(size * 8);
+
+        const qint64 verbatimCount = qint64(in.get64());
+        for(qint64 i = 0; i < verbatimCount && in.ok; ++i)
+        {
+            const qint64 row = qint64(in.get64());
+            column.verbatim.insert(row, in.getString());
+        }
+        in.align();
+        break;
+    }
+    case SheetColumn::Type::String:
+    {
+        column._type = SheetColumn::Type::String;
+
+        const qint64 dictCount = qint64(in.get64());
+        for(qint64 i = 0; i < dictCount && in.ok; ++i)
+            column.dict.append(in.getString());
+        in.align();
+
+        const char *codes = in.take(size * 4);
+        if(codes)
+        {
+            column.codes.resize(size);
+            std::memcpy(column.codes.data(), codes, size * 4);
+
+            for(const qint32 code : qAsConst(column.codes))
+                if(code < 0 || code >= column.dict.size()) return false;
+        }
+        in.align();
+        break;
+    }
+    default:
+        return false;
+    }
+
+    return in.ok;
+}
+
+bool SheetCache::store(const QString& path, const SheetData& sheet, const Stamp& source)
+{
+    if(QSysInfo::ByteOrder != QSysInfo::LittleEndian) return false;
+    if(source.size < minimumSourceSize) return false;
+
+    bool ok = false;
+    const quint64 contentHash = XXHash64::hashFile(path, &ok);
+    if(!ok) return false;
+
+    /* 読み込んだ後に元ファイルが変更されていれば作らない */
+    const Stamp current = stamp(path);
+    if(current.size != source.size || current.modified != source.modified) return false;
+
+    QDir().mkpath(cacheDirPath());
+
+    /* 前の版はシートがmmapしているかもしれないため，版ごとに別のファイルに書く．
+     * 書き込み中のファイルを読まないように，一時ファイルに書いてから名前を変える */
+    const QString cacheFile = cacheFilePath(path, contentHash, source);
+    if(QFileInfo::exists(cacheFile)) return true;
+
+    QSaveFile file(cacheFile);
+    if(!file.open(QIODevice::WriteOnly)) return false;
+
+    Writer out{ &file };
+    out.put(magic, 8);
+    out.put32(version);
+    out.put32(0);
+    out.put64(quint64(source.size));
+    out.put64(quint64(source.modified));
+    out.put64(contentHash);
+    out.put64(quint64(sheet.rowCount()));
+    out.put64(quint64(sheet.columnCount()));
+    out.putString(QFileInfo(path).absoluteFilePath());
+    out.align();
+
+    for(qsizetype col = 0; col < sheet.columnCount(); ++col)
+        writeColumn(out, sheet.column(col));
+
+    out.flush();
+
+    if(!out.ok)
+    {
+        file.cancelWriting();
+        return false;
+    }
+
+    if(!file.commit()) return false;
+
+    prune();
+    return true;
+}
+
+void SheetCache::writeColumn(Writer& out, const SheetColumn& column)
+{
+    out.put32(quint32(column.type()));
+    out.put32(quint32(column.precision));
+    out.put64(quint64(column.size()));
+    out.put64(quint64(column.textCount));
+
+    switch(column.type())
+    {
+    case SheetColumn::Type::Int64:
+    case SheetColumn::Type::Double:
+    {
+        const char *values = (column.type() == SheetColumn::Type::Int64)
+                ? reinterpret_cast<const char*>(column.int64Data())
+                : reinterpret_cast<const char*>(column.doubleData());
+        out.put(values, column.size() * 8);
+
+        out.put64(quint64(column.verbatim.size()));
+        for(auto iter = column.verbatim.cbegin(); iter != column.verbatim.cend(); ++iter)
+        {
+            out.put64(quint64(iter.key()));
+            out.putString(iter.value());
+        }
+        out.align();
+        break;
+    }
+    case SheetColumn::Type::String:
+    {
+        out.put64(quint64(column.dict.size()));
+        for(const QString& text : column.dict)
+            out.putString(text);
+        out.align();
+
+        out.put(reinterpret_cast<const char*>(column.codes.constData()), column.size() * 4);
+        out.align();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void SheetCache::storeLater(const QString& path, const SheetData& sheet, const Stamp& stamp)
+{
+    if(stamp.size < minimumSourceSize) return;
+
+    //SheetDataのコピーは列の参照カウントを増やすだけ．ファイルを開く操作より後に回す
+    IoScheduler::schedule(cacheDirPath() + '/' + cacheFilePrefix(path), IoScheduler::Operation::Write, IoScheduler::Priority::Prefetch, nullptr,
+                          [path, sheet, stamp](const QString&, bool& ok) { ok = store(path, sheet, stamp); return QVariant(); });
+}
@@ -0,0 +1,63 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef SHEETCACHE_H
+#define SHEETCACHE_H
+
+#include <QString>
+#include "sheetdata.h"
+
+
+
+/* 読み込んだシートのバイナリキャッシュ．
+ * Settings::applicationSettingsDirPath()/sheetcache に "<パスのハッシュ>-<版>.sheet" として保存する．
+ * 元ファイルのサイズと更新日時(変わっていれば内容のハッシュ)が一致すれば，テキストを解析せずにmmapで読み込む．
+ * 数値の列はキャッシュファイル上の配列をそのまま参照する．
+ *
+ * 開いているシートがmmapしているファイルは(Windowsでは)置き換えられないため，作り直すときは版を変えた別のファイルに書き，
+ * 古い版はprune()で消す．prune()は元ファイルがなくなったものも消し，全体がmaxCacheSizeを超えれば使っていない順に消す．
+ */
+class SheetCache
+{
+public:
+    struct Stamp
+    {
+        qint64 size = -1;
+        qint64 modified = 0;    //msecs since epoch
+    };
+
+    static Stamp stamp(const QString& path);
+
+    static bool load(const QString& path, SheetData& sheet);
+    static bool store(const QString& path, const SheetData& sheet, const Stamp& stamp);
+    /* 別スレッドでキャッシュを作り直す．stampは読み込む前の元ファイルの状態 */
+    static void storeLater(const QString& path, const SheetData& sheet, const Stamp& stamp);
+
+    static QString cacheDirPath();
+    /* 古い版，元ファイルがなくなったもの，大きさの上限を超えた分のキャッシュを消す．mmapしていて消せないものは次の機会に消す */
+    static void prune();
+
+    static constexpr qint64 maxCacheSize = qint64(2) << 30;
+
+private:
+    struct Reader;
+    struct Writer;
+
+    /* "<パスのハッシュ>-"．版ごとのファイル名の先頭 */
+    static QString cacheFilePrefix(const QString& path);
+    static QString cacheFilePath(const QString& path, const quint64 contentHash, const Stamp& stamp);
+    /* キャッシュファイルの元ファイルのパス．形式や版が違えば空 */
+    static QString sourcePath(const QString& cacheFile);
+    static bool readColumn(Reader& in, SheetColumn& column);
+    static void writeColumn(Writer& out, const SheetColumn& column);
+
+    static constexpr qint64 minimumSourceSize = 1 << 18;   //これより小さいファイルは解析しても十分速い
+};
+
+#endif // SHEETCACHE_H
@@ -0,0 +1,1062 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "sheetdata.h"
+
+#include <QLocale>
+#include <QSet>
+#include <QFileInfo>
+#include <QtNumeric>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include "xxhash.h"
+
+
+
+SheetColumn::Form SheetColumn::classify(QByteArrayView field, double& value, qint64& integer, int& decimals)
+{
+    if(field.isEmpty()) return Form::Empty;
+
+    const char *begin = field.data();
+    const char *end = begin + field.size();
+    const char *p = begin;
+    const bool negative = (*p == '-');
+    if(negative) ++p;
+
+    /* 整数部 */
+    const char *intBegin = p;
+    while(p < end && *p >= '0' && *p <= '9') ++p;
+    const qsizetype intDigits = p - intBegin;
+    const bool canonicalInt = (intDigits == 1 || (intDigits > 1 && *intBegin != '0'));
+
+    if(p == end && canonicalInt && intDigits <= 18 && !(negative && *intBegin == '0'))
+    {
+        std::from_chars(begin, end, integer);
+        value = double(integer);
+        return Form::Integer;
+    }
+
+    /* 小数部 */
+    if(p < end && *p == '.' && canonicalInt)
+    {
+        const char *fracBegin = ++p;
+        bool allZero = (intDigits == 1 && *intBegin == '0');
+        while(p < end && *p >= '0' && *p <= '9') { if(*p != '0') allZero = false; ++p; }
+        const qsizetype fracDigits = p - fracBegin;
+
+        //15桁以下であれば'f'書式で必ず元の文字列に戻る(-0.0は戻らない)
+        if(p == end && fracDigits > 0 && intDigits + fracDigits <= 15 && !(negative && allZero))
+        {
+            std::from_chars(begin, end, value);
+            decimals = int(fracDigits);
+            return Form::Fixed;
+        }
+    }
+
+    /* 指数表記など */
+    const std::from_chars_result result = std::from_chars(begin, end, value);
+    if(result.ec == std::errc() && result.ptr == end)
+    {
+        /* 'e'書式の形(1桁の整数部，'e'，符号，2桁以上の指数)．元の文字列に戻るかはmatchesFormat()で確かめる */
+        p = intBegin;
+        if(intDigits != 1) return Form::Other;
+        p++;
+        const char *fracBegin = p;
+        if(p < end && *p == '.')
+        {
+            fracBegin = ++p;
+            while(p < end && *p >= '0' && *p <= '9') ++p;
+            if(p == fracBegin) return Form::Other;
+        }
+        const qsizetype fracDigits = p - fracBegin;
+        if(p + 4 > end || *p != 'e' || (p[1] != '+' && p[1] != '-')) return Form::Other;
+        for(const char *q = p + 2; q < end; ++q)
+            if(*q < '0' || *q > '9') return Form::Other;
+
+        decimals = int(fracDigits);
+        return Form::Exponent;
+    }
+
+    return Form::Text;
+}
+
+bool SheetColumn::matchesFormat(const Form form, const double value, const int decimals, QByteArrayView field) const
+{
+    if(qIsNaN(value)) return false; //"nan"は空セルと区別するためverbatimに残す
+
+    switch(form)
+    {
+    case Form::Integer:
+        if(precision == 0) return true;
+        break;
+    case Form::Fixed:
+        if(precision == decimals) return true;
+        break;
+    case Form::Exponent:
+        if(precision == precisionExponent - decimals)
+            return QByteArrayView(QByteArray::number(value, 'e', decimals)) == field;
+        break;
+    default:
+        break;
+    }
+
+    if(precision != precisionShortest) return false;
+
+    return matchesShortest(value, field);
+}
+
+bool SheetColumn::matchesShortest(const double value, QByteArrayView field)
+{
+    return QString::number(value, 'g', QLocale::FloatingPointShortest) == QLatin1String(field.data(), field.size());
+}
+
+/* 'f'書式の列を最短表記の列にする．最短表記では元の文字列に戻らなくなるセル("0.50"など)はverbatimに移す */
+void SheetColumn::useShortest()
+{
+    for(qsizetype row = 0; row < _size; ++row)
+    {
+        const double v = doubles.at(row);
+        if(qIsNaN(v) || verbatim.contains(row)) continue;
+
+        const QByteArray fixed = QByteArray::number(v, 'f', precision);
+        if(!matchesShortest(v, fixed)) verbatim.insert(row, QString::fromLatin1(fixed));
+    }
+
+    precision = precisionShortest;
+}
+
+QString SheetColumn::text(const qsizetype row) const
+{
+    switch(_type)
+    {
+    case Type::Int64:
+        return QString::number(intAt(row));
+    case Type::Double:
+    {
+        if(!verbatim.isEmpty())
+        {
+            const auto iter = verbatim.constFind(row);
+            if(iter != verbatim.constEnd()) return iter.value();
+        }
+
+        const double v = doubleAt(row);
+        if(qIsNaN(v)) return QString();
+
+        if(precision >= 0)
+            return QString::number(v, 'f', precision);
+        else if(precision <= precisionExponent)
+            return QString::number(v, 'e', precisionExponent - precision);
+        else
+            return QString::number(v, 'g', QLocale::FloatingPointShortest);
+    }
+    case Type::String:
+        return dict.at(codes.at(row));
+    default:
+        return QString();
+    }
+}
+
+double SheetColumn::value(const qsizetype row) const
+{
+    switch(_type)
+    {
+    case Type::Int64: return double(intAt(row));
+    case Type::Double: return doubleAt(row);
+    default: return qQNaN();
+    }
+}
+
+/* 保存時にQStringを経由せずに書き出す */
+void SheetColumn::appendText(QByteArray& out, const qsizetype row) const
+{
+    switch(_type)
+    {
+    case Type::Int64:
+        out += QByteArray::number(intAt(row));
+        return;
+    case Type::Double:
+    {
+        if(!verbatim.isEmpty())
+        {
+            const auto iter = verbatim.constFind(row);
+            if(iter != verbatim.constEnd()) { out += iter.value().toUtf8(); return; }
+        }
+
+        const double v = doubleAt(row);
+        if(qIsNaN(v)) return;
+
+        if(precision >= 0)
+            out += QByteArray::number(v, 'f', precision);
+        else if(precision <= precisionExponent)
+            out += QByteArray::number(v, 'e', precisionExponent - precision);
+        else
+            out += QString::number(v, 'g', QLocale::FloatingPointShortest).toLatin1();
+        return;
+    }
+    case Type::String:
+        out += dict.at(codes.at(row)).toUtf8();
+        return;
+    default:
+        return;
+    }
+}
+
+void SheetColumn::append(QByteArrayView field)
+{
+    //文字列列は数値かどうかを調べる必要がない
+    if(_type == Type::String)
+    {
+        detach();
+        codes.append(0);
+        storeString(_size++, QString::fromUtf8(field));
+        return;
+    }
+
+    double value = 0;
+    qint64 integer = 0;
+    int decimals = 0;
+    const Form form = classify(field, value, integer, decimals);
+
+    detach();
+
+    switch(_type)
+    {
+    case Type::Int64:
+        if(form == Form::Integer)
+        {
+            ints.append(integer);
+            _size++;
+            return;
+        }
+        promoteToDouble();
+        Q_FALLTHROUGH();
+    case Type::Double:
+    {
+        //文字列の列かどうかは読み込む前に推定した型(SheetFormat::sniff())か，squeeze()で決める
+        doubles.append(qQNaN());
+        storeDouble(_size++, form, value, decimals, field);
+        return;
+    }
+    default:
+        return;
+    }
+}
+
+void SheetColumn::append(const QString& text)
+{
+    append(QByteArrayView(text.toUtf8()));
+}
+
+void SheetColumn::setText(const qsizetype row, const QString& text)
+{
+    if(row >= _size) resize(row + 1);
+    detach();
+
+    const QByteArray utf8 = text.toUtf8();
+    double value = 0;
+    qint64 integer = 0;
+    int decimals = 0;
+    const Form form = classify(utf8, value, integer, decimals);
+
+    switch(_type)
+    {
+    case Type::Int64:
+        if(form == Form::Integer)
+        {
+            ints[row] = integer;
+            return;
+        }
+        promoteToDouble();
+        Q_FALLTHROUGH();
+    case Type::Double:
+        storeDouble(row, form, value, decimals, utf8);
+        return;
+    case Type::String:
+        storeString(row, text);
+        return;
+    default:
+        return;
+    }
+}
+
+void SheetColumn::storeDouble(const qsizetype row, const Form form, const double value, const int decimals, QByteArrayView field)
+{
+    /* 以前のセルの状態を取り除く */
+    const auto iter = verbatim.find(row);
+    if(iter != verbatim.end())
+    {
+        if(qIsNaN(doubleAt(row))) textCount--;
+        verbatim.erase(iter);
+    }
+
+    switch(form)
+    {
+    case Form::Empty:
+        doubles[row] = qQNaN();
+        return;
+    case Form::Text:
+        doubles[row] = qQNaN();
+        verbatim.insert(row, QString::fromUtf8(field));
+        textCount++;
+        return;
+    default:
+        break;
+    }
+
+    if(precision == precisionUnset)
+    {
+        if(form == Form::Integer) precision = 0;
+        else if(form == Form::Fixed) precision = decimals;
+        else if(form == Form::Exponent) precision = precisionExponent - decimals;
+        else precision = precisionShortest;
+    }
+
+    /* 小数点以下の桁数がそろっていなければ，列の書式を最短表記にする(このセルを除いて書き直すため値は後で入れる) */
+    doubles[row] = qQNaN();
+    if(precision >= 0 && !matchesFormat(form, value, decimals, field) && !qIsNaN(value) && matchesShortest(value, field))
+        useShortest();
+
+    doubles[row] = value;
+
+    if(!matchesFormat(form, value, decimals, field))
+    {
+        verbatim.insert(row, QString::fromUtf8(field));
+        if(qIsNaN(value)) textCount++;
+    }
+}
+
+void SheetColumn::storeString(const qsizetype row, const QString& text)
+{
+    codes[row] = stringCode(text);
+}
+
+qint32 SheetColumn::stringCode(const QString& text)
+{
+    if(dictIndex.size() != dict.size())
+    {
+        dictIndex.clear();
+        for(qint32 i = 0; i < dict.size(); ++i) dictIndex.insert(dict.at(i), i);
+    }
+
+    const auto iter = dictIndex.constFind(text);
+    if(iter != dictIndex.constEnd()) return iter.value();
+
+    const qint32 code = qint32(dict.size());
+    dict.append(text);
+    dictIndex.insert(text, code);
+    return code;
+}
+
+void SheetColumn::promoteToDouble()
+{
+    static constexpr qint64 exactLimit = qint64(1) << 53; //doubleで正確に表せる整数の上限
+
+    doubles.reserve(_size + 1);
+    for(qsizetype i = 0; i < _size; ++i)
+    {
+        const qint64 v = intAt(i);
+        doubles.append(double(v));
+        if(v > exactLimit || v < -exactLimit) verbatim.insert(i, QString::number(v));
+    }
+
+    if(_size > 0) precision = 0;
+
+    ints.clear();
+    ints.squeeze();
+    mapped = nullptr;
+    mapping.reset();
+    _type = Type::Double;
+}
+
+void SheetColumn::demoteToString()
+{
+    QStringList texts;
+    texts.reserve(_size);
+    for(qsizetype row = 0; row < _size; ++row) texts.append(text(row));
+
+    ints.clear(); ints.squeeze();
+    doubles.clear(); doubles.squeeze();
+    mapped = nullptr;
+    mapping.reset();
+    verbatim.clear(); verbatim.squeeze();
+    textCount = 0;
+    precision = precisionUnset;
+
+    _type = Type::String;
+    codes.resize(_size);
+    for(qsizetype row = 0; row < _size; ++row) codes[row] = stringCode(texts.at(row));
+}
+
+SheetColumn SheetColumn::fromMapped(const Type type, const void *data, const qsizetype size, const QSharedPointer<QFile>& mapping)
+{
+    SheetColumn column;
+    column._type = type;
+    column._size = size;
+    column.precision = (type == Type::Int64) ? 0 : precisionShortest;
+    column.mapped = data;
+    column.mapping = mapping;
+    return column;
+}
+
+SheetColumn SheetColumn::fromValues(const QList<qint64>& values)
+{
+    SheetColumn column;
+    column._type = Type::Int64;
+    column._size = values.size();
+    column.precision = 0;
+    column.ints = values;
+    return column;
+}
+
+SheetColumn SheetColumn::fromValues(const QList<double>& values)
+{
+    SheetColumn column;
+    column._type = Type::Double;
+    column._size = values.size();
+    column.precision = precisionShortest;
+    column.doubles = values;
+    return column;
+}
+
+SheetColumn::Type SheetColumn::fieldType(QByteArrayView field, bool *empty)
+{
+    double value = 0;
+    qint64 integer = 0;
+    int decimals = 0;
+    const Form form = classify(field, value, integer, decimals);
+
+    if(empty) *empty = (form == Form::Empty);
+
+    switch(form)
+    {
+    case Form::Integer: return Type::Int64;
+    case Form::Text: return Type::String;
+    default: return Type::Double;
+    }
+}
+
+bool SheetColumn::isTextColumn(const qsizetype numbers, const qsizetype texts, const qsizetype distinctTexts)
+{
+    if(texts == 0) return false;
+    if(numbers == 0) return true;
+
+    return distinctTexts > missingTokens && texts > numbers * 16;
+}
+
+/* 数値のセルと数値でないセル(verbatimのNaN)の数からisTextColumn()で決める */
+bool SheetColumn::prefersString() const
+{
+    if(precision == precisionUnset) return _size > 0;       //数値が一つもない
+    if(textCount == 0) return false;
+
+    QSet<QString> distinct;
+    for(auto iter = verbatim.cbegin(); iter != verbatim.cend() && distinct.size() <= missingTokens; ++iter)
+        if(qIsNaN(doubleAt(iter.key()))) distinct.insert(iter.value());
+
+    qsizetype nans = 0;
+    const double *data = doubleData();
+    for(qsizetype row = 0; row < _size; ++row) nans += qIsNaN(data[row]);
+
+    return isTextColumn(_size - nans, textCount, distinct.size());
+}
+
+double SheetColumn::fromFloat(const float value)
+{
+    if(!std::isfinite(value)) return double(value);
+
+    char buffer[32];
+    const std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+
+    double converted = double(value);
+    std::from_chars(buffer, result.ptr, converted);
+    return converted;
+}
+
+/* 参照しているmmapの配列を自身の配列にコピーする */
+void SheetColumn::detach()
+{
+    if(!mapped) return;
+
+    if(_type == Type::Int64)
+    {
+        ints.resize(_size);
+        std::memcpy(ints.data(), mapped, sizeof(qint64) * _size);
+    }
+    else if(_type == Type::Double)
+    {
+        doubles.resize(_size);
+        std::memcpy(doubles.data(), mapped, sizeof(double) * _size);
+    }
+
+    mapped = nullptr;
+    mapping.reset();
+}
+
+void SheetColumn::resize(const qsizetype size)
+{
+    if(size == _size) return;
+
+    detach();
+
+    if(size > _size)
+    {
+        switch(_type)
+        {
+        case Type::Int64:
+            promoteToDouble();
+            Q_FALLTHROUGH();
+        case Type::Double:
+            doubles.resize(size, qQNaN());
+            break;
+        case Type::String:
+            codes.resize(size, stringCode(QString()));
+            break;
+        default:
+            break;
+        }
+    }
+    else
+    {
+        switch(_type)
+        {
+        case Type::Int64:
+            ints.resize(size);
+            break;
+        case Type::Double:
+        {
+            doubles.resize(size);
+            for(auto iter = verbatim.begin(); iter != verbatim.end();)
+            {
+                if(iter.key() >= size) iter = verbatim.erase(iter);
+                else ++iter;
+            }
+            textCount = 0;
+            for(auto iter = verbatim.cbegin(); iter != verbatim.cend(); ++iter)
+                if(qIsNaN(doubleAt(iter.key()))) textCount++;
+            break;
+        }
+        case Type::String:
+            codes.resize(size);
+            break;
+        default:
+            break;
+        }
+    }
+
+    _size = size;
+}
+
+void SheetColumn::insert(const qsizetype row, const qsizetype count)
+{
+    if(count <= 0) return;
+
+    detach();
+
+    switch(_type)
+    {
+    case Type::Int64:
+        promoteToDouble();  //Int64列は空のセルを表せない
+        Q_FALLTHROUGH();
+    case Type::Double:
+    {
+        doubles.insert(row, count, qQNaN());
+
+        if(!verbatim.isEmpty())
+        {
+            QHash<qsizetype, QString> shifted;
+            shifted.reserve(verbatim.size());
+            for(auto iter = verbatim.cbegin(); iter != verbatim.cend(); ++iter)
+                shifted.insert((iter.key() >= row) ? iter.key() + count : iter.key(), iter.value());
+            verbatim.swap(shifted);
+        }
+        break;
+    }
+    case Type::String:
+        codes.insert(row, count, stringCode(QString()));
+        break;
+    default:
+        break;
+    }
+
+    _size += count;
+}
+
+void SheetColumn::remove(const qsizetype row, const qsizetype count)
+{
+    if(count <= 0) return;
+
+    detach();
+
+    switch(_type)
+    {
+    case Type::Int64:
+        ints.remove(row, count);
+        break;
+    case Type::Double:
+    {
+        doubles.remove(row, count);
+
+        if(!verbatim.isEmpty())
+        {
+            QHash<qsizetype, QString> shifted;
+            shifted.reserve(verbatim.size());
+            for(auto iter = verbatim.cbegin(); iter != verbatim.cend(); ++iter)
+            {
+                if(iter.key() < row) shifted.insert(iter.key(), iter.value());
+                else if(iter.key() >= row + count) shifted.insert(iter.key() - count, iter.value());
+            }
+            verbatim.swap(shifted);
+
+            textCount = 0;
+            for(auto iter = verbatim.cbegin(); iter != verbatim.cend(); ++iter)
+                if(qIsNaN(doubles.at(iter.key()))) textCount++;
+        }
+        break;
+    }
+    case Type::String:
+        codes.remove(row, count);
+        break;
+    default:
+        break;
+    }
+
+    _size -= count;
+}
+
+SheetColumn SheetColumn::mid(const qsizetype row, const qsizetype count) const
+{
+    if(row == 0 && count == _size) return *this;
+
+    SheetColumn column(_type);
+    column._size = count;
+    column.precision = precision;
+
+    switch(_type)
+    {
+    case Type::Int64:
+        column.ints = QList<qint64>(int64Data() + row, int64Data() + row + count);
+        break;
+    case Type::Double:
+    {
+        column.doubles = QList<double>(doubleData() + row, doubleData() + row + count);
+        for(auto iter = verbatim.cbegin(); iter != verbatim.cend(); ++iter)
+        {
+            if(iter.key() < row || iter.key() >= row + count) continue;
+            column.verbatim.insert(iter.key() - row, iter.value());
+            if(qIsNaN(doubleAt(iter.key()))) column.textCount++;
+        }
+        break;
+    }
+    case Type::String:
+        column.codes = codes.mid(row, count);
+        column.dict = dict;
+        break;
+    default:
+        break;
+    }
+
+    return column;
+}
+
+SheetColumn SheetColumn::select(const QList<qint32>& rows) const
+{
+    SheetColumn column(_type);
+    column._size = rows.size();
+    column.precision = precision;
+
+    switch(_type)
+    {
+    case Type::Int64:
+    {
+        column.ints.resize(rows.size());
+        const qint64 *data = int64Data();
+        for(qsizetype i = 0; i < rows.size(); ++i) column.ints[i] = data[rows.at(i)];
+        break;
+    }
+    case Type::Double:
+    {
+        column.doubles.resize(rows.size());
+        const double *data = doubleData();
+        for(qsizetype i = 0; i < rows.size(); ++i) column.doubles[i] = data[rows.at(i)];
+
+        //行は昇順なので，元の文字列の行は二分探索で移動先を探す
+        for(auto iter = verbatim.cbegin(); iter != verbatim.cend(); ++iter)
+        {
+            const auto found = std::lower_bound(rows.cbegin(), rows.cend(), qint32(iter.key()));
+            if(found == rows.cend() || *found != iter.key()) continue;
+            column.verbatim.insert(found - rows.cbegin(), iter.value());
+            if(qIsNaN(doubleAt(iter.key()))) column.textCount++;
+        }
+        break;
+    }
+    case Type::String:
+        column.codes.resize(rows.size());
+        for(qsizetype i = 0; i < rows.size(); ++i) column.codes[i] = codes.at(rows.at(i));
+        column.dict = dict;
+        break;
+    default:
+        break;
+    }
+
+    return column;
+}
+
+void SheetColumn::permute(const qsizetype first, const QList<qsizetype>& order)
+{
+    const qsizetype count = order.size();
+    if(count == 0) return;
+
+    detach();
+
+    switch(_type)
+    {
+    case Type::Int64:
+    {
+        const QList<qint64> old = ints.mid(first, count);
+        qint64 *data = ints.data() + first;
+        for(qsizetype i = 0; i < count; ++i) data[i] = old.at(order.at(i));
+        break;
+    }
+    case Type::Double:
+    {
+        const QList<double> old = doubles.mid(first, count);
+        double *data = doubles.data() + first;
+        for(qsizetype i = 0; i < count; ++i) data[i] = old.at(order.at(i));
+
+        if(!verbatim.isEmpty())
+        {
+            //セルごとにverbatimを探さず，移動先の位置から元の文字列を移す
+            QList<qsizetype> destination(count);
+            for(qsizetype i = 0; i < count; ++i) destination[order.at(i)] = first + i;
+
+            QHash<qsizetype, QString> moved;
+            moved.reserve(verbatim.size());
+            for(auto iter = verbatim.cbegin(); iter != verbatim.cend(); ++iter)
+            {
+                const qsizetype row = iter.key();
+                moved.insert((row < first || row >= first + count) ? row : destination.at(row - first), iter.value());
+            }
+            verbatim.swap(moved);
+        }
+        break;
+    }
+    case Type::String:
+    {
+        const QList<qint32> old = codes.mid(first, count);
+        qint32 *data = codes.data() + first;
+        for(qsizetype i = 0; i < count; ++i) data[i] = old.at(order.at(i));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void SheetColumn::squeeze()
+{
+    if(_type == Type::Double)
+    {
+        //数値が一つもない，またはほとんどが様々な文字列の列は文字列列にする
+        if(prefersString())
+            demoteToString();
+    }
+
+    ints.squeeze();
+    doubles.squeeze();
+    codes.squeeze();
+    dict.squeeze();
+    dictIndex.clear();
+    dictIndex.squeeze();
+}
+
+qsizetype SheetColumn::byteSize() const
+{
+    /* 文字列はQStringの管理領域の分を大まかに足す */
+    static constexpr qsizetype stringOverhead = 32;
+
+    qsizetype size = ints.size() * qsizetype(sizeof(qint64))
+                   + doubles.size() * qsizetype(sizeof(double))
+                   + codes.size() * qsizetype(sizeof(qint32));
+
+    for(const QString& text : dict) size += text.size() * qsizetype(sizeof(QChar)) + stringOverhead;
+    for(auto iter = verbatim.cbegin(); iter != verbatim.cend(); ++iter)
+        size += iter.value().size() * qsizetype(sizeof(QChar)) + stringOverhead + qsizetype(sizeof(qsizetype));
+
+    return size;
+}
+
+
+
+
+
+
+
+
+
+SheetData SheetData::fromStringList(const QList<QList<QString> >& sheet)
+{
+    SheetData data;
+
+    for(const QList<QString>& row : sheet)
+    {
+        for(qsizetype col = 0; col < row.size(); ++col)
+            data.appendCell(col, row.at(col).toUtf8());
+        data.endRow();
+    }
+
+    data.squeeze();
+    return data;
+}
+
+SheetData SheetData::fromColumns(const QList<SheetColumn>& columns)
+{
+    SheetData data;
+    data.columns = columns;
+
+    for(const SheetColumn& column : columns)
+        data.rows = qMax(data.rows, column.size());
+
+    for(SheetColumn& column : data.columns)
+        if(column.size() != data.rows) column.resize(data.rows);
+
+    return data;
+}
+
+QList<QList<QString> > SheetData::toStringList() const
+{
+    QList<QList<QString> > sheet(rows, QList<QString>(columns.size()));
+
+    for(qsizetype col = 0; col < columns.size(); ++col)
+    {
+        const SheetColumn& column = columns.at(col);
+        for(qsizetype row = 0; row < rows; ++row)
+            sheet[row][col] = column.text(row);
+    }
+
+    return sheet;
+}
+
+QString SheetData::text(const qsizetype row, const qsizetype col) const
+{
+    if(row < 0 || col < 0 || row >= rows || col >= columns.size()) return QString();
+
+    return columns.at(col).text(row);
+}
+
+double SheetData::value(const qsizetype row, const qsizetype col) const
+{
+    if(row < 0 || col < 0 || row >= rows || col >= columns.size()) return qQNaN();
+
+    return columns.at(col).value(row);
+}
+
+void SheetData::setText(const qsizetype row, const qsizetype col, const QString& text)
+{
+    if(row >= rows || col >= columns.size())
+        resize(qMax(rows, row + 1), qMax(columns.size(), col + 1));
+
+    columns[col].setText(row, text);
+}
+
+void SheetData::resize(const qsizetype rowCount, const qsizetype colCount)
+{
+    columns.resize(colCount);
+    for(SheetColumn& column : columns) column.resize(rowCount);
+
+    rows = rowCount;
+}
+
+void SheetData::squeeze()
+{
+    for(SheetColumn& column : columns) column.squeeze();
+    columns.squeeze();
+}
+
+qsizetype SheetData::byteSize() const
+{
+    qsizetype size = 0;
+    for(const SheetColumn& column : columns) size += column.byteSize();
+    for(const QString& name : names) size += name.size() * qsizetype(sizeof(QChar));
+
+    return size;
+}
+
+bool SheetData::detachMapping(const QString& path)
+{
+    const QString target = QFileInfo(path).absoluteFilePath();
+
+    bool detached = false;
+    for(qsizetype col = 0; col < columns.size(); ++col)
+    {
+        const SheetColumn& column = columns.at(col);
+        if(!column.isMapped() || QFileInfo(column.mappedFileName()).absoluteFilePath() != target) continue;
+
+        columns[col].detachMapping();
+        detached = true;
+    }
+
+    return detached;
+}
+
+void SheetData::insertRows(const qsizetype row, const qsizetype count)
+{
+    if(count <= 0) return;
+
+    for(SheetColumn& column : columns) column.insert(row, count);
+    rows += count;
+}
+
+void SheetData::removeRows(const qsizetype row, const qsizetype count)
+{
+    if(count <= 0) return;
+
+    for(SheetColumn& column : columns) column.remove(row, count);
+    rows -= count;
+}
+
+void SheetData::insertColumns(const qsizetype col, const qsizetype count)
+{
+    if(count <= 0) return;
+
+    SheetColumn empty;
+    empty.resize(rows);
+    columns.insert(col, count, empty);
+
+    if(!names.isEmpty()) names.insert(col, count, QString());
+}
+
+void SheetData::insertColumn(const qsizetype col, const SheetColumn& column, const QString& name)
+{
+    SheetColumn inserted = column;
+    inserted.resize(rows);
+
+    if(!names.isEmpty() || !name.isEmpty())
+    {
+        while(names.size() < columns.size()) names.append(QString());
+        names.insert(col, name);
+    }
+
+    columns.insert(col, inserted);
+}
+
+void SheetData::removeColumns(const qsizetype col, const qsizetype count)
+{
+    if(count <= 0) return;
+
+    columns.remove(col, count);
+
+    if(!names.isEmpty()) names.remove(col, count);
+}
+
+SheetData SheetData::mid(const qsizetype row, const qsizetype col, const qsizetype rowCount, const qsizetype colCount) const
+{
+    if(row == 0 && col == 0 && rowCount == rows && colCount == columns.size()) return *this;
+
+    SheetData data;
+    data.rows = rowCount;
+
+    /* 範囲内の部分を切り出し，範囲外は空のセルで埋める */
+    const qsizetype inRows = qBound<qsizetype>(0, rows - row, rowCount);
+    for(qsizetype c = col; c < col + colCount; ++c)
+    {
+        SheetColumn column;
+        if(c < columns.size() && inRows > 0) column = columns.at(c).mid(row, inRows);
+        column.resize(rowCount);
+        data.columns.append(column);
+    }
+
+    if(!names.isEmpty())
+    {
+        for(qsizetype c = col; c < col + colCount; ++c)
+            data.names << ((c < names.size()) ? names.at(c) : QString());
+    }
+
+    return data;
+}
+
+SheetData SheetData::select(const QList<qint32>& rows, const qsizetype col, const qsizetype colCount) const
+{
+    SheetData data;
+    data.rows = rows.size();
+
+    for(qsizetype c = col; c < col + colCount; ++c)
+    {
+        SheetColumn column;
+        if(c < columns.size()) column = columns.at(c).select(rows);
+        column.resize(rows.size());
+        data.columns.append(column);
+    }
+
+    if(!names.isEmpty())
+    {
+        for(qsizetype c = col; c < col + colCount; ++c)
+            data.names << ((c < names.size()) ? names.at(c) : QString());
+    }
+
+    return data;
+}
+
+/* セルの文字列をタブと改行で区切ったもののハッシュ．保存されている内容と同じかどうかの判定に使う */
+quint64 SheetData::contentHash() const
+{
+    static constexpr qsizetype flushSize = 1 << 16;
+
+    XXHash64 hasher;
+    QByteArray buffer;
+    buffer.reserve(flushSize + 1024);
+
+    for(qsizetype row = 0; row < rows; ++row)
+    {
+        for(const SheetColumn& column : columns)
+        {
+            column.appendText(buffer, row);
+            buffer += '\t';
+        }
+        buffer += '\n';
+
+        if(buffer.size() >= flushSize)
+        {
+            hasher.addData(buffer);
+            buffer.resize(0);
+        }
+    }
+
+    hasher.addData(buffer);
+    return hasher.result();
+}
+
+void SheetData::appendCell(const qsizetype col, QByteArrayView field)
+{
+    //新しい列は前の行までを空セルで埋める
+    while(columns.size() <= col)
+    {
+        columns.append(SheetColumn());
+        columns.last().resize(rows);
+    }
+
+    columns[col].append(field);
+}
+
+void SheetData::setColumnTypes(const QList<SheetColumn::Type>& types)
+{
+    if(rows != 0) return;
+
+    columns.clear();
+    for(const SheetColumn::Type type : types) columns.append(SheetColumn(type));
+}
+
+void SheetData::endRow()
+{
+    rows++;
+
+    //列数が足りない行は空セルで埋める
+    for(SheetColumn& column : columns)
+        if(column.size() < rows) column.resize(rows);
+}
@@ -0,0 +1,205 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef SHEETDATA_H
+#define SHEETDATA_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QMetaType>
+#include <QSharedPointer>
+#include <QFile>
+
+
+
+/* シートの1列分のデータ．
+ * セルの文字列から列の型(Int64, Double, String)を推定し，数値列は連続した配列で保持する．
+ * 文字列列は辞書(dictionary)とそのインデックス(codes)で保持する．
+ *
+ * 数値列のセルは列ごとの書式(precision)で文字列に戻す．書式は小数点以下の桁数を決めた'f'，仮数の桁数を決めた'e'(numpyの"%.18e"など)，
+ * 最短表記のいずれか．小数点以下の桁数がそろわない列("0.5"，"0.25")は最短表記に切り替える．
+ * 列の書式で元の文字列に戻せないセル(ヘッダーや"1e-3"，"007"のような表記)は verbatim に元の文字列を残すため，保存時に文字列が変わることはない．
+ * Double列の空セルは verbatim のない NaN で表す．
+ *
+ * 数値の配列はmmapしたファイル(シートのキャッシュなど)を直接参照することもできる．その場合は書き換えるときに初めてコピーする．
+ */
+class SheetColumn
+{
+public:
+    enum class Type { Int64, Double, String };
+
+    SheetColumn() {}
+    /* 型を決めた空の列．読み込む前に型がわかっていれば，途中で型を変えずに済む */
+    explicit SheetColumn(const Type type) : _type(type) {}
+
+    Type type() const { return _type; }
+    qsizetype size() const { return _size; }
+    bool isNumeric() const { return _type != Type::String; }
+
+    QString text(const qsizetype row) const;
+    double value(const qsizetype row) const;       //数値でないセルはNaN
+    void appendText(QByteArray& out, const qsizetype row) const;
+
+    void append(QByteArrayView field);             //UTF-8
+    void append(const QString& text);
+    void setText(const qsizetype row, const QString& text);
+    void resize(const qsizetype size);
+    void squeeze();
+    /* 列が持つ配列と文字列のおおよそのバイト数．mmapしたファイルの配列は含めない */
+    qsizetype byteSize() const;
+
+    /* rowの位置に空のセルをcount個挿入する/rowからcount個のセルを取り除く */
+    void insert(const qsizetype row, const qsizetype count);
+    void remove(const qsizetype row, const qsizetype count);
+    /* rowからcount個のセルの列．全体であれば配列を共有する */
+    SheetColumn mid(const qsizetype row, const qsizetype count) const;
+    /* rows(昇順)の行のセルを並べた列 */
+    SheetColumn select(const QList<qint32>& rows) const;
+    /* [first, first + order.size())のi番目のセルを，元のfirst + order[i]番目のセルにする */
+    void permute(const qsizetype first, const QList<qsizetype>& order);
+
+    const qint64 *int64Data() const { return (mapped) ? static_cast<const qint64*>(mapped) : ints.constData(); }
+    const double *doubleData() const { return (mapped) ? static_cast<const double*>(mapped) : doubles.constData(); }
+    const QList<qint32>& stringCodes() const { return codes; }
+    const QStringList& dictionary() const { return dict; }
+
+    /* mmapしたファイル上の数値の配列(Int64またはDouble)を列として参照する．mappingは参照している間保持される */
+    static SheetColumn fromMapped(const Type type, const void *data, const qsizetype size, const QSharedPointer<QFile>& mapping);
+    bool isMapped() const { return mapped != nullptr; }
+    /* mmapしている配列をコピーし，ファイルから切り離す．そのファイルを置き換える前に呼ぶ */
+    void detachMapping() { detach(); }
+    QString mappedFileName() const { return (mapping) ? mapping->fileName() : QString(); }
+
+    /* 数値の配列から列を作る．Double列のNaNは空のセルになる */
+    static SheetColumn fromValues(const QList<qint64>& values);
+    static SheetColumn fromValues(const QList<double>& values);
+    /* floatの値を，floatとして最短の10進表記と同じdoubleにする(0.1fを0.10000000149011612と表示しないように) */
+    static double fromFloat(const float value);
+
+    /* セルを格納する列の型．emptyには空のセルかどうかを入れる(空のセルはDouble) */
+    static Type fieldType(QByteArrayView field, bool *empty = nullptr);
+    /* 数値のセルと数値でないセルの数，数値でないセルの値の種類の数から，文字列の列とするか．
+     * 数値がなければ文字列の列とする．"NA"のように少ない種類の値が欠損値として繰り返される列は数値の列のままにする */
+    static bool isTextColumn(const qsizetype numbers, const qsizetype texts, const qsizetype distinctTexts);
+    static constexpr qsizetype missingTokens = 4;     //欠損値とみなす値の種類の上限
+
+private:
+    friend class SheetCache;
+
+    enum class Form { Empty, Integer, Fixed, Exponent, Other, Text };
+    static constexpr int precisionUnset = -2;
+    static constexpr int precisionShortest = -1;
+    static constexpr int precisionExponent = -3;      //これ以下なら'e'書式で，仮数の小数点以下の桁数は precisionExponent - precision
+
+    static Form classify(QByteArrayView field, double& value, qint64& integer, int& decimals);
+    bool matchesFormat(const Form form, const double value, const int decimals, QByteArrayView field) const;
+    static bool matchesShortest(const double value, QByteArrayView field);
+    void useShortest();
+
+    void storeDouble(const qsizetype row, const Form form, const double value, const int decimals, QByteArrayView field);
+    void storeString(const qsizetype row, const QString& text);
+    qint32 stringCode(const QString& text);
+    void promoteToDouble();
+    void demoteToString();
+    bool prefersString() const;
+    void detach();
+
+    qint64 intAt(const qsizetype row) const { return (mapped) ? static_cast<const qint64*>(mapped)[row] : ints.at(row); }
+    double doubleAt(const qsizetype row) const { return (mapped) ? static_cast<const double*>(mapped)[row] : doubles.at(row); }
+
+private:
+    Type _type = Type::Int64;
+    qsizetype _size = 0;
+    int precision = precisionUnset;        //Double列の小数点以下の桁数．-1なら最短表記，-3以下なら'e'書式
+
+    QList<qint64> ints;
+    QList<double> doubles;
+    QHash<qsizetype, QString> verbatim;    //列の書式で表せないセルの元の文字列
+    qsizetype textCount = 0;               //Double列の数値でないセルの数
+
+    QList<qint32> codes;
+    QStringList dict;
+    QHash<QString, qint32> dictIndex;      //squeeze()で解放し，必要になれば作り直す
+
+    const void *mapped = nullptr;          //ints, doublesの代わりに参照する配列
+    QSharedPointer<QFile> mapping;
+};
+
+
+
+
+
+/* 列指向のシートデータ．
+ * QListの暗黙の共有により，コピーは列単位の参照カウントの増加のみで済む．
+ */
+class SheetData
+{
+public:
+    SheetData() {}
+
+    static SheetData fromStringList(const QList<QList<QString> >& sheet);
+    /* 列を並べてシートにする．短い列は空のセルで埋める */
+    static SheetData fromColumns(const QList<SheetColumn>& columns);
+    QList<QList<QString> > toStringList() const;
+
+    qsizetype rowCount() const { return rows; }
+    qsizetype columnCount() const { return columns.size(); }
+    bool isEmpty() const { return rows == 0 || columns.isEmpty(); }
+
+    const SheetColumn& column(const qsizetype col) const { return columns.at(col); }
+    SheetColumn& column(const qsizetype col) { return columns[col]; }
+
+    QString text(const qsizetype row, const qsizetype col) const;
+    double value(const qsizetype row, const qsizetype col) const;
+    void setText(const qsizetype row, const qsizetype col, const QString& text);
+    void resize(const qsizetype rowCount, const qsizetype colCount);
+    void squeeze();
+    qsizetype byteSize() const;
+    quint64 contentHash() const;
+
+    void insertRows(const qsizetype row, const qsizetype count);
+    void removeRows(const qsizetype row, const qsizetype count);
+    void insertColumns(const qsizetype col, const qsizetype count);
+    void removeColumns(const qsizetype col, const qsizetype count);
+    /* colの位置にcolumnを挿入する．行数はシートに合わせる */
+    void insertColumn(const qsizetype col, const SheetColumn& column, const QString& name = QString());
+    /* (row, col)からrowCount x colCountの範囲．範囲外は空のセルとする */
+    SheetData mid(const qsizetype row, const qsizetype col, const qsizetype rowCount, const qsizetype colCount) const;
+    /* rows(昇順)の行の，colからcolCount列の範囲 */
+    SheetData select(const QList<qint32>& rows, const qsizetype col, const qsizetype colCount) const;
+
+    /* pathのファイルをmmapしている列をファイルから切り離す．切り離した列があればtrue */
+    bool detachMapping(const QString& path);
+
+    /* 列の名前(Arrowのフィールド名など)．セルとは別に持ち，なければ空 */
+    const QStringList& columnNames() const { return names; }
+    void setColumnNames(const QStringList& names) { this->names = names; }
+
+    /* 空のシートに，読み込む前に推定した型の列を用意する */
+    void setColumnTypes(const QList<SheetColumn::Type>& types);
+
+    /* パーサーから1セルずつ追加する．行の終わりでendRow()を呼ぶ */
+    void appendCell(const qsizetype col, QByteArrayView field);
+    void endRow();
+
+private:
+    friend class SheetCache;
+
+    QList<SheetColumn> columns;
+    qsizetype rows = 0;
+    QStringList names;
+};
+
+Q_DECLARE_METATYPE(SheetData)
+
+#endif // SHEETDATA_H
@@ -0,0 +1,265 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "sheetfilter.h"
+
+#include <QRegularExpression>
+#include <QtAlgorithms>
+#include <QtNumeric>
+#include <algorithm>
+#include "sheetsort.h"
+
+
+
+namespace
+{
+    constexpr qsizetype wordBits = 64;
+
+    void setBit(QList<quint64>& bits, const qsizetype row)
+    {
+        bits[row / wordBits] |= quint64(1) << (row % wordBits);
+    }
+
+    /* [0, rows)のビットをすべて立てる */
+    void setAll(QList<quint64>& bits, const qsizetype rows)
+    {
+        std::fill(bits.begin(), bits.end(), ~quint64(0));
+        if(rows % wordBits != 0) bits.last() = (quint64(1) << (rows % wordBits)) - 1;
+    }
+}
+
+
+
+
+bool SheetFilter::compile(const QString& text, QString *error)
+{
+    source = text;
+    terms.clear();
+
+    /* 括弧の外の&&で条件に分ける．||と?:は&&より優先順位が低いため，括弧の外にあれば分けずに全体を1つの式にする */
+    QStringList parts;
+    bool lowerPrecedence = false;
+    int depth = 0;
+    qsizetype start = 0;
+    for(qsizetype i = 0; i < text.size(); ++i)
+    {
+        const QChar c = text.at(i);
+        if(c == '(')
+            depth++;
+        else if(c == ')')
+            depth--;
+        else if(depth != 0)
+            continue;
+        else if(c == '?' || (c == '|' && i + 1 < text.size() && text.at(i + 1) == '|'))
+            lowerPrecedence = true;
+        else if(c == '&' && i + 1 < text.size() && text.at(i + 1) == '&')
+        {
+            parts << text.mid(start, i - start);
+            start = ++i + 1;
+        }
+    }
+    parts << text.mid(start);
+    if(lowerPrecedence) parts = QStringList{ text };
+
+    QList<Term> compiled;
+    for(const QString& part : qAsConst(parts))
+    {
+        Term term;
+        if(!parseComparison(part, term) && !term.expression.compile(part)) { compiled.clear(); break; }
+        compiled.append(term);
+    }
+
+    /* 分けると式にならなければ，全体を1つの条件とする */
+    if(compiled.isEmpty())
+    {
+        Term term;
+        if(!term.expression.compile(text, error)) return false;
+        compiled.append(term);
+    }
+
+    terms = compiled;
+    return true;
+}
+
+/* $n(column(n))と数値の比較．数値が左辺であれば向きを入れ替える */
+bool SheetFilter::parseComparison(const QString& text, Term& term)
+{
+    static const QString column = R"((?:\$(\d+)|column\s*\(\s*(\d+)\s*\)))";
+    static const QString compare = R"((<=|>=|==|!=|<|>))";
+    static const QString number = R"(([-+]?(?:\d+\.?\d*|\.\d+)(?:[eE][-+]?\d+)?))";
+    static const QRegularExpression columnFirst("^\\s*" + column + "\\s*" + compare + "\\s*" + number + "\\s*$");
+    static const QRegularExpression numberFirst("^\\s*" + number + "\\s*" + compare + "\\s*" + column + "\\s*$");
+
+    QString columnText, compareText, numberText;
+    bool reversed = false;
+
+    QRegularExpressionMatch match = columnFirst.match(text);
+    if(match.hasMatch())
+    {
+        columnText = match.captured(1) + match.captured(2);
+        compareText = match.captured(3);
+        numberText = match.captured(4);
+    }
+    else
+    {
+        match = numberFirst.match(text);
+        if(!match.hasMatch()) return false;
+        numberText = match.captured(1);
+        compareText = match.captured(2);
+        columnText = match.captured(3) + match.captured(4);
+        reversed = true;
+    }
+
+    bool ok = false;
+    const int col = columnText.toInt(&ok);
+    if(!ok || col < 1) return false;       //$0(行の番号)は式として計算する
+    const double value = numberText.toDouble(&ok);
+    if(!ok) return false;
+
+    if(compareText == "<") term.compare = (reversed) ? Compare::Greater : Compare::Less;
+    else if(compareText == "<=") term.compare = (reversed) ? Compare::GreaterEqual : Compare::LessEqual;
+    else if(compareText == ">") term.compare = (reversed) ? Compare::Less : Compare::Greater;
+    else if(compareText == ">=") term.compare = (reversed) ? Compare::LessEqual : Compare::GreaterEqual;
+    else if(compareText == "==") term.compare = Compare::Equal;
+    else term.compare = Compare::NotEqual;
+
+    term.column = col - 1;
+    term.value = value;
+    return true;
+}
+
+SheetFilter::Bitmap SheetFilter::evaluate(const SheetData& sheet, IndexCache& indexes) const
+{
+    const qsizetype words = (sheet.rowCount() + wordBits - 1) / wordBits;
+
+    Bitmap result;
+    for(const Term& term : terms)
+    {
+        Bitmap bits(words, 0);
+
+        if(term.column >= 0)
+            compareIndex(sheet, term, index(sheet, term.column, indexes), bits);
+        else
+            expressionBits(term.expression.evaluate(sheet), bits);
+
+        if(result.isEmpty())
+            result = bits;
+        else
+            for(qsizetype i = 0; i < words; ++i) result[i] &= bits.at(i);
+    }
+
+    return result;
+}
+
+const SheetFilter::Index& SheetFilter::index(const SheetData& sheet, const int column, IndexCache& indexes)
+{
+    const auto found = indexes.constFind(column);
+    if(found != indexes.constEnd()) return found.value();
+
+    Index index;
+    if(column < sheet.columnCount() && sheet.column(column).isNumeric())
+    {
+        /* 並べ替えでは数値でないセルは数値の後になるので，最初の数値でないセルまでを索引にする */
+        const SheetColumn& data = sheet.column(column);
+        const QList<qsizetype> order = SheetSort::permutation(sheet, { SheetSort::Key{ column, Qt::AscendingOrder } });
+
+        index.reserve(order.size());
+        for(const qsizetype row : order)
+        {
+            if(qIsNaN(data.value(row))) break;
+            index.append(qint32(row));
+        }
+        index.squeeze();
+    }
+
+    return indexes.insert(column, index).value();
+}
+
+/* 索引の中で比較に合う範囲を二分探索で求める．!=は式と同じく数値でないセルも合うとする */
+void SheetFilter::compareIndex(const SheetData& sheet, const Term& term, const Index& index, Bitmap& bits)
+{
+    const qsizetype rows = sheet.rowCount();
+    const double value = term.value;
+
+    qsizetype lower = 0, upper = 0;     //[lower, upper)が値の等しい範囲
+    if(!index.isEmpty())
+    {
+        const SheetColumn& column = sheet.column(term.column);
+        lower = std::lower_bound(index.cbegin(), index.cend(), value,
+                                 [&column](const qint32 row, const double x) { return column.value(row) < x; }) - index.cbegin();
+        upper = std::upper_bound(index.cbegin() + lower, index.cend(), value,
+                                 [&column](const double x, const qint32 row) { return x < column.value(row); }) - index.cbegin();
+    }
+
+    qsizetype first = 0, last = 0;
+    switch(term.compare)
+    {
+    case Compare::Less: first = 0; last = lower; break;
+    case Compare::LessEqual: first = 0; last = upper; break;
+    case Compare::Greater: first = upper; last = index.size(); break;
+    case Compare::GreaterEqual: first = lower; last = index.size(); break;
+    case Compare::Equal: first = lower; last = upper; break;
+    case Compare::NotEqual:
+        setAll(bits, rows);
+        for(qsizetype i = lower; i < upper; ++i)
+        {
+            const qint32 row = index.at(i);
+            bits[row / wordBits] &= ~(quint64(1) << (row % wordBits));
+        }
+        return;
+    }
+
+    for(qsizetype i = first; i < last; ++i) setBit(bits, index.at(i));
+}
+
+/* 64行ずつ，0でもNaNでもない値のビットを1語にまとめる */
+void SheetFilter::expressionBits(const QList<double>& values, Bitmap& bits)
+{
+    const double *data = values.constData();
+    const qsizetype rows = values.size();
+
+    for(qsizetype word = 0; word < bits.size(); ++word)
+    {
+        const qsizetype first = word * wordBits;
+        const int size = int(qMin(wordBits, rows - first));
+
+        quint64 packed = 0;
+        for(int i = 0; i < size; ++i)
+        {
+            const double x = data[first + i];
+            packed |= quint64(x == x && x != 0.0) << i;
+        }
+        bits[word] = packed;
+    }
+}
+
+QList<qint32> SheetFilter::rows(const Bitmap& bits)
+{
+    QList<qint32> rows;
+    rows.reserve(count(bits));
+
+    for(qsizetype word = 0; word < bits.size(); ++word)
+    {
+        quint64 packed = bits.at(word);
+        while(packed != 0)
+        {
+            rows.append(qint32(word * wordBits + qCountTrailingZeroBits(packed)));
+            packed &= packed - 1;
+        }
+    }
+
+    return rows;
+}
+
+qsizetype SheetFilter::count(const Bitmap& bits)
+{
+    qsizetype count = 0;
+    for(const quint64 packed : bits) count += qPopulationCount(packed);
+    return count;
+}
@@ -0,0 +1,71 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef SHEETFILTER_H
+#define SHEETFILTER_H
+
+#include <QList>
+#include <QHash>
+#include <QString>
+#include "sheetdata.h"
+#include "columnexpression.h"
+
+
+
+/* シートの行を絞り込む条件．ColumnExpressionと同じ式を&&でつないで書く(例: $3 > 1e-3 && $1 != 0)．
+ * 値が0でもNaNでもない行を残す．括弧の外に||か?:があれば，優先順位を変えないように全体を1つの式として計算する．
+ *
+ * 行ごとの結果は64行を1語にしたビット列にし，条件どうしは語ごとのANDで合わせる．
+ * 列と数値の比較だけの条件($n < 数値 など)は，列の数値のセルを値の順に並べた索引を二分探索し，範囲の行のビットを立てる．
+ * 索引は列ごとに必要になったときに作り，シートが変わるまで呼び出し側(IndexCache)で使い回す．
+ * それ以外の条件は式の値の列を計算してビット列にする．
+ */
+class SheetFilter
+{
+public:
+    /* 列の数値のセルの行を，値の昇順に並べたもの．数値でないセルの行は含まない */
+    using Index = QList<qint32>;
+    using IndexCache = QHash<int, Index>;
+    using Bitmap = QList<quint64>;
+
+    SheetFilter() {}
+
+    /* textを条件に変換する．失敗すればerrorに理由を入れてfalse */
+    bool compile(const QString& text, QString *error = nullptr);
+    bool isValid() const { return !terms.isEmpty(); }
+    const QString& text() const { return source; }
+
+    /* 条件に合う行のビット列．シートは読むだけなので，別スレッドから呼べる．indexesは足りない列の索引を加える */
+    Bitmap evaluate(const SheetData& sheet, IndexCache& indexes) const;
+
+    /* ビット列の立っている行の番号(昇順)と数 */
+    static QList<qint32> rows(const Bitmap& bits);
+    static qsizetype count(const Bitmap& bits);
+
+private:
+    enum class Compare { Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual };
+
+    struct Term
+    {
+        int column = -1;            //0以上なら索引で比較する列
+        Compare compare = Compare::Equal;
+        double value = 0.0;
+        ColumnExpression expression;
+    };
+
+    static bool parseComparison(const QString& text, Term& term);
+    static const Index& index(const SheetData& sheet, const int column, IndexCache& indexes);
+    static void compareIndex(const SheetData& sheet, const Term& term, const Index& index, Bitmap& bits);
+    static void expressionBits(const QList<double>& values, Bitmap& bits);
+
+    QString source;
+    QList<Term> terms;
+};
+
+#endif // SHEETFILTER_H
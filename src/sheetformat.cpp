@@ -0,0 +1,295 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "sheetformat.h"
+
+#include <QFile>
+#include <QHash>
+#include <QSet>
+#include "deflate.h"
+
+
+
+namespace
+{
+    bool isBlank(const char c) { return c == ' ' || c == '\t'; }
+
+    /* 空白を除いた最初の文字 */
+    char firstChar(QByteArrayView line)
+    {
+        for(const char c : line)
+            if(!isBlank(c)) return c;
+        return '\0';
+    }
+
+    /* 行の先頭か区切りの候補の直後にある引用符の数 */
+    qsizetype countFieldQuotes(QByteArrayView line, const char quote)
+    {
+        qsizetype count = 0;
+        for(qsizetype i = 0; i < line.size(); ++i)
+        {
+            if(line.at(i) != quote) continue;
+            if(i == 0 || QByteArrayView(",\t;| ").contains(line.at(i - 1))) count++;
+        }
+        return count;
+    }
+
+    /* セルの先頭で開いた引用符がすべて閉じ，閉じた引用符の直後が区切りの候補か行の終わりであれば，引用符で囲まれたセルの数．
+     * 引用符の中の改行は次の行に続ける．閉じていない引用符や，セルの途中で閉じる引用符があれば-1 */
+    qsizetype countClosedQuotes(const QList<QByteArray>& lines, const char quote)
+    {
+        const QByteArrayView delimiters(",\t;| ");
+
+        qsizetype count = 0;
+        bool inQuotes = false;
+        for(const QByteArray& line : lines)
+        {
+            for(qsizetype i = 0; i < line.size(); ++i)
+            {
+                if(line.at(i) != quote) continue;
+
+                if(!inQuotes)
+                {
+                    if(i == 0 || delimiters.contains(line.at(i - 1))) { inQuotes = true; count++; }
+                    continue;
+                }
+
+                if(i + 1 < line.size() && line.at(i + 1) == quote) { ++i; continue; }     //2つ続いた引用符
+
+                inQuotes = false;
+                if(i + 1 < line.size() && !delimiters.contains(line.at(i + 1))) return -1;
+            }
+        }
+
+        return (inQuotes) ? -1 : count;
+    }
+
+    /* サンプルを行に分ける．途中から読んだサンプルの最初と最後の不完全な行は除く */
+    void appendLines(QList<QByteArray>& lines, QByteArrayView sample)
+    {
+        qsizetype begin = 0;
+        while(begin < sample.size())
+        {
+            qsizetype end = sample.indexOf('\n', begin);
+            if(end < 0) end = sample.size();
+
+            QByteArrayView line = sample.sliced(begin, end - begin);
+            if(line.endsWith('\r')) line = line.chopped(1);
+            if(firstChar(line) != '\0') lines << line.toByteArray();
+
+            begin = end + 1;
+        }
+    }
+}
+
+
+
+
+SheetFormat SheetFormat::sniff(const QString& fileName, const char defaultDelimiter)
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly)) return SheetFormat(defaultDelimiter);
+
+    QList<QByteArray> samples;
+
+    if(GzipReader::isGzip(&file))
+    {
+        /* 圧縮されたファイルは先頭だけを見る */
+        GzipReader gzip(&file);
+        QByteArray sample(sampleSize, Qt::Uninitialized);
+        const qint64 size = gzip.read(sample.data(), sampleSize);
+        sample.resize(qMax<qint64>(0, size));
+
+        if(size == sampleSize) sample.truncate(sample.lastIndexOf('\n') + 1);
+        samples << sample;
+    }
+    else
+    {
+        const qint64 size = file.size();
+        const QList<qint64> offsets = (size <= 3 * sampleSize) ? QList<qint64>{ 0 }
+                                                               : QList<qint64>{ 0, size / 2 - sampleSize / 2, size - sampleSize };
+
+        for(const qint64 offset : offsets)
+        {
+            if(!file.seek(offset)) continue;
+
+            QByteArray sample = file.read((size <= 3 * sampleSize) ? size : sampleSize);
+            if(offset + sample.size() < size) sample.truncate(sample.lastIndexOf('\n') + 1);
+            if(offset > 0) sample.remove(0, sample.indexOf('\n') + 1);
+
+            samples << sample;
+        }
+    }
+
+    return sniff(samples, defaultDelimiter);
+}
+
+SheetFormat SheetFormat::sniff(const QList<QByteArray>& samples, const char defaultDelimiter)
+{
+    SheetFormat format(defaultDelimiter);
+
+    QList<QByteArray> lines;
+    for(qsizetype i = 0; i < samples.size(); ++i)
+    {
+        QByteArrayView sample = samples.at(i);
+        if(i == 0 && sample.startsWith("\xEF\xBB\xBF")) sample = sample.sliced(3);
+        appendLines(lines, sample);
+    }
+
+    /* 注釈(gnuplotと同じく'#'で始まる行) */
+    QList<QByteArray> dataLines;
+    for(const QByteArray& line : lines)
+    {
+        if(firstChar(line) == '#') format.comment = '#';
+        else dataLines << line;
+    }
+
+    if(dataLines.isEmpty()) return format;
+
+    /* 引用符．引用符の中は改行も区切りもセルの一部になるため，1つでも閉じていない引用符があれば解釈しない
+     * (迷い込んだ引用符から後ろがすべて1つのセルにならないように)．
+     * 'はアポストロフィと区別するため，さらに半分以上の行のセルの先頭にある場合だけとする */
+    qsizetype singleQuoted = 0;
+    for(const QByteArray& line : dataLines)
+        if(countFieldQuotes(line, '\'') > 0) singleQuoted++;
+
+    if(countClosedQuotes(dataLines, '"') > 0) format.quote = '"';
+    else if(singleQuoted * 2 >= dataLines.size() && countClosedQuotes(dataLines, '\'') > 0) format.quote = '\'';
+
+    /* 区切り文字．最も多くの行が同じセルの数(2以上)になるものを選び，同じなら候補の順で前のものとする */
+    QByteArray candidates;
+    candidates += defaultDelimiter;
+    for(const char c : QByteArrayView(",\t;| "))
+        if(!candidates.contains(c)) candidates += c;
+
+    double bestShare = 0;
+    for(const char candidate : candidates)
+    {
+        SheetFormat trial = format;
+        trial.delimiter = candidate;
+        trial.mergeDelimiters = (candidate == ' ');
+
+        QHash<qsizetype, qsizetype> counts;
+        for(const QByteArray& line : dataLines)
+        {
+            qsizetype fields = 0;
+            trial.forEachField(line, [&](QByteArrayView, bool) { fields++; });
+            counts[fields]++;
+        }
+
+        qsizetype mode = 0;
+        qsizetype modeLines = 0;
+        for(auto iter = counts.cbegin(); iter != counts.cend(); ++iter)
+        {
+            if(iter.value() > modeLines || (iter.value() == modeLines && iter.key() > mode))
+            {
+                mode = iter.key();
+                modeLines = iter.value();
+            }
+        }
+
+        const double share = double(modeLines) / dataLines.size();
+        if(mode >= 2 && share >= 0.5 && share > bestShare)
+        {
+            bestShare = share;
+            format.delimiter = trial.delimiter;
+            format.mergeDelimiters = trial.mergeDelimiters;
+        }
+    }
+
+    /* セルの分割と，すべてのセルが引用符で囲まれているか */
+    QList<QList<QByteArray> > rows;
+    bool allQuoted = (format.quote != '\0');
+    for(const QByteArray& line : dataLines)
+    {
+        QList<QByteArray> fields;
+        format.forEachField(line, [&](QByteArrayView field, bool quoted) {
+            fields << field.toByteArray();
+            if(!quoted) allQuoted = false;
+        });
+        rows << fields;
+    }
+    format.quoteAll = allQuoted;
+
+    qsizetype columnCount = 0;
+    for(const QList<QByteArray>& fields : rows) columnCount = qMax(columnCount, fields.size());
+
+    /* 列ごとの型の数．最初の行は後でヘッダーかどうかを決めるため別に数える */
+    struct Tally
+    {
+        qsizetype integers = 0, doubles = 0, texts = 0, empties = 0;
+        QSet<QByteArray> textValues;    //missingTokensを超えれば数えない
+
+        void add(QByteArrayView field)
+        {
+            bool empty = false;
+            switch(SheetColumn::fieldType(field, &empty))
+            {
+            case SheetColumn::Type::Int64: integers++; break;
+            case SheetColumn::Type::Double: (empty) ? empties++ : doubles++; break;
+            default:
+                texts++;
+                if(textValues.size() <= SheetColumn::missingTokens) textValues.insert(field.toByteArray());
+                break;
+            }
+        }
+    };
+    QList<Tally> tallies(columnCount);
+
+    for(qsizetype row = 1; row < rows.size(); ++row)
+    {
+        const QList<QByteArray>& fields = rows.at(row);
+        for(qsizetype col = 0; col < fields.size(); ++col)
+        {
+            tallies[col].add(fields.at(col));
+        }
+    }
+
+    /* ヘッダー: 最初の行のセルがすべて文字列で，その下が数値である列がある */
+    if(rows.size() > 1)
+    {
+        const QList<QByteArray>& first = rows.first();
+        bool allText = true;
+        for(const QByteArray& field : first)
+        {
+            bool empty = false;
+            if(SheetColumn::fieldType(field, &empty) != SheetColumn::Type::String || empty) allText = false;
+        }
+
+        bool numericBelow = false;
+        for(const Tally& tally : tallies)
+            if(tally.integers + tally.doubles > tally.texts) numericBelow = true;
+
+        format.hasHeader = allText && numericBelow;
+    }
+
+    if(!format.hasHeader && !rows.isEmpty())
+    {
+        const QList<QByteArray>& first = rows.first();
+        for(qsizetype col = 0; col < first.size(); ++col)
+        {
+            tallies[col].add(first.at(col));
+        }
+    }
+
+    /* 列の型．SheetColumn::squeeze()と同じく，数値がないか，ほとんどが様々な文字列の列は文字列の列とする("NA"の多い列は数値の列)．
+     * Int64列は空のセルや文字列を表せないため，空のセルや短い行，ヘッダーのある列はDouble列とする */
+    for(qsizetype col = 0; col < tallies.size(); ++col)
+    {
+        const Tally& tally = tallies.at(col);
+        const qsizetype count = tally.integers + tally.doubles + tally.texts + tally.empties;
+        const qsizetype rowCount = lines.size() - ((format.hasHeader) ? 1 : 0);      //注釈の行は2列目以降が空になる
+
+        if(SheetColumn::isTextColumn(tally.integers + tally.doubles, tally.texts, tally.textValues.size())) format.columnTypes << SheetColumn::Type::String;
+        else if(tally.doubles > 0 || tally.empties > 0 || count < rowCount || format.hasHeader) format.columnTypes << SheetColumn::Type::Double;
+        else format.columnTypes << SheetColumn::Type::Int64;
+    }
+
+    return format;
+}
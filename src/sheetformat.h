@@ -0,0 +1,120 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef SHEETFORMAT_H
+#define SHEETFORMAT_H
+
+#include <QString>
+#include <QList>
+#include <QByteArray>
+#include <QByteArrayView>
+#include <cstring>
+#include "sheetdata.h"
+
+
+
+/* 区切り文字で区切られたテキストの書式．
+ * sniff()はファイルの先頭・中央・末尾から数KBずつを読んで，区切り文字，引用符，注釈の記号，ヘッダー行，列の型を推定する．
+ * 推定した列の型はSheetParserが最初の行から使うため，読み込み中に列の型を変えて解釈し直すことがない．
+ */
+struct SheetFormat
+{
+    explicit SheetFormat(const char delimiter = ',') : delimiter(delimiter) {}
+
+    char delimiter;
+    bool mergeDelimiters = false;       //空白とタブの連続を1つの区切りとする(gnuplotのデータファイル)．delimiterは' '
+    char quote = '\0';                  //'\0'なら引用符を解釈しない
+    bool quoteAll = false;              //すべてのセルが引用符で囲まれている
+    char comment = '\0';                //この文字で始まる行は注釈として1つのセルに入れる
+    bool hasHeader = false;             //最初のデータ行が列名
+    QList<SheetColumn::Type> columnTypes;
+
+    /* 区切り文字だけで分ければよい(高速な解析を使える) */
+    bool isPlain() const { return !mergeDelimiters && quote == '\0' && comment == '\0'; }
+
+    static SheetFormat sniff(const QString& fileName, const char defaultDelimiter);
+    static SheetFormat sniff(const QList<QByteArray>& samples, const char defaultDelimiter);
+
+    static constexpr qsizetype sampleSize = 16 * 1024;
+
+    /* 1行(改行を含まない)をこの書式でセルに分け，引用符を取り除いたセルごとにfunction(field, quoted)を呼ぶ．
+     * 空の行は1つの空のセルとする */
+    template <typename Function>
+    void forEachField(QByteArrayView line, Function function) const;
+};
+
+
+
+
+template <typename Function>
+void SheetFormat::forEachField(QByteArrayView line, Function function) const
+{
+    const char *p = line.data();
+    const char *end = p + line.size();
+
+    const auto isBlank = [](const char c) { return c == ' ' || c == '\t'; };
+    const auto findDelimiter = [&](const char *from) -> const char* {
+        if(mergeDelimiters)
+        {
+            while(from < end && !isBlank(*from)) ++from;
+            return from;
+        }
+        if(from >= end) return end;
+        const char *found = static_cast<const char*>(std::memchr(from, delimiter, end - from));
+        return (found) ? found : end;
+    };
+
+    if(mergeDelimiters)
+    {
+        while(p < end && isBlank(*p)) ++p;
+        while(end > p && isBlank(end[-1])) --end;
+    }
+
+    QByteArray unquoted;
+    for(;;)
+    {
+        if(quote != '\0' && p < end && *p == quote)
+        {
+            /* 引用符の中の区切り文字はそのまま，2つ続いた引用符は1つにする */
+            unquoted.clear();
+            for(++p; ; )
+            {
+                const char *q = static_cast<const char*>(std::memchr(p, quote, end - p));
+                if(!q) { unquoted.append(p, end - p); p = end; break; }
+
+                unquoted.append(p, q - p);
+                p = q + 1;
+                if(p < end && *p == quote) { unquoted.append(quote); ++p; continue; }
+                break;
+            }
+
+            //閉じた引用符の後ろから区切りまでの文字も加える
+            const char *next = findDelimiter(p);
+            unquoted.append(p, next - p);
+            p = next;
+
+            function(QByteArrayView(unquoted), true);
+        }
+        else
+        {
+            const char *next = findDelimiter(p);
+            function(QByteArrayView(p, next - p), false);
+            p = next;
+        }
+
+        if(p == end) return;
+
+        if(mergeDelimiters)
+            while(p < end && isBlank(*p)) ++p;
+        else
+            ++p;
+    }
+}
+
+#endif // SHEETFORMAT_H
@@ -0,0 +1,398 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "sheetgroup.h"
+
+#include <QHash>
+#include <QThread>
+#include <QThreadPool>
+#include <QtNumeric>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include "sheetsort.h"
+#include "columnstats.h"
+
+
+
+namespace
+{
+    /* Double列の数値でないセルのキー．数値のビット列と重ならないように，文字列ごとにNaNの別のビット列にする */
+    constexpr quint64 textKey = 0x7ff8000000000001ull;
+
+    /* 行を分けてスレッドで実行する */
+    class Parallel
+    {
+    public:
+        explicit Parallel(const qsizetype rows)
+        {
+            int chunks = 1;
+            if(rows >= SheetGroupBy::parallelThreshold) chunks = qMax(1, QThread::idealThreadCount());
+
+            bounds.resize(chunks + 1);
+            for(int i = 0; i <= chunks; ++i) bounds[i] = rows * i / chunks;
+            pool.setMaxThreadCount(chunks);
+        }
+
+        int chunks() const { return int(bounds.size()) - 1; }
+
+        void run(const std::function<void(qsizetype first, qsizetype last, int chunk)>& function)
+        {
+            if(chunks() == 1) { function(bounds[0], bounds[1], 0); return; }
+            for(int i = 0; i < chunks(); ++i) pool.start([&, i]() { function(bounds[i], bounds[i + 1], i); });
+            pool.waitForDone();
+        }
+
+    private:
+        std::vector<qsizetype> bounds;
+        QThreadPool pool;
+    };
+
+    /* 列のセルの，型のままのキー */
+    std::vector<quint64> columnKeys(const SheetData& sheet, const int col, Parallel& parallel)
+    {
+        const qsizetype rows = sheet.rowCount();
+        std::vector<quint64> keys(rows, 0);
+        if(col < 0 || col >= sheet.columnCount()) return keys;
+
+        const SheetColumn& column = sheet.column(col);
+
+        switch(column.type())
+        {
+        case SheetColumn::Type::Int64:
+        {
+            const qint64 *data = column.int64Data();
+            parallel.run([&](const qsizetype first, const qsizetype last, int) {
+                for(qsizetype row = first; row < last; ++row) keys[row] = quint64(data[row]);
+            });
+            break;
+        }
+        case SheetColumn::Type::Double:
+        {
+            const double *data = column.doubleData();
+            parallel.run([&](const qsizetype first, const qsizetype last, int) {
+                for(qsizetype row = first; row < last; ++row)
+                {
+                    double value = data[row];
+                    if(value == 0.0) value = 0.0;       //-0.0を0.0と同じにする
+                    std::memcpy(&keys[row], &value, sizeof(value));
+                }
+            });
+
+            /* 数値でないセル(空のセルを含む)は文字列ごとに分ける．ふつうは少ないので1スレッドで行う */
+            QHash<QString, quint64> texts;
+            for(qsizetype row = 0; row < rows; ++row)
+            {
+                if(!qIsNaN(data[row])) continue;
+                const QString text = column.text(row);
+                auto found = texts.find(text);
+                if(found == texts.end()) found = texts.insert(text, textKey + quint64(texts.size()));
+                keys[row] = found.value();
+            }
+            break;
+        }
+        case SheetColumn::Type::String:
+        {
+            const QList<qint32>& codes = column.stringCodes();
+            parallel.run([&](const qsizetype first, const qsizetype last, int) {
+                for(qsizetype row = first; row < last; ++row) keys[row] = quint64(codes.at(row));
+            });
+            break;
+        }
+        default:
+            break;
+        }
+
+        return keys;
+    }
+
+    /* キーの値ごとに，最初に現れた順の番号を付ける．countにはキーの種類の数を入れる．
+     * 行を分けたそれぞれで番号を付けてから，分けた順に全体の番号に置き換える */
+    QList<qint32> densify(const std::vector<quint64>& keys, Parallel& parallel, qint32& count)
+    {
+        QList<qint32> ids(keys.size());
+        qint32 *out = ids.data();
+
+        std::vector<std::vector<quint64> > firstKeys(parallel.chunks());
+        parallel.run([&](const qsizetype first, const qsizetype last, const int chunk) {
+            QHash<quint64, qint32> local;
+            std::vector<quint64>& order = firstKeys[chunk];
+            for(qsizetype row = first; row < last; ++row)
+            {
+                auto found = local.find(keys[row]);
+                if(found == local.end())
+                {
+                    found = local.insert(keys[row], qint32(order.size()));
+                    order.push_back(keys[row]);
+                }
+                out[row] = found.value();
+            }
+        });
+
+        QHash<quint64, qint32> global;
+        std::vector<std::vector<qint32> > remap(parallel.chunks());
+        for(int chunk = 0; chunk < parallel.chunks(); ++chunk)
+        {
+            for(const quint64 key : firstKeys[chunk])
+            {
+                auto found = global.find(key);
+                if(found == global.end()) found = global.insert(key, qint32(global.size()));
+                remap[chunk].push_back(found.value());
+            }
+        }
+
+        parallel.run([&](const qsizetype first, const qsizetype last, const int chunk) {
+            const std::vector<qint32>& table = remap[chunk];
+            for(qsizetype row = first; row < last; ++row) out[row] = table[out[row]];
+        });
+
+        count = qint32(global.size());
+        return ids;
+    }
+
+    /* 各番号が最初に現れる行(昇順) */
+    QList<qint32> firstRows(const QList<qint32>& ids, const qint32 count)
+    {
+        QList<qint32> rows;
+        rows.reserve(count);
+        for(qsizetype row = 0; row < ids.size() && rows.size() < count; ++row)
+            if(ids.at(row) == rows.size()) rows.append(qint32(row));     //番号は最初に現れた順
+        return rows;
+    }
+
+    /* 1つのグループの1つの列の集計．平均と偏差平方和はWelfordの方法で求め，行を分けた集計はChanの方法で合わせる */
+    struct Accumulator
+    {
+        ColumnStatistics::Block moments;        //countは数値のセルの数
+        double sum = 0.0;
+
+        void add(const double x)
+        {
+            if(qIsNaN(x)) return;
+            moments.count++;
+            sum += x;
+            const double delta = x - moments.mean;
+            moments.mean += delta / double(moments.count);
+            moments.m2 += delta * (x - moments.mean);
+            moments.min = qMin(moments.min, x);
+            moments.max = qMax(moments.max, x);
+        }
+
+        void merge(const Accumulator& other)
+        {
+            moments = ColumnStatistics::merge(moments, other.moments);
+            sum += other.sum;
+        }
+
+        double result(const SheetGroupBy::Aggregate aggregate) const
+        {
+            const qsizetype count = moments.count;
+            if(aggregate == SheetGroupBy::Aggregate::Count) return double(count);
+            if(count == 0) return qQNaN();
+
+            switch(aggregate)
+            {
+            case SheetGroupBy::Aggregate::Sum: return sum;
+            case SheetGroupBy::Aggregate::Mean: return moments.mean;
+            case SheetGroupBy::Aggregate::StdDev: return (count > 1) ? std::sqrt(moments.m2 / double(count - 1)) : qQNaN();
+            case SheetGroupBy::Aggregate::Min: return moments.min;
+            case SheetGroupBy::Aggregate::Max: return moments.max;
+            default: return qQNaN();
+            }
+        }
+    };
+
+    /* 数値でないセルはNaN */
+    struct ValueReader
+    {
+        const qint64 *ints = nullptr;
+        const double *doubles = nullptr;
+
+        explicit ValueReader(const SheetData& sheet, const int col)
+        {
+            if(col < 0 || col >= sheet.columnCount()) return;
+            const SheetColumn& column = sheet.column(col);
+            if(column.type() == SheetColumn::Type::Int64) ints = column.int64Data();
+            else if(column.type() == SheetColumn::Type::Double) doubles = column.doubleData();
+        }
+
+        double operator()(const qsizetype row) const
+        {
+            return (doubles) ? doubles[row] : (ints) ? double(ints[row]) : qQNaN();
+        }
+    };
+
+    QString columnName(const SheetData& sheet, const int col)
+    {
+        const QString name = sheet.columnNames().value(col);
+        return (name.isEmpty()) ? "$" + QString::number(col + 1) : name;
+    }
+}
+
+
+
+
+QString SheetGroupBy::aggregateName(const Aggregate aggregate)
+{
+    switch(aggregate)
+    {
+    case Aggregate::Count: return "count";
+    case Aggregate::Sum: return "sum";
+    case Aggregate::Mean: return "mean";
+    case Aggregate::StdDev: return "stddev";
+    case Aggregate::Min: return "min";
+    case Aggregate::Max: return "max";
+    default: return QString();
+    }
+}
+
+SheetData SheetGroupBy::aggregate(const SheetData& sheet, const Spec& spec, QString *error)
+{
+    const qsizetype rows = sheet.rowCount();
+    if(rows == 0 || spec.values.isEmpty())
+    {
+        if(error) *error = "no rows or no columns to aggregate";
+        return SheetData();
+    }
+    if(spec.pivot >= sheet.columnCount())
+    {
+        if(error) *error = "the pivot column is out of the sheet";
+        return SheetData();
+    }
+
+    Parallel parallel(rows);
+
+    /* キーの組ごとの番号 */
+    QList<qint32> groups(rows, 0);
+    qint32 groupCount = 1;
+    for(qsizetype i = 0; i < spec.keys.size(); ++i)
+    {
+        qint32 codeCount = 0;
+        const QList<qint32> codes = densify(columnKeys(sheet, spec.keys.at(i), parallel), parallel, codeCount);
+
+        if(i == 0) { groups = codes; groupCount = codeCount; continue; }
+
+        std::vector<quint64> pairs(rows);
+        parallel.run([&](const qsizetype first, const qsizetype last, int) {
+            for(qsizetype row = first; row < last; ++row) pairs[row] = (quint64(quint32(groups.at(row))) << 32) | quint32(codes.at(row));
+        });
+        groups = densify(pairs, parallel, groupCount);
+    }
+
+    /* ピボットの列の値ごとの番号 */
+    QList<qint32> pivots;
+    qint32 pivotCount = 1;
+    if(spec.pivot >= 0)
+    {
+        pivots = densify(columnKeys(sheet, spec.pivot, parallel), parallel, pivotCount);
+        if(pivotCount > maxPivotValues)
+        {
+            if(error) *error = "the pivot column has more than " + QString::number(maxPivotValues) + " values";
+            return SheetData();
+        }
+    }
+
+    /* グループとピボットの値の組ごとに集計する */
+    const qsizetype valueCount = spec.values.size();
+    const qsizetype cellCount = qsizetype(groupCount) * pivotCount;
+    if(cellCount * valueCount > maxAccumulators)
+    {
+        if(error) *error = "too many groups to aggregate (" + QString::number(cellCount * valueCount) + " cells)";
+        return SheetData();
+    }
+
+    std::vector<ValueReader> readers;
+    for(const Value& value : spec.values) readers.emplace_back(sheet, value.column);
+
+    /* 行を分けたそれぞれで集計してから，分けた順に合わせる．
+     * 分けたそれぞれがすべての組の集計を持つため，合わせて上限を超えるほどグループが多ければ1スレッドで集計する */
+    const bool split = parallel.chunks() > 1 && cellCount * valueCount * parallel.chunks() <= maxAccumulators;
+    std::vector<std::vector<Accumulator> > partials((split) ? parallel.chunks() : 1);
+    const auto accumulate = [&](const qsizetype first, const qsizetype last, const int chunk) {
+        std::vector<Accumulator>& partial = partials[chunk];
+        partial.resize(cellCount * valueCount);
+        for(qsizetype row = first; row < last; ++row)
+        {
+            const qsizetype cell = qsizetype(groups.at(row)) * pivotCount + ((pivots.isEmpty()) ? 0 : pivots.at(row));
+            Accumulator *target = partial.data() + cell * valueCount;
+            for(qsizetype v = 0; v < valueCount; ++v) target[v].add(readers[v](row));
+        }
+    };
+
+    if(split) parallel.run(accumulate);
+    else accumulate(0, rows, 0);
+
+    std::vector<Accumulator>& accumulators = partials.front();
+    for(size_t chunk = 1; chunk < partials.size(); ++chunk)
+    {
+        const std::vector<Accumulator>& partial = partials[chunk];
+        for(qsizetype i = 0; i < cellCount * valueCount; ++i) accumulators[i].merge(partial[i]);
+    }
+
+    /* キーの列は各グループの最初の行のセルとする */
+    const QList<qint32> groupRows = firstRows(groups, groupCount);
+    QList<SheetColumn> columns;
+    QStringList names;
+    for(const int key : spec.keys)
+    {
+        columns.append((key < sheet.columnCount()) ? sheet.column(key).select(groupRows) : SheetColumn());
+        names << columnName(sheet, key);
+    }
+
+    /* ピボットの値は小さい順に並べる */
+    QList<qsizetype> pivotOrder(1, 0);
+    QList<QString> pivotNames(1);
+    if(spec.pivot >= 0)
+    {
+        const SheetData pivotValues = SheetData::fromColumns({ sheet.column(spec.pivot).select(firstRows(pivots, pivotCount)) });
+        pivotOrder = SheetSort::permutation(pivotValues, { SheetSort::Key{ 0, Qt::AscendingOrder } });
+        pivotNames.clear();
+        for(const qsizetype p : qAsConst(pivotOrder)) pivotNames << pivotValues.text(p, 0) + ":";
+    }
+
+    for(qsizetype i = 0; i < pivotOrder.size(); ++i)
+    {
+        const qsizetype pivot = pivotOrder.at(i);
+
+        for(qsizetype v = 0; v < valueCount; ++v)
+        {
+            const Value& value = spec.values.at(v);
+
+            if(value.aggregate == Aggregate::Count)
+            {
+                QList<qint64> counts(groupCount);
+                for(qint32 g = 0; g < groupCount; ++g) counts[g] = accumulators[(qsizetype(g) * pivotCount + pivot) * valueCount + v].moments.count;
+                columns.append(SheetColumn::fromValues(counts));
+            }
+            else
+            {
+                QList<double> results(groupCount);
+                for(qint32 g = 0; g < groupCount; ++g) results[g] = accumulators[(qsizetype(g) * pivotCount + pivot) * valueCount + v].result(value.aggregate);
+                columns.append(SheetColumn::fromValues(results));
+            }
+
+            names << pivotNames.at(i) + aggregateName(value.aggregate) + "(" + columnName(sheet, value.column) + ")";
+        }
+    }
+
+    SheetData result = SheetData::fromColumns(columns);
+    result.setColumnNames(names);
+
+    /* グループはキーの昇順に並べる */
+    if(!spec.keys.isEmpty() && groupCount > 1)
+    {
+        QList<SheetSort::Key> keys;
+        for(int i = 0; i < spec.keys.size(); ++i) keys.append(SheetSort::Key{ i, Qt::AscendingOrder });
+        const QList<qsizetype> order = SheetSort::permutation(result, keys);
+        for(qsizetype col = 0; col < result.columnCount(); ++col) result.column(col).permute(0, order);
+    }
+
+    return result;
+}
@@ -0,0 +1,56 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef SHEETGROUP_H
+#define SHEETGROUP_H
+
+#include <QList>
+#include <QString>
+#include "sheetdata.h"
+
+
+
+/* シートの行をキーの列の値の組ごとにまとめ，値の列を集計する(group by)．
+ * ピボットの列を指定すれば，その列の値ごとの集計を横に並べる．
+ *
+ * キーは列の型のまま64bitの整数にし(Int64列は値，Double列は値のビット列，String列は辞書の番号)，
+ * ハッシュで最初に現れた順の番号に置き換える．キーが複数あれば，それまでの番号と次の列の番号の組をまた番号にする．
+ * 番号付けと集計は行を分けてスレッドごとに行い，分けた順に合わせる．集計はColumnStatistics::merge()で合わせる．
+ * シートには手を付けないので，シートのコピーを渡せば別スレッドで実行できる．
+ */
+class SheetGroupBy
+{
+public:
+    enum class Aggregate { Count, Sum, Mean, StdDev, Min, Max };
+
+    struct Value
+    {
+        int column;
+        Aggregate aggregate;
+    };
+
+    struct Spec
+    {
+        QList<int> keys;            //まとめるキーの列．空ならシート全体を1つのグループとする
+        QList<Value> values;        //集計する列と方法
+        int pivot = -1;             //0以上なら，この列の値ごとに集計を横に並べる
+    };
+
+    /* キーの列と集計の列を並べたシート．行はキーの昇順．列の名前は見出し(mean($3)など)．
+     * 失敗すれば空のシートを返し，errorに理由を入れる */
+    static SheetData aggregate(const SheetData& sheet, const Spec& spec, QString *error = nullptr);
+
+    static QString aggregateName(const Aggregate aggregate);
+
+    static constexpr qsizetype parallelThreshold = 1 << 16;    //これより少ない行は1スレッドで集計する
+    static constexpr int maxPivotValues = 1024;                //ピボットで横に並べる値の種類の上限
+    static constexpr qsizetype maxAccumulators = 1 << 21;      //グループ，ピボットの値，集計の列の組の数の上限
+};
+
+#endif // SHEETGROUP_H
@@ -0,0 +1,722 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "sheetmodel.h"
+
+#include <QThreadPool>
+#include <algorithm>
+#include "sheetsort.h"
+
+
+
+SheetModel::SheetModel(QObject *parent)
+    : QAbstractTableModel(parent)
+{
+}
+
+int SheetModel::rowCount(const QModelIndex& parent) const
+{
+    return (parent.isValid()) ? 0 : int(_sheet.rowCount());
+}
+
+int SheetModel::columnCount(const QModelIndex& parent) const
+{
+    return (parent.isValid()) ? 0 : int(_sheet.columnCount());
+}
+
+bool SheetModel::isStyleRole(const int role)
+{
+    switch(role)
+    {
+    case Qt::FontRole:
+    case Qt::ForegroundRole:
+    case Qt::BackgroundRole:
+    case Qt::TextAlignmentRole:
+        return true;
+    default:
+        return false;
+    }
+}
+
+QVariant SheetModel::data(const QModelIndex& index, int role) const
+{
+    if(!index.isValid()) return QVariant();
+
+    if(role == Qt::DisplayRole || role == Qt::EditRole)
+        return _sheet.text(index.row(), index.column());
+
+    if(isStyleRole(role) && !styles.isEmpty())
+    {
+        const auto iter = styles.constFind(QPair<int, int>(index.row(), index.column()));
+        if(iter != styles.constEnd()) return iter.value().value(role);
+    }
+
+    return QVariant();
+}
+
+bool SheetModel::setData(const QModelIndex& index, const QVariant& value, int role)
+{
+    if(!index.isValid()) return false;
+
+    const EditGroup group(this);
+
+    if(role == Qt::DisplayRole || role == Qt::EditRole)
+    {
+        record(SheetEdit{ SheetEdit::Kind::Texts, index.row(), index.column(), index.row(), index.column(),
+                          _sheet.mid(index.row(), index.column(), 1, 1) });
+        _sheet.setText(index.row(), index.column(), value.toString());
+        emit dataChanged(index, index, { Qt::DisplayRole, Qt::EditRole });
+        return true;
+    }
+
+    if(isStyleRole(role))
+    {
+        record(SheetEdit{ SheetEdit::Kind::Styles, index.row(), index.column(), index.row(), index.column(),
+                          SheetData(), stylesIn(index.row(), index.column(), index.row(), index.column()) });
+
+        const QPair<int, int> key(index.row(), index.column());
+        if(value.isValid()) styles[key].insert(role, value);
+        else if(styles.contains(key)) styles[key].remove(role);
+        emit dataChanged(index, index, { role });
+        return true;
+    }
+
+    return false;
+}
+
+QVariant SheetModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(role != Qt::DisplayRole) return QAbstractTableModel::headerData(section, orientation, role);
+
+    /* 列の名前がなければQTableWidgetと同じく1からの番号 */
+    if(orientation == Qt::Horizontal && section < _sheet.columnNames().size() && !_sheet.columnNames().at(section).isEmpty())
+        return _sheet.columnNames().at(section);
+
+    return QString::number(section + 1);
+}
+
+Qt::ItemFlags SheetModel::flags(const QModelIndex& index) const
+{
+    if(!index.isValid()) return Qt::NoItemFlags;
+
+    return Qt::ItemIsSelectable | Qt::ItemIsEditable | Qt::ItemIsEnabled;
+}
+
+bool SheetModel::insertRows(int row, int count, const QModelIndex& parent)
+{
+    if(parent.isValid() || row < 0 || row > rowCount() || count <= 0) return false;
+
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::RemoveRows, row, 0, row + count - 1 });
+
+    beginInsertRows(QModelIndex(), row, row + count - 1);
+    _sheet.insertRows(row, count);
+    shiftStyles(Qt::Vertical, row, count);
+    endInsertRows();
+
+    return true;
+}
+
+bool SheetModel::removeRows(int row, int count, const QModelIndex& parent)
+{
+    if(parent.isValid() || row < 0 || count <= 0 || row + count > rowCount()) return false;
+
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::InsertRows, row, 0, row + count - 1, columnCount() - 1,
+                      _sheet.mid(row, 0, count, columnCount()), stylesIn(row, 0, row + count - 1, columnCount() - 1) });
+
+    beginRemoveRows(QModelIndex(), row, row + count - 1);
+    _sheet.removeRows(row, count);
+    shiftStyles(Qt::Vertical, row, -count);
+    endRemoveRows();
+
+    return true;
+}
+
+bool SheetModel::insertColumns(int column, int count, const QModelIndex& parent)
+{
+    if(parent.isValid() || column < 0 || column > columnCount() || count <= 0) return false;
+
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::RemoveColumns, 0, column, rowCount() - 1, column + count - 1 });
+
+    beginInsertColumns(QModelIndex(), column, column + count - 1);
+    _sheet.insertColumns(column, count);
+    shiftStyles(Qt::Horizontal, column, count);
+    endInsertColumns();
+
+    return true;
+}
+
+bool SheetModel::removeColumns(int column, int count, const QModelIndex& parent)
+{
+    if(parent.isValid() || column < 0 || count <= 0 || column + count > columnCount()) return false;
+
+    //列全体は配列を共有するため，取り除いた列を記録してもコピーしない
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::InsertColumns, 0, column, rowCount() - 1, column + count - 1,
+                      _sheet.mid(0, column, rowCount(), count), stylesIn(0, column, rowCount() - 1, column + count - 1) });
+
+    beginRemoveColumns(QModelIndex(), column, column + count - 1);
+    _sheet.removeColumns(column, count);
+    shiftStyles(Qt::Horizontal, column, -count);
+    endRemoveColumns();
+
+    return true;
+}
+
+/* 列の型に合わせて行全体を並べ替える(数値の列は数値の大小，文字列の列は文字列の順)．空のセルは順序によらず最後にする */
+void SheetModel::sort(int column, Qt::SortOrder order)
+{
+    if(column < 0 || column >= columnCount()) return;
+
+    setRowOrder(SheetSort::permutation(_sheet, { SheetSort::Key{ column, order } }));
+}
+
+void SheetModel::setRowOrder(const QList<qsizetype>& permutation)
+{
+    const qsizetype rows = _sheet.rowCount();
+    if(permutation.size() != rows || rows == 0) return;
+
+    const EditGroup group(this);
+
+    emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+
+    /* 列ごとに並べ替える．列の配列は列ごとに別なので，それぞれ別スレッドで並べ替えられる */
+    QList<SheetColumn*> targets;
+    for(qsizetype col = 0; col < _sheet.columnCount(); ++col) targets.append(&_sheet.column(col));
+
+    QThreadPool pool;
+    for(SheetColumn *target : qAsConst(targets))
+        pool.start([target, &permutation]() { target->permute(0, permutation); });
+    pool.waitForDone();
+
+    QList<qsizetype> destination(rows);
+    for(qsizetype i = 0; i < rows; ++i) destination[permutation.at(i)] = i;
+
+    /* 元に戻すには逆の置換で並べ替える．シートのコピーではなく置換の配列1つだけを持つ */
+    SheetEdit inverse{ SheetEdit::Kind::RowOrder, 0, 0, int(rows) - 1, columnCount() - 1 };
+    inverse.order.resize(rows);
+    for(qsizetype i = 0; i < rows; ++i) inverse.order[i] = qint32(destination.at(i));
+    record(inverse);
+
+    /* 書式と選択も行と一緒に移す */
+    if(!styles.isEmpty())
+    {
+        QHash<QPair<int, int>, Style> moved;
+        for(auto iter = styles.cbegin(); iter != styles.cend(); ++iter)
+            moved.insert(QPair<int, int>(int(destination.at(iter.key().first)), iter.key().second), iter.value());
+        styles.swap(moved);
+    }
+
+    const QModelIndexList from = persistentIndexList();
+    QModelIndexList to;
+    to.reserve(from.size());
+    for(const QModelIndex& index : from)
+        to.append(this->index(int(destination.at(index.row())), index.column()));
+    changePersistentIndexList(from, to);
+
+    emit rowOrderChanged(permutation);
+    emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+}
+
+void SheetModel::detachMapping(const QString& path)
+{
+    //値は変わらないので通知しない
+    _sheet.detachMapping(path);
+    undoStack.detachMapping(path);
+}
+
+void SheetModel::setSheet(const SheetData& sheet)
+{
+    beginResetModel();
+    _sheet = sheet;
+    styles.clear();
+    undoStack.clear();
+    pendingStep.clear();
+    endResetModel();
+}
+
+void SheetModel::insertColumn(const int column, const SheetColumn& data, const QString& name)
+{
+    if(column < 0 || column > columnCount()) return;
+
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::RemoveColumns, 0, column, rowCount() - 1, column });
+
+    beginInsertColumns(QModelIndex(), column, column);
+    _sheet.insertColumn(column, data, name);
+    shiftStyles(Qt::Horizontal, column, 1);
+    endInsertColumns();
+
+    //空の列の挿入と，その値の書き込みとして通知する
+    if(rowCount() > 0)
+        emit dataChanged(index(0, column), index(rowCount() - 1, column), { Qt::DisplayRole, Qt::EditRole });
+}
+
+void SheetModel::resize(const int rowCount, const int colCount)
+{
+    const EditGroup group(this);
+
+    if(rowCount > this->rowCount()) insertRows(this->rowCount(), rowCount - this->rowCount());
+    else if(rowCount < this->rowCount()) removeRows(rowCount, this->rowCount() - rowCount);
+
+    if(colCount > columnCount()) insertColumns(columnCount(), colCount - columnCount());
+    else if(colCount < columnCount()) removeColumns(colCount, columnCount() - colCount);
+}
+
+void SheetModel::setTexts(const int top, const int left, const QList<QStringList>& texts)
+{
+    if(texts.isEmpty()) return;
+
+    int right = left;
+    for(const QStringList& row : texts) right = qMax(right, left + int(row.size()) - 1);
+    const int bottom = top + int(texts.size()) - 1;
+
+    const EditGroup group(this);
+
+    if(bottom >= rowCount()) insertRows(rowCount(), bottom - rowCount() + 1);
+    if(right >= columnCount()) insertColumns(columnCount(), right - columnCount() + 1);
+
+    record(SheetEdit{ SheetEdit::Kind::Texts, top, left, bottom, right, _sheet.mid(top, left, bottom - top + 1, right - left + 1) });
+
+    for(int row = 0; row < texts.size(); ++row)
+    {
+        const QStringList& cells = texts.at(row);
+        for(int col = 0; col < cells.size(); ++col)
+            _sheet.setText(top + row, left + col, cells.at(col));
+    }
+
+    emit dataChanged(index(top, left), index(bottom, right), { Qt::DisplayRole, Qt::EditRole });
+}
+
+void SheetModel::setCells(const int top, const int left, const SheetData& cells)
+{
+    if(cells.isEmpty() || top < 0 || left < 0) return;
+
+    const int bottom = top + int(cells.rowCount()) - 1;
+    const int right = left + int(cells.columnCount()) - 1;
+
+    const EditGroup group(this);
+
+    if(bottom >= rowCount()) insertRows(rowCount(), bottom - rowCount() + 1);
+    if(right >= columnCount()) insertColumns(columnCount(), right - columnCount() + 1);
+
+    record(SheetEdit{ SheetEdit::Kind::Texts, top, left, bottom, right, _sheet.mid(top, left, cells.rowCount(), cells.columnCount()) });
+
+    for(qsizetype col = 0; col < cells.columnCount(); ++col)
+    {
+        /* 列全体であれば列ごと入れ替える(配列を共有するのでコピーしない) */
+        if(top == 0 && cells.rowCount() == _sheet.rowCount())
+        {
+            _sheet.column(left + col) = cells.column(col);
+            continue;
+        }
+
+        for(qsizetype row = 0; row < cells.rowCount(); ++row)
+            _sheet.setText(top + row, left + col, cells.text(row, col));
+    }
+
+    emit dataChanged(index(top, left), index(bottom, right), { Qt::DisplayRole, Qt::EditRole });
+}
+
+void SheetModel::clearTexts(const int top, const int left, const int bottom, const int right)
+{
+    if(top > bottom || left > right) return;
+
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::Texts, top, left, bottom, right, _sheet.mid(top, left, bottom - top + 1, right - left + 1) });
+
+    for(int col = left; col <= right; ++col)
+        for(int row = top; row <= bottom; ++row)
+            _sheet.setText(row, col, QString());
+
+    emit dataChanged(index(top, left), index(bottom, right), { Qt::DisplayRole, Qt::EditRole });
+}
+
+void SheetModel::permuteRows(const int top, const int left, const int right, const QList<qsizetype>& order)
+{
+    if(order.isEmpty() || left > right) return;
+
+    const EditGroup group(this);
+    SheetEdit inverse{ SheetEdit::Kind::PermuteRows, top, left, top + int(order.size()) - 1, right };
+    inverse.order.resize(order.size());
+    for(qsizetype i = 0; i < order.size(); ++i) inverse.order[order.at(i)] = qint32(i);
+    record(inverse);
+
+    for(int col = left; col <= right; ++col)
+        _sheet.column(col).permute(top, order);
+
+    emit dataChanged(index(top, left), index(top + int(order.size()) - 1, right), { Qt::DisplayRole, Qt::EditRole });
+}
+
+void SheetModel::setStyle(const int top, const int left, const int bottom, const int right, const int role,
+                          const std::function<QVariant(const QVariant&)>& function)
+{
+    if(top > bottom || left > right) return;
+
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::Styles, top, left, bottom, right, SheetData(), stylesIn(top, left, bottom, right) });
+
+    for(int row = top; row <= bottom; ++row)
+    {
+        for(int col = left; col <= right; ++col)
+        {
+            const QPair<int, int> key(row, col);
+            const auto iter = styles.constFind(key);
+            const QVariant value = function((iter != styles.constEnd()) ? iter.value().value(role) : QVariant());
+
+            if(value.isValid()) styles[key].insert(role, value);
+            else if(iter != styles.constEnd()) styles[key].remove(role);
+        }
+    }
+
+    emit dataChanged(index(top, left), index(bottom, right), { role });
+}
+
+/* 行か列の挿入(countが正)・削除(countが負)に合わせて書式の位置をずらす */
+void SheetModel::shiftStyles(const Qt::Orientation orientation, const int first, const int count)
+{
+    if(styles.isEmpty()) return;
+
+    QHash<QPair<int, int>, Style> shifted;
+    for(auto iter = styles.cbegin(); iter != styles.cend(); ++iter)
+    {
+        QPair<int, int> key = iter.key();
+        int& position = (orientation == Qt::Vertical) ? key.first : key.second;
+
+        if(count < 0 && position >= first && position < first - count) continue;
+        if(position >= first) position += count;
+
+        shifted.insert(key, iter.value());
+    }
+    styles.swap(shifted);
+}
+
+
+
+
+
+
+
+void SheetModel::record(const SheetEdit& edit)
+{
+    pendingStep.append(edit);
+}
+
+/* 一番外側のEditGroupが閉じたとき，その間の編集を戻す操作を1回の操作として積む */
+void SheetModel::endEdit()
+{
+    if(--editDepth > 0 || pendingStep.isEmpty()) return;
+
+    switch(editSource)
+    {
+    case EditSource::User:
+        undoStack.push(pendingStep); break;
+    case EditSource::Undo:
+        undoStack.pushRedo(pendingStep); break;
+    case EditSource::Redo:
+        undoStack.pushUndo(pendingStep); break;
+    }
+
+    pendingStep.clear();
+}
+
+/* 記録した操作を逆の順に適用する．適用した操作の逆はやり直す操作として積まれる */
+void SheetModel::undo()
+{
+    if(!canUndo() || editDepth > 0) return;
+
+    const SheetUndoStack::Step step = undoStack.takeUndo();
+
+    editSource = EditSource::Undo;
+    {
+        const EditGroup group(this);
+        for(auto edit = step.crbegin(); edit != step.crend(); ++edit) apply(*edit);
+    }
+    editSource = EditSource::User;
+}
+
+void SheetModel::redo()
+{
+    if(!canRedo() || editDepth > 0) return;
+
+    const SheetUndoStack::Step step = undoStack.takeRedo();
+
+    editSource = EditSource::Redo;
+    {
+        const EditGroup group(this);
+        for(auto edit = step.crbegin(); edit != step.crend(); ++edit) apply(*edit);
+    }
+    editSource = EditSource::User;
+}
+
+void SheetModel::apply(const SheetEdit& edit)
+{
+    switch(edit.kind)
+    {
+    case SheetEdit::Kind::Texts:
+        setCells(edit.top, edit.left, edit.cells); break;
+    case SheetEdit::Kind::Styles:
+        restoreStyles(edit.top, edit.left, edit.bottom, edit.right, edit.styles); break;
+    case SheetEdit::Kind::RowOrder:
+        setRowOrder(QList<qsizetype>(edit.order.cbegin(), edit.order.cend())); break;
+    case SheetEdit::Kind::PermuteRows:
+        permuteRows(edit.top, edit.left, edit.right, QList<qsizetype>(edit.order.cbegin(), edit.order.cend())); break;
+    case SheetEdit::Kind::InsertRows:
+        restoreRows(edit.top, edit.cells, edit.styles); break;
+    case SheetEdit::Kind::RemoveRows:
+        removeRows(edit.top, edit.bottom - edit.top + 1); break;
+    case SheetEdit::Kind::InsertColumns:
+        restoreColumns(edit.left, edit.cells, edit.styles); break;
+    case SheetEdit::Kind::RemoveColumns:
+        removeColumns(edit.left, edit.right - edit.left + 1); break;
+    }
+}
+
+SheetEdit::Styles SheetModel::stylesIn(const int top, const int left, const int bottom, const int right) const
+{
+    SheetEdit::Styles found;
+    for(auto iter = styles.cbegin(); iter != styles.cend(); ++iter)
+    {
+        const QPair<int, int>& key = iter.key();
+        if(key.first >= top && key.first <= bottom && key.second >= left && key.second <= right)
+            found.insert(key, iter.value());
+    }
+    return found;
+}
+
+void SheetModel::restoreStyles(const int top, const int left, const int bottom, const int right, const SheetEdit::Styles& restored)
+{
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::Styles, top, left, bottom, right, SheetData(), stylesIn(top, left, bottom, right) });
+
+    for(auto iter = styles.begin(); iter != styles.end(); )
+    {
+        const QPair<int, int>& key = iter.key();
+        if(key.first >= top && key.first <= bottom && key.second >= left && key.second <= right)
+            iter = styles.erase(iter);
+        else
+            ++iter;
+    }
+    for(auto iter = restored.cbegin(); iter != restored.cend(); ++iter)
+        styles.insert(iter.key(), iter.value());
+
+    emit dataChanged(index(top, left), index(bottom, right), { Qt::FontRole, Qt::ForegroundRole, Qt::BackgroundRole, Qt::TextAlignmentRole });
+}
+
+/* removeRows()で取り除いた行を戻す */
+void SheetModel::restoreRows(const int row, const SheetData& cells, const SheetEdit::Styles& restored)
+{
+    const int count = int(cells.rowCount());
+    if(row < 0 || row > rowCount() || count <= 0) return;
+
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::RemoveRows, row, 0, row + count - 1 });
+
+    beginInsertRows(QModelIndex(), row, row + count - 1);
+    _sheet.insertRows(row, count);
+    shiftStyles(Qt::Vertical, row, count);
+    for(qsizetype col = 0; col < qMin(cells.columnCount(), _sheet.columnCount()); ++col)
+    {
+        for(qsizetype i = 0; i < count; ++i)
+        {
+            const QString text = cells.text(i, col);
+            if(!text.isEmpty()) _sheet.setText(row + i, col, text);
+        }
+    }
+    for(auto iter = restored.cbegin(); iter != restored.cend(); ++iter)
+        styles.insert(iter.key(), iter.value());
+    endInsertRows();
+
+    //空の行の挿入と，その値の書き込みとして通知する
+    if(columnCount() > 0)
+        emit dataChanged(index(row, 0), index(row + count - 1, columnCount() - 1), { Qt::DisplayRole, Qt::EditRole });
+}
+
+/* removeColumns()で取り除いた列を戻す．列の配列はそのまま共有する */
+void SheetModel::restoreColumns(const int column, const SheetData& cells, const SheetEdit::Styles& restored)
+{
+    const int count = int(cells.columnCount());
+    if(column < 0 || column > columnCount() || count <= 0) return;
+
+    const EditGroup group(this);
+    record(SheetEdit{ SheetEdit::Kind::RemoveColumns, 0, column, rowCount() - 1, column + count - 1 });
+
+    beginInsertColumns(QModelIndex(), column, column + count - 1);
+    for(qsizetype i = 0; i < count; ++i)
+        _sheet.insertColumn(column + i, cells.column(i), (i < cells.columnNames().size()) ? cells.columnNames().at(i) : QString());
+    shiftStyles(Qt::Horizontal, column, count);
+    for(auto iter = restored.cbegin(); iter != restored.cend(); ++iter)
+        styles.insert(iter.key(), iter.value());
+    endInsertColumns();
+
+    if(rowCount() > 0)
+        emit dataChanged(index(0, column), index(rowCount() - 1, column + count - 1), { Qt::DisplayRole, Qt::EditRole });
+}
+
+
+
+
+
+SheetFilterModel::SheetFilterModel(SheetModel *source)
+    : QAbstractProxyModel(source)
+    , sheetModel(source)
+{
+    setSourceModel(source);
+
+    connect(source, &SheetModel::dataChanged, this, [this](const QModelIndex& topLeft, const QModelIndex& bottomRight, const QList<int>& roles) {
+        const int first = lowerRow(topLeft.row());
+        const int last = lowerRow(bottomRight.row() + 1) - 1;
+        if(first <= last) emit dataChanged(index(first, topLeft.column()), index(last, bottomRight.column()), roles);
+    });
+    connect(source, &SheetModel::headerDataChanged, this, [this](Qt::Orientation orientation, int first, int last) {
+        if(orientation == Qt::Vertical) { first = lowerRow(first); last = lowerRow(last + 1) - 1; }
+        if(first <= last) emit headerDataChanged(orientation, first, last);
+    });
+
+    /* 列は絞り込まないので，そのまま通知する */
+    connect(source, &SheetModel::columnsAboutToBeInserted, this, [this](const QModelIndex&, int first, int last) { beginInsertColumns(QModelIndex(), first, last); });
+    connect(source, &SheetModel::columnsInserted, this, [this]() { endInsertColumns(); });
+    connect(source, &SheetModel::columnsAboutToBeRemoved, this, [this](const QModelIndex&, int first, int last) { beginRemoveColumns(QModelIndex(), first, last); });
+    connect(source, &SheetModel::columnsRemoved, this, [this]() { endRemoveColumns(); });
+
+    /* 絞り込んでいる間に挿入された行は表示せず，後ろの行の番号をずらす */
+    connect(source, &SheetModel::rowsAboutToBeInserted, this, [this](const QModelIndex&, int first, int last) {
+        if(!filtered) beginInsertRows(QModelIndex(), first, last);
+    });
+    connect(source, &SheetModel::rowsInserted, this, [this](const QModelIndex&, int first, int last) {
+        if(!filtered) { endInsertRows(); return; }
+
+        const int shifted = lowerRow(first);
+        for(qsizetype i = shifted; i < rows.size(); ++i) rows[i] += last - first + 1;
+        if(shifted < rows.size()) emit headerDataChanged(Qt::Vertical, shifted, int(rows.size()) - 1);
+    });
+    connect(source, &SheetModel::rowsAboutToBeRemoved, this, [this](const QModelIndex&, int first, int last) {
+        if(!filtered) { beginRemoveRows(QModelIndex(), first, last); return; }
+
+        const int begin = lowerRow(first);
+        const int end = lowerRow(last + 1);
+        removing = (begin < end);
+        if(removing) beginRemoveRows(QModelIndex(), begin, end - 1);
+    });
+    connect(source, &SheetModel::rowsRemoved, this, [this](const QModelIndex&, int first, int last) {
+        if(!filtered) { endRemoveRows(); return; }
+
+        const int begin = lowerRow(first);
+        const int end = lowerRow(last + 1);
+        rows.erase(rows.begin() + begin, rows.begin() + end);
+        for(qsizetype i = begin; i < rows.size(); ++i) rows[i] -= last - first + 1;
+
+        if(removing) endRemoveRows();
+        removing = false;
+        if(begin < rows.size()) emit headerDataChanged(Qt::Vertical, begin, int(rows.size()) - 1);
+    });
+
+    connect(source, &SheetModel::layoutAboutToBeChanged, this, [this]() {
+        emit layoutAboutToBeChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+
+        layoutProxies = persistentIndexList();
+        layoutSources.clear();
+        layoutSources.reserve(layoutProxies.size());
+        for(const QModelIndex& index : qAsConst(layoutProxies)) layoutSources.append(QPersistentModelIndex(mapToSource(index)));
+    });
+    connect(source, &SheetModel::layoutChanged, this, [this]() {
+        QModelIndexList to;
+        to.reserve(layoutSources.size());
+        for(const QPersistentModelIndex& index : qAsConst(layoutSources)) to.append(mapFromSource(index));
+        changePersistentIndexList(layoutProxies, to);
+
+        layoutProxies.clear();
+        layoutSources.clear();
+
+        emit layoutChanged(QList<QPersistentModelIndex>(), QAbstractItemModel::VerticalSortHint);
+    });
+
+    connect(source, &SheetModel::modelAboutToBeReset, this, [this]() { beginResetModel(); });
+    connect(source, &SheetModel::modelReset, this, [this]() {
+        rows.clear();
+        filtered = false;
+        endResetModel();
+    });
+}
+
+void SheetFilterModel::setSourceRows(const QList<qint32>& rows)
+{
+    if(filtered && rows == this->rows) return;     //編集しても合う行が変わらなければ，選択をそのままにする
+
+    beginResetModel();
+    this->rows = rows;
+    const int sourceRows = sheetModel->rowCount();
+    while(!this->rows.isEmpty() && this->rows.last() >= sourceRows) this->rows.removeLast();
+    filtered = true;
+    endResetModel();
+}
+
+void SheetFilterModel::clearFilter()
+{
+    if(!filtered) return;
+
+    beginResetModel();
+    rows.clear();
+    filtered = false;
+    endResetModel();
+}
+
+int SheetFilterModel::lowerRow(const int sourceRow) const
+{
+    if(!filtered) return sourceRow;
+    return int(std::lower_bound(rows.cbegin(), rows.cend(), qint32(sourceRow)) - rows.cbegin());
+}
+
+QModelIndex SheetFilterModel::mapToSource(const QModelIndex& proxyIndex) const
+{
+    if(!proxyIndex.isValid()) return QModelIndex();
+    return sheetModel->index(sourceRow(proxyIndex.row()), proxyIndex.column());
+}
+
+QModelIndex SheetFilterModel::mapFromSource(const QModelIndex& sourceIndex) const
+{
+    if(!sourceIndex.isValid()) return QModelIndex();
+
+    const int row = lowerRow(sourceIndex.row());
+    if(row >= rowCount() || sourceRow(row) != sourceIndex.row()) return QModelIndex();     //表示していない行
+
+    return index(row, sourceIndex.column());
+}
+
+QModelIndex SheetFilterModel::index(int row, int column, const QModelIndex& parent) const
+{
+    if(parent.isValid() || row < 0 || column < 0 || row >= rowCount() || column >= columnCount()) return QModelIndex();
+    return createIndex(row, column);
+}
+
+QModelIndex SheetFilterModel::parent(const QModelIndex&) const
+{
+    return QModelIndex();
+}
+
+int SheetFilterModel::rowCount(const QModelIndex& parent) const
+{
+    if(parent.isValid()) return 0;
+    return (filtered) ? int(rows.size()) : sheetModel->rowCount();
+}
+
+int SheetFilterModel::columnCount(const QModelIndex& parent) const
+{
+    return (parent.isValid()) ? 0 : sheetModel->columnCount();
+}
+
+QVariant SheetFilterModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if(orientation == Qt::Vertical && section >= 0 && section < rowCount())
+        return sheetModel->headerData(sourceRow(section), orientation, role);
+
+    return sheetModel->headerData(section, orientation, role);
+}
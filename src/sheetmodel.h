@@ -0,0 +1,163 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef SHEETMODEL_H
+#define SHEETMODEL_H
+
+#include <QAbstractTableModel>
+#include <QAbstractProxyModel>
+#include <QHash>
+#include <QPair>
+#include <functional>
+#include "sheetdata.h"
+#include "sheetundo.h"
+
+
+
+/* SheetDataをそのまま表示・編集するモデル．セルごとのオブジェクトを作らないため，
+ * メモリの使用量は列の配列の大きさ程度で，表示するときに見えているセルの文字列だけを作る．
+ *
+ * 色，フォント，配置などの書式は設定したセルだけを別に持つ．
+ * 範囲の書き換えはsetTexts()などでまとめて行い，変更の通知を1回にする．
+ *
+ * 編集ごとに，それを元に戻す操作(変わる前のセルや逆の置換)をSheetUndoStackに積む．
+ * 1回の呼び出しで1回の操作とし，EditGroupがある間の編集は1回の操作にまとめる．setSheet()で記録は消える．
+ */
+class SheetModel : public QAbstractTableModel
+{
+    Q_OBJECT
+public:
+    explicit SheetModel(QObject *parent);
+
+    /* 生存期間の間の編集を1回の元に戻す操作にする */
+    class EditGroup
+    {
+    public:
+        explicit EditGroup(SheetModel *model) : model(model) { model->editDepth++; }
+        ~EditGroup() { model->endEdit(); }
+        EditGroup(const EditGroup&) = delete;
+        EditGroup& operator=(const EditGroup&) = delete;
+    private:
+        SheetModel *const model;
+    };
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    bool setData(const QModelIndex& index, const QVariant& value, int role = Qt::EditRole) override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex& index) const override;
+
+    bool insertRows(int row, int count, const QModelIndex& parent = QModelIndex()) override;
+    bool removeRows(int row, int count, const QModelIndex& parent = QModelIndex()) override;
+    bool insertColumns(int column, int count, const QModelIndex& parent = QModelIndex()) override;
+    bool removeColumns(int column, int count, const QModelIndex& parent = QModelIndex()) override;
+    void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+
+    const SheetData& sheet() const { return _sheet; }
+    void setSheet(const SheetData& sheet);
+    void resize(const int rowCount, const int colCount);
+    /* columnの位置に列を挿入する．名前があれば見出しにする */
+    void insertColumn(const int column, const SheetColumn& data, const QString& name = QString());
+    /* i行目を元のpermutation[i]行目にする．SheetSort::permutation()の結果を，通知1回で反映する */
+    void setRowOrder(const QList<qsizetype>& permutation);
+
+    QString text(const int row, const int col) const { return _sheet.text(row, col); }
+    /* (top, left)からtextsを書き込む．足りない行と列は追加する */
+    void setTexts(const int top, const int left, const QList<QStringList>& texts);
+    /* (top, left)からcellsのセルを書き込む．足りない行と列は追加し，列全体であれば列の配列をそのまま共有する */
+    void setCells(const int top, const int left, const SheetData& cells);
+    void clearTexts(const int top, const int left, const int bottom, const int right);
+    /* [top, bottom]の行を，列[left, right]の中で並べ替える．orderはtopからの相対位置 */
+    void permuteRows(const int top, const int left, const int right, const QList<qsizetype>& order);
+    /* 範囲のセルの書式を変える．functionは(今の値)から新しい値を返す */
+    void setStyle(const int top, const int left, const int bottom, const int right, const int role,
+                  const std::function<QVariant(const QVariant&)>& function);
+
+    bool canUndo() const { return undoStack.canUndo(); }
+    bool canRedo() const { return undoStack.canRedo(); }
+    void undo();
+    void redo();
+    /* 元に戻すために保持する操作のバイト数の上限 */
+    void setUndoMemoryLimit(const qsizetype bytes) { undoStack.setMemoryLimit(bytes); }
+    /* シートと元に戻す記録のうち，pathのファイルをmmapしている列をコピーして切り離す．
+     * mmapしているファイルは(Windowsでは)置き換えられないため，そのファイルに保存する前に呼ぶ */
+    void detachMapping(const QString& path);
+
+signals:
+    /* setRowOrder()で行を並べ替えた．layoutChangedの直前に通知する */
+    void rowOrderChanged(const QList<qsizetype>& permutation);
+
+private:
+    using Style = SheetEdit::Style;
+    static bool isStyleRole(const int role);
+    void shiftStyles(const Qt::Orientation orientation, const int first, const int count);
+
+    /* 元に戻す操作の記録 */
+    enum class EditSource { User, Undo, Redo };
+    void record(const SheetEdit& edit);
+    void endEdit();
+    void apply(const SheetEdit& edit);
+    SheetEdit::Styles stylesIn(const int top, const int left, const int bottom, const int right) const;
+    void restoreStyles(const int top, const int left, const int bottom, const int right, const SheetEdit::Styles& restored);
+    void restoreRows(const int row, const SheetData& cells, const SheetEdit::Styles& restored);
+    void restoreColumns(const int column, const SheetData& cells, const SheetEdit::Styles& restored);
+
+    SheetData _sheet;
+    QHash<QPair<int, int>, Style> styles;     //書式を設定したセルだけ
+
+    SheetUndoStack undoStack;
+    SheetUndoStack::Step pendingStep;         //閉じていないEditGroupの間の編集を戻す操作
+    int editDepth = 0;
+    EditSource editSource = EditSource::User;
+};
+
+
+
+
+
+/* SheetModelの行のうち，絞り込んだ行だけを表示するモデル．
+ * 行の対応は表示する元の行の番号(昇順)の配列1つだけで持ち，セルはコピーしない．絞り込んでいなければそのまま表示する．
+ * 絞り込んでいる間の元の行の挿入と削除は行の番号をずらして反映し，並べ替えなどで行が変われば呼び出し側が絞り込み直す．
+ * 行の見出しは元の行の番号とする．
+ */
+class SheetFilterModel : public QAbstractProxyModel
+{
+    Q_OBJECT
+public:
+    explicit SheetFilterModel(SheetModel *source);
+
+    bool isFiltered() const { return filtered; }
+    /* 表示する元の行(昇順)．範囲外の行は除く */
+    void setSourceRows(const QList<qint32>& rows);
+    void clearFilter();
+    int sourceRow(const int row) const { return (filtered) ? rows.at(row) : row; }
+
+    QModelIndex mapToSource(const QModelIndex& proxyIndex) const override;
+    QModelIndex mapFromSource(const QModelIndex& sourceIndex) const override;
+    QModelIndex index(int row, int column, const QModelIndex& parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex& child) const override;
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+private:
+    /* 元の行がsourceRow以上である最初の表示の行 */
+    int lowerRow(const int sourceRow) const;
+
+    SheetModel *sheetModel;
+    QList<qint32> rows;
+    bool filtered = false;
+    bool removing = false;
+
+    QModelIndexList layoutProxies;                  //並べ替えの間，選択などを元の行と一緒に移すため
+    QList<QPersistentModelIndex> layoutSources;
+};
+
+#endif // SHEETMODEL_H
@@ -0,0 +1,267 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "sheetsort.h"
+
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+
+
+namespace
+{
+    constexpr qint32 emptyRank = std::numeric_limits<qint32>::max();
+    constexpr quint64 signBit = quint64(1) << 63;
+
+    /* 1つのキーの列．比較のたびに文字列を作らないように，文字列は順位にしておく */
+    struct KeyColumn
+    {
+        SheetColumn::Type type;
+        bool descending;
+        const qint64 *ints = nullptr;
+        const double *doubles = nullptr;
+        std::vector<qint32> ranks;      //Double列は0が数値，1以上が文字列の順位(NaNのセルがなければ空)．String列は文字列の順位
+    };
+
+    /* 文字列の順位．同じ文字列は同じ順位とし，空の文字列はemptyRank */
+    std::vector<qint32> textRanks(const QStringList& texts)
+    {
+        std::vector<qint32> order(texts.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&texts](const qint32 a, const qint32 b) { return texts.at(a) < texts.at(b); });
+
+        std::vector<qint32> ranks(texts.size());
+        qint32 rank = 0;
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            const QString& text = texts.at(order[i]);
+            if(i > 0 && text != texts.at(order[i - 1])) rank++;
+            ranks[order[i]] = (text.isEmpty()) ? emptyRank : rank;
+        }
+
+        return ranks;
+    }
+
+    KeyColumn prepare(const SheetColumn& column, const Qt::SortOrder order)
+    {
+        KeyColumn key;
+        key.type = column.type();
+        key.descending = (order == Qt::DescendingOrder);
+
+        switch(key.type)
+        {
+        case SheetColumn::Type::Int64:
+            key.ints = column.int64Data();
+            break;
+        case SheetColumn::Type::Double:
+        {
+            key.doubles = column.doubleData();
+
+            QList<qsizetype> nanRows;
+            for(qsizetype row = 0; row < column.size(); ++row)
+                if(qIsNaN(key.doubles[row])) nanRows.append(row);
+            if(nanRows.isEmpty()) break;
+
+            QStringList texts;
+            texts.reserve(nanRows.size());
+            for(const qsizetype row : qAsConst(nanRows)) texts.append(column.text(row));
+
+            const std::vector<qint32> ranks = textRanks(texts);
+            key.ranks.assign(column.size(), 0);
+            for(qsizetype i = 0; i < nanRows.size(); ++i)
+                key.ranks[nanRows.at(i)] = (ranks[i] == emptyRank) ? emptyRank : ranks[i] + 1;
+            break;
+        }
+        case SheetColumn::Type::String:
+        {
+            const std::vector<qint32> ranks = textRanks(column.dictionary());
+            const QList<qint32>& codes = column.stringCodes();
+            key.ranks.resize(column.size());
+            for(qsizetype row = 0; row < column.size(); ++row) key.ranks[row] = ranks[codes.at(row)];
+            break;
+        }
+        default:
+            break;
+        }
+
+        return key;
+    }
+
+    /* 数値の大小と同じ順になる符号なし整数．-0.0は0.0と同じにする */
+    quint64 orderedBits(double value)
+    {
+        if(value == 0.0) value = 0.0;
+        quint64 bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return (bits & signBit) ? ~bits : (bits | signBit);
+    }
+
+    /* Double列でNaNのセルがあれば，種類(数値，文字列，空)と数値の2回に分けて並べる */
+    int passCount(const KeyColumn& key)
+    {
+        return (key.type == SheetColumn::Type::Double && !key.ranks.empty()) ? 2 : 1;
+    }
+
+    /* [first, last)の行を，passの順に並べるための整数にする．passは0が上位．空のセルは順序によらず最大 */
+    void encode(const KeyColumn& key, const int pass, const qsizetype first, const qsizetype last, quint64 *out)
+    {
+        constexpr quint64 empty = ~quint64(0);
+        constexpr quint64 maxRank = quint64(emptyRank) + 1;   //降順で数値とする値．文字列の順位より大きい
+
+        for(qsizetype row = first; row < last; ++row)
+        {
+            quint64 code = 0;
+
+            switch(key.type)
+            {
+            case SheetColumn::Type::Int64:
+                code = quint64(key.ints[row]) ^ signBit;
+                if(key.descending) code = ~code;
+                break;
+            case SheetColumn::Type::Double:
+            {
+                const qint32 rank = (key.ranks.empty()) ? 0 : key.ranks[row];
+
+                if(pass + 1 < passCount(key))
+                    code = (rank == emptyRank) ? empty : (key.descending) ? maxRank - quint64(rank) : quint64(rank);
+                else if(rank == 0)
+                    code = (key.descending) ? ~orderedBits(key.doubles[row]) : orderedBits(key.doubles[row]);
+                break;
+            }
+            case SheetColumn::Type::String:
+            {
+                const qint32 rank = key.ranks[row];
+                code = (rank == emptyRank) ? empty : (key.descending) ? maxRank - quint64(rank) : quint64(rank);
+                break;
+            }
+            default:
+                break;
+            }
+
+            out[row - first] = code;
+        }
+    }
+
+    struct Entry
+    {
+        quint64 code;
+        qsizetype row;
+    };
+
+    constexpr int radixBits = 11;       //64bitを6回で並べる
+    constexpr quint64 radixMask = (quint64(1) << radixBits) - 1;
+
+    /* codeで安定に並べ替える(LSD基数ソート)．すべての要素で等しい桁は飛ばす */
+    void radixSort(Entry *first, Entry *last, Entry *buffer)
+    {
+        const qsizetype size = last - first;
+        if(size < 2) return;
+
+        quint64 differs = 0;
+        for(const Entry *entry = first; entry != last; ++entry) differs |= entry->code ^ first->code;
+
+        Entry *source = first;
+        Entry *destination = buffer;
+
+        for(int shift = 0; shift < 64; shift += radixBits)
+        {
+            if(((differs >> shift) & radixMask) == 0) continue;
+
+            std::vector<qsizetype> offsets(radixMask + 1, 0);
+            for(qsizetype i = 0; i < size; ++i) offsets[(source[i].code >> shift) & radixMask]++;
+
+            qsizetype sum = 0;
+            for(qsizetype& offset : offsets) { const qsizetype count = offset; offset = sum; sum += count; }
+
+            for(qsizetype i = 0; i < size; ++i) destination[offsets[(source[i].code >> shift) & radixMask]++] = source[i];
+
+            std::swap(source, destination);
+        }
+
+        if(source != first) std::copy(source, source + size, first);
+    }
+}
+
+
+
+
+QList<qsizetype> SheetSort::permutation(const SheetData& sheet, const QList<Key>& keys)
+{
+    const qsizetype rows = sheet.rowCount();
+
+    QList<qsizetype> permutation(rows);
+    std::iota(permutation.begin(), permutation.end(), 0);
+
+    std::vector<KeyColumn> keyColumns;
+    for(const Key& key : keys)
+        if(key.column >= 0 && key.column < sheet.columnCount() && sheet.column(key.column).size() >= rows)
+            keyColumns.push_back(prepare(sheet.column(key.column), key.order));
+
+    if(keyColumns.empty() || rows < 2) return permutation;
+
+    /* 2のべき乗個に分けてそれぞれ基数ソートし，隣どうしをマージしていく．inplace_mergeは等しい要素で前の範囲を先にするため安定 */
+    int chunks = 1;
+    if(rows >= parallelThreshold)
+        while(chunks * 2 <= QThread::idealThreadCount()) chunks *= 2;
+
+    std::vector<qsizetype> bounds(chunks + 1);
+    for(int i = 0; i <= chunks; ++i) bounds[i] = rows * i / chunks;
+
+    std::vector<quint64> codes(rows);
+    std::vector<Entry> entries(rows);
+    std::vector<Entry> buffer(rows);
+    qsizetype *order = permutation.data();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(chunks);
+
+    const auto parallel = [&](const std::function<void(qsizetype first, qsizetype last, int chunk)>& function) {
+        if(chunks == 1) { function(0, rows, 0); return; }
+        for(int i = 0; i < chunks; ++i) pool.start([&, i]() { function(bounds[i], bounds[i + 1], i); });
+        pool.waitForDone();
+    };
+
+    /* 安定なソートを重ねるため，最後のキーの下位から順に並べる */
+    for(auto key = keyColumns.crbegin(); key != keyColumns.crend(); ++key)
+    {
+        for(int pass = passCount(*key) - 1; pass >= 0; --pass)
+        {
+            parallel([&](const qsizetype first, const qsizetype last, int) {
+                encode(*key, pass, first, last, codes.data() + first);
+            });
+
+            parallel([&](const qsizetype first, const qsizetype last, int) {
+                for(qsizetype i = first; i < last; ++i) entries[i] = Entry{ codes[order[i]], order[i] };
+                radixSort(entries.data() + first, entries.data() + last, buffer.data() + first);
+            });
+
+            for(int width = 1; width < chunks; width *= 2)
+            {
+                for(int i = 0; i < chunks; i += width * 2)
+                    pool.start([&, i, width]() {
+                        std::inplace_merge(entries.begin() + bounds[i], entries.begin() + bounds[i + width], entries.begin() + bounds[i + width * 2],
+                                           [](const Entry& a, const Entry& b) { return a.code < b.code; });
+                    });
+                pool.waitForDone();
+            }
+
+            parallel([&](const qsizetype first, const qsizetype last, int) {
+                for(qsizetype i = first; i < last; ++i) order[i] = entries[i].row;
+            });
+        }
+    }
+
+    return permutation;
+}
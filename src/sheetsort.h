@@ -0,0 +1,41 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef SHEETSORT_H
+#define SHEETSORT_H
+
+#include <QList>
+#include <Qt>
+#include "sheetdata.h"
+
+
+
+/* シートの行の並べ替え．列の型に合わせて比較する(Int64, Double列は数値，String列は文字列)．
+ * 複数の列をキーにでき，前のキーが等しい行を次のキーで比べる．キーがすべて等しい行は元の順序を保つ．
+ * 空のセルは順序によらず最後にし，Double列の数値でないセルは数値の後に文字列として並べる．
+ *
+ * シートには手を付けず行の番号の配列(置換)を並べ替えるため，シートのコピーを渡せば別スレッドで実行できる．
+ * セルは大小の順を保つ64bitの整数にし，行を分けて複数のスレッドで基数ソートしてからマージする．
+ */
+class SheetSort
+{
+public:
+    struct Key
+    {
+        int column;
+        Qt::SortOrder order;
+    };
+
+    /* 並べ替えたi行目が元のpermutation[i]行目となる置換 */
+    static QList<qsizetype> permutation(const SheetData& sheet, const QList<Key>& keys);
+
+    static constexpr qsizetype parallelThreshold = 1 << 16;    //これより少ない行は1スレッドで並べ替える
+};
+
+#endif // SHEETSORT_H
@@ -0,0 +1,161 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "sheetundo.h"
+
+
+
+qsizetype SheetEdit::byteSize() const
+{
+    /* 書式は1つのセルあたりのおおよその大きさ */
+    static constexpr qsizetype styleSize = 64;
+
+    return qsizetype(sizeof(SheetEdit))
+         + cells.byteSize()
+         + styles.size() * styleSize
+         + order.size() * qsizetype(sizeof(qint32));
+}
+
+
+
+
+void SheetUndoStack::clear()
+{
+    undoSteps.clear();
+    redoSteps.clear();
+    undoSizes.clear();
+    redoSizes.clear();
+    usage = 0;
+    lastPush.invalidate();
+}
+
+void SheetUndoStack::detachMapping(const QString& path)
+{
+    bool detached = false;
+    for(QList<Step>* steps : { &undoSteps, &redoSteps })
+        for(Step& step : *steps)
+            for(SheetEdit& edit : step)
+                if(edit.cells.detachMapping(path)) detached = true;
+
+    if(!detached) return;
+
+    /* コピーした配列の分だけ大きくなる */
+    usage = 0;
+    for(qsizetype i = 0; i < undoSteps.size(); ++i) usage += (undoSizes[i] = byteSize(undoSteps.at(i)));
+    for(qsizetype i = 0; i < redoSteps.size(); ++i) usage += (redoSizes[i] = byteSize(redoSteps.at(i)));
+    trim();
+}
+
+qsizetype SheetUndoStack::byteSize(const Step& step)
+{
+    qsizetype size = 0;
+    for(const SheetEdit& edit : step) size += edit.byteSize();
+    return size;
+}
+
+/* どちらも同じ範囲のセルか書式を1回書き換えただけの操作であればまとめられる */
+bool SheetUndoStack::canMerge(const Step& previous, const Step& next)
+{
+    if(previous.size() != 1 || next.size() != 1) return false;
+
+    const SheetEdit& a = previous.first();
+    const SheetEdit& b = next.first();
+
+    if(a.kind != b.kind || (a.kind != SheetEdit::Kind::Texts && a.kind != SheetEdit::Kind::Styles)) return false;
+
+    return a.top == b.top && a.left == b.left && a.bottom == b.bottom && a.right == b.right;
+}
+
+void SheetUndoStack::push(const Step& step)
+{
+    if(step.isEmpty()) return;
+
+    redoSteps.clear();
+    redoSizes.clear();
+
+    /* まとめる場合は，古い方(最初の状態に戻す操作)だけを残す */
+    const bool merge = lastPush.isValid() && lastPush.elapsed() < mergeInterval
+                       && !undoSteps.isEmpty() && canMerge(undoSteps.last(), step);
+    lastPush.start();
+
+    if(!merge)
+    {
+        undoSteps.append(step);
+        undoSizes.append(byteSize(step));
+    }
+
+    usage = 0;
+    for(const qsizetype size : qAsConst(undoSizes)) usage += size;
+
+    trim();
+}
+
+void SheetUndoStack::pushUndo(const Step& step)
+{
+    if(step.isEmpty()) return;
+
+    undoSteps.append(step);
+    undoSizes.append(byteSize(step));
+    usage += undoSizes.last();
+    lastPush.invalidate();      //やり直した操作には次の編集をまとめない
+
+    trim();
+}
+
+void SheetUndoStack::pushRedo(const Step& step)
+{
+    if(step.isEmpty()) return;
+
+    redoSteps.append(step);
+    redoSizes.append(byteSize(step));
+    usage += redoSizes.last();
+    lastPush.invalidate();
+
+    trim();
+}
+
+SheetUndoStack::Step SheetUndoStack::takeUndo()
+{
+    if(undoSteps.isEmpty()) return Step();
+
+    usage -= undoSizes.takeLast();
+    return undoSteps.takeLast();
+}
+
+SheetUndoStack::Step SheetUndoStack::takeRedo()
+{
+    if(redoSteps.isEmpty()) return Step();
+
+    usage -= redoSizes.takeLast();
+    return redoSteps.takeLast();
+}
+
+void SheetUndoStack::setMemoryLimit(const qsizetype bytes)
+{
+    memoryLimit = bytes;
+    trim();
+}
+
+/* 上限を超えていれば，最も古い元に戻す操作，次に最も先のやり直す操作から捨てる */
+void SheetUndoStack::trim()
+{
+    while(usage > memoryLimit && undoSteps.size() + redoSteps.size() > 1)
+    {
+        if(!undoSteps.isEmpty())
+        {
+            usage -= undoSizes.takeFirst();
+            undoSteps.removeFirst();
+        }
+        else
+        {
+            usage -= redoSizes.takeFirst();
+            redoSteps.removeFirst();
+        }
+    }
+}
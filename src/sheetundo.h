@@ -0,0 +1,98 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef SHEETUNDO_H
+#define SHEETUNDO_H
+
+#include <QList>
+#include <QHash>
+#include <QPair>
+#include <QVariant>
+#include <QElapsedTimer>
+#include "sheetdata.h"
+
+
+
+/* SheetModelの編集を元に戻すための操作．シート全体ではなく，変わった部分だけを持つ．
+ *   Texts          範囲[top, bottom] x [left, right]のセルをcellsに戻す
+ *   Styles         範囲のセルの書式をstylesに戻す
+ *   RowOrder       行全体をorderの順に並べ替える(SheetModel::setRowOrder)
+ *   PermuteRows    行[top, bottom]を列[left, right]の中でorderの順に並べ替える(SheetModel::permuteRows)
+ *   InsertRows     行[top, bottom]にcellsとstylesの行を挿入する
+ *   RemoveRows     行[top, bottom]を取り除く
+ *   InsertColumns  列[left, right]にcellsとstylesの列を挿入する
+ *   RemoveColumns  列[left, right]を取り除く
+ * 取り除いた列は配列を共有するため，列の削除を戻すための記録はほとんどメモリを使わない．
+ */
+struct SheetEdit
+{
+    using Style = QHash<int, QVariant>;
+    using Styles = QHash<QPair<int, int>, Style>;
+
+    enum class Kind { Texts, Styles, RowOrder, PermuteRows, InsertRows, RemoveRows, InsertColumns, RemoveColumns };
+
+    Kind kind;
+    int top = 0;
+    int left = 0;
+    int bottom = -1;
+    int right = -1;
+    SheetData cells;
+    Styles styles;              //シート上の位置をキーとする
+    QList<qint32> order;        //行の番号はintに収まるので，置換はqint32で持つ
+
+    qsizetype byteSize() const;
+};
+
+
+
+
+/* 元に戻す・やり直す操作のスタック．1回の操作は複数のSheetEditからなり，適用する順に並べる．
+ * 保持する操作のバイト数がmemoryLimitを超えれば，古い操作から捨てる(最後の1回は残す)．
+ * 同じ範囲の書き換えがmergeInterval以内に続けば，1回の操作にまとめる(フォントの大きさを続けて変えた場合など)．
+ */
+class SheetUndoStack
+{
+public:
+    using Step = QList<SheetEdit>;
+
+    static constexpr qsizetype defaultMemoryLimit = qsizetype(256) << 20;
+    static constexpr qint64 mergeInterval = 1000;      //msec
+
+    bool canUndo() const { return !undoSteps.isEmpty(); }
+    bool canRedo() const { return !redoSteps.isEmpty(); }
+    void clear();
+
+    /* 新しい編集．やり直しの操作は捨てる */
+    void push(const Step& step);
+    /* 元に戻した・やり直した結果を，逆の操作として積む */
+    void pushUndo(const Step& step);
+    void pushRedo(const Step& step);
+    Step takeUndo();
+    Step takeRedo();
+
+    void setMemoryLimit(const qsizetype bytes);
+    qsizetype memoryUsage() const { return usage; }
+    /* 記録したセルのうち，pathのファイルをmmapしている列をファイルから切り離す */
+    void detachMapping(const QString& path);
+
+private:
+    static qsizetype byteSize(const Step& step);
+    static bool canMerge(const Step& previous, const Step& next);
+    void trim();
+
+    QList<Step> undoSteps;
+    QList<Step> redoSteps;
+    QList<qsizetype> undoSizes;
+    QList<qsizetype> redoSizes;
+    qsizetype usage = 0;
+    qsizetype memoryLimit = defaultMemoryLimit;
+    QElapsedTimer lastPush;
+};
+
+#endif // SHEETUNDO_H
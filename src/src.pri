@@ -1,9 +1,17 @@
 HEADERS += \
+    $$PWD/arrowfile.h \
+    $$PWD/bigfileviewer.h \
+    $$PWD/columnexpression.h \
+    $$PWD/columnhistogram.h \
+    $$PWD/columnstats.h \
     $$PWD/cursorwatcher.h \
+    $$PWD/deflate.h \
+    $$PWD/editjournal.h \
     $$PWD/editormanager.h \
     $$PWD/editorsettingwidget.h \
     $$PWD/editorsyntaxhighlighter.h \
     $$PWD/editorwidget.h \
+    $$PWD/filechangewatcher.h \
     $$PWD/filetreesettingwidget.h \
     $$PWD/filetreewidget.h \
     $$PWD/gnuplot.h \
@@ -18,12 +26,23 @@ HEADERS += \
     $$PWD/imagedisplay.h \
     $$PWD/imageviewer.h \
     $$PWD/iofile.h \
+    $$PWD/ioscheduler.h \
     $$PWD/layoutparts.h \
     $$PWD/logger.h \
     $$PWD/menubar.h \
+    $$PWD/numpyfile.h \
     $$PWD/pdfviewer.h \
+    $$PWD/plotdownsampler.h \
     $$PWD/plugin.h \
     $$PWD/settings.h \
+    $$PWD/sheetcache.h \
+    $$PWD/sheetdata.h \
+    $$PWD/sheetfilter.h \
+    $$PWD/sheetformat.h \
+    $$PWD/sheetgroup.h \
+    $$PWD/sheetmodel.h \
+    $$PWD/sheetsort.h \
+    $$PWD/sheetundo.h \
     $$PWD/standardpixmap.h \
     $$PWD/tablesettingwidget.h \
     $$PWD/tablewidget.h \
@@ -35,17 +54,27 @@ HEADERS += \
     $$PWD/textedit.h \
     $$PWD/texteditor.h \
     $$PWD/utility.h \
-    $$PWD/windowmenubar.h
+    $$PWD/windowmenubar.h \
+    $$PWD/xxhash.h \
+    $$PWD/zipfile.h
 #=======
     $$PWD/windowmenubar.h \
 #    $$PWD/windowscontents.h
 #>>>>>>> d2f7655fc2dea0117945d23b8e5e25ce22252c9f
 
 SOURCES += \
+    $$PWD/arrowfile.cpp \
+    $$PWD/bigfileviewer.cpp \
+    $$PWD/columnexpression.cpp \
+    $$PWD/columnhistogram.cpp \
+    $$PWD/columnstats.cpp \
+    $$PWD/deflate.cpp \
+    $$PWD/editjournal.cpp \
     $$PWD/editormanager.cpp \
     $$PWD/editorsettingwidget.cpp \
     $$PWD/editorsyntaxhighlighter.cpp \
     $$PWD/editorwidget.cpp \
+    $$PWD/filechangewatcher.cpp \
     $$PWD/filetreesettingwidget.cpp \
     $$PWD/filetreewidget.cpp \
     $$PWD/gnuplot.cpp \
@@ -60,13 +89,24 @@ SOURCES += \
     $$PWD/imagedisplay.cpp \
     $$PWD/imageviewer.cpp \
     $$PWD/iofile.cpp \
+    $$PWD/ioscheduler.cpp \
     $$PWD/layoutparts.cpp \
     $$PWD/logger.cpp \
     $$PWD/main.cpp \
     $$PWD/menubar.cpp \
+    $$PWD/numpyfile.cpp \
     $$PWD/pdfviewer.cpp \
+    $$PWD/plotdownsampler.cpp \
     $$PWD/plugin.cpp \
     $$PWD/settings.cpp \
+    $$PWD/sheetcache.cpp \
+    $$PWD/sheetdata.cpp \
+    $$PWD/sheetfilter.cpp \
+    $$PWD/sheetformat.cpp \
+    $$PWD/sheetgroup.cpp \
+    $$PWD/sheetmodel.cpp \
+    $$PWD/sheetsort.cpp \
+    $$PWD/sheetundo.cpp \
     $$PWD/standardpixmap.cpp \
     $$PWD/tablesettingwidget.cpp \
     $$PWD/tablewidget.cpp \
@@ -74,9 +114,12 @@ SOURCES += \
 #<<<<<<< HEAD
 #    $$PWD/updatemanager.cpp \
     $$PWD/terminalwidget.cpp \
+    $$PWD/textcodec.cpp \
     $$PWD/textedit.cpp \
     $$PWD/texteditor.cpp \
-    $$PWD/windowmenubar.cpp
+    $$PWD/windowmenubar.cpp \
+    $$PWD/xxhash.cpp \
+    $$PWD/zipfile.cpp
 #=======
     $$PWD/windowmenubar.cpp \
 #    $$PWD/windowscontents.cpp
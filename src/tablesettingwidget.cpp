@@ -20,6 +20,14 @@
 #include <QScrollBar>
 #include <QMenu>
 #include <QLineEdit>
+#include <QTableWidget>
+#include <QTimer>
+#include <QThreadPool>
+#include <QCoreApplication>
+#include <QItemSelectionModel>
+#include <QPushButton>
+#include <QCheckBox>
+#include <algorithm>
 #include "layoutparts.h"
 #include "gnuplottable.h"
 #include "standardpixmap.h"
@@ -39,6 +47,10 @@ TableArea::TableArea(QWidget *parent)
     , tableEditSettingWidget(new TableEditSettingWidget(nullptr))
     , tableCellSettingWidget(new TableCellSettingWidget(nullptr))
     , tablePlotSettingWidget(new TablePlotSettingWidget(nullptr))
+    , tableStatsWidget(new TableStatsWidget(nullptr))
+    , tableFormulaWidget(new TableFormulaWidget(nullptr))
+    , tableFilterWidget(new TableFilterWidget(nullptr))
+    , tableGroupWidget(new TableGroupWidget(nullptr))
 
     , selectPageMenu(new QMenu(this))
 
@@ -113,6 +125,10 @@ void TableArea::setupLayout()
     selectPageMenu->addAction(new QAction("Edit", tableEditSettingWidget));
     selectPageMenu->addAction(new QAction("Cell", tableCellSettingWidget));
     selectPageMenu->addAction(new QAction("Plot", tablePlotSettingWidget));
+    selectPageMenu->addAction(new QAction("Stats", tableStatsWidget));
+    selectPageMenu->addAction(new QAction("Formula", tableFormulaWidget));
+    selectPageMenu->addAction(new QAction("Filter", tableFilterWidget));
+    selectPageMenu->addAction(new QAction("Group", tableGroupWidget));
 }
 
 void TableArea::setupConnection()
@@ -147,6 +163,27 @@ void TableArea::setupConnection()
     /* tablePlotSettingWidget */
     connect(tablePlotSettingWidget, &TablePlotSettingWidget::plotRequested, table, &GnuplotTable::plotSelectedData);
     connect(tablePlotSettingWidget, &TablePlotSettingWidget::plotOptionSet, table, &GnuplotTable::setOptionCmd);
+    /* tableStatsWidget */
+    tableStatsWidget->setModel(table->sheetModel());
+    auto selectStatsColumns = [this]() {
+        QList<int> columns;
+        for(const QTableWidgetSelectionRange& range : table->selectedRanges())
+            for(int col = range.leftColumn(); col <= range.rightColumn(); ++col)
+                if(!columns.contains(col)) columns.append(col);
+        if(columns.isEmpty() && table->currentIndex().isValid()) columns.append(table->currentIndex().column());
+        std::sort(columns.begin(), columns.end());
+        tableStatsWidget->setColumns(columns);
+    };
+    connect(table->selectionModel(), &QItemSelectionModel::selectionChanged, tableStatsWidget, selectStatsColumns);
+    connect(table->selectionModel(), &QItemSelectionModel::currentChanged, tableStatsWidget, selectStatsColumns);
+    /* tableFormulaWidget */
+    connect(tableFormulaWidget, &TableFormulaWidget::formulaColumnRequested, table, &GnuplotTable::insertFormulaColumn);
+    /* tableFilterWidget */
+    connect(tableFilterWidget, &TableFilterWidget::filterRequested, table, &GnuplotTable::setRowFilter);
+    connect(tableFilterWidget, &TableFilterWidget::clearRequested, table, &GnuplotTable::clearRowFilter);
+    connect(table, &GnuplotTable::rowFilterApplied, tableFilterWidget, &TableFilterWidget::setFilterResult);
+    /* tableGroupWidget */
+    connect(tableGroupWidget, &TableGroupWidget::groupRequested, table, &GnuplotTable::groupRows);
 }
 
 void TableArea::resizeSettingPanel()
@@ -174,6 +211,10 @@ void TableArea::expandSettingPage()
     {
         scrollContentsVLayout->removeWidget(tableCellSettingWidget);
         scrollContentsVLayout->removeWidget(tablePlotSettingWidget);
+        scrollContentsVLayout->removeWidget(tableStatsWidget);
+        scrollContentsVLayout->removeWidget(tableFormulaWidget);
+        scrollContentsVLayout->removeWidget(tableFilterWidget);
+        scrollContentsVLayout->removeWidget(tableGroupWidget);
         expandButton->setPixmap(expandPixmap);
     }
     else
@@ -181,6 +222,10 @@ void TableArea::expandSettingPage()
         scrollContentsVLayout->addWidget(tableEditSettingWidget);
         scrollContentsVLayout->addWidget(tableCellSettingWidget);
         scrollContentsVLayout->addWidget(tablePlotSettingWidget);
+        scrollContentsVLayout->addWidget(tableStatsWidget);
+        scrollContentsVLayout->addWidget(tableFormulaWidget);
+        scrollContentsVLayout->addWidget(tableFilterWidget);
+        scrollContentsVLayout->addWidget(tableGroupWidget);
         expandButton->setPixmap(contractPixmap);
     }
 
@@ -609,10 +654,12 @@ void TablePlotSettingWidget::setupMenu()
     QAction *scatter2dAct = plotScatter2DMenu->addAction("scatter 2d");
     QAction *lines2dAct = plotScatter2DMenu->addAction("line 2d");
     QAction *linespoints2dAct = plotScatter2DMenu->addAction("linespoints 2d");
+    QAction *yerrorbars2dAct = plotScatter2DMenu->addAction("yerrorbars 2d");
 
     connect(scatter2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::Scatter2D); });
     connect(lines2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::Lines2D); });
     connect(linespoints2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::LinesPoints2D); });
+    connect(yerrorbars2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::YErrorBars2D); });
 
     QAction *boxes2dAct = plotBar2DMenu->addAction("boxes 2d");
     QAction *steps2dAct = plotBar2DMenu->addAction("steps 2d");
@@ -620,6 +667,11 @@ void TablePlotSettingWidget::setupMenu()
     QAction *fillsteps2dAct = plotBar2DMenu->addAction("fill steps 2d");
     QAction *histeps2dAct = plotBar2DMenu->addAction("histogram steps 2d");
     QAction *impulses2dAct = plotBar2DMenu->addAction("impulses 2d");
+    plotBar2DMenu->addSeparator();
+    QAction *histogram2dAct = plotBar2DMenu->addAction("histogram 2d");
+    QAction *histogramFD2dAct = plotBar2DMenu->addAction("histogram (Freedman-Diaconis) 2d");
+    QAction *histogramLog2dAct = plotBar2DMenu->addAction("histogram (log bins) 2d");
+    QAction *density2dAct = plotBar2DMenu->addAction("density (KDE) 2d");
 
     connect(boxes2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::Boxes2D); });
     connect(steps2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::Steps2D); });
@@ -627,6 +679,425 @@ void TablePlotSettingWidget::setupMenu()
     connect(fillsteps2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::FillSteps2D); });
     connect(histeps2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::HiSteps2D); });
     connect(impulses2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::Impulses2D); });
+    connect(histogram2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::Histogram2D); });
+    connect(histogramFD2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::HistogramFD2D); });
+    connect(histogramLog2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::HistogramLog2D); });
+    connect(density2dAct, &QAction::triggered, [this](){ emit plotRequested(GnuplotTable::PlotType::Density2D); });
+}
+
+
+
+
+
+
+
+
+
+
+
+TableStatsWidget::TableStatsWidget(QWidget *parent)
+    : QWidget(parent)
+    , statsTable(new QTableWidget(0, 10, this))
+    , updateTimer(new QTimer(this))
+{
+    QHBoxLayout *hLayout = new QHBoxLayout(this);
+    setLayout(hLayout);
+    hLayout->setSpacing(0);
+    hLayout->setContentsMargins(0, 0, 0, 0);
+    setContentsMargins(0, 0, 0, 0);
+
+    hLayout->addWidget(statsTable);
+
+    statsTable->setHorizontalHeaderLabels(QStringList() << "column" << "count" << "NaN" << "min" << "max"
+                                          << "mean" << "variance" << "25%" << "median" << "75%");
+    statsTable->horizontalHeaderItem(6)->setToolTip("unbiased variance");
+    statsTable->verticalHeader()->hide();
+    statsTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    statsTable->verticalHeader()->setDefaultSectionSize(TableArea::iconSize);
+    statsTable->setFixedHeight(TableArea::iconSize * 5);
+
+    updateTimer->setSingleShot(true);
+    updateTimer->setInterval(updateInterval);
+
+    connect(updateTimer, &QTimer::timeout, this, &TableStatsWidget::calculate);
+}
+
+void TableStatsWidget::setModel(SheetModel *model)
+{
+    if(this->model) disconnect(this->model, nullptr, this, nullptr);
+
+    this->model = model;
+    invalidateAll();
+
+    if(!model) return;
+
+    connect(model, &SheetModel::dataChanged, this, &TableStatsWidget::invalidateCells);
+    connect(model, &SheetModel::rowsInserted, this, &TableStatsWidget::invalidateAll);
+    connect(model, &SheetModel::rowsRemoved, this, &TableStatsWidget::invalidateAll);
+    connect(model, &SheetModel::columnsInserted, this, &TableStatsWidget::invalidateAll);
+    connect(model, &SheetModel::columnsRemoved, this, &TableStatsWidget::invalidateAll);
+    connect(model, &SheetModel::layoutChanged, this, &TableStatsWidget::invalidateAll);
+    connect(model, &SheetModel::modelReset, this, &TableStatsWidget::invalidateAll);
+}
+
+void TableStatsWidget::setColumns(const QList<int>& columns)
+{
+    if(this->columns == columns) return;
+
+    this->columns = columns;
+    updateTimer->start();
+}
+
+void TableStatsWidget::showEvent(QShowEvent *event)
+{
+    QWidget::showEvent(event);
+    updateTimer->start();
+}
+
+/* 文字列が変わったセルのブロックだけを集計し直す．書式だけの変更は無視する */
+void TableStatsWidget::invalidateCells(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QList<int>& roles)
+{
+    if(!roles.isEmpty() && !roles.contains(Qt::DisplayRole) && !roles.contains(Qt::EditRole)) return;
+
+    for(int col = topLeft.column(); col <= bottomRight.column(); ++col)
+    {
+        auto iter = caches.find(col);
+        if(iter != caches.end()) iter.value().invalidate(topLeft.row(), bottomRight.row());
+    }
+
+    revision++;
+    updateTimer->start();
+}
+
+/* 行や列の位置が変わればすべて集計し直す */
+void TableStatsWidget::invalidateAll()
+{
+    caches.clear();
+    revision++;
+    updateTimer->start();
+}
+
+void TableStatsWidget::calculate()
+{
+    if(!model || !isVisible()) return;
+
+    if(running) { pending = true; return; }
+
+    QList<int> targets;
+    QList<SheetColumn> sheetColumns;
+    QList<ColumnStatistics> states;
+    for(const int col : qAsConst(columns))
+    {
+        if(col < 0 || col >= model->columnCount()) continue;
+        targets.append(col);
+        sheetColumns.append(model->sheet().column(col));     //列の配列は共有し，計算中に編集されればGUI側がコピーする
+        states.append(caches.value(col));
+    }
+
+    if(targets.isEmpty()) { display(targets, QList<ColumnStats>()); return; }
+
+    running = true;
+
+    const QPointer<TableStatsWidget> self(this);
+    const quint64 revision = this->revision;
+
+    QThreadPool::globalInstance()->start([self, revision, targets, sheetColumns, states]() mutable {
+        QList<ColumnStats> stats;
+        for(qsizetype i = 0; i < targets.size(); ++i)
+            stats.append(states[i].update(sheetColumns.at(i)));
+
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, revision, targets, states, stats]() {
+            if(self) self->receiveStats(revision, targets, states, stats);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void TableStatsWidget::receiveStats(const quint64 revision, const QList<int>& columns,
+                                    const QList<ColumnStatistics>& states, const QList<ColumnStats>& stats)
+{
+    running = false;
+
+    /* 計算中に変わっていれば，その結果は次の計算で置き換える */
+    if(revision == this->revision)
+    {
+        for(qsizetype i = 0; i < columns.size(); ++i) caches.insert(columns.at(i), states.at(i));
+        if(columns == this->columns) display(columns, stats);
+    }
+
+    if(pending)
+    {
+        pending = false;
+        calculate();
+    }
+}
+
+void TableStatsWidget::display(const QList<int>& columns, const QList<ColumnStats>& stats)
+{
+    auto number = [](const double value) { return (qIsNaN(value)) ? QString("-") : QString::number(value, 'g', 8); };
+
+    statsTable->setRowCount(columns.size());
+
+    for(qsizetype i = 0; i < columns.size(); ++i)
+    {
+        const ColumnStats& stat = stats.at(i);
+        const QStringList texts = QStringList()
+                << model->headerData(columns.at(i), Qt::Horizontal).toString()
+                << QString::number(stat.count) << QString::number(stat.nanCount)
+                << number(stat.min) << number(stat.max) << number(stat.mean) << number(stat.variance)
+                << number(stat.lowerQuartile) << number(stat.median) << number(stat.upperQuartile);
+
+        for(int col = 0; col < texts.size(); ++col)
+            statsTable->setItem(i, col, new QTableWidgetItem(texts.at(col)));
+    }
+}
+
+
+
+
+
+
+
+
+
+
+
+TableFormulaWidget::TableFormulaWidget(QWidget *parent)
+    : QWidget(parent)
+    , formulaEdit(new QLineEdit(this))
+    , messageLabel(new QLabel(this))
+{
+    QHBoxLayout *hLayout = new QHBoxLayout(this);
+    setLayout(hLayout);
+    hLayout->setSpacing(2);
+    hLayout->setContentsMargins(0, 0, 0, 0);
+    setContentsMargins(0, 0, 0, 0);
+
+    QPushButton *insertButton = new QPushButton("Insert column", this);
+
+    hLayout->addWidget(new QLabel(" f = ", this));
+    hLayout->addWidget(formulaEdit);
+    hLayout->addWidget(insertButton);
+    hLayout->addWidget(messageLabel);
+    hLayout->addItem(new QSpacerItem(0, 0, QSizePolicy::Expanding, QSizePolicy::Preferred));
+
+    formulaEdit->setPlaceholderText("log10($2) * 1000");
+    formulaEdit->setMinimumWidth(TableArea::iconSize * 15);
+    formulaEdit->setToolTip("$n or column(n) : value of the n-th column ($0 : row number)\n"
+                            "functions : " + ColumnExpression::functionNames().join(", "));
+    insertButton->setToolTip("insert the values as a new column right of the selection");
+    QPalette palette = messageLabel->palette();
+    palette.setColor(QPalette::WindowText, Qt::red);
+    messageLabel->setPalette(palette);
+
+    connect(formulaEdit, &QLineEdit::textChanged, this, &TableFormulaWidget::checkFormula);
+    connect(formulaEdit, &QLineEdit::returnPressed, this, &TableFormulaWidget::requestColumn);
+    connect(insertButton, &QPushButton::released, this, &TableFormulaWidget::requestColumn);
+}
+
+/* 入力中に式の誤りを表示する */
+void TableFormulaWidget::checkFormula(const QString& text)
+{
+    QString error;
+    ColumnExpression expression;
+    if(text.trimmed().isEmpty() || expression.compile(text, &error)) error.clear();
+
+    messageLabel->setText(error);
+}
+
+void TableFormulaWidget::requestColumn()
+{
+    QString error;
+    ColumnExpression expression;
+    if(!expression.compile(formulaEdit->text(), &error))
+    {
+        messageLabel->setText(error);
+        return;
+    }
+
+    emit formulaColumnRequested(expression);
+}
+
+
+
+
+
+
+
+
+
+
+
+TableFilterWidget::TableFilterWidget(QWidget *parent)
+    : QWidget(parent)
+    , filterEdit(new QLineEdit(this))
+    , resultLabel(new QLabel(this))
+    , messageLabel(new QLabel(this))
+{
+    QHBoxLayout *hLayout = new QHBoxLayout(this);
+    setLayout(hLayout);
+    hLayout->setSpacing(2);
+    hLayout->setContentsMargins(0, 0, 0, 0);
+    setContentsMargins(0, 0, 0, 0);
+
+    QPushButton *applyButton = new QPushButton("Filter", this);
+    QPushButton *clearButton = new QPushButton("Clear", this);
+
+    hLayout->addWidget(new QLabel(" rows where ", this));
+    hLayout->addWidget(filterEdit);
+    hLayout->addWidget(applyButton);
+    hLayout->addWidget(clearButton);
+    hLayout->addWidget(resultLabel);
+    hLayout->addWidget(messageLabel);
+    hLayout->addItem(new QSpacerItem(0, 0, QSizePolicy::Expanding, QSizePolicy::Preferred));
+
+    filterEdit->setPlaceholderText("$3 > 1e-3 && $1 != 0");
+    filterEdit->setMinimumWidth(TableArea::iconSize * 15);
+    filterEdit->setToolTip("conditions joined by && (same expression as the formula column)\n"
+                           "rows where every condition is neither 0 nor NaN are shown");
+    applyButton->setToolTip("show only the rows matching the condition");
+    clearButton->setToolTip("show all rows");
+    QPalette palette = messageLabel->palette();
+    palette.setColor(QPalette::WindowText, Qt::red);
+    messageLabel->setPalette(palette);
+
+    connect(filterEdit, &QLineEdit::textChanged, this, &TableFilterWidget::checkFilter);
+    connect(filterEdit, &QLineEdit::returnPressed, this, &TableFilterWidget::requestFilter);
+    connect(applyButton, &QPushButton::released, this, &TableFilterWidget::requestFilter);
+    connect(clearButton, &QPushButton::released, this, &TableFilterWidget::requestClear);
+}
+
+void TableFilterWidget::setFilterResult(const qsizetype shown, const qsizetype total)
+{
+    resultLabel->setText((shown == total) ? QString() : QString::number(shown) + " of " + QString::number(total) + " rows");
+}
+
+/* 入力中に条件の誤りを表示する */
+void TableFilterWidget::checkFilter(const QString& text)
+{
+    QString error;
+    SheetFilter filter;
+    if(text.trimmed().isEmpty() || filter.compile(text, &error)) error.clear();
+
+    messageLabel->setText(error);
+}
+
+/* 空の条件は絞り込みの解除とする */
+void TableFilterWidget::requestFilter()
+{
+    if(filterEdit->text().trimmed().isEmpty()) { requestClear(); return; }
+
+    QString error;
+    SheetFilter filter;
+    if(!filter.compile(filterEdit->text(), &error))
+    {
+        messageLabel->setText(error);
+        return;
+    }
+
+    emit filterRequested(filter);
+}
+
+void TableFilterWidget::requestClear()
+{
+    messageLabel->clear();
+    emit clearRequested();
+}
+
+
+
+
+
+
+
+
+
+
+TableGroupWidget::TableGroupWidget(QWidget *parent)
+    : QWidget(parent)
+    , keysEdit(new QLineEdit(this))
+    , valuesEdit(new QLineEdit(this))
+    , pivotSpinBox(new QSpinBox(this))
+    , messageLabel(new QLabel(this))
+{
+    QHBoxLayout *hLayout = new QHBoxLayout(this);
+    setLayout(hLayout);
+    hLayout->setSpacing(2);
+    hLayout->setContentsMargins(0, 0, 0, 0);
+    setContentsMargins(0, 0, 0, 0);
+
+    QPushButton *groupButton = new QPushButton("Group", this);
+
+    hLayout->addWidget(new QLabel(" group by ", this));
+    hLayout->addWidget(keysEdit);
+    hLayout->addWidget(new QLabel(" values ", this));
+    hLayout->addWidget(valuesEdit);
+
+    for(const SheetGroupBy::Aggregate aggregate : { SheetGroupBy::Aggregate::Count, SheetGroupBy::Aggregate::Sum, SheetGroupBy::Aggregate::Mean,
+                                                    SheetGroupBy::Aggregate::StdDev, SheetGroupBy::Aggregate::Min, SheetGroupBy::Aggregate::Max })
+    {
+        QCheckBox *check = new QCheckBox(SheetGroupBy::aggregateName(aggregate), this);
+        check->setChecked(aggregate == SheetGroupBy::Aggregate::Mean || aggregate == SheetGroupBy::Aggregate::StdDev);
+        hLayout->addWidget(check);
+        aggregateChecks.append(qMakePair(check, aggregate));
+    }
+
+    hLayout->addWidget(new QLabel(" pivot ", this));
+    hLayout->addWidget(pivotSpinBox);
+    hLayout->addWidget(groupButton);
+    hLayout->addWidget(messageLabel);
+    hLayout->addItem(new QSpacerItem(0, 0, QSizePolicy::Expanding, QSizePolicy::Preferred));
+
+    keysEdit->setPlaceholderText("1, 2");
+    valuesEdit->setPlaceholderText("3");
+    keysEdit->setMinimumWidth(TableArea::iconSize * 4);
+    valuesEdit->setMinimumWidth(TableArea::iconSize * 4);
+    keysEdit->setToolTip("key columns separated by commas (empty groups all rows)");
+    valuesEdit->setToolTip("columns to aggregate separated by commas");
+    pivotSpinBox->setRange(0, 9999);
+    pivotSpinBox->setSpecialValueText("none");
+    pivotSpinBox->setToolTip("spread the aggregates of each value of this column into columns");
+    groupButton->setToolTip("open the aggregated rows as a new sheet\n"
+                            "mean and stddev columns can be plotted with \"plot with errorbars\"");
+    QPalette palette = messageLabel->palette();
+    palette.setColor(QPalette::WindowText, Qt::red);
+    messageLabel->setPalette(palette);
+
+    connect(groupButton, &QPushButton::released, this, &TableGroupWidget::requestGroup);
+    connect(valuesEdit, &QLineEdit::returnPressed, this, &TableGroupWidget::requestGroup);
+}
+
+/* "1, 3"のような1から数えた列の番号を0から数えた番号にする */
+bool TableGroupWidget::parseColumns(const QString& text, QList<int>& columns)
+{
+    columns.clear();
+    for(const QString& part : text.split(',', Qt::SkipEmptyParts))
+    {
+        bool ok = false;
+        const int col = part.trimmed().remove('$').toInt(&ok);
+        if(!ok || col < 1) return false;
+        columns.append(col - 1);
+    }
+    return true;
+}
+
+void TableGroupWidget::requestGroup()
+{
+    SheetGroupBy::Spec spec;
+    QList<int> valueColumns;
+
+    if(!parseColumns(keysEdit->text(), spec.keys)) { messageLabel->setText("invalid key columns"); return; }
+    if(!parseColumns(valuesEdit->text(), valueColumns)) { messageLabel->setText("invalid value columns"); return; }
+
+    for(const int col : qAsConst(valueColumns))
+        for(const QPair<QCheckBox*, SheetGroupBy::Aggregate>& check : qAsConst(aggregateChecks))
+            if(check.first->isChecked()) spec.values.append(SheetGroupBy::Value{ col, check.second });
+
+    if(spec.values.isEmpty()) { messageLabel->setText("select value columns and aggregates"); return; }
+
+    spec.pivot = pivotSpinBox->value() - 1;
+
+    messageLabel->clear();
+    emit groupRequested(spec);
 }
 
 
@@ -11,16 +11,27 @@
 #define TABLESETTINGWIDGET_H
 
 #include <QWidget>
+#include <QPointer>
 #include "gnuplottable.h"
+#include "columnstats.h"
+#include "columnexpression.h"
+#include "sheetfilter.h"
+#include "sheetgroup.h"
 
 class QMenu;
+class QLabel;
 class QScrollArea;
 class QVBoxLayout;
 class QStackedWidget;
 class TableEditSettingWidget;
 class TableCellSettingWidget;
 class TablePlotSettingWidget;
+class TableStatsWidget;
+class TableFormulaWidget;
+class TableFilterWidget;
+class TableGroupWidget;
 class QLineEdit;
+class QCheckBox;
 namespace mlayout { class IconLabel; }
 
 
@@ -66,6 +77,10 @@ private:
     TableEditSettingWidget *tableEditSettingWidget;
     TableCellSettingWidget *tableCellSettingWidget;
     TablePlotSettingWidget *tablePlotSettingWidget;
+    TableStatsWidget *tableStatsWidget;
+    TableFormulaWidget *tableFormulaWidget;
+    TableFilterWidget *tableFilterWidget;
+    TableGroupWidget *tableGroupWidget;
 
     GnuplotTable *table;
 };
@@ -177,4 +192,135 @@ signals:
 
 
 
+
+
+
+class QTableWidget;
+class QTimer;
+
+/* 選択した列の統計量(個数，最小，最大，平均，分散，四分位点，NaNの数)を表示する．
+ * 計算は別スレッドで行い，セルが変わったときは変わったブロックだけ集計し直す．表示していない間は計算しない */
+class TableStatsWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit TableStatsWidget(QWidget *parent);
+
+    void setModel(SheetModel *model);
+
+public slots:
+    void setColumns(const QList<int>& columns);
+
+protected:
+    void showEvent(QShowEvent *event) override;
+
+private slots:
+    void invalidateCells(const QModelIndex& topLeft, const QModelIndex& bottomRight, const QList<int>& roles);
+    void invalidateAll();
+    void calculate();
+
+private:
+    void receiveStats(const quint64 revision, const QList<int>& columns,
+                      const QList<ColumnStatistics>& states, const QList<ColumnStats>& stats);
+    void display(const QList<int>& columns, const QList<ColumnStats>& stats);
+
+    QTableWidget *statsTable;
+    QTimer *updateTimer;
+    QPointer<SheetModel> model;
+
+    QList<int> columns;
+    QHash<int, ColumnStatistics> caches;    //列ごとのブロックの集計
+    quint64 revision = 0;                   //変更ごとに増やし，計算中に変わった結果は捨てる
+    bool running = false;
+    bool pending = false;
+
+    static constexpr int updateInterval = 100;     //msec
+};
+
+
+
+
+
+
+
+/* 式から計算した列を挿入する．式はColumnExpressionの書式(gnuplotのusingの式と同じ) */
+class TableFormulaWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit TableFormulaWidget(QWidget *parent);
+
+private slots:
+    void checkFormula(const QString& text);
+    void requestColumn();
+
+private:
+    QLineEdit *const formulaEdit;
+    QLabel *const messageLabel;
+
+signals:
+    void formulaColumnRequested(const ColumnExpression& expression);
+};
+
+
+
+
+
+
+
+/* 条件に合う行だけを表示する．条件はSheetFilterの書式(ColumnExpressionの式を&&でつなぐ) */
+class TableFilterWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit TableFilterWidget(QWidget *parent);
+
+public slots:
+    void setFilterResult(const qsizetype shown, const qsizetype total);
+
+private slots:
+    void checkFilter(const QString& text);
+    void requestFilter();
+    void requestClear();
+
+private:
+    QLineEdit *const filterEdit;
+    QLabel *const resultLabel;
+    QLabel *const messageLabel;
+
+signals:
+    void filterRequested(const SheetFilter& filter);
+    void clearRequested();
+};
+
+
+
+
+
+/* キーの列の値ごとに値の列を集計したシートを作る．結果は新しいシートとして開く */
+class TableGroupWidget : public QWidget
+{
+    Q_OBJECT
+public:
+    explicit TableGroupWidget(QWidget *parent);
+
+private slots:
+    void requestGroup();
+
+private:
+    static bool parseColumns(const QString& text, QList<int>& columns);
+
+    QLineEdit *const keysEdit;
+    QLineEdit *const valuesEdit;
+    QList<QPair<QCheckBox*, SheetGroupBy::Aggregate> > aggregateChecks;
+    QSpinBox *const pivotSpinBox;
+    QLabel *const messageLabel;
+
+signals:
+    void groupRequested(const SheetGroupBy::Spec& spec);
+};
+
+
+
+
 #endif // TABLESETTINGWIDGET_H
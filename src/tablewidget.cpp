@@ -1,53 +1,119 @@
 #include "tablewidget.h"
 
+#include <QThreadPool>
+#include <QPointer>
+#include <algorithm>
+#include "iofile.h"
+#include "logger.h"
+
 TableWidget::TableWidget(QWidget *parent)
-    : QTableWidget(parent)
+    : QTableView(parent)
+    , _model(new SheetModel(this))
+    , _filterModel(new SheetFilterModel(_model))
 {
+    setModel(_filterModel);
+
+    /* QTableWidget::cellChangedの代わり．行と列の数の変更も編集とする */
+    connect(_model, &SheetModel::dataChanged, this, [this](const QModelIndex& topLeft) { emit cellChanged(topLeft.row(), topLeft.column()); });
+    connect(_model, &SheetModel::rowsInserted, this, [this](const QModelIndex&, int first) { emit cellChanged(first, 0); });
+    connect(_model, &SheetModel::rowsRemoved, this, [this](const QModelIndex&, int first) { emit cellChanged(first, 0); });
+    connect(_model, &SheetModel::columnsInserted, this, [this](const QModelIndex&, int first) { emit cellChanged(0, first); });
+    connect(_model, &SheetModel::columnsRemoved, this, [this](const QModelIndex&, int first) { emit cellChanged(0, first); });
+    connect(_model, &SheetModel::layoutChanged, this, [this]() { emit cellChanged(0, 0); });     //並べ替え
+
+    /* 別スレッドで並べ替えている間に内容が変わったかを調べる */
+    connect(this, &TableWidget::cellChanged, this, [this]() { editRevision++; });
+    connect(_model, &SheetModel::modelReset, this, [this]() { editRevision++; });
+
+    /* 絞り込んでいる間は，内容が変わるたびに絞り込み直す．シートを読み込み直せば解除する */
+    connect(this, &TableWidget::cellChanged, this, [this]() { if(rowFilter.isValid()) evaluateRowFilter(); });
+    connect(_model, &SheetModel::modelReset, this, [this]() { if(rowFilter.isValid()) clearRowFilter(); });
+
     /* ショートカットキーの登録 */
     QShortcut *scCtrC = new QShortcut(QKeySequence("Ctrl+C"), this);
     QShortcut *scCtrV = new QShortcut(QKeySequence("Ctrl+V"), this);
     QShortcut *scCtrX = new QShortcut(QKeySequence("Ctrl+X"), this);
+    QShortcut *scCtrZ = new QShortcut(QKeySequence("Ctrl+Z"), this);
+    QShortcut *scCtrY = new QShortcut(QKeySequence("Ctrl+Y"), this);
+    QShortcut *scCtrShiftZ = new QShortcut(QKeySequence("Ctrl+Shift+Z"), this);
     connect(scCtrC, &QShortcut::activated, this, &TableWidget::copyCell);
     connect(scCtrV, &QShortcut::activated, this, &TableWidget::pasteCell);
     connect(scCtrX, &QShortcut::activated, this, &TableWidget::cutCell);
+    connect(scCtrZ, &QShortcut::activated, this, &TableWidget::undo);
+    connect(scCtrY, &QShortcut::activated, this, &TableWidget::redo);
+    connect(scCtrShiftZ, &QShortcut::activated, this, &TableWidget::redo);
 }
 
 template <>
 void TableWidget::setData(const QList<QList<QString> >& data)
 {
-    this->clear();
-
-    for(int row = 0; row < data.size(); ++row)
-    {
-        if(row >= rowCount()) { insertRow(rowCount()); }                         //行が足りなかったら足す
-        for(int col = 0; col < data.at(row).size(); ++col)
-        {
-            if(col >= columnCount()) { insertColumn(columnCount()); }            //列が足りなかったら足す
-            QTableWidgetItem *item = new QTableWidgetItem(data.at(row).at(col));
-            setItem(row, col, item);                                             //アイテムをセット
-        }
-    }
+    setSheet(SheetData::fromStringList(data));
 }
 
 template <>
 QList<QList<QString> > TableWidget::getData() const
 {
-    const int rows = rowCount();
-    const int cols = columnCount();
-    QList<QList<QString> > data(rows, QList<QString>(cols));
+    return _model->sheet().toStringList();
+}
 
-    for(int row = 0; row < rows; ++row){
-        for(int col = 0; col < cols; ++col){
-            //item()はQTableWidgetItem*がセットされていなかったり、インデックスが範囲外であればエラー(nullptr)
-            data[row][col] = (item(row, col) != nullptr) ? item(row, col)->text() : "";
-        }
-    }
+void TableWidget::setSheet(const SheetData& sheet)
+{
+    clearSpans();
+    _model->setSheet(sheet);
+}
+
+SheetData TableWidget::sheet() const
+{
+    //列の配列を共有するためコピーしない
+    return _model->sheet();
+}
+
+SheetData TableWidget::sheet(const QTableWidgetSelectionRange& range) const
+{
+    if(!isFiltered())
+        return _model->sheet().mid(range.topRow(), range.leftColumn(), range.rowCount(), range.columnCount());
+
+    /* 表示している行だけを，元の行から型のまま取り出す */
+    QList<qint32> rows;
+    rows.reserve(range.rowCount());
+    for(int row = qMax(0, range.topRow()); row <= range.bottomRow() && row < _filterModel->rowCount(); ++row)
+        rows.append(qint32(sourceRow(row)));
+
+    return _model->sheet().select(rows, range.leftColumn(), range.columnCount());
+}
+
+QList<QTableWidgetSelectionRange> TableWidget::selectedRanges() const
+{
+    QList<QTableWidgetSelectionRange> ranges;
+
+    for(const QItemSelectionRange& range : selectionModel()->selection())
+        ranges.append(QTableWidgetSelectionRange(range.top(), range.left(), range.bottom(), range.right()));
+
+    return ranges;
+}
+
+void TableWidget::setRowCount(int rows)
+{
+    if(isFiltered()) return;   //行の見出しの数(表示の行数)から呼ばれても，元の行を減らさない
 
-    return data;
+    _model->resize(qMax(0, rows), columnCount());
+}
+
+void TableWidget::setColumnCount(int columns)
+{
+    _model->resize(rowCount(), qMax(0, columns));
 }
 
 void TableWidget::copyCell()
 {
+    /* 1つの範囲は，セルごとにモデルを経由せず列の配列から直接テキストにする */
+    const QList<QTableWidgetSelectionRange> ranges = selectedRanges();
+    if(ranges.size() == 1)
+    {
+        QApplication::clipboard()->setText(QString::fromUtf8(sheetToText(sheet(ranges.first()), '\t')));
+        return;
+    }
+
     /* tableの情報を取得 */
     const QAbstractItemModel *model = this->model();                //table全体の値の情報
     const QItemSelectionModel *selection = this->selectionModel();  //選択された部分の情報
@@ -79,63 +145,70 @@ void TableWidget::copyCell()
 
 void TableWidget::cutCell()
 {
+    if(isFiltered()) return;
+
+    const SheetModel::EditGroup group(_model);
+
     this->copyCell();
     this->clearCell();
 }
 
+/* クリップボードのテキストはcopyCell()と同じタブ区切りとして，別スレッドで列のデータにする．
+ * GUIのスレッドでは各選択範囲に列のまま書き込み，変更の通知を範囲ごとに1回にする */
 void TableWidget::pasteCell()
 {
+    if(isFiltered()) return;
+
     /* 選択された行と列のインデックスを取得 */
     const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
+    if(selectedRangeList.isEmpty()) return;
 
     /* クリップボードを読み取る */
-    const QStringList rowStrList = QApplication::clipboard()->text().split("\n");
+    const QByteArray text = QApplication::clipboard()->text().toUtf8();
+    if(text.isEmpty()) return;
 
-    /* 各選択範囲にペースト */
-    for(const QTableWidgetSelectionRange& selected : selectedRangeList)
-    {
-        const int pasteRow = selected.topRow();            //ペースト開始点の行数
-        const int pasteCol = selected.leftColumn();        //ペースト開始点の列数
+    const QPointer<TableWidget> self(this);
+    const quint64 revision = editRevision;
 
-        for(int row = 0; row < rowStrList.size(); ++row)
-        {
-            const QStringList colStrList = rowStrList.at(row).split(QRegularExpression("\\t| ")); //タブまたは空白区切りでセルにペースト
-            if(pasteRow + row >= rowCount()) { insertRow(rowCount()); }                           //行数が足りない場合は追加
+    viewport()->setCursor(Qt::BusyCursor);
+
+    QThreadPool::globalInstance()->start([self, selectedRangeList, text, revision]() {
+        const SheetData cells = sheetFromText(text, '\t');
+
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, selectedRangeList, cells, revision]() {
+            if(!self) return;
 
-            for(int col = 0; col < colStrList.size(); ++col)
+            self->viewport()->unsetCursor();
+
+            /* 解析している間に絞り込んだり編集したりすれば，選択範囲の行が変わっているかもしれないので貼り付けない */
+            if(self->isFiltered() || revision != self->editRevision)
             {
-                if(pasteCol + col >= columnCount()) { insertColumn(columnCount()); }              //列数が足りない場合は追加
-                if(item(pasteRow + row, pasteCol + col) == nullptr){                              //QTableWidgetItemがセットされているか確認
-                    QTableWidgetItem *item = new QTableWidgetItem(colStrList.at(col));
-                    setItem(pasteRow + row, pasteCol + col, item);
-                }
-                else
-                    item(pasteRow + row, pasteCol + col)->setText(colStrList.at(col));
+                __LOGOUT__("paste was canceled because the sheet changed while reading the clipboard.", Logger::LogLevel::Warn);
+                return;
             }
-        }
-    }
+
+            /* 各選択範囲にペースト．行数や列数が足りない場合は追加される．まとめて1回の操作として元に戻せる */
+            const SheetModel::EditGroup group(self->_model);
+            for(const QTableWidgetSelectionRange& selected : selectedRangeList)
+            {
+                self->_model->setCells(selected.topRow(), selected.leftColumn(), cells);
+            }
+        }, Qt::QueuedConnection);
+    });
 }
 
 void TableWidget::clearCell()
 {
+    if(isFiltered()) return;
+
     /* 選択された範囲を取得 */
     const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
 
     /* 各選択された範囲をクリア */
+    const SheetModel::EditGroup group(_model);
     for(const QTableWidgetSelectionRange& selected : selectedRangeList)
     {
-        const int startRow = selected.topRow();         //選択されたセルの開始行
-        const int startCol = selected.leftColumn();     //選択されたセルの開始列
-        const int endRow = selected.bottomRow();        //選択されたセルの終了行
-        const int endCol = selected.rightColumn();      //選択されたセルの終了列
-
-        for(int row = startRow; row <= endRow; ++row){
-            for(int col = startCol; col <= endCol; ++col)
-            {
-                if(item(row, col) != nullptr)           //QTableWidgetItem*がセットされているか
-                    item(row, col)->setText("");
-            }
-        }
+        _model->clearTexts(selected.topRow(), selected.leftColumn(), selected.bottomRow(), selected.rightColumn());
     }
 }
 
@@ -144,6 +217,8 @@ void TableWidget::clearCell()
  */
 void TableWidget::deleteCell()
 {
+    if(isFiltered()) return;
+
     /* 選択された範囲を取得 */
     const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
 
@@ -152,19 +227,18 @@ void TableWidget::deleteCell()
     int previousRemovedRow = rowCount();           //削除した行(上限で初期化)
     int previousRemovedCol = columnCount();        //削除した列(上限で初期化)
 
+    const SheetModel::EditGroup group(_model);
+
     for(const QTableWidgetSelectionRange range : selectedRangeList)
     {
         //全列が選択された場合，行を削除するということ
         if(range.columnCount() == previousColumnCount)
         {
-            //削除する行数
-            const int removeRowCount = range.rowCount();
             //削除するRowが以前のrangeで削除されたRow以降であった場合，その削除した分，削除するRowのインデックスをずらす必要がある。
             const int removeStartRow = (previousRemovedRow < range.topRow()) ? range.topRow() - (previousRowCount - rowCount())
                                                                              : range.topRow();
 
-            for(int i = 0; i < removeRowCount; ++i)
-                removeRow(removeStartRow);
+            _model->removeRows(removeStartRow, range.rowCount());
 
             previousRemovedRow = range.topRow();
         }
@@ -172,13 +246,11 @@ void TableWidget::deleteCell()
         //全行が選択された場合，列を削除するということ
         if(range.rowCount() == previousRowCount)
         {
-            //削除する列数
-            const int removeColCount = range.columnCount();
             //削除するColが以前のrangeで削除されたCol以降であった場合，その削除した分，削除するColのインデックスをずらす必要がある。
             const int removeStartCol = (previousRemovedCol < range.leftColumn()) ? range.leftColumn() - (previousColumnCount - columnCount())
                                                                                  : range.leftColumn();
-            for(int i = 0; i < removeColCount; ++i)
-                removeColumn(removeStartCol);
+
+            _model->removeColumns(removeStartCol, range.columnCount());
 
             previousRemovedCol = range.leftColumn();
         }
@@ -187,11 +259,15 @@ void TableWidget::deleteCell()
 
 void TableWidget::insertRowUp()
 {
+    if(isFiltered()) return;
+
     insertRow(currentIndex().row());
 }
 
 void TableWidget::insertRowDown()
 {
+    if(isFiltered()) return;
+
     insertRow(currentIndex().row() + 1);
 }
 
@@ -207,48 +283,32 @@ void TableWidget::insertColRight()
 
 void TableWidget::reverseRow()
 {
+    if(isFiltered()) return;
+
     /* 選択された範囲を取得 */
     const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
 
     /* 各選択された範囲 */
+    const SheetModel::EditGroup group(_model);
     for(const QTableWidgetSelectionRange& selected : selectedRangeList)
     {
-        const int startRow = selected.topRow();      //選択された範囲の開始行
-        const int startCol = selected.leftColumn();  //選択された範囲の開始列
-        const int endRow = selected.bottomRow();     //選択された範囲の終了行
-        const int endCol = selected.rightColumn();   //選択された範囲の終了列
-
-        /* 選択された範囲の中央行 */
-        const int middleRow = (endRow - startRow) / 2;
+        /* 上下を入れ替える並び */
+        QList<qsizetype> order(selected.rowCount());
+        for(qsizetype i = 0; i < order.size(); ++i) order[i] = order.size() - 1 - i;
 
-        /* 入れ替え */
-        for(int row = 0; row <= middleRow; ++row){
-            for(int col = startCol; col <= endCol; ++col)
-            {
-                if(item(startRow + row, col) == nullptr){                   //セルにQTableWidgetItem*がセットされていなかったらセット
-                    QTableWidgetItem *topItem = new QTableWidgetItem("");
-                    setItem(startRow + row, col, topItem);
-                }
-                if(item(endRow - row, col) == nullptr){                     //セルにQTableWidgetItem*がセットされていなかったらセット
-                    QTableWidgetItem *btmItem = new QTableWidgetItem("");
-                    setItem(endRow - row, col, btmItem);
-                }
-
-                const QString topText = item(startRow + row, col)->text();
-                const QString btmText = item(endRow - row, col)->text();
-                item(startRow + row, col)->setText(btmText);
-                item(endRow - row, col)->setText(topText);
-            }
-        }
+        _model->permuteRows(selected.topRow(), selected.leftColumn(), selected.rightColumn(), order);
     }
 }
 
 void TableWidget::reverseCol()
 {
+    if(isFiltered()) return;
+
     /* 選択された範囲を取得 */
     const QList<QTableWidgetSelectionRange> selectedRangeList = selectedRanges();
 
     /* 各選択された範囲 */
+    const SheetModel::EditGroup group(_model);
     for(const QTableWidgetSelectionRange& selected : selectedRangeList)
     {
         const int startRow = selected.topRow();      //選択された範囲の開始行
@@ -256,34 +316,24 @@ void TableWidget::reverseCol()
         const int endRow = selected.bottomRow();     //選択された範囲の終了行
         const int endCol = selected.rightColumn();   //選択された範囲の終了列
 
-        /* 選択された範囲の中央列 */
-        const int middleCol = (endCol - startCol) / 2;
-
-        /* 入れ替え */
+        /* 左右を入れ替えた文字列 */
+        QList<QStringList> texts(endRow - startRow + 1);
         for(int row = startRow; row <= endRow; ++row){
-            for(int col = 0; col <= middleCol; ++col)
-            {
-                if(item(row, startCol + col) == nullptr){
-                    QTableWidgetItem *leftItem = new QTableWidgetItem("");
-                    setItem(row, startCol + col, leftItem);
-                }
-                if(item(row, endCol - col) == nullptr){
-                    QTableWidgetItem *rightItem = new QTableWidgetItem("");
-                    setItem(row, endCol - col, rightItem);
-                }
-
-                const QString leftText = item(row, startCol + col)->text();
-                const QString rightText = item(row, endCol - col)->text();
-                item(row, startCol + col)->setText(rightText);
-                item(row, endCol - col)->setText(leftText);
-            }
+            QStringList& cells = texts[row - startRow];
+            for(int col = endCol; col >= startCol; --col)
+                cells.append(text(row, col));
         }
+
+        _model->setTexts(startRow, startCol, texts);
     }
 }
 
 void TableWidget::transposeCell()
 {
+    if(isFiltered()) return;
+
     const QList<QTableWidgetSelectionRange> ranges = selectedRanges();
+    const SheetModel::EditGroup group(_model);
 
     //選択された行数、列数の大きい方の値に合わせてDim次正方行列で転置を行う
     for(const QTableWidgetSelectionRange& range : ranges)
@@ -292,152 +342,280 @@ void TableWidget::transposeCell()
         const int startCol = range.leftColumn();
         const int Dim = std::max(range.bottomRow() - startRow, range.rightColumn() - startCol) + 1;
 
-        //転置後の必要な分だけセルを増やす
-        if(columnCount() < startRow + Dim) setColumnCount(startRow + Dim);
-        if(rowCount() <= startCol + Dim) setRowCount(startCol + Dim);
-
-        //データの入れ替え
+        //転置した文字列．足りないセルはsetTexts()で増やす
+        QList<QStringList> texts(Dim, QStringList(Dim));
         for(int i = 0; i < Dim; ++i){
-            for(int j = i + 1; j < Dim; ++j)
-            {
-                //下三角成分Lと上三角成分を取得
-                const QString dataL = (item(startRow + i, startCol + j)) ? item(startRow + i, startCol + j)->text() : "";
-                const QString dataU = (item(startRow + j, startCol + i)) ? item(startRow + j, startCol + i)->text() : "";
-
-                //上三角成分に下三角成分をセット
-                if(item(startRow + i, startCol + j))
-                    item(startRow + i, startCol + j)->setText(dataU);
-                else
-                {
-                    QTableWidgetItem *item = new QTableWidgetItem(dataU);
-                    setItem(startRow + i, startCol + j, item);
-                }
-                //下三角成分に上三角成分をセット
-                if(item(startRow + j, startCol + i))
-                    item(startRow + j, startCol + i)->setText(dataL);
-                else
-                {
-                    QTableWidgetItem *item = new QTableWidgetItem(dataL);
-                    setItem(startRow + j, startCol + i, item);
-                }
-            }
+            for(int j = 0; j < Dim; ++j)
+                texts[j][i] = text(startRow + i, startCol + j);
         }
 
+        _model->setTexts(startRow, startCol, texts);
     }
 }
 
 void TableWidget::sortAscending()
 {
-    for(auto&& range : selectedRanges())
-    {
-        sortByColumn(range.leftColumn(), Qt::AscendingOrder);
-        emit cellChanged(range.leftColumn(), range.topRow());
-        break;
-    }
+    sortSelectedColumns(Qt::AscendingOrder);
 }
 
 void TableWidget::sortDescending()
 {
-    for(auto&& range : selectedRanges())
-    {
-        sortByColumn(range.leftColumn(), Qt::DescendingOrder);
-        emit cellChanged(range.leftColumn(), range.topRow());
-        break;
-    }
+    sortSelectedColumns(Qt::DescendingOrder);
+}
+
+/* 選択した列を左から順にキーとして，行全体を並べ替える */
+void TableWidget::sortSelectedColumns(const Qt::SortOrder order)
+{
+    QList<int> columns;
+    for(const QTableWidgetSelectionRange& range : selectedRanges())
+        for(int col = range.leftColumn(); col <= range.rightColumn(); ++col)
+            if(!columns.contains(col)) columns.append(col);
+    std::sort(columns.begin(), columns.end());
+
+    QList<SheetSort::Key> keys;
+    for(const int col : qAsConst(columns)) keys.append(SheetSort::Key{ col, order });
+
+    sortRows(keys);
+}
+
+/* 置換は別スレッドで求め，GUIのスレッドでは行の入れ替えを1回で行う．
+ * 並べ替えている間に内容が変われば，変わった内容で並べ替え直す */
+void TableWidget::sortRows(const QList<SheetSort::Key>& keys)
+{
+    if(keys.isEmpty()) return;
+
+    const QPointer<TableWidget> self(this);
+    const SheetData sheet = _model->sheet();
+    const quint64 revision = editRevision;
+
+    viewport()->setCursor(Qt::BusyCursor);
+
+    QThreadPool::globalInstance()->start([self, sheet, keys, revision]() {
+        const QList<qsizetype> permutation = SheetSort::permutation(sheet, keys);
+
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, keys, revision, permutation]() {
+            if(!self) return;
+
+            self->viewport()->unsetCursor();
+
+            if(revision != self->editRevision)
+                self->sortRows(keys);
+            else
+                self->_model->setRowOrder(permutation);
+        }, Qt::QueuedConnection);
+    });
+}
+
+/* 式の値の列を，選択した列の右(選択がなければ最後)に挿入する */
+void TableWidget::insertFormulaColumn(const ColumnExpression& expression)
+{
+    if(!expression.isValid()) return;
+
+    int column = -1;
+    for(const QTableWidgetSelectionRange& range : selectedRanges())
+        column = qMax(column, range.rightColumn());
+
+    evaluateFormulaColumn(expression, (column < 0) ? columnCount() : column + 1);
+}
+
+/* 計算は別スレッドで行う．計算している間に内容が変われば，変わった内容で計算し直す */
+void TableWidget::evaluateFormulaColumn(const ColumnExpression& expression, const int column)
+{
+    const QPointer<TableWidget> self(this);
+    const SheetData sheet = _model->sheet();
+    const quint64 revision = editRevision;
+
+    viewport()->setCursor(Qt::BusyCursor);
+
+    QThreadPool::globalInstance()->start([self, sheet, expression, column, revision]() {
+        const SheetColumn values = SheetColumn::fromValues(expression.evaluate(sheet));
+
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, expression, column, revision, values]() {
+            if(!self) return;
+
+            self->viewport()->unsetCursor();
+
+            if(revision != self->editRevision)
+                self->evaluateFormulaColumn(expression, qMin(column, self->columnCount()));
+            else
+                self->_model->insertColumn(column, values, expression.text());
+        }, Qt::QueuedConnection);
+    });
+}
+
+void TableWidget::setRowFilter(const SheetFilter& filter)
+{
+    if(!filter.isValid()) { clearRowFilter(); return; }
+
+    rowFilter = filter;
+    evaluateRowFilter();
+}
+
+void TableWidget::clearRowFilter()
+{
+    rowFilter = SheetFilter();
+    _filterModel->clearFilter();
+
+    emit rowFilterApplied(rowCount(), rowCount());
+}
+
+/* 条件は別スレッドで評価し，GUIのスレッドでは表示する行の配列を渡すだけにする．
+ * 評価している間の要求はまとめ，終わったときに条件か内容が変わっていれば評価し直す．
+ * 列の索引は内容が変わるまで次の評価に使い回す */
+void TableWidget::evaluateRowFilter()
+{
+    if(filterRunning) return;
+    filterRunning = true;
+
+    const QPointer<TableWidget> self(this);
+    const SheetData sheet = _model->sheet();
+    const quint64 revision = editRevision;
+    const SheetFilter filter = rowFilter;
+    const SheetFilter::IndexCache indexes = (indexRevision == revision) ? filterIndexes : SheetFilter::IndexCache();
+
+    viewport()->setCursor(Qt::BusyCursor);
+
+    QThreadPool::globalInstance()->start([self, sheet, filter, revision, indexes]() {
+        SheetFilter::IndexCache built = indexes;
+        const QList<qint32> rows = SheetFilter::rows(filter.evaluate(sheet, built));
+
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, filter, revision, built, rows]() {
+            if(!self) return;
+
+            self->viewport()->unsetCursor();
+            self->filterRunning = false;
+
+            if(!self->rowFilter.isValid()) return;     //評価している間に解除された
+
+            if(revision == self->editRevision)
+            {
+                self->filterIndexes = built;
+                self->indexRevision = revision;
+            }
+
+            if(revision != self->editRevision || filter.text() != self->rowFilter.text())
+            {
+                self->evaluateRowFilter();
+                return;
+            }
+
+            self->_filterModel->setSourceRows(rows);
+            emit self->rowFilterApplied(rows.size(), self->rowCount());
+        }, Qt::QueuedConnection);
+    });
+}
+
+/* 集計は別スレッドで行い，結果のシートはgroupedSheetReady()で渡す．絞り込んでいれば表示している行だけを集計する */
+void TableWidget::groupRows(const SheetGroupBy::Spec& spec)
+{
+    const QPointer<TableWidget> self(this);
+    const SheetData sheet = (isFiltered()) ? this->sheet(QTableWidgetSelectionRange(0, 0, model()->rowCount() - 1, columnCount() - 1))
+                                           : _model->sheet();
+
+    viewport()->setCursor(Qt::BusyCursor);
+
+    QThreadPool::globalInstance()->start([self, sheet, spec]() {
+        QString error;
+        const SheetData result = SheetGroupBy::aggregate(sheet, spec, &error);
+
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, result, error]() {
+            if(!self) return;
+
+            self->viewport()->unsetCursor();
+
+            if(result.isEmpty())
+            {
+                __LOGOUT__("failed to group rows: " + error + ".", Logger::LogLevel::Error);
+                return;
+            }
+
+            emit self->groupedSheetReady(result);
+        }, Qt::QueuedConnection);
+    });
 }
 
 void TableWidget::setSelectedCellColor(const QColor& color)
 {
+    if(isFiltered()) return;
+
     QBrush brush(color);
+    const SheetModel::EditGroup group(_model);
 
-    for(QTableWidgetItem *item : selectedItems())
+    for(const QTableWidgetSelectionRange& range : selectedRanges())
     {
-        if(item) item->setBackground(brush);
+        _model->setStyle(range.topRow(), range.leftColumn(), range.bottomRow(), range.rightColumn(), Qt::BackgroundRole,
+                         [brush](const QVariant&) { return QVariant(brush); });
     }
 }
 
 void TableWidget::setSelectedTextColor(const QColor& color)
 {
+    if(isFiltered()) return;
+
     QBrush brush(color);
+    const SheetModel::EditGroup group(_model);
 
-    for(QTableWidgetItem *item : selectedItems())
+    for(const QTableWidgetSelectionRange& range : selectedRanges())
     {
-        if(item) item->setForeground(brush);
+        _model->setStyle(range.topRow(), range.leftColumn(), range.bottomRow(), range.rightColumn(), Qt::ForegroundRole,
+                         [brush](const QVariant&) { return QVariant(brush); });
     }
 }
 
-void TableWidget::setSelectedTextFamily(const QString& family)
+/* 選択されたセルのフォントをセルごとに変える */
+void TableWidget::setSelectedFont(const std::function<void(QFont&)>& function)
 {
-    for(QTableWidgetItem *item : selectedItems())
+    if(isFiltered()) return;
+
+    const QFont defaultFont = font();
+    const SheetModel::EditGroup group(_model);
+
+    for(const QTableWidgetSelectionRange& range : selectedRanges())
     {
-        if(item)
-        {
-            QFont font(item->font());
-            font.setFamily(family);
-            item->setFont(font);
-        }
+        _model->setStyle(range.topRow(), range.leftColumn(), range.bottomRow(), range.rightColumn(), Qt::FontRole,
+                         [&](const QVariant& previous) {
+                             QFont font = (previous.isValid()) ? previous.value<QFont>() : defaultFont;
+                             function(font);
+                             return QVariant(font);
+                         });
     }
 }
 
+void TableWidget::setSelectedTextFamily(const QString& family)
+{
+    setSelectedFont([&family](QFont& font) { font.setFamily(family); });
+}
+
 void TableWidget::setSelectedTextSize(const int ps)
 {
-    for(QTableWidgetItem *item : selectedItems())
-    {
-        if(item)
-        {
-            QFont font(item->font());
-            font.setPointSize(ps);
-            item->setFont(font);
-        }
-    }
+    setSelectedFont([ps](QFont& font) { font.setPointSize(ps); });
 }
 
 void TableWidget::setSelectedTextBold()
 {
-    for(QTableWidgetItem *item : selectedItems())
-    {
-        if(item)
-        {
-            QFont font(item->font());
-            font.setBold(!font.bold());
-            item->setFont(font);
-        }
-    }
+    setSelectedFont([](QFont& font) { font.setBold(!font.bold()); });
 }
 
 void TableWidget::setSelectedTextItalic()
 {
-    for(QTableWidgetItem *item : selectedItems())
-    {
-        if(item)
-        {
-            QFont font(item->font());
-            font.setItalic(!font.italic());
-            item->setFont(font);
-        }
-    }
+    setSelectedFont([](QFont& font) { font.setItalic(!font.italic()); });
 }
 
 void TableWidget::setSelectedTextUnderline()
 {
-    for(QTableWidgetItem *item : selectedItems())
-    {
-        if(item)
-        {
-            QFont font(item->font());
-            font.setUnderline(!font.underline());
-            item->setFont(font);
-        }
-    }
+    setSelectedFont([](QFont& font) { font.setUnderline(!font.underline()); });
 }
 
 void TableWidget::setSelectedTextAlignment(const Qt::AlignmentFlag &align)
 {
-    for(QTableWidgetItem *item : selectedItems())
+    if(isFiltered()) return;
+
+    const SheetModel::EditGroup group(_model);
+    for(const QTableWidgetSelectionRange& range : selectedRanges())
     {
-        if(item)
-        {
-            const int previousAlignment = item->textAlignment();
+        _model->setStyle(range.topRow(), range.leftColumn(), range.bottomRow(), range.rightColumn(), Qt::TextAlignmentRole,
+                         [align](const QVariant& previous) {
+            const int previousAlignment = previous.toInt();
 
             int previousHorizontalAlignment = previousAlignment % 32;
             if(previousHorizontalAlignment <= 0) previousHorizontalAlignment = Qt::AlignmentFlag::AlignLeft; //設定されてない場合のデフォルト
@@ -448,14 +626,14 @@ void TableWidget::setSelectedTextAlignment(const Qt::AlignmentFlag &align)
             if(align >= Qt::AlignmentFlag::AlignTop/* =32 */)
             {
                 /* previousHorizontal + newVertical */
-                item->setTextAlignment(previousHorizontalAlignment | align);
+                return QVariant(previousHorizontalAlignment | align);
             }
             else
             {
                 /* previousVertical + newHorizontal */
-                item->setTextAlignment(previousVerticalAlignment | align);
+                return QVariant(previousVerticalAlignment | align);
             }
-        }
+        });
     }
 }
 
@@ -476,16 +654,3 @@ void TableWidget::splitSelectedCells()
         setSpan(ranges.topRow(), ranges.leftColumn(), 1, 1); //警告される．正しくない処理だが結果は一致する
     }
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -1,15 +1,26 @@
 #ifndef TABLEWIDGET_H
 #define TABLEWIDGET_H
 
-#include <QTableWidget>
-#include <QTableWidget>
+#include <QTableView>
+#include <QTableWidgetSelectionRange>
 #include <QShortcut>
 #include <QKeySequence>
 #include <QApplication>
 #include <QClipboard>
 #include <QScreen>
-
-class TableWidget : public QTableWidget
+#include "sheetdata.h"
+#include "sheetmodel.h"
+#include "sheetsort.h"
+#include "columnexpression.h"
+#include "sheetfilter.h"
+#include "sheetgroup.h"
+
+/* SheetModelを表示するテーブル．セルごとのQTableWidgetItemを作らないため，数千万セルのシートも開ける．
+ * 選択範囲はQTableWidgetと同じくQTableWidgetSelectionRangeで扱う．
+ *
+ * 表示はSheetFilterModelを通し，行を絞り込んでいる間の選択範囲は表示の行で表す．sheet(range)は元の行のセルを返す．
+ * 絞り込んでいる間は選択範囲の行が元のシートで連続しないため，範囲を書き換える操作(貼り付け，消去，削除，入れ替え，書式など)は行わない */
+class TableWidget : public QTableView
 {
     Q_OBJECT
 
@@ -19,8 +30,27 @@ public:
 public:
     template <class T> void setData(const QList<QList<T> >& data);
     template <class T> QList<QList<T> > getData() const;
+    void setSheet(const SheetData& sheet);
+    SheetData sheet() const;
+    SheetData sheet(const QTableWidgetSelectionRange& range) const;
+
+    SheetModel *sheetModel() const { return _model; }
+    int rowCount() const { return _model->rowCount(); }
+    int columnCount() const { return _model->columnCount(); }
+    QString text(const int row, const int col) const { return _model->text(row, col); }
+    QList<QTableWidgetSelectionRange> selectedRanges() const;
+
+    bool isFiltered() const { return _filterModel->isFiltered(); }
+    /* 表示のrow行目の元の行 */
+    int sourceRow(const int row) const { return _filterModel->sourceRow(row); }
 
 public slots:
+    void setRowCount(int rows);
+    void setColumnCount(int columns);
+    void insertRow(int row) { _model->insertRows(row, 1); }
+    void insertColumn(int column) { _model->insertColumns(column, 1); }
+    void removeRow(int row) { _model->removeRows(row, 1); }
+    void removeColumn(int column) { _model->removeColumns(column, 1); }
     void appendRowLast() { insertRow(rowCount()); }
     void removeLastRow() { removeRow(rowCount() - 1); }
     void appendColLast() { insertColumn(columnCount()); }
@@ -39,6 +69,11 @@ public slots:
     void transposeCell();
     void sortAscending();
     void sortDescending();
+    void sortRows(const QList<SheetSort::Key>& keys);
+    void insertFormulaColumn(const ColumnExpression& expression);
+    void setRowFilter(const SheetFilter& filter);
+    void clearRowFilter();
+    void groupRows(const SheetGroupBy::Spec& spec);
     void setSelectedCellColor(const QColor& color);
     void setSelectedTextColor(const QColor& color);
     void setSelectedTextFamily(const QString& family);
@@ -49,6 +84,32 @@ public slots:
     void setSelectedTextAlignment(const Qt::AlignmentFlag& align);
     void mergeSelectedCells();
     void splitSelectedCells();
+    void undo() { _model->undo(); }
+    void redo() { _model->redo(); }
+
+private:
+    void setSelectedFont(const std::function<void(QFont&)>& function);
+    void sortSelectedColumns(const Qt::SortOrder order);
+    void evaluateFormulaColumn(const ColumnExpression& expression, const int column);
+    void evaluateRowFilter();
+
+    SheetModel *_model;
+    SheetFilterModel *_filterModel;
+    quint64 editRevision = 0;
+
+    /* 絞り込みの条件と，列の索引．索引はindexRevisionの内容で作ったもので，内容が変われば作り直す */
+    SheetFilter rowFilter;
+    SheetFilter::IndexCache filterIndexes;
+    quint64 indexRevision = 0;
+    bool filterRunning = false;
+
+signals:
+    /* セルの内容や書式，行と列の数が変わった */
+    void cellChanged(int row, int column);
+    /* 絞り込んだ結果．絞り込みを解除すればshownはtotalと同じ */
+    void rowFilterApplied(qsizetype shown, qsizetype total);
+    /* groupRows()の集計結果 */
+    void groupedSheetReady(const SheetData& sheet);
 };
 
 
@@ -39,6 +39,8 @@
 TerminalWidget::TerminalWidget(QWidget *parent)
     : QPlainTextEdit(parent)
     , _charCode(TextCodec::CharCode::Shift_JIS)
+    , stdOutDecoder(_charCode)
+    , stdErrDecoder(_charCode)
     , leftArea(new LeftArea(this))
 {
     setContextMenuPolicy(Qt::CustomContextMenu);
@@ -75,6 +77,8 @@ void TerminalWidget::setProcess(QProcess *process)
         _process->disconnect(this);
 
     _process = process;
+    stdOutDecoder.reset();
+    stdErrDecoder.reset();
 
     connect(process, &QProcess::readyReadStandardOutput, this, &TerminalWidget::readProcessStdOut);
     connect(process, &QProcess::readyReadStandardError, this, &TerminalWidget::readProcessStdErr);
@@ -137,6 +141,8 @@ void TerminalWidget::setStartArguments(const QStringList& arguments)
 void TerminalWidget::setCharCode(const TextCodec::CharCode &code)
 {
     _charCode = code;
+    stdOutDecoder.setCharCode(code);
+    stdErrDecoder.setCharCode(code);
 }
 
 void TerminalWidget::setPromptString(const QString &text)
@@ -154,7 +160,7 @@ void TerminalWidget::readProcessStdOut()
 {
     if(!_process) return;
 
-    const QString stdOut = TextCodec::QStringFrom(_process->readAllStandardOutput(), _charCode);
+    const QString stdOut = stdOutDecoder.decode(_process->readAllStandardOutput());
 
     if(stdOut.isEmpty()) return;
 
@@ -167,7 +173,7 @@ void TerminalWidget::readProcessStdOut()
 void TerminalWidget::readProcessStdErr()
 {
     if(!_process) return;
-    const QString stdErr = TextCodec::QStringFrom(_process->readAllStandardError(), _charCode);
+    const QString stdErr = stdErrDecoder.decode(_process->readAllStandardError());
     if(stdErr.isEmpty()) return;
 
     QTextCharFormat format = textCursor().charFormat();
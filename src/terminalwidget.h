@@ -54,6 +54,8 @@ protected:
     virtual void write();
     QProcess *_process = nullptr;
     TextCodec::CharCode _charCode;
+    TextDecoder stdOutDecoder;
+    TextDecoder stdErrDecoder;
 
     virtual void keyPressEvent(QKeyEvent *e) override;
 
@@ -0,0 +1,221 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "textcodec.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTCODEC_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define TEXTCODEC_NEON
+#endif
+
+
+
+namespace
+{
+    /* UTF-8の先頭のバイトから，その文字のバイト数．継続のバイトや不正なバイトは0 */
+    int utf8SequenceLength(const uchar lead)
+    {
+        if(lead < 0x80) return 1;
+        if(lead >= 0xC2 && lead <= 0xDF) return 2;
+        if(lead >= 0xE0 && lead <= 0xEF) return 3;
+        if(lead >= 0xF0 && lead <= 0xF4) return 4;
+        return 0;
+    }
+
+    /* 末尾で途中までしか届いていない文字のバイト数 */
+    qsizetype incompleteUtf8Tail(const char *data, const qsizetype size)
+    {
+        for(qsizetype back = 1; back <= qMin<qsizetype>(3, size); ++back)
+        {
+            const uchar c = uchar(data[size - back]);
+            if((c & 0xC0) == 0x80) continue;    //継続のバイト
+
+            const int length = utf8SequenceLength(c);
+            return (length > back) ? back : 0;
+        }
+        return 0;
+    }
+}
+
+
+
+
+QTextCodec *TextCodec::codecFor(const CharCode& code)
+{
+    switch(code)
+    {
+    case CharCode::Shift_JIS: return shiftJisCodec;
+    case CharCode::EUC_JP: return eucJpCodec;
+    case CharCode::JIS: return jisCodec;
+    case CharCode::Utf_8: return utf8Codec;
+    case CharCode::Utf_16LE: return utf16LeCodec;
+    case CharCode::Utf_16BE: return utf16BeCodec;
+    default: return nullptr;
+    }
+}
+
+qsizetype TextCodec::asciiLength(const char *data, const qsizetype size)
+{
+    qsizetype i = 0;
+
+#if defined(TEXTCODEC_SSE2)
+    /* 各バイトの最上位ビットをまとめて取り出す */
+    for(; i + 16 <= size; i += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const int mask = _mm_movemask_epi8(chunk);
+        if(mask != 0)
+        {
+            int offset = 0;
+            while(!(mask & (1 << offset))) ++offset;
+            return i + offset;
+        }
+    }
+#elif defined(TEXTCODEC_NEON)
+    for(; i + 16 <= size; i += 16)
+    {
+        const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+        if(vmaxvq_u8(chunk) >= 0x80) break;
+    }
+#else
+    /* 8バイトずつ最上位ビットを調べる */
+    for(; i + 8 <= size; i += 8)
+    {
+        quint64 word;
+        std::memcpy(&word, data + i, 8);
+        if(word & Q_UINT64_C(0x8080808080808080)) break;
+    }
+#endif
+
+    for(; i < size; ++i)
+        if(uchar(data[i]) >= 0x80) break;
+
+    return i;
+}
+
+bool TextCodec::isAsciiText(const char *data, const qsizetype size, const CharCode& code)
+{
+    switch(code)
+    {
+    case CharCode::Shift_JIS:
+    case CharCode::EUC_JP:
+    case CharCode::Utf_8:
+        return asciiLength(data, size) == size;
+    case CharCode::JIS:
+        //ESC(0x1B)で漢字に切り替わり，SO(0x0E), SI(0x0F)で半角カナに切り替わる
+        return asciiLength(data, size) == size
+                && !std::memchr(data, 0x1B, size) && !std::memchr(data, 0x0E, size) && !std::memchr(data, 0x0F, size);
+    default:
+        return false;   //UTF-16
+    }
+}
+
+QString TextCodec::QStringFrom(const QByteArray& array, const CharCode& code)
+{
+    const char *data = array.constData();
+    qsizetype size = array.size();
+
+    if(code == CharCode::Utf_8)
+    {
+        /* QTextCodecと同じくBOMは取り除く．QString::fromUtf8は不正なバイトをQTextCodecと同じく置換文字にする */
+        if(size >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0) { data += 3; size -= 3; }
+        return QString::fromUtf8(data, size);
+    }
+
+    if(isAsciiText(data, size, code))
+        return QString::fromLatin1(data, size);
+
+    QTextCodec *codec = codecFor(code);
+
+    if(codec)
+        return codec->toUnicode(array);
+    else
+        return array;
+}
+
+
+
+
+TextDecoder::TextDecoder(const TextCodec::CharCode& code)
+    : code(code)
+    , codec(TextCodec::codecFor(code))
+{
+}
+
+void TextDecoder::setCharCode(const TextCodec::CharCode& code)
+{
+    if(code == this->code) return;
+
+    this->code = code;
+    codec = TextCodec::codecFor(code);
+    reset();
+}
+
+void TextDecoder::reset()
+{
+    state.clear();
+    pending.clear();
+    atStart = true;
+    shifted = false;
+}
+
+QString TextDecoder::decode(const QByteArray& chunk)
+{
+    if(chunk.isEmpty()) return QString();
+
+    if(code == TextCodec::CharCode::Utf_8)
+    {
+        /* 前のチャンクの終わりで切れた文字を先頭に付ける */
+        QByteArray joined;
+        const char *data = chunk.constData();
+        qsizetype size = chunk.size();
+        if(!pending.isEmpty())
+        {
+            joined = pending + chunk;
+            data = joined.constData();
+            size = joined.size();
+            pending.clear();
+        }
+
+        /* 先頭のBOMは取り除く．BOMの途中で切れていれば次のチャンクを待つ */
+        if(atStart)
+        {
+            if(size < 3 && std::memcmp(data, "\xEF\xBB\xBF", size) == 0)
+            {
+                pending = QByteArray(data, size);
+                return QString();
+            }
+            if(std::memcmp(data, "\xEF\xBB\xBF", 3) == 0) { data += 3; size -= 3; }
+            atStart = false;
+        }
+
+        const qsizetype tail = incompleteUtf8Tail(data, size);
+        pending = QByteArray(data + size - tail, tail);
+
+        return QString::fromUtf8(data, size - tail);
+    }
+
+    atStart = false;
+
+    /* 途中の文字を持っていなければ，ASCIIだけのチャンクはそのまま広げる */
+    if(!shifted && state.remainingChars == 0 && TextCodec::isAsciiText(chunk.constData(), chunk.size(), code))
+        return QString::fromLatin1(chunk.constData(), chunk.size());
+
+    if(!codec) return QString::fromLatin1(chunk.constData(), chunk.size());
+
+    //JISはエスケープシーケンスによる状態をQTextCodecが持つため，以降はすべてQTextCodecに渡す
+    if(code == TextCodec::CharCode::JIS) shifted = true;
+
+    return codec->toUnicode(chunk.constData(), int(chunk.size()), &state);
+}
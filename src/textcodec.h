@@ -28,26 +28,15 @@ public:
     };
     Q_ENUM(CharCode)
 
-    static QString QStringFrom(const QByteArray& array, const CharCode& code)
-    {
-        QTextCodec *codec = nullptr;
-
-        switch(code)
-        {
-        case CharCode::Shift_JIS: codec = shiftJisCodec; break;
-        case CharCode::EUC_JP: codec = eucJpCodec; break;
-        case CharCode::JIS: codec = jisCodec; break;
-        case CharCode::Utf_8: codec = utf8Codec; break;
-        case CharCode::Utf_16LE: codec = utf16LeCodec; break;
-        case CharCode::Utf_16BE: codec = utf16BeCodec; break;
-        default: break;
-        }
-
-        if(codec)
-            return codec->toUnicode(array);
-        else
-            return array;
-    }
+    /* ASCIIだけのバイト列や，UTF-8のバイト列はQTextCodecを通さずにQStringにする */
+    static QString QStringFrom(const QByteArray& array, const CharCode& code);
+
+    /* 先頭から続くASCII(0x80未満)のバイト数．16バイトずつまとめて調べる */
+    static qsizetype asciiLength(const char *data, const qsizetype size);
+    /* codeでASCIIの部分がそのままASCIIとして読めるバイト列か(JISはエスケープシーケンスを含まないもの) */
+    static bool isAsciiText(const char *data, const qsizetype size, const CharCode& code);
+
+    static QTextCodec *codecFor(const CharCode& code);
 
 private:
     inline static QTextCodec *const shiftJisCodec = QTextCodec::codecForName("Shift-JIS");
@@ -58,4 +47,33 @@ private:
     inline static QTextCodec *const utf16BeCodec = QTextCodec::codecForName("UTF-16BE");
 };
 
+
+
+
+
+/* チャンクに分かれて届くバイト列(プロセスの出力など)を順にQStringにする．
+ * マルチバイト文字がチャンクの境界で分かれても，残りのバイトを次のチャンクと合わせて変換する．
+ * ASCIIだけのチャンクとUTF-8はQTextCodecを通さない．
+ */
+class TextDecoder
+{
+public:
+    explicit TextDecoder(const TextCodec::CharCode& code);
+
+    QString decode(const QByteArray& chunk);
+    /* 文字コードが変われば，途中の状態を捨てる */
+    void setCharCode(const TextCodec::CharCode& code);
+    void reset();
+
+    TextCodec::CharCode charCode() const { return code; }
+
+private:
+    TextCodec::CharCode code;
+    QTextCodec *codec;
+    QTextCodec::ConverterState state;
+    QByteArray pending;             //UTF-8の途中で切れた文字
+    bool atStart = true;
+    bool shifted = false;           //JISのエスケープシーケンスがあった．以降はすべてQTextCodecで変換する
+};
+
 #endif // TEXTCODEC_H
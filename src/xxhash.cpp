@@ -0,0 +1,159 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "xxhash.h"
+
+#include <QFile>
+#include <QtEndian>
+#include <cstring>
+
+
+
+namespace
+{
+    constexpr quint64 prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr quint64 prime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr quint64 prime3 = 0x165667B19E3779F9ULL;
+    constexpr quint64 prime4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr quint64 prime5 = 0x27D4EB2F165667C5ULL;
+
+    inline quint64 rotl(const quint64 x, const int r) { return (x << r) | (x >> (64 - r)); }
+    inline quint64 read64(const char *p) { return qFromLittleEndian<quint64>(p); }
+    inline quint32 read32(const char *p) { return qFromLittleEndian<quint32>(p); }
+
+    inline quint64 round(quint64 acc, const quint64 input)
+    {
+        acc += input * prime2;
+        acc = rotl(acc, 31);
+        return acc * prime1;
+    }
+
+    inline quint64 mergeRound(quint64 acc, const quint64 value)
+    {
+        acc ^= round(0, value);
+        return acc * prime1 + prime4;
+    }
+}
+
+
+
+XXHash64::XXHash64(const quint64 seed)
+{
+    acc[0] = seed + prime1 + prime2;
+    acc[1] = seed + prime2;
+    acc[2] = seed;
+    acc[3] = seed - prime1;
+}
+
+void XXHash64::addData(const char *data, const qsizetype size)
+{
+    if(size <= 0) return;
+
+    const char *p = data;
+    const char *end = data + size;
+    totalSize += quint64(size);
+
+    /* 前回の端数と合わせて32バイトになれば処理する */
+    if(bufferSize > 0)
+    {
+        const int fill = int(qMin<qsizetype>(32 - bufferSize, end - p));
+        std::memcpy(buffer + bufferSize, p, fill);
+        bufferSize += fill;
+        p += fill;
+
+        if(bufferSize < 32) return;
+
+        for(int i = 0; i < 4; ++i) acc[i] = round(acc[i], read64(buffer + i * 8));
+        bufferSize = 0;
+    }
+
+    quint64 v0 = acc[0], v1 = acc[1], v2 = acc[2], v3 = acc[3];
+    while(end - p >= 32)
+    {
+        v0 = round(v0, read64(p));
+        v1 = round(v1, read64(p + 8));
+        v2 = round(v2, read64(p + 16));
+        v3 = round(v3, read64(p + 24));
+        p += 32;
+    }
+    acc[0] = v0; acc[1] = v1; acc[2] = v2; acc[3] = v3;
+
+    if(p < end)
+    {
+        bufferSize = int(end - p);
+        std::memcpy(buffer, p, bufferSize);
+    }
+}
+
+quint64 XXHash64::result() const
+{
+    quint64 h;
+
+    if(totalSize >= 32)
+    {
+        h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        for(int i = 0; i < 4; ++i) h = mergeRound(h, acc[i]);
+    }
+    else
+        h = acc[2] + prime5; //acc[2]はseedのまま
+
+    h += totalSize;
+
+    const char *p = buffer;
+    const char *end = buffer + bufferSize;
+
+    for(; end - p >= 8; p += 8)
+        h = rotl(h ^ round(0, read64(p)), 27) * prime1 + prime4;
+
+    if(end - p >= 4)
+    {
+        h = rotl(h ^ (quint64(read32(p)) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+
+    for(; p < end; ++p)
+        h = rotl(h ^ (quint64(uchar(*p)) * prime5), 11) * prime1;
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+quint64 XXHash64::hash(QByteArrayView data, const quint64 seed)
+{
+    XXHash64 hasher(seed);
+    hasher.addData(data);
+    return hasher.result();
+}
+
+quint64 XXHash64::hashFile(const QString& fileName, bool *ok)
+{
+    static constexpr qsizetype chunkSize = 1 << 20;
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        if(ok) *ok = false;
+        return 0;
+    }
+
+    XXHash64 hasher;
+    QByteArray chunk(chunkSize, Qt::Uninitialized);
+
+    qint64 size = 0;
+    while((size = file.read(chunk.data(), chunkSize)) > 0)
+        hasher.addData(chunk.constData(), size);
+
+    if(ok) *ok = (size == 0);
+    return hasher.result();
+}
@@ -0,0 +1,40 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <QString>
+#include <QByteArrayView>
+
+
+
+/* XXH64によるハッシュ．暗号用ではないが高速で，ファイル内容の比較に使う．
+ * データは分割して何回かに分けて渡してもよい．
+ */
+class XXHash64
+{
+public:
+    explicit XXHash64(const quint64 seed = 0);
+
+    void addData(const char *data, const qsizetype size);
+    void addData(QByteArrayView data) { addData(data.data(), data.size()); }
+    quint64 result() const;
+
+    static quint64 hash(QByteArrayView data, const quint64 seed = 0);
+    static quint64 hashFile(const QString& fileName, bool *ok = nullptr);
+
+private:
+    quint64 acc[4];
+    quint64 totalSize = 0;
+    char buffer[32];
+    int bufferSize = 0;
+};
+
+#endif // XXHASH_H
@@ -0,0 +1,432 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#include "zipfile.h"
+
+#include <QFile>
+#include <QtEndian>
+#include "deflate.h"
+
+
+
+namespace
+{
+    constexpr quint32 localHeaderSignature = 0x04034b50;
+    constexpr quint32 centralHeaderSignature = 0x02014b50;
+    constexpr quint32 endOfCentralDirSignature = 0x06054b50;
+    constexpr quint32 zip64EndOfCentralDirSignature = 0x06064b50;
+    constexpr quint32 zip64LocatorSignature = 0x07064b50;
+    constexpr quint32 dataDescriptorSignature = 0x08074b50;
+
+    constexpr qint64 localHeaderSize = 30;
+    constexpr qint64 centralHeaderSize = 46;
+    constexpr qint64 endOfCentralDirSize = 22;
+    constexpr qint64 maxCommentSize = 0xFFFF;
+
+    inline quint16 read16(const char *p) { return qFromLittleEndian<quint16>(p); }
+    inline quint32 read32(const char *p) { return qFromLittleEndian<quint32>(p); }
+    inline quint64 read64(const char *p) { return qFromLittleEndian<quint64>(p); }
+
+    inline void append16(QByteArray& out, const quint16 value) { char b[2]; qToLittleEndian(value, b); out.append(b, 2); }
+    inline void append32(QByteArray& out, const quint32 value) { char b[4]; qToLittleEndian(value, b); out.append(b, 4); }
+}
+
+
+
+
+/* エントリーのデータ部分だけを読み出すデバイス．deflateなら展開しながら返す */
+class ZipEntryDevice : public QIODevice
+{
+public:
+    ZipEntryDevice(QFile *file, const quint16 method, const qint64 compressedSize)
+        : file(file)
+        , remaining(compressedSize)
+        , inflater((method == 8) ? new Inflater(file, compressedSize) : nullptr)
+    {
+        setOpenMode(QIODevice::ReadOnly);
+    }
+
+    ~ZipEntryDevice()
+    {
+        delete inflater;
+        delete file;
+    }
+
+    bool isSequential() const override { return true; }
+
+    bool atEnd() const override
+    {
+        const bool finished = (inflater) ? (inflater->isFinished() || inflater->hasError()) : (remaining <= 0);
+        return finished && QIODevice::bytesAvailable() == 0;
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override
+    {
+        if(inflater)
+        {
+            const qint64 size = inflater->read(data, maxSize);
+            if(size < 0) setErrorString("Broken deflate stream.");
+            return size;
+        }
+
+        if(remaining <= 0) return 0;
+
+        const qint64 size = file->read(data, qMin(maxSize, remaining));
+        if(size > 0) remaining -= size;
+        return size;
+    }
+
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+private:
+    QFile *file;
+    qint64 remaining;
+    Inflater *inflater;
+};
+
+
+
+
+
+
+ZipReader::ZipReader(const QString& fileName)
+    : fileName(fileName)
+{
+    valid = readCentralDirectory();
+}
+
+bool ZipReader::readCentralDirectory()
+{
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly)) return false;
+
+    const qint64 fileSize = file.size();
+    if(fileSize < endOfCentralDirSize) return false;
+
+    /* 末尾のコメントの分だけ遡って終端レコードを探す */
+    const qint64 tailSize = qMin(fileSize, endOfCentralDirSize + maxCommentSize);
+    file.seek(fileSize - tailSize);
+    const QByteArray tail = file.read(tailSize);
+    if(tail.size() != tailSize) return false;
+
+    qsizetype eocd = -1;
+    for(qsizetype i = tail.size() - endOfCentralDirSize; i >= 0; --i)
+    {
+        if(read32(tail.constData() + i) == endOfCentralDirSignature) { eocd = i; break; }
+    }
+    if(eocd < 0) return false;
+
+    const char *record = tail.constData() + eocd;
+    qint64 entryCount = read16(record + 10);
+    qint64 directorySize = read32(record + 12);
+    qint64 directoryOffset = read32(record + 16);
+
+    /* Zip64 */
+    if(entryCount == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF)
+    {
+        const qint64 locatorPos = fileSize - tailSize + eocd - 20;
+        if(locatorPos < 0) return false;
+
+        file.seek(locatorPos);
+        const QByteArray locator = file.read(20);
+        if(locator.size() != 20 || read32(locator.constData()) != zip64LocatorSignature) return false;
+
+        file.seek(qint64(read64(locator.constData() + 8)));
+        const QByteArray record64 = file.read(56);
+        if(record64.size() != 56 || read32(record64.constData()) != zip64EndOfCentralDirSignature) return false;
+
+        entryCount = qint64(read64(record64.constData() + 32));
+        directorySize = qint64(read64(record64.constData() + 40));
+        directoryOffset = qint64(read64(record64.constData() + 48));
+    }
+
+    if(directoryOffset + directorySize > fileSize) return false;
+
+    file.seek(directoryOffset);
+    const QByteArray directory = file.read(directorySize);
+    if(directory.size() != directorySize) return false;
+
+    _entries.reserve(entryCount);
+
+    const char *p = directory.constData();
+    const char *end = p + directory.size();
+
+    for(qint64 i = 0; i < entryCount; ++i)
+    {
+        if(end - p < centralHeaderSize || read32(p) != centralHeaderSignature) return false;
+
+        const quint16 flags = read16(p + 8);
+        const quint16 nameLength = read16(p + 28);
+        const quint16 extraLength = read16(p + 30);
+        const quint16 commentLength = read16(p + 32);
+        if(end - p < centralHeaderSize + nameLength + extraLength + commentLength) return false;
+
+        Entry entry;
+        entry.method = read16(p + 10);
+        entry.compressedSize = read32(p + 20);
+        entry.size = read32(p + 24);
+        entry.headerOffset = read32(p + 42);
+
+        const char *name = p + centralHeaderSize;
+        entry.name = (flags & 0x0800) ? QString::fromUtf8(name, nameLength) : QString::fromLatin1(name, nameLength);
+
+        /* Zip64の拡張フィールドには，0xFFFFFFFFになっている値だけがこの順で入る */
+        const char *extra = name + nameLength;
+        const char *extraEnd = extra + extraLength;
+        while(extraEnd - extra >= 4)
+        {
+            const quint16 id = read16(extra);
+            const quint16 size = read16(extra + 2);
+            const char *field = extra + 4;
+            const char *fieldEnd = field + size;
+            if(fieldEnd > extraEnd) break;
+
+            if(id == 0x0001)
+            {
+                if(entry.size == 0xFFFFFFFF && fieldEnd - field >= 8) { entry.size = qint64(read64(field)); field += 8; }
+                if(entry.compressedSize == 0xFFFFFFFF && fieldEnd - field >= 8) { entry.compressedSize = qint64(read64(field)); field += 8; }
+                if(entry.headerOffset == 0xFFFFFFFF && fieldEnd - field >= 8) { entry.headerOffset = qint64(read64(field)); field += 8; }
+            }
+
+            extra = fieldEnd;
+        }
+
+        _entries.append(entry);
+        p += centralHeaderSize + nameLength + extraLength + commentLength;
+    }
+
+    return true;
+}
+
+qsizetype ZipReader::indexOf(const QString& name) const
+{
+    for(qsizetype i = 0; i < _entries.size(); ++i)
+        if(_entries.at(i).name == name) return i;
+
+    return -1;
+}
+
+QIODevice *ZipReader::openEntry(const qsizetype index) const
+{
+    if(index < 0 || index >= _entries.size()) return nullptr;
+
+    const Entry& entry = _entries.at(index);
+    if(entry.method != 0 && entry.method != 8) return nullptr; //deflate以外の圧縮には対応していない
+
+    const qint64 offset = dataOffset(index);
+    if(offset < 0) return nullptr;
+
+    QFile *file = new QFile(fileName);
+    if(!file->open(QIODevice::ReadOnly) || !file->seek(offset))
+    {
+        delete file;
+        return nullptr;
+    }
+
+    return new ZipEntryDevice(file, entry.method, entry.compressedSize);
+}
+
+qint64 ZipReader::dataOffset(const qsizetype index) const
+{
+    if(index < 0 || index >= _entries.size()) return -1;
+
+    const Entry& entry = _entries.at(index);
+
+    QFile file(fileName);
+    if(!file.open(QIODevice::ReadOnly) || !file.seek(entry.headerOffset)) return -1;
+
+    const QByteArray header = file.read(localHeaderSize);
+    if(header.size() != localHeaderSize || read32(header.constData()) != localHeaderSignature) return -1;
+
+    /* ローカルヘッダーの名前と拡張フィールドの長さは中央ディレクトリと異なることがある */
+    return entry.headerOffset + localHeaderSize + read16(header.constData() + 26) + read16(header.constData() + 28);
+}
+
+QByteArray ZipReader::readEntry(const QString& name, bool *ok) const
+{
+    const qsizetype index = indexOf(name);
+    QIODevice *device = openEntry(index);
+    if(!device)
+    {
+        if(ok) *ok = false;
+        return QByteArray();
+    }
+
+    QByteArray data;
+    data.reserve(qMin(_entries.at(index).size, qint64(1) << 26));
+
+    char buffer[1 << 14];
+    qint64 size = 0;
+    while((size = device->read(buffer, sizeof(buffer))) > 0)
+        data.append(buffer, size);
+
+    if(ok) *ok = (size == 0);
+
+    delete device;
+    return data;
+}
+
+
+
+
+
+
+
+
+
+
+ZipWriter::ZipWriter(QIODevice *device)
+    : device(device)
+{
+}
+
+ZipWriter::~ZipWriter()
+{
+    delete deflater;
+}
+
+bool ZipWriter::put(const char *data, const qsizetype size)
+{
+    if(ok && size > 0) ok = (device->write(data, size) == size);
+    offset += size;
+    return ok;
+}
+
+bool ZipWriter::beginEntry(const QString& name, const bool compress)
+{
+    if(inEntry && !endEntry()) return false;
+
+    Entry entry;
+    entry.name = name.toUtf8();
+    entry.method = (compress) ? 8 : 0;
+    entry.headerOffset = offset;
+
+    /* サイズとCRCは0にしておき，データ記述子に書く(フラグのビット3) */
+    QByteArray header;
+    append32(header, localHeaderSignature);
+    append16(header, 20);                       //展開に必要なバージョン
+    append16(header, 0x0008 | 0x0800);          //データ記述子, UTF-8の名前
+    append16(header, entry.method);
+    append16(header, 0);                        //時刻
+    append16(header, 0x21);                     //日付(1980-01-01)
+    append32(header, 0);
+    append32(header, 0);
+    append32(header, 0);
+    append16(header, quint16(entry.name.size()));
+    append16(header, 0);
+    header.append(entry.name);
+
+    _entries.append(entry);
+    inEntry = true;
+
+    if(!put(header.constData(), header.size())) return false;
+
+    delete deflater;
+    deflater = (compress) ? new Deflater(device) : nullptr;
+
+    return ok;
+}
+
+bool ZipWriter::write(const char *data, const qsizetype size)
+{
+    if(!inEntry || !ok) return false;
+
+    Entry& entry = _entries.last();
+    entry.crc = Crc32::update(entry.crc, data, size);
+    entry.size += size;
+
+    if(deflater)
+        ok = deflater->write(data, size);
+    else
+    {
+        put(data, size);
+        entry.compressedSize += size;
+    }
+
+    return ok;
+}
+
+bool ZipWriter::endEntry()
+{
+    if(!inEntry) return false;
+    inEntry = false;
+
+    Entry& entry = _entries.last();
+
+    if(deflater)
+    {
+        if(!deflater->finish()) ok = false;
+        entry.compressedSize = deflater->bytesWritten();
+        offset += entry.compressedSize;
+
+        delete deflater;
+        deflater = nullptr;
+    }
+
+    if(entry.size > 0xFFFFFFFF || entry.compressedSize > 0xFFFFFFFF) ok = false;
+
+    QByteArray descriptor;
+    append32(descriptor, dataDescriptorSignature);
+    append32(descriptor, entry.crc);
+    append32(descriptor, quint32(entry.compressedSize));
+    append32(descriptor, quint32(entry.size));
+
+    return put(descriptor.constData(), descriptor.size());
+}
+
+bool ZipWriter::addEntry(const QString& name, const QByteArray& data)
+{
+    return beginEntry(name) && write(data) && endEntry();
+}
+
+bool ZipWriter::finish()
+{
+    if(inEntry && !endEntry()) return false;
+
+    const qint64 directoryOffset = offset;
+
+    QByteArray directory;
+    for(const Entry& entry : qAsConst(_entries))
+    {
+        append32(directory, centralHeaderSignature);
+        append16(directory, 20);                //作成したバージョン
+        append16(directory, 20);
+        append16(directory, 0x0008 | 0x0800);
+        append16(directory, entry.method);
+        append16(directory, 0);
+        append16(directory, 0x21);
+        append32(directory, entry.crc);
+        append32(directory, quint32(entry.compressedSize));
+        append32(directory, quint32(entry.size));
+        append16(directory, quint16(entry.name.size()));
+        append16(directory, 0);                 //拡張フィールド
+        append16(directory, 0);                 //コメント
+        append16(directory, 0);                 //ディスク番号
+        append16(directory, 0);                 //内部属性
+        append32(directory, 0);                 //外部属性
+        append32(directory, quint32(entry.headerOffset));
+        directory.append(entry.name);
+    }
+
+    const qint64 directorySize = directory.size();
+    if(directoryOffset + directorySize > 0xFFFFFFFF || _entries.size() >= 0xFFFF) ok = false;
+
+    append32(directory, endOfCentralDirSignature);
+    append16(directory, 0);
+    append16(directory, 0);
+    append16(directory, quint16(_entries.size()));
+    append16(directory, quint16(_entries.size()));
+    append32(directory, quint32(directorySize));
+    append32(directory, quint32(directoryOffset));
+    append16(directory, 0);
+
+    return put(directory.constData(), directory.size());
+}
+
@@ -0,0 +1,104 @@
+/*!
+ * GnuplotEditor
+ *
+ * Copyright (c) 2022 yuya
+ *
+ * This software is released under the GPLv3.
+ * see https://www.gnu.org/licenses/gpl-3.0.en.html
+ */
+
+#ifndef ZIPFILE_H
+#define ZIPFILE_H
+
+#include <QString>
+#include <QList>
+#include <QIODevice>
+
+class Deflater;
+
+
+/* zipアーカイブの読み込み．
+ * 外部のunzipを使わずに，中央ディレクトリからエントリーの一覧を作り，
+ * 各エントリーは展開しながら読み出せるデバイスとして開く．
+ */
+class ZipReader
+{
+public:
+    struct Entry
+    {
+        QString name;
+        quint16 method = 0;         //0: 無圧縮, 8: deflate
+        qint64 compressedSize = 0;
+        qint64 size = 0;
+        qint64 headerOffset = 0;    //ローカルファイルヘッダーの位置
+    };
+
+    explicit ZipReader(const QString& fileName);
+
+    bool isValid() const { return valid; }
+    const QList<Entry>& entries() const { return _entries; }
+    qsizetype indexOf(const QString& name) const;
+
+    /* エントリーを読み出すデバイスを開く．呼び出し側がdeleteする．失敗したらnullptr */
+    QIODevice *openEntry(const qsizetype index) const;
+    QByteArray readEntry(const QString& name, bool *ok = nullptr) const;
+
+    /* エントリーのデータ部分のアーカイブ先頭からの位置．無圧縮のエントリーはこの位置から直接参照できる．失敗したら-1 */
+    qint64 dataOffset(const qsizetype index) const;
+
+private:
+    bool readCentralDirectory();
+
+private:
+    const QString fileName;
+    QList<Entry> _entries;
+    bool valid = false;
+};
+
+
+
+
+
+
+/* zipアーカイブの書き込み．
+ * エントリーのデータはwrite()で少しずつ渡し，deflateで圧縮しながらdeviceへ書き出す．
+ * サイズとCRCはデータの後ろ(データ記述子)に書くため，deviceを遡って書き換えることはない．
+ * Zip64には対応していないので，エントリーとアーカイブは4GB未満でなければならない．
+ */
+class ZipWriter
+{
+public:
+    explicit ZipWriter(QIODevice *device);
+    ~ZipWriter();
+
+    bool beginEntry(const QString& name, const bool compress = true);
+    bool write(const char *data, const qsizetype size);
+    bool write(const QByteArray& data) { return write(data.constData(), data.size()); }
+    bool endEntry();
+    bool addEntry(const QString& name, const QByteArray& data);
+
+    /* 中央ディレクトリを書き出す．これを呼ばなければ有効なzipにならない */
+    bool finish();
+
+private:
+    struct Entry
+    {
+        QByteArray name;            //UTF-8
+        quint16 method = 0;
+        quint32 crc = 0;
+        qint64 compressedSize = 0;
+        qint64 size = 0;
+        qint64 headerOffset = 0;
+    };
+
+    bool put(const char *data, const qsizetype size);
+
+    QIODevice *device;
+    qint64 offset = 0;
+    QList<Entry> _entries;
+    Deflater *deflater = nullptr;
+    bool inEntry = false;
+    bool ok = true;
+};
+
+#endif // ZIPFILE_H
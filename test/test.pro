@@ -1,7 +1,50 @@
 QT += testlib
 QT += gui
+QT += widgets
 CONFIG += qt warn_on depend_includepath testcase
 
 TEMPLATE = app
 
-SOURCES +=  tst_test.cpp
+INCLUDEPATH += ../src
+
+HEADERS += \
+    ../src/deflate.h \
+    ../src/zipfile.h \
+    ../src/sheetdata.h \
+    ../src/sheetsort.h \
+    ../src/columnexpression.h \
+    ../src/sheetfilter.h \
+    ../src/gnuplotcompletion.h \
+    ../src/xxhash.h \
+    ../src/sheetformat.h \
+    ../src/sheetgroup.h \
+    ../src/columnstats.h \
+    ../src/sheetundo.h \
+    ../src/sheetcache.h \
+    ../src/iofile.h \
+    ../src/ioscheduler.h \
+    ../src/settings.h \
+    ../src/logger.h \
+    ../src/layoutparts.h \
+    ../src/standardpixmap.h \
+    ../src/utility.h
+
+SOURCES +=  tst_test.cpp \
+    ../src/deflate.cpp \
+    ../src/zipfile.cpp \
+    ../src/sheetdata.cpp \
+    ../src/sheetsort.cpp \
+    ../src/columnexpression.cpp \
+    ../src/sheetfilter.cpp \
+    ../src/xxhash.cpp \
+    ../src/sheetformat.cpp \
+    ../src/sheetgroup.cpp \
+    ../src/columnstats.cpp \
+    ../src/sheetundo.cpp \
+    ../src/sheetcache.cpp \
+    ../src/iofile.cpp \
+    ../src/ioscheduler.cpp \
+    ../src/settings.cpp \
+    ../src/logger.cpp \
+    ../src/layoutparts.cpp \
+    ../src/standardpixmap.cpp
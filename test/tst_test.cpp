@@ -1,7 +1,102 @@
 #include <QtTest>
 #include <QCoreApplication>
+#include <QBuffer>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
 
-// add necessary includes here
+#include "deflate.h"
+#include "zipfile.h"
+#include "sheetdata.h"
+#include "sheetfilter.h"
+#include "sheetsort.h"
+#include "columnexpression.h"
+#include "sheetundo.h"
+#include "sheetformat.h"
+#include "sheetgroup.h"
+#include "iofile.h"
+
+namespace
+{
+    /* chunkバイトずつwrite()してdeflate形式にする */
+    QByteArray deflate(const QByteArray& data, const qsizetype chunk)
+    {
+        QByteArray compressed;
+        QBuffer sink(&compressed);
+        sink.open(QIODevice::WriteOnly);
+
+        Deflater deflater(&sink);
+        for(qsizetype pos = 0; pos < data.size(); pos += chunk)
+            if(!deflater.write(data.constData() + pos, qMin(chunk, data.size() - pos))) return QByteArray();
+        if(!deflater.finish()) return QByteArray();
+
+        return compressed;
+    }
+
+    /* chunkバイトずつread()して展開する．エラーならokをfalseにする */
+    QByteArray inflate(QByteArray compressed, const qint64 chunk, bool *ok)
+    {
+        QBuffer source(&compressed);
+        source.open(QIODevice::ReadOnly);
+
+        Inflater inflater(&source);
+        QByteArray data;
+        QByteArray buffer(chunk, Qt::Uninitialized);
+        qint64 count;
+        while((count = inflater.read(buffer.data(), chunk)) > 0) data.append(buffer.constData(), count);
+
+        *ok = (count == 0 && inflater.isFinished());
+        return data;
+    }
+
+    QByteArray gzip(const QByteArray& data)
+    {
+        QByteArray compressed;
+        QBuffer sink(&compressed);
+        sink.open(QIODevice::WriteOnly);
+
+        GzipWriter writer(&sink);
+        if(!writer.write(data.constData(), data.size()) || !writer.finish()) return QByteArray();
+
+        return compressed;
+    }
+
+    QByteArray gunzip(QByteArray compressed, bool *ok)
+    {
+        QBuffer source(&compressed);
+        source.open(QIODevice::ReadOnly);
+
+        GzipReader reader(&source);
+        QByteArray data;
+        char buffer[4096];
+        qint64 count;
+        while((count = reader.read(buffer, sizeof(buffer))) > 0) data.append(buffer, count);
+
+        *ok = (count == 0 && !reader.hasError());
+        return data;
+    }
+
+    QByteArray randomBytes(const qsizetype size, const quint32 seed)
+    {
+        QRandomGenerator generator(seed);
+        QByteArray data(size, Qt::Uninitialized);
+        for(char& c : data) c = char(generator.bounded(256));
+        return data;
+    }
+
+    /* 行を改行，セルを,で区切った文字列からシートを作る */
+    SheetData sheetOf(const QString& text)
+    {
+        QList<QList<QString> > rows;
+        for(const QString& line : text.split('\n')) rows.append(line.split(','));
+        return SheetData::fromStringList(rows);
+    }
+
+    /* deflateのブロックの種類(BTYPE)．最初のブロックのヘッダーは先頭バイトの下位3ビット */
+    int blockType(const QByteArray& compressed)
+    {
+        return (uchar(compressed.at(0)) >> 1) & 3;
+    }
+}
 
 class test : public QObject
 {
@@ -14,6 +109,35 @@ public:
 private slots:
     void test_case1();
 
+    void deflateRoundTrip_data();
+    void deflateRoundTrip();
+    void inflateStoredBlocks();
+    void inflateFixedBlock();
+    void inflateDynamicBlock();
+    void inflateTruncated();
+    void gzipRoundTrip();
+    void gzipMultiMember();
+    void gzipCorrupted();
+    void zipRoundTrip();
+    void zipExcelWorkbook();
+    void excelRoundTrip();
+    void excelSharedStrings();
+
+    void sheetFilter_data();
+    void sheetFilter();
+    void sheetSort_data();
+    void sheetSort();
+    void columnExpression_data();
+    void columnExpression();
+    void sheetColumnType_data();
+    void sheetColumnType();
+    void sheetUndoStack();
+    void sheetFromText_data();
+    void sheetFromText();
+    void sheetFormatSniff_data();
+    void sheetFormatSniff();
+    void sheetGroupBy();
+    void sheetGroupByParallel();
 };
 
 test::test()
@@ -31,6 +155,692 @@ void test::test_case1()
 
 }
 
+void test::deflateRoundTrip_data()
+{
+    QTest::addColumn<QByteArray>("data");
+
+    QByteArray text;
+    for(int i = 0; i < 20000; ++i) text += "row " + QByteArray::number(i) + ", value " + QByteArray::number(i * 0.25) + '\n';
+
+    /* 周期が窓(32KB)と同じで，最も遠い距離の一致になる */
+    const QByteArray period = randomBytes(1 << 15, 7);
+
+    QTest::newRow("empty") << QByteArray();
+    QTest::newRow("one byte") << QByteArray("x");
+    QTest::newRow("max match") << QByteArray(258, 'a');
+    QTest::newRow("zeros") << QByteArray(1 << 20, '\0');
+    QTest::newRow("random") << randomBytes(300000, 1);
+    QTest::newRow("text") << text;
+    QTest::newRow("window distance") << period + period + period.left(1000);
+    QTest::newRow("all bytes") << [] { QByteArray data; for(int i = 0; i < 256 * 64; ++i) data += char(i * 7); return data; }();
+}
+
+/* 入力の渡し方(まとめて/少しずつ)と取り出し方によらず元に戻る */
+void test::deflateRoundTrip()
+{
+    QFETCH(QByteArray, data);
+
+    for(const qsizetype chunk : { qsizetype(1) << 30, qsizetype(4093), qsizetype(1) })
+    {
+        if(chunk == 1 && data.size() > 100000) continue;     //1バイトずつは小さい入力だけ
+
+        const QByteArray compressed = deflate(data, chunk);
+        QVERIFY(!compressed.isEmpty());
+
+        bool ok = false;
+        QCOMPARE(inflate(compressed, 1 << 16, &ok), data);
+        QVERIFY(ok);
+        QCOMPARE(inflate(compressed, 7, &ok), data);
+        QVERIFY(ok);
+    }
+}
+
+/* 無圧縮のブロック(BTYPE=00)．空のブロックと，複数のブロックに分かれたもの */
+void test::inflateStoredBlocks()
+{
+    const QByteArray first = "stored ";
+    const QByteArray second = "blocks\n";
+
+    const QList<QByteArray> blocks = { first, QByteArray(), second };
+
+    QByteArray compressed;
+    for(qsizetype i = 0; i < blocks.size(); ++i)
+    {
+        const QByteArray& block = blocks.at(i);
+        const quint16 length = quint16(block.size());
+        compressed += char((i == blocks.size() - 1) ? 1 : 0);   //BFINAL
+        compressed += char(length & 0xFF);
+        compressed += char(length >> 8);
+        compressed += char(~length & 0xFF);
+        compressed += char((~length >> 8) & 0xFF);
+        compressed += block;
+    }
+
+    bool ok = false;
+    QCOMPARE(inflate(compressed, 3, &ok), first + second);
+    QVERIFY(ok);
+
+    /* LENとNLENが合わない */
+    compressed[3] = char(compressed.at(3) ^ 1);
+    inflate(compressed, 1024, &ok);
+    QVERIFY(!ok);
+}
+
+/* 固定ハフマン符号のブロック(BTYPE=01)．zlibのZ_FIXEDで作ったもの */
+void test::inflateFixedBlock()
+{
+    const QByteArray compressed = QByteArray::fromHex("f348cdc9c9d751f040a15252d372124b5215b900");
+    QCOMPARE(blockType(compressed), 1);
+
+    bool ok = false;
+    QCOMPARE(inflate(compressed, 1024, &ok), QByteArray("Hello, Hello, Hello, deflate!\n"));
+    QVERIFY(ok);
+}
+
+/* 動的ハフマン符号のブロック(BTYPE=10)．zlibで作ったもの */
+void test::inflateDynamicBlock()
+{
+    const QByteArray compressed = QByteArray::fromHex(
+        "4d923b6e03410c437b9f620f9062f499df7152a40b10c04092eb27d8a14897b4b5d41b8acfafdfabbd5d3fef9fdf1f57"
+        "7b3cffa595b45b7ac9bc6594dcb74c0e8f5bf7d2de6f3d4ac7f97fd2ed7cbf4a8f63bf4bafb3dd08670d78e273cc10d1"
+        "f2b85808ebec3181ee43624205ab0dc16386b8bee043e070ecda7a2212237382d9c99c8919c5ba8e8f93b9fbd9e564ee"
+        "f3f0389907989dcca366c83ccb87ccb3762966f00499379883cc1bef0ae5dcf0f850d00d09859236c4185d2703770cfd"
+        "848304c12d70b5582f97c546a25bc7fd531d19804f9564a04929fa89b2a5e817fa982f3d4165534569a04f35c550fc54"
+        "55bcc18bf41e0d1b49efd9ecf107");
+    QCOMPARE(blockType(compressed), 2);
+
+    QByteArray expected;
+    for(int i = 0; i < 50; ++i) expected += "row " + QByteArray::number(i) + ", value " + QByteArray::number(i * i) + '\n';
+
+    bool ok = false;
+    QCOMPARE(inflate(compressed, 100, &ok), expected);
+    QVERIFY(ok);
+}
+
+/* 途中で切れたデータは終端ではなくエラーにする */
+void test::inflateTruncated()
+{
+    const QByteArray compressed = deflate(randomBytes(100000, 3), 1 << 20);
+
+    bool ok = true;
+    inflate(compressed.left(compressed.size() / 2), 4096, &ok);
+    QVERIFY(!ok);
+}
+
+void test::gzipRoundTrip()
+{
+    for(const QByteArray& data : { QByteArray(), QByteArray("a,b\n1,2\n"), randomBytes(200000, 5), QByteArray(500000, ',') })
+    {
+        QByteArray compressed = gzip(data);
+
+        QBuffer buffer(&compressed);
+        buffer.open(QIODevice::ReadOnly);
+        QVERIFY(GzipReader::isGzip(&buffer));
+
+        bool ok = false;
+        QCOMPARE(gunzip(compressed, &ok), data);
+        QVERIFY(ok);
+    }
+}
+
+/* 連結したgzipは，各メンバーを展開して続けたものになる */
+void test::gzipMultiMember()
+{
+    bool ok = false;
+
+    /* Pythonのgzipで作った，ファイル名(FNAME)付きのメンバー2つ */
+    const QByteArray python = QByteArray::fromHex(
+        "1f8b08080000000002ff70617274312e63737600abd0a9e432d431e2020023df7200080000001f8b08080000000002ff"
+        "70617274322e6373760033d631e132d531e30200794a4d2c08000000");
+    QCOMPARE(gunzip(python, &ok), QByteArray("x,y\n1,2\n3,4\n5,6\n"));
+    QVERIFY(ok);
+
+    const QByteArray first = randomBytes(70000, 11);
+    const QByteArray second = QByteArray(40000, 'z');
+    QCOMPARE(gunzip(gzip(first) + gzip(QByteArray()) + gzip(second), &ok), first + second);
+    QVERIFY(ok);
+
+    /* 最後のメンバーの後ろのgzipでないデータは無視する */
+    QCOMPARE(gunzip(gzip(first) + QByteArray(16, '\0'), &ok), first);
+    QVERIFY(ok);
+}
+
+void test::gzipCorrupted()
+{
+    const QByteArray data = randomBytes(10000, 13);
+    const QByteArray compressed = gzip(data);
+    bool ok = true;
+
+    /* CRC-32が合わない */
+    QByteArray crc = compressed;
+    crc[crc.size() - 8] = char(crc.at(crc.size() - 8) ^ 0xFF);
+    gunzip(crc, &ok);
+    QVERIFY(!ok);
+
+    /* 元のサイズが合わない */
+    QByteArray size = compressed;
+    size[size.size() - 1] = char(size.at(size.size() - 1) ^ 0x01);
+    gunzip(size, &ok);
+    QVERIFY(!ok);
+
+    /* gzipでない */
+    QByteArray plain = "x,y\n1,2\n";
+    QBuffer buffer(&plain);
+    buffer.open(QIODevice::ReadOnly);
+    QVERIFY(!GzipReader::isGzip(&buffer));
+    gunzip(plain, &ok);
+    QVERIFY(!ok);
+}
+
+/* ZipWriterで書いたものをZipReaderで読み戻す */
+void test::zipRoundTrip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.filePath("roundtrip.zip");
+
+    const QByteArray text = "x,y\n1,2\n3,4\n";
+    const QByteArray large = randomBytes(300000, 17) + QByteArray(300000, 'a');
+    const QByteArray stored = randomBytes(5000, 19);
+    const QString utf8Name = QString::fromUtf8("データ/表.csv");
+
+    {
+        QFile file(fileName);
+        QVERIFY(file.open(QIODevice::WriteOnly));
+
+        ZipWriter writer(&file);
+        QVERIFY(writer.addEntry("text.csv", text));
+        QVERIFY(writer.addEntry("empty.txt", QByteArray()));
+
+        /* 少しずつ渡す */
+        QVERIFY(writer.beginEntry("dir/large.bin"));
+        for(qsizetype pos = 0; pos < large.size(); pos += 10007)
+            QVERIFY(writer.write(large.constData() + pos, qMin(qsizetype(10007), large.size() - pos)));
+        QVERIFY(writer.endEntry());
+
+        QVERIFY(writer.beginEntry("stored.bin", false));
+        QVERIFY(writer.write(stored));
+        QVERIFY(writer.endEntry());
+
+        QVERIFY(writer.addEntry(utf8Name, text));
+        QVERIFY(writer.finish());
+    }
+
+    ZipReader reader(fileName);
+    QVERIFY(reader.isValid());
+    QCOMPARE(reader.entries().size(), qsizetype(5));
+    QCOMPARE(reader.indexOf("missing"), qsizetype(-1));
+
+    bool ok = false;
+    QCOMPARE(reader.readEntry("text.csv", &ok), text);
+    QVERIFY(ok);
+    QCOMPARE(reader.readEntry("empty.txt", &ok), QByteArray());
+    QVERIFY(ok);
+    QCOMPARE(reader.readEntry("dir/large.bin", &ok), large);
+    QVERIFY(ok);
+    QCOMPARE(reader.readEntry(utf8Name, &ok), text);
+    QVERIFY(ok);
+
+    /* 無圧縮のエントリーはdataOffsetから直接読める */
+    const qsizetype index = reader.indexOf("stored.bin");
+    QVERIFY(index >= 0);
+    QCOMPARE(reader.entries().at(index).method, quint16(0));
+    QCOMPARE(reader.entries().at(index).size, qint64(stored.size()));
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    const qint64 offset = reader.dataOffset(index);
+    QVERIFY(offset > 0);
+    QVERIFY(file.seek(offset));
+    QCOMPARE(file.read(stored.size()), stored);
+
+    QCOMPARE(reader.readEntry("stored.bin", &ok), stored);
+    QVERIFY(ok);
+}
+
+/* Excelで保存したxlsx(補完のプラグインの表)を読む */
+void test::zipExcelWorkbook()
+{
+    const QString fileName = QFINDTESTDATA("data/commands.xlsx");
+    QVERIFY(!fileName.isEmpty());
+
+    ZipReader reader(fileName);
+    QVERIFY(reader.isValid());
+    QCOMPARE(reader.entries().size(), qsizetype(12));
+    QCOMPARE(reader.entries().first().name, QString("[Content_Types].xml"));
+
+    for(const ZipReader::Entry& entry : reader.entries())
+    {
+        QCOMPARE(entry.method, quint16(8));
+
+        bool ok = false;
+        const QByteArray data = reader.readEntry(entry.name, &ok);
+        QVERIFY2(ok, qPrintable(entry.name));
+        QCOMPARE(qint64(data.size()), entry.size);
+    }
+
+    bool ok = false;
+    const QByteArray sheet = reader.readEntry("xl/worksheets/sheet1.xml", &ok);
+    QVERIFY(ok);
+    QCOMPARE(sheet.size(), qsizetype(6640));
+    QCOMPARE(Crc32::update(0, sheet.constData(), sheet.size()), quint32(0xa85bb52c));
+
+    const QByteArray sharedStrings = reader.readEntry("xl/sharedStrings.xml", &ok);
+    QVERIFY(ok);
+    QCOMPARE(sharedStrings.size(), qsizetype(3442));
+    QCOMPARE(Crc32::update(0, sharedStrings.constData(), sharedStrings.size()), quint32(0x7bde46c6));
+    QVERIFY(sharedStrings.contains("<t>break</t>"));
+
+    /* 展開しながら少しずつ読んでも同じになる */
+    QIODevice *device = reader.openEntry(reader.indexOf("xl/sharedStrings.xml"));
+    QVERIFY(device);
+    QByteArray streamed;
+    char buffer[100];
+    qint64 count;
+    while((count = device->read(buffer, sizeof(buffer))) > 0) streamed.append(buffer, count);
+    delete device;
+    QCOMPARE(streamed, sharedStrings);
+}
+
+/* writeSheet()で書いたブックをreadSheet()で読むと同じセルになる．列名は最初の行になる */
+void test::excelRoundTrip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath("round.xlsx");
+
+    SheetData sheet = sheetOf("x,1,2.5\n,-3,\ny & <z>,,1e-3\n\"q\",4,0.125");
+    sheet.setColumnNames({ "a", "b", "c" });
+    QVERIFY(ExcelDocument::writeSheet(path, sheet, "Data"));
+
+    const ExcelDocument document(path);
+    QVERIFY(document.isValid());
+    QCOMPARE(document.sheetNames(), QStringList{ "Data" });
+
+    bool ok = false;
+    const SheetData read = document.readSheet(0, &ok);
+    QVERIFY(ok);
+
+    QList<QList<QString> > expected{ { "a", "b", "c" } };
+    expected.append(sheet.toStringList());
+    QCOMPARE(read.toStringList(), expected);
+
+    QVERIFY(!document.readSheet(1, &ok).rowCount());
+    QVERIFY(!ok);
+}
+
+/* 共有文字列(書式付きを含む)，インライン文字列，真偽値，省略された行とセル(r="C5"など)，数式の計算済みの値 */
+void test::excelSharedStrings()
+{
+    const QString fileName = QFINDTESTDATA("data/sharedstrings.xlsx");
+    QVERIFY(!fileName.isEmpty());
+
+    const ExcelDocument document(fileName);
+    QVERIFY(document.isValid());
+    QCOMPARE(document.sheetNames(), QStringList{ "Data" });
+
+    bool ok = false;
+    const SheetData sheet = document.readSheet(0, &ok);
+    QVERIFY(ok);
+
+    const QList<QList<QString> > expected{
+        { "name", "value", "", "", "" },
+        { "alpha", "1.5", "", "", "" },
+        { "", "", "", "", "" },
+        { "inline", "", "TRUE", "", "" },
+        { "rich text", "", "a & b", "", "1.5" },
+    };
+    QCOMPARE(sheet.toStringList(), expected);
+}
+
+void test::sheetFilter_data()
+{
+    QTest::addColumn<QString>("sheet");
+    QTest::addColumn<QString>("condition");
+    QTest::addColumn<QList<qint32> >("expected");
+
+    /* ||と?:は&&より優先順位が低い */
+    const QString bits = "1,0,0\n0,1,1\n0,1,0\n0,0,1\n1,1,1";
+    QTest::newRow("and") << bits << "$1 > 0 && $2 > 0" << QList<qint32>{ 4 };
+    QTest::newRow("or then and") << bits << "$1 > 0 || $2 > 0 && $3 > 0" << QList<qint32>{ 0, 1, 4 };
+    QTest::newRow("and then or") << bits << "$2 > 0 && $3 > 0 || $1 > 0" << QList<qint32>{ 0, 1, 4 };
+    QTest::newRow("parenthesized or") << bits << "($1 > 0 || $2 > 0) && $3 > 0" << QList<qint32>{ 1, 4 };
+    QTest::newRow("ternary") << bits << "$1 > 0 ? 1 : $2 > 0 && $3 > 0" << QList<qint32>{ 0, 1, 4 };
+    QTest::newRow("and in ternary") << bits << "$1 > 0 && $2 > 0 ? 1 : $3 > 0" << QList<qint32>{ 1, 3, 4 };
+
+    /* 索引の範囲で比べる条件は，式として計算した結果と同じ行を残す．数値でないセルと空のセルはNaN */
+    const QString values = "1,a\n5,b\nx,c\n3,d\n,e\n5,f";
+    QTest::newRow("greater") << values << "$1 > 2" << QList<qint32>{ 1, 3, 5 };
+    QTest::newRow("greater expression") << values << "($1 > 2)" << QList<qint32>{ 1, 3, 5 };
+    QTest::newRow("range") << values << "$1 >= 3 && $1 < 5" << QList<qint32>{ 3 };
+    QTest::newRow("less equal") << values << "$1 <= 3" << QList<qint32>{ 0, 3 };
+    QTest::newRow("equal") << values << "$1 == 5" << QList<qint32>{ 1, 5 };
+    QTest::newRow("not equal") << values << "$1 != 5" << QList<qint32>{ 0, 2, 3, 4 };
+    QTest::newRow("not equal expression") << values << "($1 != 5)" << QList<qint32>{ 0, 2, 3, 4 };
+    QTest::newRow("not equal and range") << values << "$1 != 5 && $1 > 2" << QList<qint32>{ 3 };
+    QTest::newRow("text column") << values << "$2 != 0" << QList<qint32>{ 0, 1, 2, 3, 4, 5 };
+    QTest::newRow("row number") << values << "$0 < 2" << QList<qint32>{ 0, 1 };
+}
+
+void test::sheetFilter()
+{
+    QFETCH(QString, sheet);
+    QFETCH(QString, condition);
+    QFETCH(QList<qint32>, expected);
+
+    const SheetData data = sheetOf(sheet);
+
+    SheetFilter filter;
+    QString error;
+    QVERIFY2(filter.compile(condition, &error), qPrintable(error));
+
+    SheetFilter::IndexCache indexes;
+    QCOMPARE(SheetFilter::rows(filter.evaluate(data, indexes)), expected);
+}
+
+void test::sheetSort_data()
+{
+    QTest::addColumn<QString>("sheet");
+    QTest::addColumn<QList<int> >("keys");                 //1から数えた列の番号．負なら降順
+    QTest::addColumn<QList<qsizetype> >("expected");
+
+    QTest::newRow("int") << "3\n1\n2" << QList<int>{ 1 } << QList<qsizetype>{ 1, 2, 0 };
+    QTest::newRow("int descending") << "3\n1\n2" << QList<int>{ -1 } << QList<qsizetype>{ 0, 2, 1 };
+    QTest::newRow("negative") << "-1\n2\n-3\n0" << QList<int>{ 1 } << QList<qsizetype>{ 2, 0, 3, 1 };
+    QTest::newRow("double") << "0.5\n-0.25\n1e3\n0.125" << QList<int>{ 1 } << QList<qsizetype>{ 1, 3, 0, 2 };
+    QTest::newRow("text") << "b\nc\na\nd\ne" << QList<int>{ 1 } << QList<qsizetype>{ 2, 0, 1, 3, 4 };
+    QTest::newRow("text descending") << "b\nc\na\nd\ne" << QList<int>{ -1 } << QList<qsizetype>{ 4, 3, 1, 0, 2 };
+
+    /* キーが等しい行は元の順序を保つ */
+    QTest::newRow("stable") << "1,a\n0,b\n1,c\n0,d" << QList<int>{ 1 } << QList<qsizetype>{ 1, 3, 0, 2 };
+    QTest::newRow("stable descending") << "1,a\n0,b\n1,c\n0,d" << QList<int>{ -1 } << QList<qsizetype>{ 0, 2, 1, 3 };
+
+    /* 空のセルは順序によらず最後．Double列の数値でないセルは数値の後 */
+    QTest::newRow("empty") << "2\n\n1" << QList<int>{ 1 } << QList<qsizetype>{ 2, 0, 1 };
+    QTest::newRow("empty descending") << "2\n\n1" << QList<int>{ -1 } << QList<qsizetype>{ 0, 2, 1 };
+    QTest::newRow("nan and text") << "1.5\nx\n0.5\n\na" << QList<int>{ 1 } << QList<qsizetype>{ 2, 0, 4, 1, 3 };
+
+    QTest::newRow("two keys") << "1,b\n0,b\n1,a\n0,a" << QList<int>{ 1, 2 } << QList<qsizetype>{ 3, 1, 2, 0 };
+    QTest::newRow("two keys mixed order") << "1,b\n0,b\n1,a\n0,a" << QList<int>{ 2, -1 } << QList<qsizetype>{ 2, 3, 0, 1 };
+}
+
+void test::sheetSort()
+{
+    QFETCH(QString, sheet);
+    QFETCH(QList<int>, keys);
+    QFETCH(QList<qsizetype>, expected);
+
+    QList<SheetSort::Key> sortKeys;
+    for(const int key : keys)
+        sortKeys.append(SheetSort::Key{ qAbs(key) - 1, (key < 0) ? Qt::DescendingOrder : Qt::AscendingOrder });
+
+    QCOMPARE(SheetSort::permutation(sheetOf(sheet), sortKeys), expected);
+}
+
+void test::columnExpression_data()
+{
+    QTest::addColumn<QString>("expression");
+    QTest::addColumn<bool>("valid");
+    QTest::addColumn<QList<double> >("expected");
+
+    const double nan = qQNaN();
+    QTest::newRow("add") << "$1 + $2" << true << QList<double>{ 3, nan, -4 };
+    QTest::newRow("column") << "column(1) * 2" << true << QList<double>{ 2, 6, -8 };
+    QTest::newRow("row") << "$0" << true << QList<double>{ 0, 1, 2 };
+    QTest::newRow("valid") << "valid(2)" << true << QList<double>{ 1, 0, 1 };
+    QTest::newRow("real division") << "1 / 2" << true << QList<double>{ 0.5, 0.5, 0.5 };
+    QTest::newRow("divide by zero") << "$1 / $2" << true << QList<double>{ 0.5, nan, nan };
+    QTest::newRow("precedence") << "1 + 2 * 3 ** 2" << true << QList<double>{ 19, 19, 19 };
+    QTest::newRow("ternary") << "$1 > 0 ? $1 : -$1" << true << QList<double>{ 1, 3, 4 };
+    QTest::newRow("logical") << "$1 > 0 && $2 == 2 || $1 < -3" << true << QList<double>{ 1, 0, 1 };
+    QTest::newRow("function") << "abs($1) + sqrt(4)" << true << QList<double>{ 3, 5, 6 };
+    QTest::newRow("two arguments") << "atan2(0, 1) + pi * 0" << true << QList<double>{ 0, 0, 0 };
+
+    QTest::newRow("missing operand") << "$1 +" << false << QList<double>();
+    QTest::newRow("unclosed parenthesis") << "($1 + 1" << false << QList<double>();
+    QTest::newRow("unknown function") << "foo($1)" << false << QList<double>();
+    QTest::newRow("empty") << "" << false << QList<double>();
+}
+
+void test::columnExpression()
+{
+    QFETCH(QString, expression);
+    QFETCH(bool, valid);
+    QFETCH(QList<double>, expected);
+
+    ColumnExpression column;
+    QString error;
+    QCOMPARE(column.compile(expression, &error), valid);
+    if(!valid) { QVERIFY(!error.isEmpty()); return; }
+
+    const QList<double> values = column.evaluate(sheetOf("1,2\n3,x\n-4,0"));
+    QCOMPARE(values.size(), expected.size());
+    for(qsizetype row = 0; row < values.size(); ++row)
+        QVERIFY2((qIsNaN(values.at(row)) && qIsNaN(expected.at(row))) || values.at(row) == expected.at(row),
+                 qPrintable(QString::number(row) + ": " + QString::number(values.at(row))));
+}
+
+/* 列の型を推定し，セルの文字列はそのまま戻る */
+void test::sheetColumnType_data()
+{
+    QTest::addColumn<QString>("cells");
+    QTest::addColumn<SheetColumn::Type>("type");
+
+    QTest::newRow("int") << "1\n-2\n30" << SheetColumn::Type::Int64;
+    QTest::newRow("leading zeros") << "007\n8" << SheetColumn::Type::Double;      //007は元の文字列を残す
+    QTest::newRow("double") << "1.5\n2\n-0.25" << SheetColumn::Type::Double;
+    QTest::newRow("exponent") << "1e-3\n2.5E+10" << SheetColumn::Type::Double;
+    QTest::newRow("mixed decimals") << "0.5\n0.25\n1.125" << SheetColumn::Type::Double;
+    QTest::newRow("empty cells") << "1\n\n3" << SheetColumn::Type::Double;
+    QTest::newRow("missing token") << "1\nNA\n3\nNA" << SheetColumn::Type::Double;
+    QTest::newRow("text") << "a\nb\nc" << SheetColumn::Type::String;
+    QTest::newRow("text with numbers") << "a\n1\nb\n2\nc\nd\ne\nf\ng\nh\ni\nj\nk\nl\nm\nn\no\np\nq\nr\ns\nt\nu\nv\nw\nx\ny\nz\naa\nab\nac\nad\nae\naf\nag\nah"
+                                       << SheetColumn::Type::String;
+}
+
+void test::sheetColumnType()
+{
+    QFETCH(QString, cells);
+    QFETCH(SheetColumn::Type, type);
+
+    const SheetData sheet = sheetOf(cells);
+    QCOMPARE(sheet.column(0).type(), type);
+
+    QList<QList<QString> > expected;
+    for(const QString& cell : cells.split('\n')) expected.append({ cell });
+    QCOMPARE(sheet.toStringList(), expected);
+}
+
+void test::sheetUndoStack()
+{
+    const auto texts = [](const int row, const QString& cell) {
+        SheetEdit edit;
+        edit.kind = SheetEdit::Kind::Texts;
+        edit.top = edit.bottom = row;
+        edit.left = edit.right = 0;
+        edit.cells = sheetOf(cell);
+        return SheetUndoStack::Step{ edit };
+    };
+
+    SheetUndoStack stack;
+    QVERIFY(!stack.canUndo() && !stack.canRedo());
+
+    /* 同じ範囲の書き換えが続けば，最初の状態に戻す操作だけを残す */
+    stack.push(texts(0, "a"));
+    stack.push(texts(0, "b"));
+    stack.push(texts(1, "c"));
+    QCOMPARE(stack.takeUndo().first().cells.text(0, 0), QString("c"));
+    QCOMPARE(stack.takeUndo().first().cells.text(0, 0), QString("a"));
+    QVERIFY(!stack.canUndo());
+    QCOMPARE(stack.memoryUsage(), qsizetype(0));
+
+    /* 元に戻した結果はやり直しの操作になり，新しい編集でやり直しの操作は捨てる */
+    stack.pushRedo(texts(0, "x"));
+    QVERIFY(stack.canRedo());
+    QCOMPARE(stack.takeRedo().first().cells.text(0, 0), QString("x"));
+    stack.pushUndo(texts(0, "y"));
+    stack.pushRedo(texts(0, "z"));
+    stack.push(texts(2, "w"));
+    QVERIFY(!stack.canRedo());
+    QCOMPARE(stack.takeUndo().first().cells.text(0, 0), QString("w"));
+
+    /* 上限を超えれば古い操作から捨て，最後の1回は残す */
+    stack.clear();
+    QCOMPARE(stack.memoryUsage(), qsizetype(0));
+    for(int row = 0; row < 10; ++row) stack.pushUndo(texts(row, QString::number(row)));
+    const qsizetype stepSize = stack.memoryUsage() / 10;
+    stack.setMemoryLimit(stepSize * 3);
+    QVERIFY(stack.memoryUsage() <= stepSize * 3);
+    QCOMPARE(stack.takeUndo().first().cells.text(0, 0), QString("9"));
+    stack.setMemoryLimit(0);
+    QVERIFY(stack.canUndo());
+    QCOMPARE(stack.takeUndo().first().cells.text(0, 0), QString("8"));
+    QVERIFY(!stack.canUndo());
+}
+
+/* クリップボードのテキストはタブだけで分け，書式を推定しない */
+void test::sheetFromText_data()
+{
+    QTest::addColumn<QByteArray>("text");
+    QTest::addColumn<QList<QStringList> >("expected");
+
+    QTest::newRow("tab") << QByteArray("1\t2\n3\t4\n") << QList<QStringList>{ { "1", "2" }, { "3", "4" } };
+    QTest::newRow("crlf") << QByteArray("1\t2\r\n3\t4") << QList<QStringList>{ { "1", "2" }, { "3", "4" } };
+    QTest::newRow("empty cells") << QByteArray("1\t\t3\n\t5\t") << QList<QStringList>{ { "1", "", "3" }, { "", "5", "" } };
+    QTest::newRow("comma column") << QByteArray("1,5\n2,5") << QList<QStringList>{ { "1,5" }, { "2,5" } };
+    QTest::newRow("hash") << QByteArray("#x\ty\n1\t2") << QList<QStringList>{ { "#x", "y" }, { "1", "2" } };
+    QTest::newRow("quote") << QByteArray("\"a\tb\nc\td\"\ne\tf") << QList<QStringList>{ { "\"a", "b" }, { "c", "d\"" }, { "e", "f" } };
+    QTest::newRow("spaces") << QByteArray("a b\tc  d") << QList<QStringList>{ { "a b", "c  d" } };
+}
+
+void test::sheetFromText()
+{
+    QFETCH(QByteArray, text);
+    QFETCH(QList<QStringList>, expected);
+
+    const SheetData sheet = ::sheetFromText(text, '\t');
+    QCOMPARE(sheet.toStringList(), expected);
+
+    /* コピーしたものを貼り付けると元に戻る */
+    QCOMPARE(::sheetFromText(sheetToText(sheet, '\t'), '\t').toStringList(), expected);
+}
+
+/* 閉じていない引用符やアポストロフィを引用符と推定しない */
+void test::sheetFormatSniff_data()
+{
+    QTest::addColumn<QByteArray>("sample");
+    QTest::addColumn<char>("delimiter");
+    QTest::addColumn<char>("quote");
+    QTest::addColumn<char>("comment");
+    QTest::addColumn<bool>("hasHeader");
+
+    QTest::newRow("comma") << QByteArray("x,y\n1,2\n3,4\n") << ',' << '\0' << '\0' << true;
+    QTest::newRow("tab") << QByteArray("1\t2\n3\t4\n") << '\t' << '\0' << '\0' << false;
+    QTest::newRow("semicolon") << QByteArray("1;2\n3;4\n") << ';' << '\0' << '\0' << false;
+    QTest::newRow("comment") << QByteArray("# data\n1,2\n3,4\n") << ',' << '\0' << '#' << false;
+    QTest::newRow("quoted") << QByteArray("name,value\n\"a,b\",1\nc,2\nd,3\n") << ',' << '"' << '\0' << true;
+    QTest::newRow("quoted newline") << QByteArray("name,value\n\"a\nb\",1\n\"c\",2\n") << ',' << '"' << '\0' << true;
+    QTest::newRow("escaped quote") << QByteArray("\"a\"\"b\",1\n\"c\",2\n") << ',' << '"' << '\0' << false;
+    QTest::newRow("stray quote") << QByteArray("1,\"2\n3,4\n5,6\n") << ',' << '\0' << '\0' << false;
+    QTest::newRow("quote in field") << QByteArray("\"a\"b,1\n\"c\"d,2\n") << ',' << '\0' << '\0' << false;
+    QTest::newRow("inch mark") << QByteArray("5\",1\n6\",2\n") << ',' << '\0' << '\0' << false;
+    QTest::newRow("single quoted") << QByteArray("'a',1\n'b',2\n") << ',' << '\'' << '\0' << false;
+    QTest::newRow("apostrophe") << QByteArray("it's,1\nthat's,2\n") << ',' << '\0' << '\0' << false;
+    QTest::newRow("few single quotes") << QByteArray("'a',1\nb,2\nc,3\n") << ',' << '\0' << '\0' << false;
+}
+
+void test::sheetFormatSniff()
+{
+    QFETCH(QByteArray, sample);
+    QFETCH(char, delimiter);
+    QFETCH(char, quote);
+    QFETCH(char, comment);
+    QFETCH(bool, hasHeader);
+
+    const SheetFormat format = SheetFormat::sniff(QList<QByteArray>{ sample }, ',');
+    QCOMPARE(format.delimiter, delimiter);
+    QCOMPARE(format.quote, quote);
+    QCOMPARE(format.comment, comment);
+    QCOMPARE(format.hasHeader, hasHeader);
+}
+
+void test::sheetGroupBy()
+{
+    const SheetData sheet = sheetOf("a,1\nb,2\na,3\nb,4\na,5");
+
+    SheetGroupBy::Spec spec;
+    spec.keys = { 0 };
+    for(const SheetGroupBy::Aggregate aggregate : { SheetGroupBy::Aggregate::Count, SheetGroupBy::Aggregate::Sum, SheetGroupBy::Aggregate::Mean,
+                                                    SheetGroupBy::Aggregate::StdDev, SheetGroupBy::Aggregate::Min, SheetGroupBy::Aggregate::Max })
+        spec.values.append(SheetGroupBy::Value{ 1, aggregate });
+
+    QString error;
+    const SheetData result = SheetGroupBy::aggregate(sheet, spec, &error);
+    QVERIFY2(error.isEmpty(), qPrintable(error));
+    QCOMPARE(result.rowCount(), qsizetype(2));
+    QCOMPARE(result.text(0, 0), QString("a"));
+    QCOMPARE(result.text(1, 0), QString("b"));
+
+    const QList<double> a{ 3, 9, 3, 2, 1, 5 };
+    const QList<double> b{ 2, 6, 3, std::sqrt(2.0), 2, 4 };
+    for(qsizetype v = 0; v < a.size(); ++v)
+    {
+        QCOMPARE(result.value(0, v + 1), a.at(v));
+        QVERIFY(qFuzzyCompare(result.value(1, v + 1), b.at(v)));
+    }
+}
+
+/* 行を分けて集計したものを合わせても，1行ずつ足した結果と合う．組が多すぎれば集計しない */
+void test::sheetGroupByParallel()
+{
+    const qsizetype rows = SheetGroupBy::parallelThreshold * 3 + 5;
+    QList<qint64> keys(rows);
+    QList<double> values(rows);
+    for(qsizetype row = 0; row < rows; ++row)
+    {
+        keys[row] = row % 7;
+        values[row] = double(row % 1000) * 0.5;
+    }
+    const SheetData sheet = SheetData::fromColumns({ SheetColumn::fromValues(keys), SheetColumn::fromValues(values) });
+
+    SheetGroupBy::Spec spec;
+    spec.keys = { 0 };
+    spec.values = { SheetGroupBy::Value{ 1, SheetGroupBy::Aggregate::Count },
+                    SheetGroupBy::Value{ 1, SheetGroupBy::Aggregate::Mean },
+                    SheetGroupBy::Value{ 1, SheetGroupBy::Aggregate::StdDev },
+                    SheetGroupBy::Value{ 1, SheetGroupBy::Aggregate::Max } };
+
+    QString error;
+    const SheetData result = SheetGroupBy::aggregate(sheet, spec, &error);
+    QVERIFY2(error.isEmpty(), qPrintable(error));
+    QCOMPARE(result.rowCount(), qsizetype(7));
+
+    for(qint64 key = 0; key < 7; ++key)
+    {
+        qint64 count = 0;
+        double sum = 0.0;
+        double max = 0.0;
+        for(qsizetype row = key; row < rows; row += 7) { count++; sum += values.at(row); max = qMax(max, values.at(row)); }
+        const double mean = sum / double(count);
+        double squares = 0.0;
+        for(qsizetype row = key; row < rows; row += 7) squares += (values.at(row) - mean) * (values.at(row) - mean);
+
+        QCOMPARE(result.value(key, 0), double(key));
+        QCOMPARE(result.value(key, 1), double(count));
+        QVERIFY(qFuzzyCompare(result.value(key, 2), mean));
+        QVERIFY(qFuzzyCompare(result.value(key, 3), std::sqrt(squares / double(count - 1))));
+        QCOMPARE(result.value(key, 4), max);
+    }
+
+    /* 行ごとに別のグループにすると，組の数が上限を超える */
+    for(qsizetype row = 0; row < rows; ++row) keys[row] = row;
+    const SheetData distinct = SheetData::fromColumns({ SheetColumn::fromValues(keys), SheetColumn::fromValues(values) });
+    while(qsizetype(rows) * spec.values.size() <= SheetGroupBy::maxAccumulators)
+        spec.values.append(SheetGroupBy::Value{ 1, SheetGroupBy::Aggregate::Sum });
+    QVERIFY(SheetGroupBy::aggregate(distinct, spec, &error).columnCount() == 0);
+    QVERIFY(!error.isEmpty());
+}
+
 QTEST_MAIN(test)
 
 #include "tst_test.moc"